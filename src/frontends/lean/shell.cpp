@@ -33,12 +33,12 @@ protected:
             } else if (strlen(line) == 0) {
                 // ignore blank line
                 m_buffer.push_back('\n');
-                free(line);
+                ::free(line);
             } else {
                 add_history(line);
                 m_buffer += line;
                 m_buffer.push_back('\n');
-                free(line);
+                ::free(line);
                 m_high = m_buffer.size();
             }
         }
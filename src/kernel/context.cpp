@@ -6,83 +6,139 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include "util/exception.h"
+#include "util/buffer.h"
 #include "kernel/context.h"
 #include "kernel/metavar.h"
 #include "kernel/free_vars.h"
 
 namespace lean {
-context::context(std::initializer_list<std::pair<char const *, expr const &>> const & l) {
-    for (auto const & p : l)
-        m_list = cons(context_entry(name(p.first), p.second), m_list);
+context::cell::cell(context_entry const & e, cell * next):
+    m_rc(1), m_entry(e), m_size(1), m_next(next), m_jump(next) {
+    if (next) {
+        next->inc_ref();
+        m_size = next->m_size + 1;
+        // If the jumps of next and next->m_jump have the same length, then we jump over both.
+        cell * j = next->m_jump;
+        if (j) {
+            cell * jj       = j->m_jump;
+            unsigned jj_sz  = jj ? jj->m_size : 0;
+            if (next->m_size - j->m_size == j->m_size - jj_sz)
+                m_jump = jj;
+        }
+    }
 }
 
-std::pair<context_entry const &, context> context::lookup_ext(unsigned i) const {
-    list<context_entry> const * it1 = &m_list;
-    while (*it1) {
-        if (i == 0)
-            return std::pair<context_entry const &, context>(head(*it1), context(tail(*it1)));
-        --i;
-        it1 = &tail(*it1);
+void context::cell::dealloc() {
+    cell * it = this;
+    while (true) {
+        lean_assert(it->get_rc() == 0);
+        cell * next = it->m_next;
+        delete it;
+        if (next && next->dec_ref_core())
+            it = next;
+        else
+            break;
     }
-    throw exception("unknown free variable");
 }
 
-context_entry const & context::lookup(unsigned i) const {
-    list<context_entry> const * it1 = &m_list;
-    while (*it1) {
-        if (i == 0)
-            return head(*it1);
+context::context(unsigned sz, context_entry const * es):m_ptr(nullptr) {
+    unsigned i = sz;
+    while (i > 0) {
         --i;
-        it1 = &tail(*it1);
+        *this = context(*this, es[i]);
     }
-    throw exception("unknown free variable");
 }
 
-optional<context_entry> context::find(unsigned i) const {
-    list<context_entry> const * it1 = &m_list;
-    while (*it1) {
-        if (i == 0)
-            return some(head(*it1));
-        --i;
-        it1 = &tail(*it1);
+context::context(std::initializer_list<std::pair<char const *, expr const &>> const & l):m_ptr(nullptr) {
+    for (auto const & p : l)
+        *this = context(*this, context_entry(name(p.first), p.second));
+}
+
+/** \brief Return the cell for the free variable with de Bruijn index \c i, or nullptr if there is none. */
+context::cell const * context::find_cell(unsigned i) const {
+    if (i >= size())
+        return nullptr;
+    unsigned target = m_ptr->m_size - i;
+    cell const * it = m_ptr;
+    while (it->m_size != target) {
+        if (it->m_jump && it->m_jump->m_size >= target)
+            it = it->m_jump;
+        else
+            it = it->m_next;
     }
-    return optional<context_entry>();
+    return it;
 }
 
-list<context_entry> truncate_core(list<context_entry> const & l, unsigned s) {
-    if (s == 0) {
-        return list<context_entry>();
-    } else {
-        return cons(head(l), truncate_core(tail(l), s-1));
+std::pair<context_entry const &, context> context::lookup_ext(unsigned i) const {
+    cell const * c = find_cell(i);
+    if (!c)
+        throw exception("unknown free variable");
+    if (c->m_next)
+        c->m_next->inc_ref();
+    return std::pair<context_entry const &, context>(c->m_entry, context(c->m_next));
+}
+
+context_entry const & context::lookup(unsigned i) const {
+    cell const * c = find_cell(i);
+    if (!c)
+        throw exception("unknown free variable");
+    return c->m_entry;
+}
+
+optional<context_entry> context::find(unsigned i) const {
+    cell const * c = find_cell(i);
+    if (!c)
+        return optional<context_entry>();
+    return some(c->m_entry);
+}
+
+bool operator==(context const & ctx1, context const & ctx2) {
+    if (ctx1.size() != ctx2.size())
+        return false;
+    context::cell const * it1 = ctx1.m_ptr;
+    context::cell const * it2 = ctx2.m_ptr;
+    while (it1 != nullptr) {
+        if (it1 == it2)
+            return true;
+        if (it1->m_entry != it2->m_entry)
+            return false;
+        it1 = it1->m_next;
+        it2 = it2->m_next;
     }
+    return true;
 }
 
 context context::truncate(unsigned s) const {
-    return context(truncate_core(m_list, s));
+    buffer<context_entry> entries;
+    for (auto it = begin(); it != end() && entries.size() < s; ++it)
+        entries.push_back(*it);
+    return context(entries.size(), entries.data());
 }
 
 struct remove_no_applicable {};
-static list<context_entry> remove_core(list<context_entry> const & l, unsigned s, unsigned n, metavar_env const & menv) {
-    if (l) {
+static context remove_core(context const & c, unsigned s, unsigned n, metavar_env const & menv) {
+    if (c) {
+        auto p = lookup_ext(c, 0);
         if (s == 0) {
             if (n > 0) {
-                return remove_core(tail(l), 0, n-1, menv);
+                return remove_core(p.second, 0, n-1, menv);
             } else {
-                return l;
+                return c;
             }
         } else {
-            if (has_free_var(head(l), s-1, s+n-1, menv))
+            if (has_free_var(p.first, s-1, s+n-1, menv))
                 throw remove_no_applicable();
-            return cons(lower_free_vars(head(l), s+n-1, n, menv), remove_core(tail(l), s-1, n, menv));
+            context_entry new_entry = lower_free_vars(p.first, s+n-1, n, menv);
+            return context(remove_core(p.second, s-1, n, menv), new_entry);
         }
     } else {
-        return l;
+        return c;
     }
 }
 
 optional<context> context::remove(unsigned s, unsigned n, metavar_env const & menv) const {
     try {
-        return some(context(remove_core(m_list, s, n, menv)));
+        return some(remove_core(*this, s, n, menv));
     } catch (remove_no_applicable&) {
         return optional<context>();
     }
@@ -6,7 +6,9 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <utility>
-#include "util/list.h"
+#include <iterator>
+#include "util/rc.h"
+#include "util/memory.h"
 #include "util/optional.h"
 #include "kernel/expr.h"
 
@@ -35,30 +37,73 @@ class metavar_env;
 
 /**
    \brief A context is essentially a mapping from free-variables to types (and definition/body).
+
+   It is a persistent stack of entries. Besides the entry and the next cell, each cell stores
+   the size of the context it represents and a "jump" pointer to one of its ancestors.
+   The jump pointers follow the skew-binary scheme described in
+   [E. Myers, An applicative random-access stack, 1983].
+   So, \c size and \c extend are O(1), and \c lookup and \c lookup_ext are O(log n).
 */
 class context {
-    list<context_entry> m_list;
-    explicit context(list<context_entry> const & l):m_list(l) {}
+    class cell {
+        MK_LEAN_RC();
+        LEAN_SMALL_OBJECT_ALLOCATOR();
+        context_entry m_entry;
+        unsigned      m_size;    // number of entries in the context headed by this cell
+        cell *        m_next;    // the reference counter of this cell is incremented
+        cell *        m_jump;    // ancestor of this cell (m_next if the jump is not useful)
+        void dealloc();
+        friend class context;
+    public:
+        cell(context_entry const & e, cell * next);
+    };
+    cell * m_ptr;
+    explicit context(cell * c):m_ptr(c) {}
+    cell const * find_cell(unsigned vidx) const;
 public:
-    context() {}
-    context(context const & c, name const & n, optional<expr> const & d, expr const & b):m_list(context_entry(n, d, b), c.m_list) {}
-    context(context const & c, name const & n, expr const & d, optional<expr> const & b):m_list(context_entry(n, d, b), c.m_list) {}
-    context(context const & c, name const & n, expr const & d, expr const & b):m_list(context_entry(n, d, b), c.m_list) {}
-    context(context const & c, name const & n, expr const & d):m_list(context_entry(n, d), c.m_list) {}
-    context(context const & c, context_entry const & e):m_list(e, c.m_list) {}
-    context(unsigned sz, context_entry const * es):context(to_list(es, es + sz)) {}
+    context():m_ptr(nullptr) {}
+    context(context const & c, name const & n, optional<expr> const & d, expr const & b):m_ptr(new cell(context_entry(n, d, b), c.m_ptr)) {}
+    context(context const & c, name const & n, expr const & d, optional<expr> const & b):m_ptr(new cell(context_entry(n, d, b), c.m_ptr)) {}
+    context(context const & c, name const & n, expr const & d, expr const & b):m_ptr(new cell(context_entry(n, d, b), c.m_ptr)) {}
+    context(context const & c, name const & n, expr const & d):m_ptr(new cell(context_entry(n, d), c.m_ptr)) {}
+    context(context const & c, context_entry const & e):m_ptr(new cell(e, c.m_ptr)) {}
+    context(unsigned sz, context_entry const * es);
     context(std::initializer_list<std::pair<char const *, expr const &>> const & l);
+    context(context const & s):m_ptr(s.m_ptr) { if (m_ptr) m_ptr->inc_ref(); }
+    context(context && s):m_ptr(s.m_ptr) { s.m_ptr = nullptr; }
+    ~context() { if (m_ptr) m_ptr->dec_ref(); }
+    context & operator=(context const & s) { LEAN_COPY_REF(s); }
+    context & operator=(context && s) { LEAN_MOVE_REF(s); }
     context_entry const & lookup(unsigned vidx) const;
     std::pair<context_entry const &, context> lookup_ext(unsigned vidx) const;
     /** \brief Similar to lookup, but always succeed */
     optional<context_entry> find(unsigned vidx) const;
-    bool empty() const { return is_nil(m_list); }
+    bool empty() const { return m_ptr == nullptr; }
     explicit operator bool() const { return !empty(); }
-    unsigned size() const { return length(m_list); }
-    typedef list<context_entry>::iterator iterator;
-    iterator begin() const { return m_list.begin(); }
-    iterator end() const { return m_list.end(); }
-    friend bool is_eqp(context const & c1, context const & c2) { return is_eqp(c1.m_list, c2.m_list); }
+    unsigned size() const { return m_ptr ? m_ptr->m_size : 0; }
+    /** \brief Context iterator, the first entry is the one with de Bruijn index 0. */
+    class iterator {
+        friend class context;
+        cell const * m_it;
+        iterator(cell const * it):m_it(it) {}
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef context_entry         value_type;
+        typedef unsigned              difference_type;
+        typedef context_entry const * pointer;
+        typedef context_entry const & reference;
+
+        iterator(iterator const & s):m_it(s.m_it) {}
+        iterator & operator++() { m_it = m_it->m_next; return *this; }
+        iterator operator++(int) { iterator tmp(*this); operator++(); return tmp; }
+        bool operator==(iterator const & s) const { return m_it == s.m_it; }
+        bool operator!=(iterator const & s) const { return !operator==(s); }
+        context_entry const & operator*() { lean_assert(m_it); return m_it->m_entry; }
+        context_entry const * operator->() { lean_assert(m_it); return &(m_it->m_entry); }
+    };
+    iterator begin() const { return iterator(m_ptr); }
+    iterator end() const { return iterator(nullptr); }
+    friend bool is_eqp(context const & c1, context const & c2) { return c1.m_ptr == c2.m_ptr; }
     /**
        \brief Return a new context where entries at positions >= s are removed.
     */
@@ -78,7 +123,7 @@ public:
        That is, the lower operations must be valid.
     */
     optional<context> remove(unsigned s, unsigned n, metavar_env const & menv) const;
-    friend bool operator==(context const & ctx1, context const & ctx2) { return ctx1.m_list == ctx2.m_list; }
+    friend bool operator==(context const & ctx1, context const & ctx2);
     friend bool operator!=(context const & ctx1, context const & ctx2) { return !(ctx1 == ctx2); }
 };
 
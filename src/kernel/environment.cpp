@@ -11,12 +11,16 @@ Author: Leonardo de Moura
 #include <fstream>
 #include <string>
 #include <utility>
+#include <set>
 #include "util/thread.h"
 #include "util/safe_arith.h"
 #include "util/realpath.h"
 #include "util/sstream.h"
 #include "util/lean_path.h"
 #include "util/flet.h"
+#include "util/mapped_file.h"
+#include "util/thread_pool.h"
+#include "util/name_set.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/find_fn.h"
 #include "kernel/kernel_exception.h"
@@ -28,6 +32,10 @@ Author: Leonardo de Moura
 #include "kernel/kernel.h"
 #include "version.h"
 
+#ifndef LEAN_ENV_INDEX_CHUNK_SIZE
+#define LEAN_ENV_INDEX_CHUNK_SIZE 256
+#endif
+
 namespace lean {
 class set_opaque_command : public neutral_object_cell {
     name m_obj_name;
@@ -153,6 +161,8 @@ environment environment_cell::parent() const {
 }
 
 environment environment_cell::mk_child() const {
+    // children must not see theorems whose proofs may still be rejected
+    const_cast<environment_cell*>(this)->join_theorem_checks();
     return environment(m_this.lock(), true);
 }
 
@@ -189,8 +199,8 @@ unsigned environment_cell::get_max_weight(expr const & e) {
 
 /** \brief Throw exception if environment or its ancestors already have an object with the given name. */
 void environment_cell::check_name_core(name const & n) {
-    if (has_parent())
-        m_parent->check_name_core(n);
+    if (m_ancestor_index && m_ancestor_index->m_object_dictionary.contains(n))
+        throw already_declared_exception(env(), n);
     if (m_object_dictionary.find(n) != m_object_dictionary.end())
         throw already_declared_exception(env(), n);
 }
@@ -201,10 +211,21 @@ void environment_cell::check_name(name const & n) {
     check_name_core(n);
 }
 
+/** \brief Append \c obj to the sequence of objects of this environment */
+void environment_cell::add_object(object const & obj) {
+    m_objects.push_back(obj);
+    m_objects_version++;
+}
+
 /** \brief Store new named object inside internal data-structures */
 void environment_cell::register_named_object(object const & new_obj) {
-    m_objects.push_back(new_obj);
-    m_object_dictionary.insert(std::make_pair(new_obj.get_name(), new_obj));
+    add_object(new_obj);
+    if (m_async_theorems) {
+        exclusive_lock lock(m_dictionary_mutex);
+        m_object_dictionary.insert(std::make_pair(new_obj.get_name(), new_obj));
+    } else {
+        m_object_dictionary.insert(std::make_pair(new_obj.get_name(), new_obj));
+    }
 }
 
 /**
@@ -213,15 +234,98 @@ void environment_cell::register_named_object(object const & new_obj) {
    given name.
 */
 optional<object> environment_cell::get_object_core(name const & n) const {
+    optional<object> r;
+    if (m_async_theorems)
+        m_dictionary_mutex.lock_shared(); // proofs may be type checked by other threads
     auto it = m_object_dictionary.find(n);
-    if (it == m_object_dictionary.end()) {
-        if (has_parent())
-            return m_parent->get_object_core(n);
-        else
-            return none_object();
+    if (it != m_object_dictionary.end())
+        r = it->second;
+    if (m_async_theorems)
+        m_dictionary_mutex.unlock_shared();
+    if (!r && m_ancestor_index)
+        r = m_ancestor_index->find(n);
+    return r;
+}
+
+object const & environment_cell::object_index::get_object(unsigned i) const {
+    lean_assert(i < m_num_objects);
+    object const & obj = (**m_chunks.find(i / LEAN_ENV_INDEX_CHUNK_SIZE))[i % LEAN_ENV_INDEX_CHUNK_SIZE];
+    if (!m_opaque_overrides.empty() && obj.is_definition()) {
+        if (optional<object> const * new_obj = m_opaque_overrides.find(obj.get_name()))
+            return **new_obj;
+    }
+    return obj;
+}
+
+optional<object> environment_cell::object_index::find(name const & n) const {
+    if (optional<object> const * obj = m_object_dictionary.find(n))
+        return *obj;
+    return optional<object>();
+}
+
+/** \brief Append the objects <tt>objs[begin, objs.size())</tt> to this index. */
+void environment_cell::object_index::add_objects(std::vector<object> const & objs, unsigned begin) {
+    unsigned i = m_num_objects / LEAN_ENV_INDEX_CHUNK_SIZE;
+    std::shared_ptr<object_chunk> last;
+    if (m_num_objects % LEAN_ENV_INDEX_CHUNK_SIZE != 0) {
+        // the last chunk may be shared with other indices
+        last = std::make_shared<object_chunk>(**m_chunks.find(i));
+    }
+    for (unsigned j = begin; j < objs.size(); j++) {
+        object const & obj = objs[j];
+        if (!last) {
+            last = std::make_shared<object_chunk>();
+            last->reserve(LEAN_ENV_INDEX_CHUNK_SIZE);
+        }
+        last->push_back(obj);
+        m_num_objects++;
+        if (obj.has_name() && obj.kind() != object_kind::UVarConstraint) {
+            m_object_dictionary.insert(obj.get_name(), optional<object>(obj));
+        } else if (is_set_opaque(obj)) {
+            // the definition may be an object of the ancestors, see environment_cell::set_opaque
+            name const & n = get_set_opaque_id(obj);
+            if (optional<object> d = find(n)) {
+                optional<object> new_d(update_opaque(*d, get_set_opaque_flag(obj)));
+                m_object_dictionary.insert(n, new_d);
+                m_opaque_overrides.insert(n, new_d);
+            }
+        }
+        if (last->size() == LEAN_ENV_INDEX_CHUNK_SIZE) {
+            m_chunks.insert(i, last);
+            last.reset();
+            i++;
+        }
+    }
+    if (last)
+        m_chunks.insert(i, last);
+}
+
+/**
+   \brief Return the index of the objects of this environment and its ancestors.
+   The index is shared by the children environments created while this environment
+   does not change.
+*/
+environment_cell::object_index_ptr environment_cell::get_children_index() const {
+    if (m_objects.empty())
+        return m_ancestor_index;
+    lock_guard<mutex> lock(m_children_index_mutex);
+    if (m_children_index && m_children_index->size() == get_num_objects(false))
+        return m_children_index;
+    // The new index is a copy of the previous one (or the index of the ancestors), and only the new objects are added.
+    // The copy is cheap since it shares the nodes of the persistent maps.
+    std::shared_ptr<object_index> r;
+    unsigned begin = 0;
+    if (m_children_index) {
+        r = std::make_shared<object_index>(*m_children_index);
+        begin = m_children_index->size() - (m_ancestor_index ? m_ancestor_index->size() : 0);
+    } else if (m_ancestor_index) {
+        r = std::make_shared<object_index>(*m_ancestor_index);
     } else {
-        return some_object(it->second);
+        r = std::make_shared<object_index>();
     }
+    r->add_objects(m_objects, begin);
+    m_children_index = r;
+    return m_children_index;
 }
 
 object environment_cell::get_object(name const & n) const {
@@ -268,23 +372,28 @@ optional<int> environment_cell::get_universe_distance(name const & u1, name cons
     return get_ro_ucs().get_distance(u1, u2);
 }
 
-/** \brief Return true iff l1 >= l2 + k by asserted universe constraints. */
-bool environment_cell::is_ge(level const & l1, level const & l2, int k) const {
+/** \brief Return true iff l1 >= l2 + k by the universe constraints \c ucs. */
+static bool is_ge(universe_constraints const & ucs, level const & l1, level const & l2, int k) {
     if (l1 == l2)
         return k <= 0;
     switch (kind(l2)) {
     case level_kind::UVar:
         switch (kind(l1)) {
-        case level_kind::UVar: return get_ro_ucs().is_implied(uvar_name(l1), uvar_name(l2), k);
-        case level_kind::Lift: return is_ge(lift_of(l1), l2, safe_sub(k, lift_offset(l1)));
-        case level_kind::Max:  return std::any_of(max_begin_levels(l1), max_end_levels(l1), [&](level const & l) { return is_ge(l, l2, k); });
+        case level_kind::UVar: return ucs.is_implied(uvar_name(l1), uvar_name(l2), k);
+        case level_kind::Lift: return is_ge(ucs, lift_of(l1), l2, safe_sub(k, lift_offset(l1)));
+        case level_kind::Max:  return std::any_of(max_begin_levels(l1), max_end_levels(l1), [&](level const & l) { return is_ge(ucs, l, l2, k); });
         }
-    case level_kind::Lift: return is_ge(l1, lift_of(l2), safe_add(k, lift_offset(l2)));
-    case level_kind::Max:  return std::all_of(max_begin_levels(l2), max_end_levels(l2), [&](level const & l) { return is_ge(l1, l, k); });
+    case level_kind::Lift: return is_ge(ucs, l1, lift_of(l2), safe_add(k, lift_offset(l2)));
+    case level_kind::Max:  return std::all_of(max_begin_levels(l2), max_end_levels(l2), [&](level const & l) { return is_ge(ucs, l1, l, k); });
     }
     lean_unreachable(); // LCOV_EXCL_LINE
 }
 
+/** \brief Return true iff l1 >= l2 + k by asserted universe constraints. */
+bool environment_cell::is_ge(level const & l1, level const & l2, int k) const {
+    return ::lean::is_ge(get_ro_ucs(), l1, l2, k);
+}
+
 /** \brief Return true iff l1 >= l2 is implied by asserted universe constraints. */
 bool environment_cell::is_ge(level const & l1, level const & l2) const {
     return is_ge(l1, l2, 0);
@@ -339,6 +448,7 @@ void environment_cell::check_consistency(name const & n, level const & l, int k)
 level environment_cell::add_uvar_cnstr(name const & n, level const & l) {
     if (has_children())
         throw read_only_environment_exception(env());
+    join_theorem_checks();
     level r;
     auto const & uvs = get_ro_universes().m_uvars;
     auto it = std::find_if(uvs.begin(), uvs.end(), [&](level const & l) { return uvar_name(l) == n; });
@@ -352,7 +462,7 @@ level environment_cell::add_uvar_cnstr(name const & n, level const & l) {
         r = *it;
         new_universe = false;
     }
-    m_objects.push_back(mk_uvar_cnstr(n, l));
+    add_object(mk_uvar_cnstr(n, l));
     add_constraints(n, l, 0);
     name const & Uname = uvar_name(ty_level(TypeU));
     if (new_universe && n != Uname && !is_ge(ty_level(TypeU), r, 1)) {
@@ -418,6 +528,8 @@ void environment_cell::check_type(name const & n, expr const & t, expr const & v
 /** \brief Throw exception if it is not a valid new definition */
 void environment_cell::check_new_definition(name const & n, expr const & t, expr const & v) {
     check_name(n);
+    join_theorem_checks_used_by(t);
+    join_theorem_checks_used_by(v);
     check_type(n, t, v);
 }
 
@@ -463,6 +575,7 @@ void environment_cell::add_definition(name const & n, expr const & t, expr const
 void environment_cell::add_definition(name const & n, expr const & v, bool opaque) {
     check_no_cached_type(v);
     check_name(n);
+    join_theorem_checks_used_by(v);
     expr v_t;
     if (m_type_check)
         v_t = m_type_checker->check(v);
@@ -474,26 +587,231 @@ void environment_cell::add_definition(name const & n, expr const & v, bool opaqu
         set_opaque(n, opaque);
 }
 
+/** \brief Throw an exception if \c v is not a proof/value of the declaration \c obj. */
+static void check_value(type_checker & tc, ro_environment const & env, object const & obj) {
+    expr t   = obj.get_type();
+    expr v   = obj.get_value();
+    expr v_t = tc.check(v);
+    if (!tc.is_convertible(v_t, t))
+        throw def_type_mismatch_exception(env, obj.get_name(), t, v, v_t);
+}
+
+struct environment_cell::theorem_check {
+    object                     m_theorem;
+    std::unique_ptr<exception> m_ex;
+#if defined(LEAN_MULTI_THREAD)
+    std::unique_ptr<task>      m_task;
+#endif
+    theorem_check(object const & thm):m_theorem(thm) {}
+};
+
+object environment_cell::mk_theorem_object(name const & n, expr const & t, expr const & v) const {
+    return m_compress_proofs ? mk_compressible_theorem(n, t, v) : mk_theorem(n, t, v);
+}
+
 /** \brief Add new theorem. */
 void environment_cell::add_theorem(name const & n, expr const & t, expr const & v) {
     check_no_cached_type(t);
     check_no_cached_type(v);
+#if defined(LEAN_MULTI_THREAD)
+    if (m_async_theorems && m_type_check) {
+        check_name(n);
+        join_theorem_checks_used_by(t);
+        m_type_checker->check_type(t);
+        // The proof is checked using an immutable snapshot of the objects declared before the theorem,
+        // since this environment is modified while the check is running.
+        std::shared_ptr<environment_snapshot const> s = update_snapshot(true);
+        object thm = mk_theorem_object(n, t, v);
+        register_named_object(thm);
+        auto c = std::make_shared<theorem_check>(thm);
+        theorem_check * p = c.get();
+        c->m_task.reset(new task([=]() {
+                    ro_environment env = s->get_environment();
+                    try {
+                        type_checker tc(env);
+                        check_value(tc, env, p->m_theorem);
+                        compress_proof(p->m_theorem);
+                    } catch (exception & ex) {
+                        p->m_ex.reset(ex.clone());
+                    } catch (...) {
+                        p->m_ex.reset(new kernel_exception(env, sstream() << "failed to type check '" << p->m_theorem.get_name() << "'"));
+                    }
+                }));
+        m_theorem_checks.push_back(c);
+        m_pending_theorems.insert(n);
+        return;
+    }
+#endif
     check_new_definition(n, t, v);
-    register_named_object(mk_theorem(n, t, v));
+    object thm = mk_theorem_object(n, t, v);
+    register_named_object(thm);
+    compress_proof(thm);
+}
+
+/**
+   \brief Remove the theorems in \c failed from this environment. The objects declared after them
+   that use them (directly or indirectly) are also removed, since they were checked assuming the failed theorems.
+   Return the names of these objects.
+*/
+std::vector<name> environment_cell::remove_failed_theorems(std::vector<object> const & failed) {
+    name_set removed;
+    for (auto const & thm : failed)
+        removed.insert(thm.get_name());
+    auto uses_removed = [&](expr const & e) {
+        return static_cast<bool>(find(e, [&](expr const & c) { return is_constant(c) && removed.find(const_name(c)) != removed.end(); }));
+    };
+    // objects declared before the first failed theorem do not need to be inspected
+    auto it = std::find_if(m_objects.begin(), m_objects.end(), [&](object const & obj) {
+            return obj.has_name() && removed.find(obj.get_name()) != removed.end();
+        });
+    std::vector<object> new_objects(m_objects.begin(), it);
+    std::vector<name> dependents;
+    for (; it != m_objects.end(); ++it) {
+        object const & obj = *it;
+        if (obj.has_name() && obj.kind() != object_kind::UVarConstraint) {
+            if (removed.find(obj.get_name()) != removed.end())
+                continue;
+            if ((obj.has_type() && uses_removed(obj.get_type())) ||
+                (obj.is_definition() && uses_removed(obj.get_value()))) {
+                removed.insert(obj.get_name());
+                dependents.push_back(obj.get_name());
+                continue;
+            }
+        }
+        new_objects.push_back(obj);
+    }
+    {
+        exclusive_lock lock(m_dictionary_mutex);
+        for (name const & n : removed)
+            m_object_dictionary.erase(n);
+    }
+    m_objects.swap(new_objects);
+    reset_object_caches();
+    return dependents;
+}
+
+/** \brief Remove the objects at positions <tt>[i, get_num_objects(true))</tt> from this environment. */
+void environment_cell::remove_objects_from(unsigned i) {
+    {
+        exclusive_lock lock(m_dictionary_mutex);
+        for (unsigned j = i; j < m_objects.size(); j++) {
+            object const & obj = m_objects[j];
+            if (obj.has_name() && obj.kind() != object_kind::UVarConstraint)
+                m_object_dictionary.erase(obj.get_name());
+        }
+    }
+    m_objects.erase(m_objects.begin() + i, m_objects.end());
+    reset_object_caches();
+}
+
+/** \brief Recreate the data-structures that depend on the objects of this environment, after objects were removed or replaced. */
+void environment_cell::reset_object_caches() {
+    m_objects_version++;
+    {
+        // The snapshot and the children index are built incrementally, and must be recreated.
+        // Readers keep using the current snapshot until the new one is published.
+        lock_guard<mutex> lock(m_snapshot_mutex);
+        m_rebuild_snapshot = true;
+    }
+    {
+        lock_guard<mutex> lock(m_children_index_mutex);
+        m_children_index.reset();
+    }
+    m_type_checker->clear();
+}
+
+void environment_cell::join_theorem_checks() {
+    if (m_theorem_checks.empty())
+        return;
+    std::vector<std::shared_ptr<theorem_check>> todo;
+    todo.swap(m_theorem_checks);
+    m_pending_theorems.clear();
+    std::vector<name> removed;
+    auto remove_failed = [&]() {
+        std::vector<object> failed;
+        std::vector<std::shared_ptr<exception const>> exs;
+        for (auto const & c : todo) {
+            if (c->m_ex) {
+                failed.push_back(c->m_theorem);
+                exs.push_back(std::shared_ptr<exception const>(c->m_ex.release()));
+            }
+        }
+        if (!failed.empty())
+            removed = remove_failed_theorems(failed);
+        return exs;
+    };
+#if defined(LEAN_MULTI_THREAD)
+    try {
+        for (auto const & c : todo)
+            wait_for(*c->m_task, g_no_timeout);
+    } catch (...) {
+        // the current thread was interrupted, the interrupted checks are considered failures
+        for (auto const & c : todo)
+            c->m_task->request_interrupt();
+        for (auto const & c : todo)
+            c->m_task->wait();
+        remove_failed();
+        throw;
+    }
+#endif
+    std::vector<std::shared_ptr<exception const>> exs = remove_failed();
+    if (exs.size() == 1 && removed.empty())
+        exs[0]->rethrow();
+    else if (!exs.empty())
+        throw theorem_check_exception(env(), exs, removed);
+}
+
+/**
+   \brief Wait for the theorems being checked in background threads if \c e uses one of them.
+   Declarations that are type checked when they are added must not depend on proofs that may be rejected.
+*/
+void environment_cell::join_theorem_checks_used_by(expr const & e) {
+    if (m_pending_theorems.empty())
+        return;
+    if (find(e, [&](expr const & c) { return is_constant(c) && m_pending_theorems.find(const_name(c)) != m_pending_theorems.end(); }))
+        join_theorem_checks();
+}
+
+void environment_cell::set_async_theorem_checking(bool flag) {
+    join_theorem_checks();
+    m_async_theorems = flag;
+}
+
+void environment_cell::set_compress_proofs(bool flag) {
+    m_compress_proofs = flag;
 }
 
 void environment_cell::set_opaque(name const & n, bool opaque) {
+    if (has_children())
+        throw read_only_environment_exception(env());
+    // opaque definitions cannot be unfolded when checking the pending objects
+    check_pending_objects();
+    join_theorem_checks();
     auto obj = find_object(n);
     if (!obj || !obj->is_definition())
         throw kernel_exception(env(), sstream() << "set_opaque failed, '" << n << "' is not a definition");
-    obj->set_opaque(opaque);
+    // The object may be shared with snapshots and the ancestors, so we replace it with a new one.
+    // If it is an object of the ancestors, then the new one is only stored in the dictionary,
+    // and get_object and the indices built from this environment also return it.
+    object new_obj = update_opaque(*obj, opaque);
+    auto it = std::find_if(m_objects.rbegin(), m_objects.rend(), [&](object const & o) { return o.cell() == obj->cell(); });
+    if (it != m_objects.rend())
+        *it = new_obj;
+    {
+        exclusive_lock lock(m_dictionary_mutex);
+        m_object_dictionary.erase(n);
+        m_object_dictionary.insert(std::make_pair(n, new_obj));
+    }
     add_neutral_object(new set_opaque_command(n, opaque));
+    // cached results and snapshots may depend on the definitions that can be unfolded
+    reset_object_caches();
 }
 
 /** \brief Add new axiom. */
 void environment_cell::add_axiom(name const & n, expr const & t) {
     check_no_cached_type(t);
     check_name(n);
+    join_theorem_checks_used_by(t);
     if (m_type_check)
         m_type_checker->check_type(t);
     register_named_object(mk_axiom(n, t));
@@ -503,32 +821,91 @@ void environment_cell::add_axiom(name const & n, expr const & t) {
 void environment_cell::add_var(name const & n, expr const & t) {
     check_no_cached_type(t);
     check_name(n);
+    join_theorem_checks_used_by(t);
     if (m_type_check)
         m_type_checker->check_type(t);
     register_named_object(mk_var_decl(n, t));
 }
 
+/** \brief Throw exception if \c e contains a constant that is not defined in this environment. */
+void environment_cell::check_declared(expr const & e) {
+    for_each(e, [&](expr const & c, unsigned) {
+            if (is_constant(c) && !get_object_core(const_name(c)))
+                throw unknown_object_exception(env(), const_name(c));
+            return true;
+        });
+}
+
+void environment_cell::add_imported_object(object const & obj) {
+    if (m_type_check && m_defer_checks) {
+        // All constants used by the object must have been declared before it.
+        // So, the type checking order does not matter.
+        name const & n = obj.get_name();
+        expr t = obj.get_type();
+        check_no_cached_type(t);
+        check_name(n);
+        check_declared(t);
+        object new_obj = obj;
+        if (obj.is_definition()) {
+            expr v = obj.get_value();
+            check_no_cached_type(v);
+            check_declared(v);
+            if (obj.is_theorem())
+                new_obj = mk_theorem_object(n, t, v);
+            else
+                new_obj = mk_definition(n, t, v, get_max_weight(v) + 1);
+        } else if (obj.is_axiom()) {
+            new_obj = mk_axiom(n, t);
+        } else {
+            new_obj = mk_var_decl(n, t);
+        }
+        register_named_object(new_obj);
+        m_pending_checks.push_back(new_obj);
+    } else if (m_type_check) {
+        if (obj.is_theorem())
+            add_theorem(obj.get_name(), obj.get_type(), obj.get_value());
+        else if (obj.is_definition())
+            add_definition(obj.get_name(), obj.get_type(), obj.get_value());
+        else if (obj.is_axiom())
+            add_axiom(obj.get_name(), obj.get_type());
+        else
+            add_var(obj.get_name(), obj.get_type());
+    } else {
+        check_name(obj.get_name());
+        register_named_object(obj);
+    }
+}
+
 void environment_cell::add_neutral_object(neutral_object_cell * o) {
-    m_objects.push_back(mk_neutral(o));
+    object obj = mk_neutral(o);
+    if (has_children())
+        throw read_only_environment_exception(env());
+    add_object(obj);
 }
 
 unsigned environment_cell::get_num_objects(bool local) const {
-    if (local || !has_parent()) {
+    if (local || !m_ancestor_index) {
         return m_objects.size();
     } else {
-        return m_objects.size() + m_parent->get_num_objects(false);
+        return m_objects.size() + m_ancestor_index->size();
     }
 }
 
 object const & environment_cell::get_object(unsigned i, bool local) const {
-    if (local || !has_parent()) {
+    if (local || !m_ancestor_index) {
         return m_objects[i];
     } else {
-        unsigned num_parent_objects = m_parent->get_num_objects(false);
-        if (i >= num_parent_objects)
-            return m_objects[i - num_parent_objects];
-        else
-            return m_parent->get_object(i, false);
+        unsigned num_ancestor_objects = m_ancestor_index->size();
+        if (i >= num_ancestor_objects)
+            return m_objects[i - num_ancestor_objects];
+        object const & obj = m_ancestor_index->get_object(i);
+        if (obj.is_definition()) {
+            // the opaque flag may have been modified in this environment, see set_opaque
+            auto it = m_object_dictionary.find(obj.get_name());
+            if (it != m_object_dictionary.end())
+                return it->second;
+        }
+        return obj;
     }
 }
 
@@ -587,12 +964,82 @@ void environment_cell::set_trusted_imported(bool flag) {
     m_trust_imported = flag;
 }
 
+void environment_cell::set_num_check_threads(unsigned n) {
+    m_num_check_threads = n;
+}
+
+static void check_object(type_checker & tc, ro_environment const & env, object const & obj) {
+    tc.check_type(obj.get_type());
+    if (obj.is_definition()) {
+        check_value(tc, env, obj);
+        compress_proof(obj);
+    }
+}
+
+/**
+   \brief Type check the objects in \c m_pending_checks using \c m_num_check_threads threads.
+   Each thread uses its own type checker. If one of the objects is not type correct,
+   then an exception is thrown.
+*/
+void environment_cell::check_pending_objects() {
+    if (m_pending_checks.empty())
+        return;
+    std::vector<object> todo;
+    todo.swap(m_pending_checks);
+    ro_environment env(this->env());
+    unsigned num = todo.size();
+    atomic<unsigned> next(0);
+    atomic<bool> failed(false);
+    mutex ex_mutex;
+    std::unique_ptr<exception> ex;
+    auto check_fn = [&]() {
+        type_checker tc(env);
+        while (!failed) {
+            unsigned i = next++;
+            if (i >= num)
+                return;
+            try {
+                check_object(tc, env, todo[i]);
+            } catch (exception & e) {
+                lock_guard<mutex> lock(ex_mutex);
+                if (!ex)
+                    ex.reset(e.clone());
+                failed = true;
+            } catch (...) {
+                lock_guard<mutex> lock(ex_mutex);
+                if (!ex)
+                    ex.reset(new kernel_exception(env, sstream() << "failed to type check '" << todo[i].get_name() << "'"));
+                failed = true;
+            }
+        }
+    };
+#if defined(LEAN_MULTI_THREAD)
+    std::vector<std::unique_ptr<task>> tasks;
+    for (unsigned i = 1; i < std::min(m_num_check_threads, num); i++)
+        tasks.push_back(std::unique_ptr<task>(new task(check_fn)));
+    check_fn();
+    for (auto & t : tasks)
+        t->wait();
+#else
+    check_fn();
+#endif
+    if (ex)
+        ex->rethrow();
+}
+
 static char const * g_olean_header   = "oleanfile";
 static char const * g_olean_end_file = "EndFile";
+/**
+   \brief Version of the binary format used in .olean files.
+   It must be increased whenever the encoding produced by the serializer changes.
+   Version 1 used fixed size integers and null-terminated strings.
+*/
+static unsigned     g_olean_version  = 2;
 void environment_cell::export_objects(std::string const & fname) {
+    join_theorem_checks();
     std::ofstream out(fname, std::ofstream::binary);
     serializer s(out);
-    s << g_olean_header << LEAN_VERSION_MAJOR << LEAN_VERSION_MINOR;
+    s << g_olean_header << g_olean_version << LEAN_VERSION_MAJOR << LEAN_VERSION_MINOR;
     auto it  = begin_objects();
     auto end = end_objects();
     unsigned num_imports = 0;
@@ -616,14 +1063,19 @@ void environment_cell::export_objects(std::string const & fname) {
 
 bool environment_cell::load_core(std::string const & fname, io_state const & ios, optional<std::string> const & mod_name) {
     if (!mod_name || mark_imported_core(fname)) {
-        std::ifstream in(fname, std::ifstream::binary);
-        if (!in.good())
-            throw exception(sstream() << "failed to open file '" << fname << "'");
+        mapped_file_istream in(std::make_shared<mapped_file>(fname));
         deserializer d(in);
         std::string header;
-        d >> header;
-        if (header != g_olean_header)
-            throw exception(sstream() << "file '" << fname << "' does not seem to be a valid object Lean file");
+        unsigned version = 0;
+        try {
+            d >> header >> version;
+        } catch (exception &) {
+            // files produced using an older format cannot even be decoded
+            header.clear();
+        }
+        if (header != g_olean_header || version != g_olean_version)
+            throw exception(sstream() << "file '" << fname << "' does not seem to be a valid object Lean file, "
+                            << "or it was produced by an incompatible version of Lean");
         unsigned major, minor;
         // Perhaps we should enforce the right version number
         d >> major >> minor;
@@ -652,7 +1104,29 @@ bool environment_cell::load_core(std::string const & fname, io_state const & ios
 
 bool environment_cell::import(std::string const & fname, io_state const & ios) {
     flet<bool> set(m_type_check, !m_trust_imported);
-    return load_core(realpath(find_file(fname, {".olean"}).c_str()), ios, optional<std::string>(fname));
+    std::string full_name = realpath(find_file(fname, {".olean"}).c_str());
+    if (!m_type_check || m_defer_checks || m_num_check_threads <= 1)
+        return load_core(full_name, ios, optional<std::string>(fname));
+    // The objects are registered before they are type checked. So, we save the current state,
+    // and restore it if one of them is rejected.
+    unsigned num_objects = m_objects.size();
+    std::set<name> imported_modules = m_imported_modules;
+    std::unique_ptr<universes> saved_universes(m_universes ? new universes(*m_universes) : nullptr);
+    try {
+        bool r;
+        {
+            flet<bool> defer(m_defer_checks, true);
+            r = load_core(full_name, ios, optional<std::string>(fname));
+        }
+        check_pending_objects();
+        return r;
+    } catch (...) {
+        m_pending_checks.clear();
+        remove_objects_from(num_objects);
+        m_imported_modules.swap(imported_modules);
+        m_universes.swap(saved_universes);
+        throw;
+    }
 }
 
 void environment_cell::load(std::string const & fname, io_state const & ios) {
@@ -669,17 +1143,30 @@ bool environment_cell::imported(std::string const & n) const {
 }
 
 environment_cell::environment_cell():
-    m_num_children(0) {
-    m_trust_imported = false;
-    m_type_check     = true;
+    m_num_children(0),
+    m_objects_version(0),
+    m_rebuild_snapshot(false) {
+    m_trust_imported    = false;
+    m_type_check        = true;
+    m_num_check_threads = 1;
+    m_defer_checks      = false;
+    m_async_theorems    = false;
+    m_compress_proofs   = false;
     init_uvars();
 }
 
 environment_cell::environment_cell(std::shared_ptr<environment_cell> const & parent):
     m_num_children(0),
-    m_parent(parent) {
-    m_trust_imported = false;
-    m_type_check     = true;
+    m_parent(parent),
+    m_ancestor_index(parent->get_children_index()),
+    m_objects_version(0),
+    m_rebuild_snapshot(false) {
+    m_trust_imported    = false;
+    m_type_check        = true;
+    m_num_check_threads = 1;
+    m_defer_checks      = false;
+    m_async_theorems    = false;
+    m_compress_proofs   = false;
     parent->inc_children();
 }
 
@@ -749,7 +1236,157 @@ read_write_shared_environment::read_write_shared_environment(environment const &
     m_env(env),
     m_lock(m_env.m_ptr->m_mutex) {
 }
-read_write_shared_environment::~read_write_shared_environment() {}
+read_write_shared_environment::~read_write_shared_environment() {
+    try {
+        // publish the updates performed by this writer
+        m_env.m_ptr->update_snapshot(false);
+    } catch (...) {
+        // readers will create the snapshot
+    }
+}
+
+/**
+   \brief Create a snapshot containing the current objects of this environment. If \c force is false,
+   then the snapshot is only updated if it was already created by \c get_snapshot.
+
+   \pre There is no writer modifying the environment.
+*/
+std::shared_ptr<environment_snapshot const> environment_cell::update_snapshot(bool force) const {
+    lock_guard<mutex> lock(m_snapshot_mutex);
+    if (!m_snapshot && !force)
+        return m_snapshot;
+    unsigned version = m_objects_version;
+    if (m_snapshot && m_snapshot->m_version == version)
+        return m_snapshot;
+    std::shared_ptr<environment_snapshot> r;
+    unsigned begin = 0;
+    if (m_snapshot && !m_rebuild_snapshot) {
+        // the new snapshot shares the nodes of the previous one
+        r.reset(new environment_snapshot(*m_snapshot));
+        begin = r->get_num_objects(true);
+    } else {
+        r.reset(new environment_snapshot());
+        if (m_ancestor_index)
+            r->m_objects = *m_ancestor_index;
+        r->m_num_ancestors = r->m_objects.size();
+    }
+    bool new_universes = !r->m_universes;
+    for (unsigned i = begin; i < m_objects.size() && !new_universes; i++) {
+        if (m_objects[i].kind() == object_kind::UVarConstraint)
+            new_universes = true;
+    }
+    r->m_objects.add_objects(m_objects, begin);
+    r->m_version = version;
+    if (new_universes)
+        r->m_universes = std::make_shared<universes>(get_ro_universes());
+    m_snapshot = r;
+    m_rebuild_snapshot = false;
+    return m_snapshot;
+}
+
+std::shared_ptr<environment_snapshot const> environment_cell::get_snapshot() const {
+    std::shared_ptr<environment_snapshot const> r;
+    {
+        lock_guard<mutex> lock(m_snapshot_mutex);
+        r = m_snapshot;
+    }
+    if (r && r->m_version == m_objects_version)
+        return r;
+    shared_mutex & m = const_cast<environment_cell*>(this)->m_mutex;
+    if (r) {
+        // If there is an active writer, then we use the last published snapshot.
+        if (!m.try_lock_shared())
+            return r;
+    } else {
+        m.lock_shared();
+    }
+    try {
+        r = update_snapshot(true);
+    } catch (...) {
+        m.unlock_shared();
+        throw;
+    }
+    m.unlock_shared();
+    return r;
+}
+
+/** \brief Environment containing the objects and universe constraints of a snapshot. */
+environment_cell::environment_cell(std::shared_ptr<object_index const> const & objs, universes const & u):
+    m_universes(new universes(u)),
+    m_num_children(0),
+    m_ancestor_index(objs),
+    m_objects_version(0),
+    m_rebuild_snapshot(false) {
+    m_trust_imported    = false;
+    m_type_check        = true;
+    m_num_check_threads = 1;
+    m_defer_checks      = false;
+    m_async_theorems    = false;
+    m_compress_proofs   = false;
+}
+
+environment_snapshot::environment_snapshot():m_num_ancestors(0), m_version(0) {}
+
+environment_snapshot::environment_snapshot(environment_snapshot const & s):
+    m_objects(s.m_objects), m_num_ancestors(s.m_num_ancestors), m_version(s.m_version), m_universes(s.m_universes) {}
+
+environment_snapshot::~environment_snapshot() {}
+
+/**
+   \brief Return a read-only environment containing the objects and universe constraints of this snapshot.
+   It is created when it is needed for the first time.
+*/
+ro_environment environment_snapshot::get_environment() const {
+    lock_guard<mutex> lock(m_env_mutex);
+    if (!m_env) {
+        std::shared_ptr<environment_cell> env(new environment_cell(std::make_shared<environment_cell::object_index>(m_objects),
+                                                                   *m_universes));
+        env->m_this = env;
+        env->m_type_checker.reset(new type_checker(environment(env)));
+        m_env = env;
+    }
+    return ro_environment(environment(m_env));
+}
+
+unsigned environment_snapshot::get_num_objects(bool local) const {
+    if (local)
+        return m_objects.size() - m_num_ancestors;
+    else
+        return m_objects.size();
+}
+
+object const & environment_snapshot::get_object(unsigned i, bool local) const {
+    return m_objects.get_object(local ? i + m_num_ancestors : i);
+}
+
+optional<object> environment_snapshot::find_object(name const & n) const {
+    return m_objects.find(n);
+}
+
+bool environment_snapshot::is_ge(level const & l1, level const & l2) const {
+    return ::lean::is_ge(m_universes->m_constraints, l1, l2, 0);
+}
+
+optional<int> environment_snapshot::get_universe_distance(name const & u1, name const & u2) const {
+    return m_universes->m_constraints.get_distance(u1, u2);
+}
+
+expr environment_snapshot::type_check(expr const & e, context const & ctx) const {
+    // A new type checker is used in each call, so readers of the same snapshot do not wait for each other.
+    return type_checker(get_environment()).check(e, ctx);
+}
+
+expr environment_snapshot::infer_type(expr const & e, context const & ctx) const {
+    return type_checker(get_environment()).infer_type(e, ctx);
+}
+
+expr environment_snapshot::normalize(expr const & e, context const & ctx, bool unfold_opaque) const {
+    return normalizer(get_environment())(e, ctx, unfold_opaque);
+}
+
+bool environment_snapshot::is_proposition(expr const & e, context const & ctx) const {
+    return type_checker(get_environment()).is_proposition(e, ctx);
+}
 
 static std::unique_ptr<name_map<std::pair<mk_builtin_fn, bool>>> g_available_builtins;
 name_map<std::pair<mk_builtin_fn, bool>> & get_available_builtins() {
@@ -14,6 +14,8 @@ Author: Leonardo de Moura
 #include "util/lua.h"
 #include "util/shared_mutex.h"
 #include "util/name_map.h"
+#include "util/name_set.h"
+#include "util/avl_map.h"
 #include "kernel/context.h"
 #include "kernel/object.h"
 #include "kernel/level.h"
@@ -25,12 +27,14 @@ class type_checker;
 class environment_extension;
 class universe_constraints;
 class universes;
+class environment_snapshot;
 
 /** \brief Implementation of the Lean environment. */
 class environment_cell {
     friend class environment;
     friend class read_write_shared_environment;
     friend class read_only_shared_environment;
+    friend class environment_snapshot;
     // Remark: only named objects are stored in the dictionary.
     typedef name_map<object> object_dictionary;
     typedef std::tuple<level, level, int> constraint;
@@ -40,6 +44,36 @@ class environment_cell {
     // Children environment management
     atomic<unsigned>                        m_num_children;
     std::shared_ptr<environment_cell>       m_parent;
+    /**
+       \brief Immutable index of the objects of an environment and its ancestors.
+       It is shared by children environments, and provides O(log n) access to the ancestor objects.
+       The index of an environment is built from the index of its parent. They are persistent
+       data structures, then the index of nested environments share the nodes of their ancestors.
+    */
+    struct object_index {
+        typedef std::vector<object> object_chunk;
+        struct chunk_cmp { int operator()(unsigned i1, unsigned i2) const { return i1 < i2 ? -1 : (i1 > i2 ? 1 : 0); } };
+        // The objects are stored in chunks of LEAN_ENV_INDEX_CHUNK_SIZE objects, the i-th chunk is mapped to i.
+        // Only the last chunk is not full, and it is copied when objects are added to a new index.
+        avl_map<unsigned, std::shared_ptr<object_chunk const>, chunk_cmp> m_chunks;
+        unsigned                            m_num_objects;
+        // Named objects (avl_map values must be default constructible, thus we use optional.)
+        avl_map<name, optional<object>, name_quick_cmp> m_object_dictionary;
+        // Definitions whose opaque flag was modified by set_opaque commands. The objects in the chunks are not modified,
+        // then get_object returns the version stored here.
+        avl_map<name, optional<object>, name_quick_cmp> m_opaque_overrides;
+        object_index():m_num_objects(0) {}
+        unsigned size() const { return m_num_objects; }
+        object const & get_object(unsigned i) const;
+        optional<object> find(name const & n) const;
+        void add_objects(std::vector<object> const & objs, unsigned begin);
+    };
+    typedef std::shared_ptr<object_index const> object_index_ptr;
+    // Objects of the ancestors. This snapshot is valid because an environment is read-only while it has children.
+    object_index_ptr                        m_ancestor_index;
+    // Index for the children of this environment, it is recreated when new objects are added.
+    mutable object_index_ptr                m_children_index;
+    mutable mutex                           m_children_index_mutex;
     // Object management
     std::vector<object>                     m_objects;
     object_dictionary                       m_object_dictionary;
@@ -47,14 +81,32 @@ class environment_cell {
     std::set<name>                          m_imported_modules;   // set of imported files and builtin modules
     bool                                    m_trust_imported; // if true, then imported modules are not type checked.
     bool                                    m_type_check;     // auxiliary flag used to implement m_trust_imported.
+    unsigned                                m_num_check_threads; // number of threads used to type check imported modules.
+    bool                                    m_defer_checks;   // auxiliary flag used to implement parallel type checking of imported modules.
+    std::vector<object>                     m_pending_checks; // imported objects that still have to be type checked.
+    bool                                    m_async_theorems; // if true, then theorem proofs are type checked in background threads.
+    bool                                    m_compress_proofs; // if true, then theorem proofs are compressed after they are type checked.
+    struct theorem_check;
+    std::vector<std::shared_ptr<theorem_check>> m_theorem_checks; // theorems being type checked in background threads.
+    name_set                                m_pending_theorems; // names of the theorems in m_theorem_checks.
+    // Protects m_object_dictionary when m_async_theorems is true.
+    mutable shared_mutex                    m_dictionary_mutex;
     std::vector<std::unique_ptr<environment_extension>> m_extensions;
     friend class environment_extension;
 
     // This mutex is only used to implement threadsafe environment objects
     // in the external APIs
     shared_mutex                            m_mutex;
+    // Snapshot of the objects and universe constraints, see \c get_snapshot.
+    // m_objects_version is incremented whenever m_objects is modified, it is used to check whether the snapshot is up to date.
+    atomic<unsigned>                        m_objects_version;
+    mutable mutex                           m_snapshot_mutex;
+    mutable std::shared_ptr<environment_snapshot const> m_snapshot;
+    // If true, then the next snapshot must be created from scratch because objects were removed or replaced.
+    mutable bool                            m_rebuild_snapshot;
 
     environment env() const;
+    environment_cell(std::shared_ptr<object_index const> const & objs, universes const & u);
 
     void inc_children() { m_num_children++; }
     void dec_children() { m_num_children--; }
@@ -66,8 +118,11 @@ class environment_cell {
     void check_name_core(name const & n);
     void check_name(name const & n);
 
+    void add_object(object const & obj);
     void register_named_object(object const & new_obj);
     optional<object> get_object_core(name const & n) const;
+    object_index_ptr get_children_index() const;
+    std::shared_ptr<environment_snapshot const> update_snapshot(bool force) const;
 
     universes & get_rw_universes();
     universes const & get_ro_universes() const;
@@ -82,6 +137,13 @@ class environment_cell {
     void check_no_cached_type(expr const & e);
     void check_type(name const & n, expr const & t, expr const & v);
     void check_new_definition(name const & n, expr const & t, expr const & v);
+    void check_declared(expr const & e);
+    void check_pending_objects();
+    object mk_theorem_object(name const & n, expr const & t, expr const & v) const;
+    std::vector<name> remove_failed_theorems(std::vector<object> const & failed);
+    void join_theorem_checks_used_by(expr const & e);
+    void remove_objects_from(unsigned i);
+    void reset_object_caches();
 
     bool mark_imported_core(name n);
     bool load_core(std::string const & fname, io_state const & ios, optional<std::string> const & mod_name);
@@ -194,6 +256,13 @@ public:
     void add_axiom(name const & n, expr const & t);
     void add_var(name const & n, expr const & t);
 
+    /**
+       \brief Add a declaration read from an object file.
+       If imported objects are not trusted, then the declaration is type checked,
+       and its type and value are materialized. Otherwise, the object is added as is.
+    */
+    void add_imported_object(object const & obj);
+
     /**
        \brief Register the given unanymous object in this environment.
        The environment assume the object ownership.
@@ -239,11 +308,25 @@ public:
        \brief Low-level function for accessing objects. Consider using iterators.
     */
     unsigned get_num_objects(bool local) const;
+    /**
+       \brief Return a counter that is incremented whenever objects are added to, removed from or
+       replaced in this environment. Unlike \c get_num_objects, it never returns to a previous value.
+    */
+    unsigned get_objects_version() const { return m_objects_version; }
     /**
        \brief Low-level function for accessing objects. Consider using iterators.
     */
     object const & get_object(unsigned i, bool local) const;
 
+    /**
+       \brief Return an immutable snapshot of the objects and universe constraints of this environment.
+       Threads can read the snapshot without holding any lock (see \c threadsafe_environment.h).
+
+       \remark The result may not contain the updates performed by a writer that has not released
+       its \c read_write_shared_environment yet.
+    */
+    std::shared_ptr<environment_snapshot const> get_snapshot() const;
+
     /** \brief Iterator for Lean environment objects. */
     class object_iterator {
         std::shared_ptr<environment_cell const> m_env;
@@ -340,6 +423,41 @@ public:
     */
     void set_trusted_imported(bool flag);
 
+    /**
+        \brief Set the number of threads used to type check imported modules.
+        When it is greater than one, the definitions, theorems and postulates of
+        untrusted imported modules are added to the environment as they are read,
+        and are type checked in parallel after the outermost module is loaded.
+    */
+    void set_num_check_threads(unsigned n);
+
+    /**
+        \brief When the flag is true, \c add_theorem only type checks the theorem statement,
+        and the proof is type checked in a background thread.
+        Errors in proofs are only reported by \c join_theorem_checks. It is invoked by
+        \c export_objects, \c set_opaque and \c add_uvar_cnstr.
+    */
+    void set_async_theorem_checking(bool flag);
+
+    /**
+        \brief When the flag is true, theorem proofs are stored in serialized form
+        after they are type checked. The proofs are deserialized whenever they are requested.
+    */
+    void set_compress_proofs(bool flag);
+
+    /**
+        \brief Wait for the proofs being type checked in background threads.
+        Throw an exception if one of them is not type correct. The theorems that were not proved,
+        and the objects that use them, are removed from the environment before the exception is thrown.
+        When several proofs are rejected, or other objects were removed, a \c theorem_check_exception
+        reporting all of them is thrown.
+
+        \remark Declarations that are type checked when they are added (i.e., all but the proofs of
+        theorems checked in background) wait for the pending checks if they use one of these theorems.
+        Thus, only theorems whose proofs use rejected theorems may be removed.
+    */
+    void join_theorem_checks();
+
     /**
        \brief Execute function \c fn. Any object created by \c fn
        is not exported by the environment.
@@ -379,6 +497,7 @@ public:
 class environment {
     friend class ro_environment;
     friend class environment_cell;
+    friend class environment_snapshot;
     friend class read_write_shared_environment;
     std::shared_ptr<environment_cell> m_ptr;
     environment(std::shared_ptr<environment_cell> const & parent, bool);
@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <unordered_set>
 #include "util/hash.h"
 #include "util/buffer.h"
 #include "util/object_serializer.h"
@@ -18,6 +19,10 @@ Author: Leonardo de Moura
 #include "kernel/metavar.h"
 #include "kernel/max_sharing.h"
 
+#ifndef LEAN_HASH_CONSING_GC_THRESHOLD
+#define LEAN_HASH_CONSING_GC_THRESHOLD (1024*64)
+#endif
+
 namespace lean {
 static expr g_dummy(mk_var(0));
 expr::expr():expr(g_dummy) {}
@@ -88,6 +93,9 @@ void expr_cell::set_is_arrow(bool flag) {
     lean_assert(is_arrow() && *is_arrow() == flag);
 }
 
+/** \brief Return the free variable range of a binder body in the scope outside of the binder. */
+static unsigned dec_free_var_range(unsigned r) { return r == 0 ? 0 : r - 1; }
+
 // Expr variables
 expr_var::expr_var(unsigned idx):
     expr_cell(expr_kind::Var, idx, false),
@@ -97,7 +105,8 @@ expr_var::expr_var(unsigned idx):
 expr_const::expr_const(name const & n, optional<expr> const & t):
     expr_cell(expr_kind::Constant, n.hash(), t && t->has_metavar()),
     m_name(n),
-    m_type(t) {}
+    m_type(t),
+    m_free_var_range(t ? get_free_var_range(*t) : 0) {}
 void expr_const::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_type, todelete);
     delete(this);
@@ -106,7 +115,8 @@ void expr_const::dealloc(buffer<expr_cell*> & todelete) {
 // Expr heterogeneous equality
 expr_heq::expr_heq(expr const & lhs, expr const & rhs):
     expr_cell(expr_kind::HEq, ::lean::hash(lhs.hash(), rhs.hash()), lhs.has_metavar() || rhs.has_metavar()),
-    m_lhs(lhs), m_rhs(rhs), m_depth(std::max(get_depth(lhs), get_depth(rhs))+1) {
+    m_lhs(lhs), m_rhs(rhs), m_depth(std::max(get_depth(lhs), get_depth(rhs))+1),
+    m_free_var_range(std::max(get_free_var_range(lhs), get_free_var_range(rhs))) {
 }
 void expr_heq::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_lhs, todelete);
@@ -117,7 +127,8 @@ void expr_heq::dealloc(buffer<expr_cell*> & todelete) {
 // Expr dependent pairs
 expr_dep_pair::expr_dep_pair(expr const & f, expr const & s, expr const & t):
     expr_cell(expr_kind::Pair, ::lean::hash(f.hash(), s.hash()), f.has_metavar() || s.has_metavar() || t.has_metavar()),
-    m_first(f), m_second(s), m_type(t), m_depth(std::max(get_depth(f), get_depth(s))+1) {
+    m_first(f), m_second(s), m_type(t), m_depth(std::max(get_depth(f), get_depth(s))+1),
+    m_free_var_range(std::max({get_free_var_range(f), get_free_var_range(s), get_free_var_range(t)})) {
 }
 void expr_dep_pair::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_first,  todelete);
@@ -146,7 +157,7 @@ void expr_app::dealloc(buffer<expr_cell*> & todelete) {
         --i;
         dec_ref(m_args[i], todelete);
     }
-    delete[] reinterpret_cast<char*>(this);
+    free_small(this, sizeof(expr_app) + m_num_args*sizeof(expr));
 }
 expr mk_app(unsigned n, expr const * as) {
     lean_assert(n > 1);
@@ -161,16 +172,18 @@ expr mk_app(unsigned n, expr const * as) {
     } else {
         new_n = n;
     }
-    char * mem   = new char[sizeof(expr_app) + new_n*sizeof(expr)];
+    void * mem   = alloc_small(sizeof(expr_app) + new_n*sizeof(expr));
     expr r(new (mem) expr_app(new_n, has_mv));
     expr * m_args = to_app(r)->m_args;
     unsigned i = 0;
     unsigned j = 0;
     unsigned depth = 0;
+    unsigned range = 0;
     if (new_n != n) {
         for (; i < n0; ++i) {
             new (m_args+i) expr(arg(arg0, i));
             depth = std::max(depth, get_depth(m_args[i]));
+            range = std::max(range, get_free_var_range(m_args[i]));
         }
         j++;
     }
@@ -178,10 +191,12 @@ expr mk_app(unsigned n, expr const * as) {
         lean_assert(j < n);
         new (m_args+i) expr(as[j]);
         depth = std::max(depth, get_depth(m_args[i]));
+        range = std::max(range, get_free_var_range(m_args[i]));
     }
     to_app(r)->m_hash  = hash_args(new_n, m_args);
     to_app(r)->m_depth = depth + 1;
-    return r;
+    to_app(r)->m_free_var_range = range;
+    return hash_cons(r);
 }
 
 // Expr abstractions (and subclasses: Lambda, Pi and Sigma)
@@ -191,6 +206,7 @@ expr_abstraction::expr_abstraction(expr_kind k, name const & n, expr const & t,
     m_domain(t),
     m_body(b) {
     m_depth = 1 + std::max(get_depth(m_domain), get_depth(m_body));
+    m_free_var_range = std::max(get_free_var_range(m_domain), dec_free_var_range(get_free_var_range(m_body)));
 }
 void expr_abstraction::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_body, todelete);
@@ -219,9 +235,13 @@ expr_let::expr_let(name const & n, optional<expr> const & t, expr const & v, exp
     m_value(v),
     m_body(b) {
     unsigned depth = std::max(get_depth(m_value), get_depth(m_body));
-    if (m_type)
+    unsigned range = std::max(get_free_var_range(m_value), dec_free_var_range(get_free_var_range(m_body)));
+    if (m_type) {
         depth = std::max(depth, get_depth(*m_type));
+        range = std::max(range, get_free_var_range(*m_type));
+    }
     m_depth = 1 + depth;
+    m_free_var_range = range;
 }
 void expr_let::dealloc(buffer<expr_cell*> & todelete) {
     dec_ref(m_body, todelete);
@@ -311,6 +331,136 @@ void expr_cell::dealloc() {
     }
 }
 
+// Hash-consing
+static LEAN_THREAD_LOCAL bool g_hash_consing = false;
+
+/**
+   \brief Return true iff \c a and \c b have the same kind and fields, and their
+   children are pointer equal. This is the equality used by the hash-consing table.
+   Remark: binder names are taken into account.
+*/
+static bool is_shallow_eq(expr const & a, expr const & b) {
+    if (a.kind() != b.kind() || a.hash() != b.hash())
+        return false;
+    switch (a.kind()) {
+    case expr_kind::Var:      return var_idx(a) == var_idx(b);
+    case expr_kind::Constant: return const_name(a) == const_name(b) && is_eqp(const_type(a), const_type(b));
+    case expr_kind::Type:     return ty_level(a) == ty_level(b);
+    case expr_kind::Value:    return to_value(a) == to_value(b);
+    case expr_kind::Pair:
+        return is_eqp(pair_first(a), pair_first(b)) && is_eqp(pair_second(a), pair_second(b)) && is_eqp(pair_type(a), pair_type(b));
+    case expr_kind::Proj:     return proj_first(a) == proj_first(b) && is_eqp(proj_arg(a), proj_arg(b));
+    case expr_kind::HEq:      return is_eqp(heq_lhs(a), heq_lhs(b)) && is_eqp(heq_rhs(a), heq_rhs(b));
+    case expr_kind::App:
+        return num_args(a) == num_args(b) && std::equal(begin_args(a), end_args(a), begin_args(b),
+                                                        [](expr const & a1, expr const & b1) { return is_eqp(a1, b1); });
+    case expr_kind::Lambda: case expr_kind::Pi: case expr_kind::Sigma:
+        return abst_name(a) == abst_name(b) && is_eqp(abst_domain(a), abst_domain(b)) && is_eqp(abst_body(a), abst_body(b));
+    case expr_kind::Let:
+        return let_name(a) == let_name(b) && is_eqp(let_type(a), let_type(b)) &&
+            is_eqp(let_value(a), let_value(b)) && is_eqp(let_body(a), let_body(b));
+    case expr_kind::MetaVar:
+        return metavar_name(a) == metavar_name(b) &&
+            compare(metavar_lctx(a), metavar_lctx(b), [](local_entry const & e1, local_entry const & e2) {
+                    if (e1.kind() != e2.kind() || e1.s() != e2.s())
+                        return false;
+                    if (e1.is_inst())
+                        return is_eqp(e1.v(), e2.v());
+                    else
+                        return e1.n() == e2.n();
+                });
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+/**
+   \brief Return true iff structural equality coincides with pointer equality for \c e.
+   This is the case when \c e does not contain binder names, constant type annotations nor
+   semantic attachments, and all its children are canonical.
+   \pre is_shallow_eq was used to hash-cons \c e
+*/
+static bool is_canonical_core(expr const & e) {
+    switch (e.kind()) {
+    case expr_kind::Var: case expr_kind::Type:
+        return true;
+    case expr_kind::Value: case expr_kind::Lambda: case expr_kind::Pi:
+    case expr_kind::Sigma: case expr_kind::Let:
+        return false;
+    case expr_kind::Constant: return !const_type(e);
+    case expr_kind::Pair:     return is_canonical(pair_first(e)) && is_canonical(pair_second(e)) && is_canonical(pair_type(e));
+    case expr_kind::Proj:     return is_canonical(proj_arg(e));
+    case expr_kind::HEq:      return is_canonical(heq_lhs(e)) && is_canonical(heq_rhs(e));
+    case expr_kind::App:      return std::all_of(begin_args(e), end_args(e), [](expr const & a) { return is_canonical(a); });
+    case expr_kind::MetaVar:
+        return std::all_of(metavar_lctx(e).begin(), metavar_lctx(e).end(),
+                           [](local_entry const & le) { return le.is_lift() || is_canonical(le.v()); });
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+struct expr_shallow_eq { bool operator()(expr const & a, expr const & b) const { return is_shallow_eq(a, b); } };
+
+/**
+   \brief Table of unique representatives. The table owns a reference to each one of its
+   elements. So, an element is removed only when the table owns the only reference to it,
+   and no other thread can be holding it (see #gc_hash_consing_table).
+*/
+class hash_consing_table {
+    typedef std::unordered_set<expr, expr_hash, expr_shallow_eq> table;
+    mutex    m_mutex;
+    table    m_table;
+    unsigned m_gc_threshold;
+    void gc_core() {
+        auto it = m_table.begin();
+        while (it != m_table.end()) {
+            if (get_rc(*it) == 1)
+                it = m_table.erase(it);
+            else
+                ++it;
+        }
+    }
+public:
+    hash_consing_table():m_gc_threshold(LEAN_HASH_CONSING_GC_THRESHOLD) {}
+    expr insert(expr const & e) {
+        lock_guard<mutex> lock(m_mutex);
+        auto it = m_table.find(e);
+        if (it != m_table.end())
+            return *it;
+        if (m_table.size() >= m_gc_threshold) {
+            gc_core();
+            m_gc_threshold = std::max(static_cast<unsigned>(2 * m_table.size()), m_gc_threshold);
+        }
+        e.raw()->set_hash_consed(is_canonical_core(e));
+        m_table.insert(e);
+        return e;
+    }
+    void gc() {
+        lock_guard<mutex> lock(m_mutex);
+        gc_core();
+    }
+    unsigned size() {
+        lock_guard<mutex> lock(m_mutex);
+        return m_table.size();
+    }
+};
+
+static hash_consing_table & get_hash_consing_table() {
+    static hash_consing_table g_table;
+    return g_table;
+}
+
+bool is_hash_consing_enabled() { return g_hash_consing; }
+void set_hash_consing(bool flag) { g_hash_consing = flag; }
+expr hash_cons(expr const & e) {
+    if (!g_hash_consing || e.raw()->is_hash_consed())
+        return e;
+    return get_hash_consing_table().insert(e);
+}
+unsigned get_hash_consing_table_size() { return get_hash_consing_table().size(); }
+void gc_hash_consing_table() { get_hash_consing_table().gc(); }
+scoped_hash_consing::scoped_hash_consing(bool flag):m_old(g_hash_consing) { g_hash_consing = flag; }
+scoped_hash_consing::~scoped_hash_consing() { g_hash_consing = m_old; }
+
 expr mk_type() {
     static LEAN_THREAD_LOCAL expr r = mk_type(level());
     return r;
@@ -356,7 +506,32 @@ unsigned get_depth(expr const & e) {
     lean_unreachable(); // LCOV_EXCL_LINE
 }
 
+unsigned get_free_var_range(expr const & e) {
+    switch (e.kind()) {
+    case expr_kind::Type: case expr_kind::Value: case expr_kind::MetaVar:
+        return 0;
+    case expr_kind::Var:
+        return var_idx(e) + 1;
+    case expr_kind::Constant:
+        return to_constant(e)->m_free_var_range;
+    case expr_kind::HEq:
+        return to_heq(e)->m_free_var_range;
+    case expr_kind::Pair:
+        return to_pair(e)->m_free_var_range;
+    case expr_kind::Proj:
+        return get_free_var_range(proj_arg(e));
+    case expr_kind::App:
+        return to_app(e)->m_free_var_range;
+    case expr_kind::Pi: case expr_kind::Lambda: case expr_kind::Sigma:
+        return to_abstraction(e)->m_free_var_range;
+    case expr_kind::Let:
+        return to_let(e)->m_free_var_range;
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
 expr copy(expr const & a) {
+    scoped_hash_consing disable(false);
     switch (a.kind()) {
     case expr_kind::Var:      return mk_var(var_idx(a));
     case expr_kind::Constant: return mk_constant(const_name(a), const_type(a));
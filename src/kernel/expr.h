@@ -14,6 +14,7 @@ Author: Leonardo de Moura
 #include "util/thread.h"
 #include "util/lua.h"
 #include "util/rc.h"
+#include "util/memory.h"
 #include "util/name.h"
 #include "util/hash.h"
 #include "util/buffer.h"
@@ -78,10 +79,13 @@ protected:
     //    1    - term is closed
     //    2    - term contains metavariables
     //    3-4  - term is an arrow (0 - not initialized, 1 - is arrow, 2 - is not arrow)
+    //    5    - term is hash-consed (it is the unique representative of its structure in the hash-consing table)
+    //    6    - term is hash-consed, and structural equality coincides with pointer equality for it
     atomic_ushort      m_flags;
     unsigned m_hash;       // hash based on the structure of the expression (this is a good hash for structural equality)
     unsigned m_hash_alloc; // hash based on 'time' of allocation (this is a good hash for pointer-based equality)
     MK_LEAN_RC(); // Declare m_rc counter
+    LEAN_SMALL_OBJECT_ALLOCATOR();
     void dealloc();
 
     bool max_shared() const { return (m_flags & 1) != 0; }
@@ -95,6 +99,9 @@ protected:
     void set_is_arrow(bool flag);
     friend bool is_arrow(expr const & e);
 
+    void set_hash_consed(bool canonical) { m_flags |= (canonical ? 32+64 : 32); }
+    friend expr hash_cons(expr const & e);
+
     friend class has_free_var_fn;
     static void dec_ref(expr & c, buffer<expr_cell*> & todelete);
     static void dec_ref(optional<expr> & c, buffer<expr_cell*> & todelete);
@@ -104,6 +111,8 @@ public:
     unsigned  hash() const { return m_hash; }
     unsigned  hash_alloc() const { return m_hash_alloc; }
     bool has_metavar() const { return (m_flags & 4) != 0; }
+    bool is_hash_consed() const { return (m_flags & 32) != 0; }
+    bool is_canonical() const { return (m_flags & 64) != 0; }
 };
 /**
    \brief Exprs for encoding formulas/expressions, types and proofs.
@@ -154,6 +163,7 @@ public:
     friend expr mk_let(name const & n, optional<expr> const & t, expr const & v, expr const & e);
     friend expr mk_heq(expr const & lhs, expr const & rhs);
     friend expr mk_metavar(name const & n, local_context const & ctx);
+    friend expr hash_cons(expr const & e);
 
     friend bool is_eqp(expr const & a, expr const & b) { return a.m_ptr == b.m_ptr; }
     // Overloaded operator() can be used to create applications
@@ -196,10 +206,12 @@ public:
 class expr_const : public expr_cell {
     name           m_name;
     optional<expr> m_type;
+    unsigned       m_free_var_range;
     // Remark: we do *not* perform destructive updates on m_type
     // This field is used to efficiently implement the tactic framework
     friend class expr_cell;
     void dealloc(buffer<expr_cell*> & to_delete);
+    friend unsigned get_free_var_range(expr const & e);
 public:
     expr_const(name const & n, optional<expr> const & type);
     name const & get_name() const { return m_name; }
@@ -208,12 +220,14 @@ public:
 /** \brief Function Applications */
 class expr_app : public expr_cell {
     unsigned m_depth;
+    unsigned m_free_var_range;
     unsigned m_num_args;
     expr     m_args[0];
     friend expr mk_app(unsigned num_args, expr const * args);
     friend expr_cell;
     void dealloc(buffer<expr_cell*> & todelete);
     friend unsigned get_depth(expr const & e);
+    friend unsigned get_free_var_range(expr const & e);
 public:
     expr_app(unsigned size, bool has_mv);
     unsigned     get_num_args() const        { return m_num_args; }
@@ -227,10 +241,12 @@ class expr_dep_pair : public expr_cell {
     expr     m_second;
     expr     m_type;
     unsigned m_depth;
+    unsigned m_free_var_range;
     friend expr_cell;
     friend expr mk_pair(expr const & f, expr const & s, expr const & t);
     void dealloc(buffer<expr_cell*> & todelete);
     friend unsigned get_depth(expr const & e);
+    friend unsigned get_free_var_range(expr const & e);
 public:
     expr_dep_pair(expr const & f, expr const & s, expr const & t);
     expr const & get_first() const { return m_first; }
@@ -255,12 +271,14 @@ public:
 /** \brief Super class for lambda abstraction and pi (functional spaces). */
 class expr_abstraction : public expr_cell {
     unsigned m_depth;
+    unsigned m_free_var_range;
     name     m_name;
     expr     m_domain;
     expr     m_body;
     friend class expr_cell;
     void dealloc(buffer<expr_cell*> & todelete);
     friend unsigned get_depth(expr const & e);
+    friend unsigned get_free_var_range(expr const & e);
 public:
     expr_abstraction(expr_kind k, name const & n, expr const & t, expr const & e);
     name const & get_name() const   { return m_name; }
@@ -285,6 +303,7 @@ public:
 /** \brief Let expressions */
 class expr_let : public expr_cell {
     unsigned       m_depth;
+    unsigned       m_free_var_range;
     name           m_name;
     optional<expr> m_type;
     expr           m_value;
@@ -292,6 +311,7 @@ class expr_let : public expr_cell {
     friend class expr_cell;
     void dealloc(buffer<expr_cell*> & todelete);
     friend unsigned get_depth(expr const & e);
+    friend unsigned get_free_var_range(expr const & e);
 public:
     expr_let(name const & n, optional<expr> const & t, expr const & v, expr const & b);
     ~expr_let();
@@ -358,10 +378,12 @@ class expr_heq : public expr_cell {
     expr     m_lhs;
     expr     m_rhs;
     unsigned m_depth;
+    unsigned m_free_var_range;
     friend expr_cell;
     friend expr mk_heq(expr const & lhs, expr const & rhs);
     void dealloc(buffer<expr_cell*> & todelete);
     friend unsigned get_depth(expr const & e);
+    friend unsigned get_free_var_range(expr const & e);
 public:
     expr_heq(expr const & lhs, expr const & rhs);
     expr const & get_lhs() const { return m_lhs; }
@@ -473,18 +495,57 @@ inline bool is_metavar(expr const & e)     { return e.kind() == expr_kind::MetaV
 inline bool is_abstraction(expr const & e) { return is_lambda(e) || is_pi(e) || is_sigma(e); }
 // =======================================
 
+// =======================================
+// Hash-consing
+/**
+    \brief Return true iff expressions created by this thread are hash-consed.
+
+    When hash-consing is enabled, structurally identical expressions
+    (including binder names and constant type annotations) are
+    represented by the same expression cell. The table used to store
+    the unique representatives is shared by all threads.
+*/
+bool is_hash_consing_enabled();
+/** \brief Enable/disable hash-consing for expressions created by this thread. */
+void set_hash_consing(bool flag);
+/**
+    \brief Return the unique representative of \c e in the hash-consing table.
+    If hash-consing is disabled, then return \c e.
+*/
+expr hash_cons(expr const & e);
+/** \brief Return the number of expressions stored in the hash-consing table. */
+unsigned get_hash_consing_table_size();
+/**
+    \brief Remove from the hash-consing table the expressions that are
+    not referenced anywhere else.
+*/
+void gc_hash_consing_table();
+/** \brief Auxiliary object for temporarily enabling/disabling hash-consing. */
+class scoped_hash_consing {
+    bool m_old;
+public:
+    scoped_hash_consing(bool flag = true);
+    ~scoped_hash_consing();
+};
+/**
+    \brief Return true iff \c e is hash-consed, and any expression
+    structurally equal to \c e that is also canonical is pointer equal to it.
+*/
+inline bool is_canonical(expr const & e) { return e.raw()->is_canonical(); }
+// =======================================
+
 // =======================================
 // Constructors
-inline expr mk_var(unsigned idx) { return expr(new expr_var(idx)); }
+inline expr mk_var(unsigned idx) { return hash_cons(expr(new expr_var(idx))); }
 inline expr Var(unsigned idx) { return mk_var(idx); }
-inline expr mk_constant(name const & n, optional<expr> const & t) { return expr(new expr_const(n, t)); }
+inline expr mk_constant(name const & n, optional<expr> const & t) { return hash_cons(expr(new expr_const(n, t))); }
 inline expr mk_constant(name const & n, expr const & t) { return mk_constant(n, some_expr(t)); }
 inline expr mk_constant(name const & n) { return mk_constant(n, none_expr()); }
 inline expr Const(name const & n) { return mk_constant(n); }
-inline expr mk_value(value & v) { return expr(new expr_value(v)); }
+inline expr mk_value(value & v) { return hash_cons(expr(new expr_value(v))); }
 inline expr to_expr(value & v) { return mk_value(v); }
-inline expr mk_pair(expr const & f, expr const & s, expr const & t) { return expr(new expr_dep_pair(f, s, t)); }
-inline expr mk_proj(bool f, expr const & e) { return expr(new expr_proj(f, e)); }
+inline expr mk_pair(expr const & f, expr const & s, expr const & t) { return hash_cons(expr(new expr_dep_pair(f, s, t))); }
+inline expr mk_proj(bool f, expr const & e) { return hash_cons(expr(new expr_proj(f, e))); }
 inline expr mk_proj1(expr const & e) { return mk_proj(true, e); }
 inline expr mk_proj2(expr const & e) { return mk_proj(false, e); }
        expr mk_app(unsigned num_args, expr const * args);
@@ -494,23 +555,23 @@ inline expr mk_app(expr const & e1, expr const & e2) { return mk_app({e1, e2});
 inline expr mk_app(expr const & e1, expr const & e2, expr const & e3) { return mk_app({e1, e2, e3}); }
 inline expr mk_app(expr const & e1, expr const & e2, expr const & e3, expr const & e4) { return mk_app({e1, e2, e3, e4}); }
 inline expr mk_app(expr const & e1, expr const & e2, expr const & e3, expr const & e4, expr const & e5) { return mk_app({e1, e2, e3, e4, e5}); }
-inline expr mk_lambda(name const & n, expr const & t, expr const & e) { return expr(new expr_lambda(n, t, e)); }
-inline expr mk_pi(name const & n, expr const & t, expr const & e) { return expr(new expr_pi(n, t, e)); }
-inline expr mk_sigma(name const & n, expr const & t, expr const & e) { return expr(new expr_sigma(n, t, e)); }
+inline expr mk_lambda(name const & n, expr const & t, expr const & e) { return hash_cons(expr(new expr_lambda(n, t, e))); }
+inline expr mk_pi(name const & n, expr const & t, expr const & e) { return hash_cons(expr(new expr_pi(n, t, e))); }
+inline expr mk_sigma(name const & n, expr const & t, expr const & e) { return hash_cons(expr(new expr_sigma(n, t, e))); }
 inline bool is_default_arrow_var_name(name const & n) { return n == "a"; }
 inline expr mk_arrow(expr const & t, expr const & e) { return mk_pi(name("a"), t, e); }
 inline expr mk_cartesian_product(expr const & t, expr const & e) { return mk_sigma(name("a"), t, e); }
 inline expr operator>>(expr const & t, expr const & e) { return mk_arrow(t, e); }
-inline expr mk_let(name const & n, optional<expr> const & t, expr const & v, expr const & e) { return expr(new expr_let(n, t, v, e)); }
+inline expr mk_let(name const & n, optional<expr> const & t, expr const & v, expr const & e) { return hash_cons(expr(new expr_let(n, t, v, e))); }
 inline expr mk_let(name const & n, expr const & t, expr const & v, expr const & e) { return mk_let(n, some_expr(t), v, e); }
 inline expr mk_let(name const & n, expr const & v, expr const & e) { return mk_let(n, none_expr(), v, e); }
-inline expr mk_type(level const & l) { return expr(new expr_type(l)); }
+inline expr mk_type(level const & l) { return hash_cons(expr(new expr_type(l))); }
        expr mk_type();
 inline expr Type(level const & l) { return mk_type(l); }
 inline expr Type() { return mk_type(); }
-inline expr mk_heq(expr const & lhs, expr const & rhs) { return expr(new expr_heq(lhs, rhs)); }
+inline expr mk_heq(expr const & lhs, expr const & rhs) { return hash_cons(expr(new expr_heq(lhs, rhs))); }
 inline expr mk_metavar(name const & n, local_context const & ctx = local_context()) {
-    return expr(new expr_metavar(n, ctx));
+    return hash_cons(expr(new expr_metavar(n, ctx)));
 }
 
 inline expr expr::operator()(expr const & a1) const { return mk_app({*this, a1}); }
@@ -624,6 +685,13 @@ inline name const &  metavar_name(expr const & e)         { return to_metavar(e)
 inline local_context const & metavar_lctx(expr const & e) { return to_metavar(e)->get_lctx(); }
 /** \brief Return the depth of the given expression */
 unsigned get_depth(expr const & e);
+/**
+   \brief Return \c R s.t. the de Bruijn index of all free variables occurring in \c e is in the interval <tt>[0, R)</tt>.
+   The value is computed when \c e is created, so this is a constant time operation.
+
+   \remark Metavariables are ignored. See \c free_var_range at free_vars.h.
+*/
+unsigned get_free_var_range(expr const & e);
 
 inline bool has_metavar(expr const & e) { return e.has_metavar(); }
 // =======================================
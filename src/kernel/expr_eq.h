@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <memory>
+#include <type_traits>
 #include "util/interrupt.h"
 #include "kernel/expr.h"
 #include "kernel/expr_sets.h"
@@ -42,6 +43,8 @@ class expr_eq_fn {
         check_system("expression equality test");
         if (is_eqp(a0, b0))                    return true;
         if (UseHash && a0.hash() != b0.hash()) return false;
+        // Canonical expressions are hash-consed, then they are structurally equal iff they are pointer equal.
+        if (std::is_same<N, id_expr_fn>::value && is_canonical(a0) && is_canonical(b0)) return false;
         expr const & a = m_norm(a0);
         expr const & b = m_norm(b0);
         if (a.kind() != b.kind())            return false;
@@ -14,105 +14,13 @@ Author: Leonardo de Moura
 
 namespace lean {
 /**
-    \brief Functional object for checking whether a kernel expression has free variables or not.
+    \brief Return true iff the given expression has free variables.
 
     \remark We assume that a metavariable contains free variables.
     This is an approximation, since we don't know how the metavariable will be instantiated.
 */
-class has_free_vars_fn {
-protected:
-    expr_cell_offset_set m_cached;
-
-    bool apply(optional<expr> const & e, unsigned offset) {
-        return e && apply(*e, offset);
-    }
-
-    bool apply(expr const & e, unsigned offset) {
-        // handle easy cases
-        switch (e.kind()) {
-        case expr_kind::Constant:
-            if (!const_type(e))
-                return false;
-            break;
-        case expr_kind::Type: case expr_kind::Value:
-            return false;
-        case expr_kind::MetaVar:
-            return true;
-        case expr_kind::Var:
-            return var_idx(e) >= offset;
-        case expr_kind::App: case expr_kind::Lambda:
-        case expr_kind::Pi: case expr_kind::Let: case expr_kind::Sigma:
-        case expr_kind::Proj: case expr_kind::Pair: case expr_kind::HEq:
-            break;
-        }
-
-        if (e.raw()->is_closed())
-            return false;
-
-        if (offset == 0) {
-            return apply_core(e, 0);
-        } else {
-            // The apply_core(e, 0) may seem redundant, but it allows us to
-            // mark nested closed expressions.
-            return apply_core(e, 0) && apply_core(e, offset);
-        }
-    }
-
-    bool apply_core(expr const & e, unsigned offset) {
-        bool shared = false;
-        if (is_shared(e)) {
-            shared = true;
-            expr_cell_offset p(e.raw(), offset);
-            if (m_cached.find(p) != m_cached.end())
-                return false;
-        }
-
-        bool result = false;
-
-        switch (e.kind()) {
-        case expr_kind::Constant:
-            lean_assert(const_type(e));
-            result = apply(const_type(e), offset);
-            break;
-        case expr_kind::Type: case expr_kind::Value: case expr_kind::Var: case expr_kind::MetaVar:
-            // easy cases were already handled
-            lean_unreachable(); // LCOV_EXCL_LINE
-        case expr_kind::App:
-            result = std::any_of(begin_args(e), end_args(e), [=](expr const & arg){ return apply(arg, offset); });
-            break;
-        case expr_kind::Lambda: case expr_kind::Pi: case expr_kind::Sigma:
-            result = apply(abst_domain(e), offset) || apply(abst_body(e), offset + 1);
-            break;
-        case expr_kind::Let:
-            result = apply(let_type(e), offset) || apply(let_value(e), offset) || apply(let_body(e), offset + 1);
-            break;
-        case expr_kind::HEq:
-            result = apply(heq_lhs(e), offset) || apply(heq_rhs(e), offset);
-            break;
-        case expr_kind::Proj:
-            result = apply(proj_arg(e), offset);
-            break;
-        case expr_kind::Pair:
-            result = apply(pair_first(e), offset) || apply(pair_second(e), offset) || apply(pair_type(e), offset);
-            break;
-        }
-
-        if (!result) {
-            if (offset == 0)
-                e.raw()->set_closed();
-            if (shared)
-                m_cached.insert(expr_cell_offset(e.raw(), offset));
-        }
-
-        return result;
-    }
-public:
-    has_free_vars_fn() {}
-    bool operator()(expr const & e) { return apply(e, 0); }
-};
-
 bool has_free_vars(expr const & e) {
-    return has_free_vars_fn()(e);
+    return !e.raw()->is_closed() && (has_metavar(e) || get_free_var_range(e) > 0);
 }
 
 /**
@@ -188,6 +96,9 @@ class free_var_range_fn {
         if (e.raw()->is_closed())
             return 0;
 
+        if (!has_metavar(e))
+            return get_free_var_range(e);
+
         bool shared = false;
         if (is_shared(e)) {
             shared = true;
@@ -243,12 +154,17 @@ public:
 unsigned free_var_range(expr const & e, ro_metavar_env const & menv) {
     if (closed(e))
         return 0;
+    else if (!has_metavar(e))
+        return get_free_var_range(e);
     else
         return free_var_range_fn(some_ro_menv(menv))(e);
 }
 
 unsigned free_var_range(expr const & e) {
-    return free_var_range_fn(none_ro_menv())(e);
+    if (!has_metavar(e))
+        return get_free_var_range(e);
+    else
+        return free_var_range_fn(none_ro_menv())(e);
 }
 
 /**
@@ -315,6 +231,12 @@ protected:
         if (e.raw()->is_closed())
             return false;
 
+        unsigned R = get_free_var_range(e);
+        if (R > 0 && in_interval(R - 1, offset))
+            return true;
+        if (!has_metavar(e) && (R == 0 || !ge_lower(R - 1, offset)))
+            return false; // all free variables are smaller than m_low + offset
+
         bool shared = false;
         if (is_shared(e)) {
             shared = true;
@@ -406,18 +328,19 @@ bool has_free_var_ge(expr const & e, unsigned low, optional<ro_metavar_env> cons
 bool has_free_var_ge(expr const & e, unsigned low) { return has_free_var(e, low, std::numeric_limits<unsigned>::max()); }
 
 expr lower_free_vars(expr const & e, unsigned s, unsigned d, optional<ro_metavar_env> const & DEBUG_CODE(menv)) {
-    if (d == 0 || closed(e))
+    if (d == 0 || get_free_var_range(e) <= s)
         return e;
     lean_assert(s >= d);
     lean_assert(!has_free_var(e, s-d, s, menv));
-    return replace(e, [=](expr const & e, unsigned offset) -> expr {
+    return replace_skip(e, [=](expr const & e, unsigned offset) -> expr {
             if (is_var(e) && var_idx(e) >= s + offset) {
                 lean_assert(var_idx(e) >= offset + d);
                 return mk_var(var_idx(e) - d);
             } else {
                 return e;
             }
-        });
+        },
+        [=](expr const & e, unsigned offset) { return get_free_var_range(e) <= s + offset; });
 }
 expr lower_free_vars(expr const & e, unsigned s, unsigned d, ro_metavar_env const & menv) { return lower_free_vars(e, s, d, some_ro_menv(menv)); }
 expr lower_free_vars(expr const & e, unsigned s, unsigned d) { return lower_free_vars(e, s, d, none_ro_menv()); }
@@ -437,9 +360,9 @@ context_entry lower_free_vars(context_entry const & e, unsigned s, unsigned d, r
 }
 
 expr lift_free_vars(expr const & e, unsigned s, unsigned d, optional<ro_metavar_env> const & menv) {
-    if (d == 0 || closed(e))
+    if (d == 0 || closed(e) || (!has_metavar(e) && get_free_var_range(e) <= s))
         return e;
-    return replace(e, [=](expr const & e, unsigned offset) -> expr {
+    return replace_skip(e, [=](expr const & e, unsigned offset) -> expr {
             if (is_var(e) && var_idx(e) >= s + offset) {
                 return mk_var(var_idx(e) + d);
             } else if (is_metavar(e)) {
@@ -447,7 +370,8 @@ expr lift_free_vars(expr const & e, unsigned s, unsigned d, optional<ro_metavar_
             } else {
                 return e;
             }
-        });
+        },
+        [=](expr const & e, unsigned offset) { return !has_metavar(e) && get_free_var_range(e) <= s + offset; });
 }
 expr lift_free_vars(expr const & e, unsigned s, unsigned d, ro_metavar_env const & menv) { return lift_free_vars(e, s, d, some_ro_menv(menv)); }
 expr lift_free_vars(expr const & e, unsigned s, unsigned d) { return lift_free_vars(e, s, d, none_ro_menv()); }
@@ -14,7 +14,9 @@ Author: Leonardo de Moura
 namespace lean {
 template<bool ClosedSubst>
 expr instantiate_core(expr const & a, unsigned s, unsigned n, expr const * subst, optional<ro_metavar_env> const & menv) {
-    return replace(a, [=](expr const & m, unsigned offset) -> expr {
+    if (!has_metavar(a) && get_free_var_range(a) <= s)
+        return a;
+    return replace_skip(a, [=](expr const & m, unsigned offset) -> expr {
             if (is_var(m)) {
                 unsigned vidx = var_idx(m);
                 if (vidx >= offset + s) {
@@ -39,7 +41,8 @@ expr instantiate_core(expr const & a, unsigned s, unsigned n, expr const * subst
             } else {
                 return m;
             }
-        });
+        },
+        [=](expr const & m, unsigned offset) { return !has_metavar(m) && get_free_var_range(m) <= offset + s; });
 }
 
 expr instantiate_with_closed(expr const & a, unsigned n, expr const * s, optional<ro_metavar_env> const & menv) {
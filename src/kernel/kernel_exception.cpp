@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include "util/sstream.h"
 #include "kernel/kernel_exception.h"
 
 namespace lean {
@@ -107,4 +108,37 @@ format def_type_mismatch_exception::pp(formatter const & fmt, options const & op
     r += nest(indent, compose(line(), fmt(ctx, get_value_type(), false, opts)));
     return r;
 }
+
+theorem_check_exception::theorem_check_exception(ro_environment const & env, std::vector<std::shared_ptr<exception const>> const & fs,
+                                                 std::vector<name> const & removed):
+    kernel_exception(env), m_failures(fs), m_removed(removed) {
+    sstream strm;
+    strm << "failed to type check " << fs.size() << " theorems";
+    for (auto const & ex : fs)
+        strm << "\n" << ex->what();
+    if (!removed.empty()) {
+        strm << "\nthe following objects use them, and were removed:";
+        for (name const & n : removed)
+            strm << " " << n;
+    }
+    m_msg = strm.str();
+}
+
+format theorem_check_exception::pp(formatter const & fmt, options const & opts) const {
+    format r = format{format("failed to type check "), format(static_cast<unsigned>(m_failures.size())), format(" theorems")};
+    for (auto const & ex : m_failures) {
+        if (auto kex = dynamic_cast<kernel_exception const *>(ex.get()))
+            r += compose(line(), kex->pp(fmt, opts));
+        else
+            r += compose(line(), format(ex->what()));
+    }
+    if (!m_removed.empty()) {
+        format ns;
+        for (name const & n : m_removed)
+            ns += compose(line(), format(n));
+        r += compose(line(), format("the following objects use them, and were removed:"));
+        r += nest(get_pp_indent(opts), ns);
+    }
+    return r;
+}
 }
@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <vector>
+#include <memory>
 #include "util/exception.h"
 #include "util/sexpr/options.h"
 #include "kernel/context.h"
@@ -295,6 +296,25 @@ public:
     virtual void rethrow() const { throw *this; }
 };
 
+/**
+    \brief Exception used to report that the proofs of several theorems
+    were rejected by the background type checker (see \c environment_cell::join_theorem_checks).
+    It also reports the objects that were removed from the environment because they use the rejected theorems.
+*/
+class theorem_check_exception : public kernel_exception {
+    std::vector<std::shared_ptr<exception const>> m_failures;
+    std::vector<name>                             m_removed;
+public:
+    theorem_check_exception(ro_environment const & env, std::vector<std::shared_ptr<exception const>> const & fs,
+                            std::vector<name> const & removed = std::vector<name>());
+    virtual ~theorem_check_exception() {}
+    std::vector<std::shared_ptr<exception const>> const & get_failures() const { return m_failures; }
+    std::vector<name> const & get_removed() const { return m_removed; }
+    virtual format pp(formatter const & fmt, options const & opts) const;
+    virtual exception * clone() const { return new theorem_check_exception(m_env, m_failures, m_removed); }
+    virtual void rethrow() const { throw *this; }
+};
+
 /**
    \brief Unexpected metavariable occurrence
 */
@@ -59,10 +59,35 @@ void metavar_env_cell::inc_timestamp() {
     m_timestamp++;
 }
 
+void metavar_env_cell::push() {
+    m_scopes.push_back(m_trail.size());
+}
+
+void metavar_env_cell::pop(unsigned num) {
+    if (num == 0)
+        return;
+    lean_assert(num <= num_scopes());
+    unsigned old_sz = m_scopes[num_scopes() - num];
+    lean_assert(old_sz <= m_trail.size());
+    inc_timestamp();
+    unsigned i = m_trail.size();
+    while (i > old_sz) {
+        --i;
+        trail_entry const & e = m_trail[i];
+        if (e.second)
+            m_metavar_data.insert(e.first, *(e.second));
+        else
+            m_metavar_data.erase(e.first);
+    }
+    m_trail.resize(old_sz);
+    m_scopes.resize(num_scopes() - num);
+}
+
 metavar_env_cell::metavar_env_cell(name const & prefix):
     m_name_generator(prefix),
     m_beta_reduce_mv(true),
     m_timestamp(1),
+    m_subst_cache_timestamp(0),
     m_rc(0) {
 }
 
@@ -76,13 +101,30 @@ metavar_env_cell::metavar_env_cell(metavar_env_cell const & other):
     m_metavar_data(other.m_metavar_data),
     m_beta_reduce_mv(other.m_beta_reduce_mv),
     m_timestamp(1),
+    m_subst_cache_timestamp(0),
+    m_rc(0) {
+}
+
+metavar_env_cell::metavar_env_cell(metavar_env_snapshot const & s):
+    m_name_generator(s.m_name_generator),
+    m_metavar_data(s.m_metavar_data),
+    m_beta_reduce_mv(s.m_beta_reduce_mv),
+    m_timestamp(1),
+    m_subst_cache_timestamp(0),
     m_rc(0) {
 }
 
+metavar_env_snapshot::metavar_env_snapshot(metavar_env const & menv):
+    m_name_generator(menv->m_name_generator),
+    m_metavar_data(menv->m_metavar_data),
+    m_beta_reduce_mv(menv->m_beta_reduce_mv) {
+}
+
 expr metavar_env_cell::mk_metavar(context const & ctx, optional<expr> const & type) {
     inc_timestamp();
     name m = m_name_generator.next();
     expr r = ::lean::mk_metavar(m);
+    save(m, optional<data>());
     m_metavar_data.insert(m, data(type, ctx));
     return r;
 }
@@ -120,7 +162,10 @@ expr metavar_env_cell::get_type(name const & m) {
         return *(it->m_type);
     } else {
         expr t = mk_metavar(get_context(m));
-        it->m_type = t;
+        data d = *m_metavar_data.find(m);
+        save(m, optional<data>(d));
+        d.m_type = t;
+        m_metavar_data.insert(m, d);
         return t;
     }
 }
@@ -188,7 +233,10 @@ bool metavar_env_cell::assign(name const & m, expr const & t, justification cons
                             if (e_ctx_size < extra) {
                                 failed = true;
                             } else {
-                                it2->m_context = it2->m_context.truncate(e_ctx_size - extra);
+                                data d = *it2;
+                                save(metavar_name(e), optional<data>(d));
+                                d.m_context = d.m_context.truncate(e_ctx_size - extra);
+                                m_metavar_data.insert(metavar_name(e), d);
                                 lean_assert_le(free_var_range(e, metavar_env(this)), ctx_size + offset);
                             }
                         }
@@ -203,8 +251,13 @@ bool metavar_env_cell::assign(name const & m, expr const & t, justification cons
         return false;
     auto it = m_metavar_data.find(m);
     lean_assert(it);
-    it->m_subst         = t2;
-    it->m_justification = jst2;
+    data d = *it;
+    save(m, optional<data>(d));
+    d.m_subst         = t2;
+    d.m_justification = jst2;
+    m_metavar_data.insert(m, d);
+    // the substitutions cached by get_subst_jst after the timestamp was increased may contain \c m
+    m_subst_cache_timestamp = 0;
     return true;
 }
 
@@ -258,18 +311,36 @@ optional<std::pair<expr, justification>> metavar_env_cell::get_subst_jst(expr co
 }
 
 optional<std::pair<expr, justification>> metavar_env_cell::get_subst_jst(name const & m) const {
-    auto it = const_cast<metavar_env_cell*>(this)->m_metavar_data.find(m);
+    auto it = m_metavar_data.find(m);
     if (it->m_subst) {
         expr s = *(it->m_subst);
         if (has_assigned_metavar(s)) {
+            // Remark: the normalized substitution is not stored in m_metavar_data.
+            // This method is const, and threads may read this object concurrently.
+            // We cache it in m_subst_cache, otherwise reading a chain of n assignments would take O(n^2) time.
+            {
+                lock_guard<mutex> lock(m_subst_cache_mutex);
+                if (m_subst_cache_timestamp != m_timestamp) {
+                    m_subst_cache.clear();
+                    m_subst_cache_timestamp = m_timestamp;
+                }
+                auto it2 = m_subst_cache.find(m);
+                if (it2 != m_subst_cache.end())
+                    return optional<std::pair<expr, justification>>(it2->second);
+            }
             buffer<justification> jsts;
             expr new_subst = instantiate_metavars(s, jsts);
-            if (!jsts.empty()) {
-                justification new_jst(new normalize_assignment_justification(it->m_context, s, it->m_justification,
-                                                                             jsts.size(), jsts.data()));
-                it->m_justification = new_jst;
-                it->m_subst         = new_subst;
+            justification new_jst = it->m_justification;
+            if (!jsts.empty())
+                new_jst = justification(new normalize_assignment_justification(it->m_context, s, it->m_justification,
+                                                                               jsts.size(), jsts.data()));
+            std::pair<expr, justification> r(new_subst, new_jst);
+            {
+                lock_guard<mutex> lock(m_subst_cache_mutex);
+                if (m_subst_cache_timestamp == m_timestamp)
+                    m_subst_cache.insert(mk_pair(m, r));
             }
+            return optional<std::pair<expr, justification>>(r);
         }
         return optional<std::pair<expr, justification>>(std::pair<expr, justification>(*(it->m_subst), it->m_justification));
     } else {
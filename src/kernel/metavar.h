@@ -6,9 +6,12 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <utility>
+#include <vector>
 #include "util/rc.h"
 #include "util/pair.h"
-#include "util/splay_map.h"
+#include "util/thread.h"
+#include "util/avl_map.h"
+#include "util/name_map.h"
 #include "util/name_generator.h"
 #include "kernel/expr.h"
 #include "kernel/context.h"
@@ -22,9 +25,15 @@ namespace lean {
    1- Creating metavariables.
    2- Storing their types and the contexts where they were created.
    3- Storing substitutions.
+
+   The environment is backtrackable: \c push creates a scope, and \c pop undoes all
+   updates performed since the matching \c push. The updates are only recorded when
+   there is at least one scope.
 */
+class metavar_env_snapshot;
 class metavar_env_cell {
     friend class metavar_env;
+    friend class metavar_env_snapshot;
     struct data {
         optional<expr> m_subst;         // substitution
         optional<expr> m_type;          // type of the metavariable
@@ -32,10 +41,17 @@ class metavar_env_cell {
         justification  m_justification; // justification for assigned metavariables.
         data(optional<expr> const & t = none_expr(), context const & ctx = context()):m_type(t), m_context(ctx) {}
     };
-    typedef splay_map<name, data, name_quick_cmp> name2data;
+    typedef avl_map<name, data, name_quick_cmp> name2data;
+    /**
+       \brief Entry of the trail used to undo updates. If \c m_data is none, then
+       the metavariable was created, otherwise \c m_data is the value before the update.
+    */
+    typedef std::pair<name, optional<data>> trail_entry;
 
-    name_generator     m_name_generator;
-    name2data          m_metavar_data;
+    name_generator           m_name_generator;
+    name2data                m_metavar_data;
+    std::vector<trail_entry> m_trail;
+    std::vector<unsigned>    m_scopes;
     // If the following flag is true, then beta-reduction is automatically applied
     // when we apply a substitution containing ?m <- fun (x : T), ...
     // to an expression containing (?m a)
@@ -43,15 +59,28 @@ class metavar_env_cell {
     // bunch of assignments of the form ?m <- fun (x : T), ...
     bool               m_beta_reduce_mv;
     unsigned           m_timestamp;
+    /*
+       Cache for the normalized substitutions computed by \c get_subst_jst. It is only valid
+       for the timestamp m_subst_cache_timestamp. Threads may read this object concurrently,
+       then the cache is protected by a mutex.
+    */
+    mutable mutex                                         m_subst_cache_mutex;
+    mutable unsigned                                      m_subst_cache_timestamp;
+    mutable name_map<std::pair<expr, justification>>      m_subst_cache;
     MK_LEAN_RC();
 
     static bool has_metavar(expr const & e) { return ::lean::has_metavar(e); }
     void dealloc() { delete this; }
     void inc_timestamp();
+    void save(name const & m, optional<data> const & d) {
+        if (!m_scopes.empty())
+            m_trail.emplace_back(m, d);
+    }
 public:
     metavar_env_cell();
     metavar_env_cell(name const & prefix);
     metavar_env_cell(metavar_env_cell const & other);
+    metavar_env_cell(metavar_env_snapshot const & s);
 
     bool beta_reduce_metavar_application() const { return m_beta_reduce_mv; }
     void set_beta_reduce_metavar_application(bool f) { m_beta_reduce_mv = f; }
@@ -64,6 +93,20 @@ public:
     */
     unsigned get_timestamp() const { return m_timestamp; }
 
+    /** \brief Return the number of scopes. */
+    unsigned num_scopes() const { return m_scopes.size(); }
+
+    /** \brief Create a new scope (it allows us to restore the current state of the environment). */
+    void push();
+
+    /**
+       \brief Remove \c num scopes, and undo all updates performed since they were created.
+
+       \remark The name generator is not restored. So, metavariables created after \c pop
+       are never equal to the ones removed by it.
+    */
+    void pop(unsigned num = 1);
+
     /**
        \brief Create a new metavariable in the given context and with the given type.
     */
@@ -209,6 +252,7 @@ class metavar_env {
 public:
     metavar_env():m_ptr(new metavar_env_cell()) { m_ptr->inc_ref(); }
     metavar_env(name const & prefix):m_ptr(new metavar_env_cell(prefix)) { m_ptr->inc_ref(); }
+    explicit metavar_env(metavar_env_snapshot const & s):m_ptr(new metavar_env_cell(s)) { m_ptr->inc_ref(); }
     metavar_env(metavar_env const & s):m_ptr(s.m_ptr) { if (m_ptr) m_ptr->inc_ref(); }
     metavar_env(metavar_env && s):m_ptr(s.m_ptr) { s.m_ptr = nullptr; }
     ~metavar_env() { if (m_ptr) m_ptr->dec_ref(); }
@@ -223,6 +267,22 @@ public:
 };
 
 SPECIALIZE_OPTIONAL_FOR_SMART_PTR(metavar_env)
+
+/**
+   \brief Snapshot of the metavariables and substitutions of a metavariable environment.
+   Creating a snapshot is cheap: the substitutions are stored in a persistent map, and they are
+   shared with the environment. The environment can be recreated using \c to_metavar_env.
+*/
+class metavar_env_snapshot {
+    friend class metavar_env_cell;
+    name_generator               m_name_generator;
+    metavar_env_cell::name2data  m_metavar_data;
+    bool                         m_beta_reduce_mv;
+public:
+    explicit metavar_env_snapshot(metavar_env const & menv);
+    /** \brief Return a new metavariable environment in the state of \c menv when the snapshot was created. */
+    metavar_env to_metavar_env() const { return metavar_env(*this); }
+};
 inline optional<metavar_env> none_menv() { return optional<metavar_env>(); }
 inline optional<metavar_env> some_menv(metavar_env const & e) { return optional<metavar_env>(e); }
 inline optional<metavar_env> some_menv(metavar_env && e) { return optional<metavar_env>(std::forward<metavar_env>(e)); }
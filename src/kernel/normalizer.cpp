@@ -6,9 +6,11 @@ Author: Leonardo de Moura
 */
 #include <algorithm>
 #include <limits>
-#include "util/list.h"
+#include <vector>
+#include <utility>
+#include <functional>
+#include <unordered_map>
 #include "util/flet.h"
-#include "util/freset.h"
 #include "util/buffer.h"
 #include "util/interrupt.h"
 #include "util/sexpr/options.h"
@@ -28,6 +30,10 @@ Author: Leonardo de Moura
 #define LEAN_KERNEL_NORMALIZER_MAX_DEPTH std::numeric_limits<unsigned>::max()
 #endif
 
+#ifndef LEAN_NORMALIZER_CLOSED_CACHE_CAPACITY
+#define LEAN_NORMALIZER_CLOSED_CACHE_CAPACITY (1024*16)
+#endif
+
 namespace lean {
 static name g_kernel_normalizer_max_depth       {"kernel", "normalizer", "max_depth"};
 RegisterUnsignedOption(g_kernel_normalizer_max_depth, LEAN_KERNEL_NORMALIZER_MAX_DEPTH, "(kernel) maximum recursion depth for expression normalizer");
@@ -35,56 +41,142 @@ unsigned get_normalizer_max_depth(options const & opts) {
     return opts.get_unsigned(g_kernel_normalizer_max_depth, LEAN_KERNEL_NORMALIZER_MAX_DEPTH);
 }
 
-typedef list<expr> value_stack;
-value_stack extend(value_stack const & s, expr const & v) {
-    lean_assert(!is_lambda(v) && !is_pi(v) && !is_metavar(v) && !is_let(v));
-    return cons(v, s);
-}
-
 /**
-   \brief Internal value used to store closures.
-   This is a transient value that is only used during normalization.
+   \brief Storage for the objects created by the abstract machine used to implement the normalizer.
+   The objects are allocated in chunks, and they are all deleted at once.
 */
-class closure : public value {
-    expr         m_expr;
-    context      m_ctx;
-    value_stack  m_stack;
+template<typename T>
+class arena {
+    static unsigned const g_chunk_size = 256;
+    std::vector<T*> m_chunks;
+    unsigned        m_next;  // next free position in the last chunk
+    void destroy(unsigned i) {
+        unsigned sz = i + 1 == m_chunks.size() ? m_next : g_chunk_size;
+        for (unsigned j = 0; j < sz; j++)
+            m_chunks[i][j].~T();
+    }
 public:
-    closure(expr const & e, context const & ctx, value_stack const & s):m_expr(e), m_ctx(ctx), m_stack(s) {}
-    virtual ~closure() {}
-    virtual expr get_type() const { lean_unreachable(); } // LCOV_EXCL_LINE
-    virtual void write(serializer & ) const { lean_unreachable(); } // LCOV_EXCL_LINE
-    virtual name get_name() const { return name("Closure"); }
-    virtual void display(std::ostream & out) const {
-        out << "(Closure " << m_expr << " [";
-        bool first = true;
-        for (auto v : m_stack) {
-            if (first) first = false; else out << " ";
-            out << v;
+    arena():m_next(g_chunk_size) {}
+    ~arena() {
+        for (unsigned i = 0; i < m_chunks.size(); i++) {
+            destroy(i);
+            ::operator delete(m_chunks[i]);
+        }
+    }
+    template<typename... Args>
+    T * mk(Args &&... args) {
+        if (m_next == g_chunk_size) {
+            m_chunks.push_back(static_cast<T*>(::operator new(sizeof(T) * g_chunk_size)));
+            m_next = 0;
+        }
+        T * r = m_chunks.back() + m_next;
+        new (r) T(std::forward<Args>(args)...);
+        m_next++;
+        return r;
+    }
+    /** \brief Delete all objects. The first chunk is kept for the next round. */
+    void clear() {
+        for (unsigned i = 0; i < m_chunks.size(); i++) {
+            destroy(i);
+            if (i > 0)
+                ::operator delete(m_chunks[i]);
+        }
+        if (!m_chunks.empty()) {
+            m_chunks.resize(1);
+            m_next = 0;
         }
-        out << "])";
     }
-    expr const & get_expr() const { return m_expr; }
-    context const & get_context() const { return m_ctx; }
-    value_stack const & get_stack() const { return m_stack; }
-    virtual bool is_atomic_pp(bool /* unicode */, bool /* coercion */) const { return false; } // NOLINT
 };
 
-expr mk_closure(expr const & e, context const & ctx, value_stack const & s) { return mk_value(*(new closure(e, ctx, s))); }
-bool is_closure(expr const & e) { return is_value(e) && dynamic_cast<closure const *>(&to_value(e)) != nullptr; }
-closure const & to_closure(expr const & e) { lean_assert(is_closure(e));   return static_cast<closure const &>(to_value(e)); }
+struct thunk;
+/** \brief Cell of the lists used to store the environment of closures, and the arguments of applications. */
+struct frame {
+    thunk * m_head;
+    frame * m_tail;
+    frame(thunk * h, frame * t):m_head(h), m_tail(t) {}
+};
+
+/**
+   \brief Values of the free variables of an expression. The free variable \c #i is the i-th element of \c m_frames,
+   or, if there are less than \c i+1 frames, an entry of the prefix of size \c m_ctx_size of the context.
+*/
+struct scope {
+    frame *  m_frames;
+    unsigned m_ctx_size;
+    scope(frame * fs, unsigned sz):m_frames(fs), m_ctx_size(sz) {}
+};
+
+enum class thunk_kind { Delayed, Ref, Normal, Atom, Closure, App, HEq, Pair, Proj };
+/**
+   \brief Node of the abstract machine.
+
+   - Delayed: expression \c m_expr in the scope \c m_scope that was not evaluated yet.
+     When it is forced, it becomes a Ref to its weak head normal form. So, it is evaluated at most once.
+   - Ref:     reference to the value \c m_head.
+   - Normal:  closed expression whose normal form \c m_nf was found in the cache of closed terms.
+   - Atom:    constant, type, semantic attachment, or free variable. Free variables are represented
+              using de Bruijn levels.
+   - Closure: lambda, pi, sigma or metavariable \c m_expr in the scope \c m_scope.
+   - App:     application of \c m_head to \c m_args. The arguments are stored in reverse order.
+   - HEq/Pair: the arguments are stored in \c m_args in reverse order.
+   - Proj:    projection \c m_expr of the value \c m_head, where \c m_head is not a pair.
+*/
+struct thunk {
+    thunk_kind     m_kind;
+    bool           m_closed;  // true if \c m_expr is a shared closed expression
+    expr           m_expr;
+    scope          m_scope;
+    thunk *        m_head;
+    frame *        m_args;
+    optional<expr> m_nf;      // normal form in a context with \c m_nf_k binders
+    unsigned       m_nf_k;
+    thunk(thunk_kind k, expr const & e, scope const & s = scope(nullptr, 0), thunk * h = nullptr, frame * args = nullptr):
+        m_kind(k), m_closed(false), m_expr(e), m_scope(s), m_head(h), m_args(args), m_nf_k(0) {}
+};
+
+/**
+   \brief Expression normalizer.
 
-/** \brief Expression normalizer. */
+   It is implemented using a lazy abstract machine. Expressions are evaluated to weak head normal form using an
+   explicit stack of arguments and environments of (shared) thunks allocated in an arena. The normal form is then
+   read back by evaluating the bodies of abstractions. Each argument is evaluated at most once, and the normal form
+   of a thunk is reused when it is needed again.
+*/
 class normalizer::imp {
     typedef expr_map<expr> cache;
+    struct shared_key {
+        expr_cell * m_expr;
+        frame *     m_frames;
+        unsigned    m_ctx_size;
+        shared_key(expr_cell * e, frame * fs, unsigned sz):m_expr(e), m_frames(fs), m_ctx_size(sz) {}
+    };
+    struct shared_key_hash {
+        std::size_t operator()(shared_key const & k) const {
+            return std::hash<void*>()(k.m_expr) ^ (std::hash<void*>()(k.m_frames) * 31) ^ k.m_ctx_size;
+        }
+    };
+    struct shared_key_eq {
+        bool operator()(shared_key const & k1, shared_key const & k2) const {
+            return k1.m_expr == k2.m_expr && k1.m_frames == k2.m_frames && k1.m_ctx_size == k2.m_ctx_size;
+        }
+    };
+    typedef std::unordered_map<shared_key, thunk *, shared_key_hash, shared_key_eq> shared_thunks;
 
     ro_environment::weak_ref m_env;
     context                  m_ctx;
     cached_ro_metavar_env    m_menv;
-    cache                    m_cache;
+    // The normal form of a closed expression (i.e., no free variables and metavariables) does not depend on
+    // the context. So, this cache survives across calls.
+    cache                    m_closed_cache;
     bool                     m_unfold_opaque;
     unsigned                 m_max_depth;
     unsigned                 m_depth;
+    // The following fields are only used during a call, and are reset at the end of it.
+    arena<thunk>             m_thunks;
+    arena<frame>             m_frames;
+    std::vector<thunk *>     m_stack;   // arguments of the applications being evaluated, the first argument is on the top
+    shared_thunks            m_shared;  // thunks for shared expressions
+    std::vector<thunk *>     m_vars;    // m_vars[l] is the value of the free variable with de Bruijn level l
 
     ro_environment env() const { return ro_environment(m_env); }
 
@@ -92,257 +184,360 @@ class normalizer::imp {
         return ::lean::instantiate(e, n, s, m_menv.to_some_menv());
     }
 
-    expr add_lift(expr const & m, unsigned s, unsigned n) {
-        return ::lean::add_lift(m, s, n, m_menv.to_some_menv());
+    void check_depth() {
+        check_system("normalizer");
+        if (m_depth > m_max_depth)
+            throw kernel_exception(env(), "normalizer maximum recursion depth exceeded");
+    }
+
+    /** \brief Auxiliary object for deleting the objects created by the abstract machine at the end of a call. */
+    struct reset_machine {
+        imp & m_imp;
+        reset_machine(imp & i):m_imp(i) {}
+        ~reset_machine() {
+            m_imp.m_stack.clear();
+            if (m_imp.m_shared.size() > LEAN_NORMALIZER_CLOSED_CACHE_CAPACITY)
+                shared_thunks().swap(m_imp.m_shared); // release the buckets
+            else
+                m_imp.m_shared.clear();
+            m_imp.m_vars.clear();
+            m_imp.m_thunks.clear();
+            m_imp.m_frames.clear();
+        }
+    };
+
+    thunk * mk_atom(expr const & e) { return m_thunks.mk(thunk_kind::Atom, e); }
+
+    /** \brief Return the value of the free variable with de Bruijn level \c l */
+    thunk * var_value(unsigned l, optional<expr> const & body) {
+        if (m_vars.size() <= l)
+            m_vars.resize(l + 1, nullptr);
+        if (!m_vars[l]) {
+            if (body)
+                m_vars[l] = m_thunks.mk(thunk_kind::Delayed, *body, scope(nullptr, l));
+            else
+                m_vars[l] = mk_atom(mk_var(l));
+        }
+        return m_vars[l];
     }
 
-    expr lookup(value_stack const & s, unsigned i) {
+    thunk * lookup(scope const & s, unsigned i) {
         unsigned j = i;
-        value_stack const * it1 = &s;
-        while (*it1) {
+        frame * f  = s.m_frames;
+        while (f) {
             if (j == 0)
-                return head(*it1);
+                return f->m_head;
             --j;
-            it1 = &tail(*it1);
+            f = f->m_tail;
+        }
+        auto p = lookup_ext(m_ctx, m_ctx.size() - s.m_ctx_size + j);
+        return var_value(p.second.size(), p.first.get_body());
+    }
+
+    scope extend(scope const & s, thunk * v) { return scope(m_frames.mk(v, s.m_frames), s.m_ctx_size); }
+
+    /** \brief Return a scope where the free variables of an expression are the ones of a context with \c k binders. */
+    scope mk_identity_scope(unsigned k) {
+        unsigned sz = m_ctx.size();
+        frame * fs  = nullptr;
+        for (unsigned l = sz; l < k; l++)
+            fs = m_frames.mk(var_value(l, none_expr()), fs);
+        return scope(fs, sz);
+    }
+
+    /**
+        \brief Create a thunk for \c e in the scope \c s. Variables are shared, and the thunks of shared expressions
+        are reused. Since the value of a closed expression does not depend on the scope, they are shared in all scopes.
+    */
+    thunk * mk_thunk(expr const & e, scope const & s) {
+        if (is_var(e))
+            return lookup(s, var_idx(e));
+        if (!is_shared(e))
+            return m_thunks.mk(thunk_kind::Delayed, e, s);
+        bool closed = !has_free_vars(e);
+        shared_key key(e.raw(), closed ? nullptr : s.m_frames, closed ? 0 : s.m_ctx_size);
+        auto it = m_shared.find(key);
+        if (it != m_shared.end())
+            return it->second;
+        thunk * r  = m_thunks.mk(thunk_kind::Delayed, e, closed ? scope(nullptr, 0) : s);
+        r->m_closed = closed;
+        m_shared.insert(std::make_pair(key, r));
+        return r;
+    }
+
+    /** \brief Evaluate \c t to weak head normal form (if it was not evaluated yet), and return its value. */
+    thunk * force(thunk * t, unsigned k) {
+        while (t->m_kind == thunk_kind::Ref)
+            t = t->m_head;
+        if (t->m_kind != thunk_kind::Delayed)
+            return t;
+        if (t->m_closed) {
+            auto it = m_closed_cache.find(t->m_expr);
+            if (it != m_closed_cache.end()) {
+                t->m_kind = thunk_kind::Normal;
+                t->m_nf   = it->second;
+                return t;
+            }
         }
-        auto p = lookup_ext(m_ctx, j);
-        context_entry const & entry = p.first;
-        context const & entry_c     = p.second;
-        if (entry.get_body()) {
-            // Save the current context and cache
-            freset<cache>    reset(m_cache);
-            flet<context>    set(m_ctx, entry_c);
-            unsigned k = m_ctx.size();
-            return normalize(*(entry.get_body()), value_stack(), k);
-        } else {
-            return mk_var(entry_c.size());
+        thunk * v   = whnf(t->m_expr, t->m_scope, k);
+        t->m_kind   = thunk_kind::Ref;
+        t->m_head   = v;
+        return v;
+    }
+
+    /**
+       \brief Try to reduce the application of the semantic attachment \c v to the arguments on the stack above \c base.
+       The arguments are read back in a context with \c k binders.
+    */
+    optional<expr> normalize_value(thunk * v, unsigned base, unsigned k) {
+        buffer<expr> args;
+        args.push_back(v->m_expr);
+        for (unsigned i = m_stack.size(); i > base; i--) {
+            thunk * a = m_stack[i-1];
+            args.push_back(readback(a, k));
         }
+        return to_value(v->m_expr).normalize(args.size(), args.data());
     }
 
-    /** \brief Convert the value \c v back into an expression in a context that contains \c k binders. */
-    expr reify(expr const & v, unsigned k) {
-        return replace(v, [&](expr const & e, unsigned DEBUG_CODE(offset)) -> expr {
-                lean_assert(offset == 0);
-                lean_assert(!is_lambda(e) && !is_pi(e) && !is_metavar(e) && !is_let(e));
-                if (is_var(e)) {
-                    // de Bruijn level --> de Bruijn index
-                    return mk_var(k - var_idx(e) - 1);
-                } else if (is_closure(e)) {
-                    return reify_closure(to_closure(e), k);
-                } else {
-                    return e;
-                }
-            });
+    /** \brief Create the application of \c v to the arguments on the stack above \c base, and remove them from the stack. */
+    thunk * mk_app_value(thunk * v, unsigned base) {
+        thunk * f    = v;
+        frame * args = nullptr;
+        if (v->m_kind == thunk_kind::App) {
+            f    = v->m_head;
+            args = v->m_args;
+        }
+        while (m_stack.size() > base) {
+            args = m_frames.mk(m_stack.back(), args);
+            m_stack.pop_back();
+        }
+        return m_thunks.mk(thunk_kind::App, expr(), scope(nullptr, 0), f, args);
+    }
+
+    /** \brief Store the values \c vs in a list (in reverse order). */
+    frame * mk_args(std::initializer_list<thunk *> const & vs) {
+        frame * r = nullptr;
+        for (thunk * v : vs)
+            r = m_frames.mk(v, r);
+        return r;
     }
 
     /**
-        \brief Return true iff the value_stack does not affect the context of a metavariable
-        See big comment at reify_closure.
+        \brief Return the weak head normal form of \c a in the scope \c s applied to the arguments on the top of the stack.
+        The arguments are consumed. \c k is the number of binders in the context where the result is going to be read back.
     */
-    bool is_identity_stack(value_stack const & s, unsigned k) {
-        unsigned i = 0;
-        for (auto e : s) {
-            if (!is_var(e) || k - var_idx(e) - 1 != i)
+    thunk * whnf(expr const & a, scope const & sc, unsigned k) {
+        flet<unsigned> l(m_depth, m_depth);
+        unsigned base = m_stack.size();
+        expr  e = a;
+        scope s = sc;
+        while (true) {
+            m_depth++;
+            check_depth();
+            thunk * v = nullptr;
+            switch (e.kind()) {
+            case expr_kind::Var:
+                v = force(lookup(s, var_idx(e)), k);
+                break;
+            case expr_kind::Constant: {
+                optional<object> obj = env()->find_object(const_name(e));
+                if (obj && should_unfold(*obj, m_unfold_opaque)) {
+                    expr const & d = obj->get_value();
+                    // the value of a definition is closed
+                    d.raw()->set_closed();
+                    v = force(mk_thunk(d, scope(nullptr, 0)), k);
+                } else {
+                    v = mk_atom(e);
+                }
+                break;
+            }
+            case expr_kind::Type: case expr_kind::Value:
+                v = mk_atom(e);
+                break;
+            case expr_kind::Lambda:
+                if (m_stack.size() > base) {
+                    // beta reduction
+                    s = extend(s, m_stack.back());
+                    m_stack.pop_back();
+                    e = abst_body(e);
+                    continue;
+                }
+                v = m_thunks.mk(thunk_kind::Closure, e, s);
+                break;
+            case expr_kind::Pi: case expr_kind::Sigma: case expr_kind::MetaVar:
+                v = m_thunks.mk(thunk_kind::Closure, e, s);
+                break;
+            case expr_kind::App: {
+                unsigned i = num_args(e);
+                while (i > 1) {
+                    --i;
+                    m_stack.push_back(mk_thunk(arg(e, i), s));
+                }
+                e = arg(e, 0);
+                continue;
+            }
+            case expr_kind::Let:
+                s = extend(s, mk_thunk(let_value(e), s));
+                e = let_body(e);
+                continue;
+            case expr_kind::HEq:
+                v = m_thunks.mk(thunk_kind::HEq, e, s, nullptr, mk_args({mk_thunk(heq_lhs(e), s), mk_thunk(heq_rhs(e), s)}));
+                break;
+            case expr_kind::Pair:
+                v = m_thunks.mk(thunk_kind::Pair, e, s, nullptr,
+                                mk_args({mk_thunk(pair_first(e), s), mk_thunk(pair_second(e), s), mk_thunk(pair_type(e), s)}));
+                break;
+            case expr_kind::Proj: {
+                thunk * p = force(mk_thunk(proj_arg(e), s), k);
+                if (p->m_kind == thunk_kind::Normal)
+                    p = whnf(*p->m_nf, scope(nullptr, 0), k);
+                if (p->m_kind == thunk_kind::Pair) {
+                    // the arguments are stored in reverse order
+                    frame * args = p->m_args;
+                    v = force(proj_first(e) ? args->m_tail->m_tail->m_head : args->m_tail->m_head, k);
+                } else {
+                    v = m_thunks.mk(thunk_kind::Proj, e, s, p);
+                }
+                break;
+            }}
+            lean_assert(v);
+            if (m_stack.size() == base)
+                return v;
+            if (v->m_kind == thunk_kind::Normal) {
+                // the closed expression is in normal form, but we have to evaluate its application
+                e = *v->m_nf;
+                s = scope(nullptr, 0);
+                continue;
+            }
+            if (v->m_kind == thunk_kind::Closure && is_lambda(v->m_expr)) {
+                e = v->m_expr;
+                s = v->m_scope;
+                continue;
+            }
+            if (v->m_kind == thunk_kind::Atom && is_value(v->m_expr)) {
+                if (optional<expr> m = normalize_value(v, base, k)) {
+                    m_stack.resize(base);
+                    e = *m;
+                    s = has_free_vars(e) ? mk_identity_scope(k) : scope(nullptr, 0);
+                    continue;
+                }
+            }
+            return mk_app_value(v, base);
+        }
+    }
+
+    /** \brief Return true iff the values \c vs are the free variables <tt>#0, ..., #{vs.size() - 1}</tt> in a context with \c k binders. */
+    bool is_identity(buffer<thunk *> const & vs, unsigned k) {
+        for (unsigned i = 0; i < vs.size(); i++) {
+            thunk * v = force(vs[i], k);
+            if (v->m_kind != thunk_kind::Atom || !is_var(v->m_expr) || k - var_idx(v->m_expr) - 1 != i)
                 return false;
-            ++i;
         }
         return true;
     }
 
-    /** \brief Convert the closure \c c into an expression in a context that contains \c k binders. */
-    expr reify_closure(closure const & c, unsigned k) {
-        expr const & e        = c.get_expr();
-        context const & ctx   = c.get_context();
-        value_stack const & s = c.get_stack();
-        if (is_abstraction(e)) {
-            freset<cache>    reset(m_cache);
-            flet<context>    set(m_ctx, ctx);
-            expr new_d = reify(normalize(abst_domain(e), s, k), k);
-            m_cache.clear(); // make sure we do not reuse cached values from the previous call
-            expr new_b = reify(normalize(abst_body(e), extend(s, mk_var(k)), k+1), k+1);
-            return update_abstraction(e, new_d, new_b);
-        } else {
-            lean_assert(is_metavar(e));
-            // We use the following trick to reify a metavariable in the context of the value_stack s, and context ctx.
-            // Let v_0, ..., v_{n-1} be the values on the stack s. We assume v_0 is the top of the stack.
-            // Let v_i' be reify(v_i, k). Then, v_i' is the "value" of the free variable #i in the metavariable e.
-            // Let m be the size of the context ctx. Thus
-            //
-            // The metavariable e may contain free variables.
-            // Moreover, if we instantiate e with T[x_0, ..., x_{n-1}, x_n, ..., x_{n+m-1}]
-            // Then, in this occurrence of e, we must have
-            //
-            //          T[v_0', ..., v_{n-1}', reify(#{m-1}, k), ..., reify(#0, k)]
-            //
-            // reify(#j, k) is the index of j-th variable in the context ctx.
-            // It is just the variable #{k - j - 1}.
-            // So, we get
-            //
-            //          T[v_0', ..., v_{n-1}', #{k - m}, ..., #{k - 1}]
-            //
-            // Thus, we implement this operation as:
-            //
-            //         instantiate(e, {#{k - 1}, ..., #{k - m}, v_{n-1}', ..., v_1', v_0'}))
-            //
-            // This operation is equivalent to R_{n+m} defined as
-            //         R_0     = e
-            //         R_1     = instantiate(R_0, v_0')
-            //         ...
-            //         R_n     = instantiate(R_{n-1}, v_{n-1}')
-            //         R_{n+1} = instantiate(R_n, #{k - m})
-            //         ...
-            //         R_{n+m} = instantiate(R_{n+m-1}, #{k-1})
-            //
-            //
-            // Finally, we also use the following optimization.
-            // If all v_i' are equal to #i and n + m == k, then we just return e, because
-            //
-            //         T[#0, ..., #n-1, #{n + m - m}, ..., #{m + n - 1}]
-            //         ==
-            //         T[#0, ..., #n-1, #n, ..., #{m + n - 1}]
-            //         ==
-            //         e
-            //
-            unsigned n = length(s);
-            unsigned m = ctx.size();
-            if (k == n + m && is_identity_stack(s, k))
-                return e;
-            buffer<expr> subst;
-            for (auto v : s)
-                subst.push_back(reify(v, k));
-            for (unsigned i = m; i >= 1; i--)
-                subst.push_back(mk_var(k - i));
-            lean_assert(subst.size() == n + m);
-            std::reverse(subst.begin(), subst.end());
-            return instantiate(e, subst.size(), subst.data());
-        }
+    /** \brief Return the normal form of the metavariable closure \c c in a context with \c k binders. */
+    expr readback_metavar(thunk * c, unsigned k) {
+        expr const & e = c->m_expr;
+        buffer<thunk *> vs;
+        for (frame * f = c->m_scope.m_frames; f; f = f->m_tail)
+            vs.push_back(f->m_head);
+        // We use the following trick to read back a metavariable in the scope of the values v_0, ..., v_{n-1}
+        // (v_0 is the value of #0) and a context of size m.
+        // Let v_i' be the normal form of v_i. Then, v_i' is the "value" of the free variable #i in the metavariable e.
+        // If we instantiate e with T[x_0, ..., x_{n-1}, x_n, ..., x_{n+m-1}], then in this occurrence of e, we must have
+        //
+        //          T[v_0', ..., v_{n-1}', #{k - m}, ..., #{k - 1}]
+        //
+        // since the free variable #j of the context of size m is the variable #{k - j - 1} in a context with k binders.
+        // Thus, we implement this operation as:
+        //
+        //         instantiate(e, {#{k - 1}, ..., #{k - m}, v_{n-1}', ..., v_1', v_0'})
+        //
+        // If all v_i' are equal to #i and n + m == k, then we just return e.
+        unsigned n = vs.size();
+        unsigned m = c->m_scope.m_ctx_size;
+        if (k == n + m && is_identity(vs, k))
+            return e;
+        buffer<expr> subst;
+        for (thunk * v : vs)
+            subst.push_back(readback(v, k));
+        for (unsigned i = m; i >= 1; i--)
+            subst.push_back(mk_var(k - i));
+        lean_assert(subst.size() == n + m);
+        std::reverse(subst.begin(), subst.end());
+        return instantiate(e, subst.size(), subst.data());
     }
 
-    /** \brief Normalize the expression \c a in a context composed of stack \c s and \c k binders. */
-    expr normalize(expr const & a, value_stack const & s, unsigned k) {
+    /** \brief Return the normal form of \c t in a context with \c k binders. */
+    expr readback(thunk * t, unsigned k) {
         flet<unsigned> l(m_depth, m_depth+1);
-        check_system("normalizer");
-        if (m_depth > m_max_depth)
-            throw kernel_exception(env(), "normalizer maximum recursion depth exceeded");
-        bool shared = false;
-        if (is_shared(a)) {
-            shared = true;
-            auto it = m_cache.find(a);
-            if (it != m_cache.end())
-                return it->second;
+        check_depth();
+        thunk * v = force(t, k);
+        if (v->m_nf) {
+            expr const & nf = *v->m_nf;
+            if (v->m_nf_k == k || !has_free_vars(nf))
+                return nf;
+            if (v->m_nf_k < k && !has_metavar(nf))
+                return lift_free_vars(nf, 0, k - v->m_nf_k);
         }
-
         expr r;
-        switch (a.kind()) {
-        case expr_kind::Sigma: case expr_kind::Pi:
-        case expr_kind::MetaVar: case expr_kind::Lambda:
-            r = mk_closure(a, m_ctx, s);
-            break;
-        case expr_kind::Var:
-            r = lookup(s, var_idx(a));
+        switch (v->m_kind) {
+        case thunk_kind::Delayed: case thunk_kind::Ref: case thunk_kind::Normal:
+            lean_unreachable(); // LCOV_EXCL_LINE
+        case thunk_kind::Atom:
+            // de Bruijn level --> de Bruijn index
+            r = is_var(v->m_expr) ? mk_var(k - var_idx(v->m_expr) - 1) : v->m_expr;
             break;
-        case expr_kind::Constant: {
-            optional<object> obj = env()->find_object(const_name(a));
-            if (obj && should_unfold(*obj, m_unfold_opaque)) {
-                freset<cache> reset(m_cache);
-                r = normalize(obj->get_value(), value_stack(), 0);
+        case thunk_kind::Closure: {
+            expr const & e = v->m_expr;
+            if (is_abstraction(e)) {
+                expr new_d = readback(mk_thunk(abst_domain(e), v->m_scope), k);
+                expr new_b = readback(mk_thunk(abst_body(e), extend(v->m_scope, var_value(k, none_expr()))), k+1);
+                r = update_abstraction(e, new_d, new_b);
             } else {
-                r = a;
+                r = readback_metavar(v, k);
             }
             break;
         }
-        case expr_kind::HEq: {
-            expr new_lhs = normalize(heq_lhs(a), s, k);
-            expr new_rhs = normalize(heq_rhs(a), s, k);
-            r = update_heq(a, new_lhs, new_rhs);
+        case thunk_kind::App: {
+            buffer<expr> new_args;
+            for (frame * f = v->m_args; f; f = f->m_tail)
+                new_args.push_back(readback(f->m_head, k));
+            new_args.push_back(readback(v->m_head, k));
+            std::reverse(new_args.begin(), new_args.end());
+            r = mk_app(new_args);
             break;
         }
-        case expr_kind::Pair: {
-            expr new_first  = normalize(pair_first(a), s, k);
-            expr new_second = normalize(pair_second(a), s, k);
-            expr new_type   = normalize(pair_type(a), s, k);
-            r = update_pair(a, new_first, new_second, new_type);
+        case thunk_kind::HEq: {
+            frame * args = v->m_args;
+            expr new_rhs = readback(args->m_head, k);
+            expr new_lhs = readback(args->m_tail->m_head, k);
+            r = update_heq(v->m_expr, new_lhs, new_rhs);
             break;
         }
-        case expr_kind::Proj: {
-            expr new_arg = normalize(proj_arg(a), s, k);
-            if (is_dep_pair(new_arg)) {
-                if (proj_first(a))
-                    r = pair_first(new_arg);
-                else
-                    r = pair_second(new_arg);
-            } else {
-                r = update_proj(a, new_arg);
-            }
+        case thunk_kind::Pair: {
+            frame * args = v->m_args;
+            expr new_type   = readback(args->m_head, k);
+            expr new_second = readback(args->m_tail->m_head, k);
+            expr new_first  = readback(args->m_tail->m_tail->m_head, k);
+            r = update_pair(v->m_expr, new_first, new_second, new_type);
             break;
         }
-        case expr_kind::Type: case expr_kind::Value:
-            r = a;
-            break;
-        case expr_kind::App: {
-            expr f      = normalize(arg(a, 0), s, k);
-            unsigned i  = 1;
-            unsigned n  = num_args(a);
-            while (true) {
-                if (is_closure(f) && is_lambda(to_closure(f).get_expr())) {
-                    // beta reduction
-                    expr fv = to_closure(f).get_expr();
-                    value_stack new_s = to_closure(f).get_stack();
-                    while (is_lambda(fv) && i < n) {
-                        new_s = extend(new_s, normalize(arg(a, i), s, k));
-                        i++;
-                        fv = abst_body(fv);
-                    }
-                    {
-                        freset<cache> reset(m_cache);
-                        flet<context> set(m_ctx, to_closure(f).get_context());
-                        f = normalize(fv, new_s, k);
-                    }
-                    if (i == n) {
-                        r = f;
-                        break;
-                    }
-                } else {
-                    buffer<expr> new_args;
-                    new_args.push_back(f);
-                    for (; i < n; i++)
-                        new_args.push_back(normalize(arg(a, i), s, k));
-                    if (is_value(f) && !is_closure(f)) {
-                        buffer<expr> reified_args;
-                        for (auto arg : new_args) reified_args.push_back(reify(arg, k));
-                        optional<expr> m = to_value(f).normalize(reified_args.size(), reified_args.data());
-                        if (m) {
-                            r = normalize(*m, s, k);
-                            break;
-                        }
-                    }
-                    r = mk_app(new_args);
-                    break;
-                }
-            }
+        case thunk_kind::Proj:
+            r = update_proj(v->m_expr, readback(v->m_head, k));
             break;
         }
-        case expr_kind::Let: {
-            expr v = normalize(let_value(a), s, k);
-            {
-                freset<cache> reset(m_cache);
-                r = normalize(let_body(a), extend(s, v), k);
-            }
-            break;
-        }}
-        if (shared) {
-            m_cache[a] = r;
+        v->m_nf   = r;
+        v->m_nf_k = k;
+        if (t->m_closed) {
+            if (m_closed_cache.size() > LEAN_NORMALIZER_CLOSED_CACHE_CAPACITY)
+                m_closed_cache.clear();
+            m_closed_cache[t->m_expr] = r;
         }
         return r;
     }
 
-    void set_ctx(context const & ctx) {
-        if (!is_eqp(ctx, m_ctx)) {
-            m_ctx = ctx;
-            m_cache.clear();
-        }
-    }
-
 public:
     imp(ro_environment const & env, unsigned max_depth):
         m_env(env) {
@@ -353,16 +548,16 @@ public:
 
     expr operator()(expr const & e, context const & ctx, optional<ro_metavar_env> const & menv, bool unfold_opaque) {
         if (m_unfold_opaque != unfold_opaque)
-            m_cache.clear();
+            m_closed_cache.clear();
         m_unfold_opaque = unfold_opaque;
-        set_ctx(ctx);
-        if (m_menv.update(menv))
-            m_cache.clear();
+        m_ctx = ctx;
+        m_menv.update(menv);
+        reset_machine reset(*this);
         unsigned k = m_ctx.size();
-        return reify(normalize(e, value_stack(), k), k);
+        return readback(mk_thunk(e, scope(nullptr, k)), k);
     }
 
-    void clear() { m_ctx = context(); m_cache.clear(); m_menv.clear(); }
+    void clear() { m_ctx = context(); m_closed_cache.clear(); m_menv.clear(); }
 };
 
 normalizer::normalizer(ro_environment const & env, unsigned max_depth):m_ptr(new imp(env, max_depth)) {}
@@ -5,6 +5,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <string>
+#include <sstream>
+#include "util/mapped_file.h"
 #include "kernel/object.h"
 #include "kernel/environment.h"
 
@@ -157,7 +159,7 @@ public:
     axiom_object_cell(name const & n, expr const & t):postulate_object_cell(n, t) {}
     virtual char const * keyword() const { return "axiom"; }
     virtual bool is_axiom() const { return true; }
-    virtual void write(serializer & s) const { s << "ax" << get_name() << get_type(); }
+    virtual void write(serializer & s) const;
 };
 static void read_axiom(environment const & env, io_state const &, deserializer & d) {
     name n    = read_name(d);
@@ -175,7 +177,7 @@ public:
     variable_decl_object_cell(name const & n, expr const & t):postulate_object_cell(n, t) {}
     virtual char const * keyword() const { return "variable"; }
     virtual bool is_var_decl() const { return true; }
-    virtual void write(serializer & s) const { s << "var" << get_name() << get_type(); }
+    virtual void write(serializer & s) const;
 };
 static void read_variable(environment const & env, io_state const &, deserializer & d) {
     name n    = read_name(d);
@@ -202,7 +204,7 @@ public:
     virtual expr get_value() const       { return m_value; }
     virtual char const * keyword() const { return "definition"; }
     virtual unsigned get_weight() const  { return m_weight; }
-    virtual void write(serializer & s) const { s << "def" << get_name() << get_type() << get_value(); }
+    virtual void write(serializer & s) const;
 };
 static void read_definition(environment const & env, io_state const &, deserializer & d) {
     name n    = read_name(d);
@@ -223,7 +225,7 @@ public:
     }
     virtual char const * keyword() const { return "theorem"; }
     virtual bool is_theorem() const { return true; }
-    virtual void write(serializer & s) const { s << "th" << get_name() << get_type() << get_value(); }
+    virtual void write(serializer & s) const;
 };
 static void read_theorem(environment const & env, io_state const &, deserializer & d) {
     name n    = read_name(d);
@@ -233,11 +235,210 @@ static void read_theorem(environment const & env, io_state const &, deserializer
 }
 static object_cell::register_deserializer_fn theorem_ds("th", read_theorem);
 
+/**
+   \brief The type and value of declarations are stored in independent blocks in object files.
+   The expressions in a block do not share subexpressions with the rest of the file.
+   So, they can be deserialized on demand.
+*/
+static void write_decl_block(serializer & s, expr const & t, optional<expr> const & v) {
+    std::ostringstream out(std::ios_base::binary);
+    serializer block(out);
+    block << t;
+    if (v)
+        block << *v;
+    std::string const & data = out.str();
+    s << static_cast<unsigned>(data.size());
+    s.write_block(data.data(), data.size());
+}
+
+static file_block read_decl_block(deserializer & d) {
+    unsigned sz = d.read_unsigned();
+    return read_file_block(d.get_stream(), sz);
+}
+
+void axiom_object_cell::write(serializer & s) const {
+    s << "lax" << get_name();
+    write_decl_block(s, get_type(), none_expr());
+}
+
+void variable_decl_object_cell::write(serializer & s) const {
+    s << "lvar" << get_name();
+    write_decl_block(s, get_type(), none_expr());
+}
+
+void definition_object_cell::write(serializer & s) const {
+    s << "ldef" << get_name() << get_weight();
+    write_decl_block(s, get_type(), some_expr(get_value()));
+}
+
+void theorem_object_cell::write(serializer & s) const {
+    s << "lth" << get_name();
+    write_decl_block(s, get_type(), some_expr(get_value()));
+}
+
+/**
+   \brief Declaration whose type and value are only deserialized when they are needed.
+*/
+template<typename Base>
+class lazy_decl_object_cell : public Base {
+    mutable atomic<bool> m_loaded;
+    mutable mutex        m_mutex; // protects m_block, m_type and m_value until m_loaded is set
+    mutable file_block   m_block;
+    mutable expr         m_type;
+    mutable expr         m_value;
+
+    void load() const {
+        lock_guard<mutex> lock(m_mutex);
+        if (!m_loaded) {
+            memory_streambuf buf(m_block.data(), m_block.size());
+            std::istream in(&buf);
+            deserializer d(in);
+            m_type = read_expr(d);
+            if (Base::is_definition())
+                m_value = read_expr(d);
+            m_block = file_block();
+            m_loaded = true;
+        }
+    }
+public:
+    template<typename... Args>
+    lazy_decl_object_cell(file_block const & b, Args &&... args):
+        Base(std::forward<Args>(args)...), m_loaded(false), m_block(b) {}
+    virtual ~lazy_decl_object_cell() {}
+    virtual expr get_type() const {
+        if (!m_loaded)
+            load();
+        return m_type;
+    }
+    virtual expr get_value() const {
+        if (!Base::is_definition())
+            return Base::get_value();
+        if (!m_loaded)
+            load();
+        return m_value;
+    }
+};
+
+object mk_lazy_decl(object_cell * c) { return object(c); }
+
+/**
+   \brief Theorem whose proof can be replaced with its serialized form.
+
+   \remark The proof is deserialized in each call to \c get_value, and it is not cached, since keeping
+   the decoded proof alive would defeat the compression. This is fine because theorems are opaque:
+   their proofs are only requested on cold paths (exporting them, unfolding opaque definitions,
+   and removing the objects that use rejected theorems).
+*/
+class compressible_theorem_object_cell : public theorem_object_cell {
+    mutable mutex          m_mutex;
+    mutable optional<expr> m_proof;
+    mutable file_block     m_block;
+public:
+    compressible_theorem_object_cell(name const & n, expr const & t, expr const & v):
+        theorem_object_cell(n, t, expr()), m_proof(v) {}
+    virtual ~compressible_theorem_object_cell() {}
+    virtual expr get_value() const {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_proof)
+            return *m_proof;
+        memory_streambuf buf(m_block.data(), m_block.size());
+        std::istream in(&buf);
+        deserializer d(in);
+        return read_expr(d);
+    }
+    void compress() const {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_proof) {
+            std::ostringstream out(std::ios_base::binary);
+            serializer s(out);
+            s << *m_proof;
+            m_block = file_block(out.str());
+            m_proof = none_expr();
+        }
+    }
+};
+
+void compress_proof(object const & thm) {
+    if (auto c = dynamic_cast<compressible_theorem_object_cell const *>(thm.cell()))
+        c->compress();
+}
+
+static void read_lazy_axiom(environment const & env, io_state const &, deserializer & d) {
+    name n       = read_name(d);
+    file_block b = read_decl_block(d);
+    env->add_imported_object(mk_lazy_decl(new lazy_decl_object_cell<axiom_object_cell>(b, n, expr())));
+}
+static object_cell::register_deserializer_fn lazy_axiom_ds("lax", read_lazy_axiom);
+
+static void read_lazy_variable(environment const & env, io_state const &, deserializer & d) {
+    name n       = read_name(d);
+    file_block b = read_decl_block(d);
+    env->add_imported_object(mk_lazy_decl(new lazy_decl_object_cell<variable_decl_object_cell>(b, n, expr())));
+}
+static object_cell::register_deserializer_fn lazy_var_decl_ds("lvar", read_lazy_variable);
+
+static void read_lazy_definition(environment const & env, io_state const &, deserializer & d) {
+    name n       = read_name(d);
+    unsigned w   = d.read_unsigned();
+    file_block b = read_decl_block(d);
+    env->add_imported_object(mk_lazy_decl(new lazy_decl_object_cell<definition_object_cell>(b, n, expr(), expr(), w)));
+}
+static object_cell::register_deserializer_fn lazy_definition_ds("ldef", read_lazy_definition);
+
+static void read_lazy_theorem(environment const & env, io_state const &, deserializer & d) {
+    name n       = read_name(d);
+    file_block b = read_decl_block(d);
+    env->add_imported_object(mk_lazy_decl(new lazy_decl_object_cell<theorem_object_cell>(b, n, expr(), expr())));
+}
+static object_cell::register_deserializer_fn lazy_theorem_ds("lth", read_lazy_theorem);
+
 object mk_uvar_cnstr(name const & n, level const & l) { return object(new uvar_constraint_object_cell(n, l)); }
 object mk_definition(name const & n, expr const & t, expr const & v, unsigned weight) { return object(new definition_object_cell(n, t, v, weight)); }
 object mk_theorem(name const & n, expr const & t, expr const & v) { return object(new theorem_object_cell(n, t, v)); }
+object mk_compressible_theorem(name const & n, expr const & t, expr const & v) {
+    return object(new compressible_theorem_object_cell(n, t, v));
+}
 object mk_axiom(name const & n, expr const & t) { return object(new axiom_object_cell(n, t)); }
 object mk_var_decl(name const & n, expr const & t) { return object(new variable_decl_object_cell(n, t)); }
 object mk_builtin(expr const & v) { return object(new builtin_object_cell(v)); }
 object mk_builtin_set(expr const & r) { return object(new builtin_set_object_cell(r)); }
+
+/**
+   \brief Definition whose opaque flag was modified by \c update_opaque.
+   It shares the original object, then it keeps its representation (e.g., compressed proofs and lazy declarations).
+*/
+class opaque_override_object_cell : public object_cell {
+    object m_obj;
+    bool   m_opaque;
+public:
+    opaque_override_object_cell(object const & obj, bool opaque):
+        object_cell(obj.kind()), m_obj(obj), m_opaque(opaque) {}
+    virtual ~opaque_override_object_cell() {}
+    object const & get_object() const { return m_obj; }
+    virtual char const * keyword() const { return m_obj.keyword(); }
+    virtual bool has_name() const        { return true; }
+    virtual name get_name() const        { return m_obj.get_name(); }
+    virtual bool has_type() const        { return m_obj.has_type(); }
+    virtual expr get_type() const        { return m_obj.get_type(); }
+    virtual bool is_definition() const   { return true; }
+    virtual bool is_opaque() const       { return m_opaque; }
+    virtual expr get_value() const       { return m_obj.get_value(); }
+    virtual bool is_builtin() const      { return m_obj.is_builtin(); }
+    virtual bool is_theorem() const      { return m_obj.is_theorem(); }
+    virtual unsigned get_weight() const  { return m_obj.get_weight(); }
+    // the opaque flag is exported by the set_opaque command that follows the object
+    virtual void write(serializer & s) const { m_obj.write(s); }
+};
+
+object update_opaque(object const & obj, bool opaque) {
+    lean_assert(obj.is_definition());
+    if (obj.is_opaque() == opaque)
+        return obj;
+    if (auto c = dynamic_cast<opaque_override_object_cell const *>(obj.cell())) {
+        if (c->get_object().is_opaque() == opaque)
+            return c->get_object();
+        return object(new opaque_override_object_cell(c->get_object(), opaque));
+    }
+    return object(new opaque_override_object_cell(obj, opaque));
+}
 }
@@ -114,11 +114,14 @@ public:
     friend object mk_uvar_cnstr(name const & n, level const & l);
     friend object mk_definition(name const & n, expr const & t, expr const & v, unsigned weight);
     friend object mk_theorem(name const & n, expr const & t, expr const & v);
+    friend object mk_compressible_theorem(name const & n, expr const & t, expr const & v);
     friend object mk_axiom(name const & n, expr const & t);
     friend object mk_var_decl(name const & n, expr const & t);
     friend object mk_neutral(neutral_object_cell * c);
     friend object mk_builtin(expr const & v);
     friend object mk_builtin_set(expr const & r);
+    friend object mk_lazy_decl(object_cell * c);
+    friend object update_opaque(object const & obj, bool opaque);
 
     char const * keyword() const { return m_ptr->keyword(); }
     bool has_name() const { return m_ptr->has_name(); }
@@ -153,8 +156,22 @@ object mk_builtin(expr const & v);
 object mk_builtin_set(expr const & r);
 object mk_definition(name const & n, expr const & t, expr const & v, unsigned weight);
 object mk_theorem(name const & n, expr const & t, expr const & v);
+/**
+   \brief Create a theorem whose proof can be compressed using \c compress_proof.
+   A compressed proof is stored in serialized form, and it is deserialized whenever it is requested.
+*/
+object mk_compressible_theorem(name const & n, expr const & t, expr const & v);
+/** \brief Compress the proof of the given theorem. It is a noop if \c thm was not created using \c mk_compressible_theorem. */
+void compress_proof(object const & thm);
 object mk_axiom(name const & n, expr const & t);
 object mk_var_decl(name const & n, expr const & t);
+/**
+   \brief Return a definition that shares \c obj, and has the given opaque flag. It returns \c obj if it already has this flag.
+   Objects are shared by environments and their snapshots, then they are not modified after they are created.
+
+   \pre obj.is_definition()
+*/
+object update_opaque(object const & obj, bool opaque);
 inline object mk_neutral(neutral_object_cell * c) { lean_assert(c->get_rc() == 1); return object(c); }
 
 void read_object(environment const & env, io_state const & ios, std::string const & k, deserializer & d);
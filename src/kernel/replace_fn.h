@@ -22,6 +22,15 @@ public:
     void operator()(expr const &, expr const &) {}
 };
 
+/**
+   \brief Default replace_fn skip predicate functional object.
+   It does not skip any subexpression.
+*/
+class default_replace_skip {
+public:
+    bool operator()(expr const &, unsigned) { return false; }
+};
+
 /**
    \brief Functional for applying <tt>F</tt> to the subexpressions of a given expression.
 
@@ -34,8 +43,13 @@ public:
 
    P is a "post-processing" functional object that is applied to each
    pair (old, new)
+
+   S is a predicate with signature
+   expr const &, unsigned -> bool
+   When <tt>S(s, n)</tt> is true, the subexpression \c s (at scope level n) is
+   not modified, and F is not invoked for it and its subexpressions.
 */
-template<typename F, typename P = default_replace_postprocessor>
+template<typename F, typename P = default_replace_postprocessor, typename S = default_replace_skip>
 class replace_fn {
     static_assert(std::is_same<typename std::result_of<F(expr const &, unsigned)>::type, expr>::value,
                   "replace_fn: return type of F is not expr");
@@ -57,6 +71,7 @@ class replace_fn {
     expr_cell_offset_map<expr> m_cache;
     F                          m_f;
     P                          m_post;
+    S                          m_skip;
     frame_stack                m_fs;
     result_stack               m_rs;
 
@@ -83,6 +98,10 @@ class replace_fn {
        The idea is that after the frame is processed, the result will be on the result stack.
     */
     bool visit(expr const & e, unsigned offset) {
+        if (m_skip(e, offset)) {
+            save_result(e, e, offset, false);
+            return true;
+        }
         bool shared = false;
         if (is_shared(e)) {
             expr_cell_offset p(e.raw(), offset);
@@ -127,9 +146,10 @@ class replace_fn {
     }
 
 public:
-    replace_fn(F const & f, P const & p = P()):
+    replace_fn(F const & f, P const & p = P(), S const & s = S()):
         m_f(f),
-        m_post(p) {
+        m_post(p),
+        m_skip(s) {
     }
 
     expr operator()(expr const & e) {
@@ -229,4 +249,10 @@ template<typename F, typename P>
 expr replace(expr const & e, F f, P p) {
     return replace_fn<F, P>(f, p)(e);
 }
+
+/** \brief Similar to \c replace, but the subexpressions \c s s.t. <tt>skip(s, n)</tt> is true are not visited. */
+template<typename F, typename S>
+expr replace_skip(expr const & e, F f, S skip) {
+    return replace_fn<F, default_replace_postprocessor, S>(f, default_replace_postprocessor(), skip)(e);
+}
 }
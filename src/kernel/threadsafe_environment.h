@@ -5,6 +5,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
+#include <memory>
+#include "util/thread.h"
 #include "util/shared_mutex.h"
 #include "kernel/environment.h"
 
@@ -14,9 +16,46 @@ namespace lean {
    The helper classes \c read_only_shared_environment and \c read_write_shared_environment
    provides thread safe access to the environment object.
 
+   Read-only queries should use <tt>env->get_snapshot()</tt> instead of \c read_only_shared_environment.
+   The snapshot is immutable and reference counted, so it is read without any lock.
+   A writer publishes a new snapshot when it releases its \c read_write_shared_environment.
+   Thus, readers never wait for writers, and writers never wait for readers using snapshots.
+
    \remark We do not use these classes internally.
    They are only used for implementing external APIs.
 */
+class environment_snapshot {
+    friend class environment_cell;
+    // Objects of the environment and its ancestors. It is a persistent data structure,
+    // then consecutive snapshots share most of it. The objects (and their opaque flags) are never modified.
+    environment_cell::object_index                       m_objects;
+    unsigned                                             m_num_ancestors;
+    // Value of environment_cell::m_objects_version when the snapshot was created.
+    unsigned                                             m_version;
+    std::shared_ptr<universes const>                     m_universes;
+    // Environment used to type check and normalize expressions, see \c get_environment.
+    mutable mutex                                        m_env_mutex;
+    mutable std::shared_ptr<environment_cell>            m_env;
+    environment_snapshot();
+    environment_snapshot(environment_snapshot const & s);
+public:
+    ~environment_snapshot();
+    unsigned get_num_objects(bool local) const;
+    object const & get_object(unsigned i, bool local) const;
+    optional<object> find_object(name const & n) const;
+    bool has_object(name const & n) const { return static_cast<bool>(find_object(n)); }
+    /** \brief Return true iff l1 >= l2 is implied by the universe constraints of the snapshot. */
+    bool is_ge(level const & l1, level const & l2) const;
+    optional<int> get_universe_distance(name const & u1, name const & u2) const;
+
+    ro_environment get_environment() const;
+    /** \brief Type check the given expression using the objects of the snapshot. */
+    expr type_check(expr const & e, context const & ctx = context()) const;
+    expr infer_type(expr const & e, context const & ctx = context()) const;
+    expr normalize(expr const & e, context const & ctx = context(), bool unfold_opaque = false) const;
+    bool is_proposition(expr const & e, context const & ctx = context()) const;
+};
+
 class read_only_shared_environment {
     ro_environment m_env;
     shared_lock    m_lock;
@@ -17,6 +17,14 @@ Author: Leonardo de Moura
 #include "kernel/free_vars.h"
 #include "kernel/type_checker_justification.h"
 
+#ifndef LEAN_TYPE_CHECKER_MAX_CACHE_SIZE
+#define LEAN_TYPE_CHECKER_MAX_CACHE_SIZE (1024*128)
+#endif
+
+#ifndef LEAN_TYPE_CHECKER_LAZY_DELTA_MAX_STEPS
+#define LEAN_TYPE_CHECKER_LAZY_DELTA_MAX_STEPS (1024*4)
+#endif
+
 namespace lean {
 expr pi_body_at(expr const & pi, expr const & a) {
     lean_assert(is_pi(pi));
@@ -35,12 +43,22 @@ class type_checker::imp {
     typedef buffer<unification_constraint> unification_constraints;
 
     ro_environment::weak_ref  m_env;
-    cache                     m_cache;
+    /*
+       The cached results are valid for the context m_ctx and the metavariable environment m_menv
+       (at the timestamp stored in it). They survive across top-level calls, and they are only
+       invalidated when one of these is modified. We use a different cache for each value of the
+       flag m_infer_only.
+    */
+    cache                     m_cache[2];
     normalizer                m_normalizer;
     context                   m_ctx;
     cached_metavar_env        m_menv;
     unification_constraints * m_uc;
     bool                      m_infer_only;
+    unsigned                  m_lazy_steps;  // number of steps the lazy convertibility check can still perform
+    unsigned                  m_num_cache_hits;
+
+    cache & get_cache() { return m_cache[m_infer_only]; }
 
     ro_environment env() const { return ro_environment(m_env); }
     expr lift_free_vars(expr const & e, unsigned s, unsigned d) { return ::lean::lift_free_vars(e, s, d, m_menv.to_some_ro_menv()); }
@@ -145,7 +163,7 @@ class type_checker::imp {
 
     expr save_result(expr const & e, expr const & r, bool shared) {
         if (shared)
-            m_cache[e] = r;
+            get_cache()[e] = r;
         return r;
     }
 
@@ -210,9 +228,12 @@ class type_checker::imp {
         bool shared = false;
         if (is_shared(e)) {
             shared = true;
-            auto it = m_cache.find(e);
-            if (it != m_cache.end())
+            cache const & c = get_cache();
+            auto it = c.find(e);
+            if (it != c.end()) {
+                m_num_cache_hits++;
                 return it->second;
+            }
         }
 
         expr r;
@@ -307,7 +328,7 @@ class type_checker::imp {
                 check_type(d, abst_domain(e), ctx);
             }
             {
-                freset<cache> reset(m_cache);
+                freset<cache> reset(get_cache());
                 r = mk_pi(abst_name(e), abst_domain(e), infer_type_core(abst_body(e), extend(ctx, abst_name(e), abst_domain(e))));
             }
             break;
@@ -318,7 +339,7 @@ class type_checker::imp {
             expr t2;
             context new_ctx = extend(ctx, abst_name(e), abst_domain(e));
             {
-                freset<cache> reset(m_cache);
+                freset<cache> reset(get_cache());
                 t2 = check_type(infer_type_core(abst_body(e), new_ctx), abst_body(e), new_ctx);
             }
             if (is_bool(t2)) {
@@ -358,7 +379,7 @@ class type_checker::imp {
                 }
             }
             {
-                freset<cache> reset(m_cache);
+                freset<cache> reset(get_cache());
                 expr t = infer_type_core(let_body(e), extend(ctx, let_name(e), lt, let_value(e)));
                 r = instantiate(t, let_value(e));
             }
@@ -392,10 +413,160 @@ class type_checker::imp {
         }
     }
 
+    /**
+        \brief Put \c e in weak head normal form without unfolding definitions.
+        That is, apply beta, let and projection reductions to the head of \c e.
+    */
+    expr whnf_core(expr e) {
+        while (true) {
+            switch (e.kind()) {
+            case expr_kind::App:
+                if (!is_lambda(arg(e, 0)))
+                    return e;
+                e = head_beta_reduce(e, m_menv.to_some_ro_menv());
+                break;
+            case expr_kind::Let:
+                e = instantiate(let_body(e), let_value(e));
+                break;
+            case expr_kind::Proj: {
+                expr p = whnf_core(proj_arg(e));
+                if (!is_dep_pair(p))
+                    return e;
+                e = proj_first(e) ? pair_first(p) : pair_second(p);
+                break;
+            }
+            default:
+                return e;
+            }
+        }
+    }
+
+    /** \brief Return the definition that should be unfolded to reduce \c e, if \c e is a constant or an application of a constant. */
+    optional<object> get_unfoldable(expr const & e) {
+        expr const & f = is_app(e) ? arg(e, 0) : e;
+        if (!is_constant(f))
+            return none_object();
+        optional<object> obj = env()->find_object(const_name(f));
+        if (should_unfold(obj))
+            return obj;
+        return none_object();
+    }
+
+    /** \brief Replace the head of \c e (see \c get_unfoldable) with the value of \c d, and put the result in weak head normal form. */
+    expr unfold(expr const & e, object const & d) {
+        if (is_app(e)) {
+            buffer<expr> new_args;
+            new_args.push_back(d.get_value());
+            new_args.append(num_args(e) - 1, &arg(e, 1));
+            return whnf_core(mk_app(new_args.size(), new_args.data()));
+        } else {
+            return whnf_core(d.get_value());
+        }
+    }
+
+    /** \brief Return true iff all arguments of the applications \c t and \c s are definitionally equal. */
+    bool is_def_eq_args(expr const & t, expr const & s) {
+        if (num_args(t) != num_args(s))
+            return false;
+        for (unsigned i = 1; i < num_args(t); i++) {
+            if (!is_convertible_lazy(arg(t, i), arg(s, i), true))
+                return false;
+        }
+        return true;
+    }
+
+    /**
+        \brief Check whether \c t is convertible to \c s (or definitionally equal to when \c def_eq is true)
+        without normalizing them.
+
+        Both terms are reduced to weak head normal form. While their heads are not the same, we
+        unfold the definition with the higher weight. The weight of a definition is greater than the
+        weight of all definitions it uses, so it is never necessary to unfold the one with the
+        lower weight to expose the other. When both heads are the same constant, we try to compare
+        the arguments before unfolding.
+
+        This method is a sound, but incomplete, procedure: when it returns false, the terms may still
+        be convertible (e.g., they contain metavariables or builtin values that must be evaluated), and
+        the caller must fall back to full normalization. The amount of work is bounded by \c m_lazy_steps.
+    */
+    bool is_convertible_lazy(expr const & t, expr const & s, bool def_eq) {
+        if (t == s)
+            return true;
+        if (m_lazy_steps == 0)
+            return false;
+        m_lazy_steps--;
+        check_system("type checker");
+        expr t_n = whnf_core(t);
+        expr s_n = whnf_core(s);
+        while (true) {
+            if (t_n == s_n)
+                return true;
+            optional<object> d_t = get_unfoldable(t_n);
+            optional<object> d_s = get_unfoldable(s_n);
+            if (!d_t && !d_s)
+                break;
+            if (d_t && d_s && d_t->get_name() == d_s->get_name()) {
+                if (is_app(t_n) && is_app(s_n) && is_def_eq_args(t_n, s_n))
+                    return true;
+                t_n = unfold(t_n, *d_t);
+                s_n = unfold(s_n, *d_s);
+            } else if (d_t && (!d_s || d_t->get_weight() > d_s->get_weight())) {
+                t_n = unfold(t_n, *d_t);
+            } else if (d_s && (!d_t || d_s->get_weight() > d_t->get_weight())) {
+                s_n = unfold(s_n, *d_s);
+            } else {
+                t_n = unfold(t_n, *d_t);
+                s_n = unfold(s_n, *d_s);
+            }
+            if (m_lazy_steps == 0)
+                return false;
+            m_lazy_steps--;
+        }
+
+        if (is_type(t_n) && is_type(s_n))
+            return def_eq ? ty_level(t_n) == ty_level(s_n) : env()->is_ge(ty_level(s_n), ty_level(t_n));
+        if (!def_eq && is_type(s_n) && t_n == mk_bool_type())
+            return true;
+        if (t_n.kind() != s_n.kind())
+            return false;
+        switch (t_n.kind()) {
+        case expr_kind::Pi:
+            return
+                is_convertible_lazy(abst_domain(t_n), abst_domain(s_n), true) &&
+                is_convertible_lazy(abst_body(t_n), abst_body(s_n), def_eq);
+        case expr_kind::Lambda: case expr_kind::Sigma:
+            return
+                is_convertible_lazy(abst_domain(t_n), abst_domain(s_n), true) &&
+                is_convertible_lazy(abst_body(t_n), abst_body(s_n), true);
+        case expr_kind::App:
+            return
+                is_convertible_lazy(arg(t_n, 0), arg(s_n, 0), true) &&
+                is_def_eq_args(t_n, s_n);
+        case expr_kind::HEq:
+            return
+                is_convertible_lazy(heq_lhs(t_n), heq_lhs(s_n), true) &&
+                is_convertible_lazy(heq_rhs(t_n), heq_rhs(s_n), true);
+        case expr_kind::Pair:
+            return
+                is_convertible_lazy(pair_first(t_n), pair_first(s_n), true) &&
+                is_convertible_lazy(pair_second(t_n), pair_second(s_n), true) &&
+                is_convertible_lazy(pair_type(t_n), pair_type(s_n), true);
+        case expr_kind::Proj:
+            return
+                proj_first(t_n) == proj_first(s_n) &&
+                is_convertible_lazy(proj_arg(t_n), proj_arg(s_n), true);
+        default:
+            return false;
+        }
+    }
+
     template<typename MkJustification>
     bool is_convertible(expr const & given, expr const & expected, context const & ctx, MkJustification const & mk_justification) {
         if (is_convertible_core(given, expected))
             return true;
+        m_lazy_steps = LEAN_TYPE_CHECKER_LAZY_DELTA_MAX_STEPS;
+        if (is_convertible_lazy(given, expected, false))
+            return true;
         expr new_given    = normalize(given, ctx, false);
         expr new_expected = normalize(expected, ctx, false);
         if (is_convertible_core(new_given, new_expected))
@@ -409,7 +580,7 @@ class type_checker::imp {
 
     void set_ctx(context const & ctx) {
         if (!is_eqp(m_ctx, ctx)) {
-            clear();
+            clear_cache();
             m_ctx = ctx;
         }
     }
@@ -419,18 +590,26 @@ class type_checker::imp {
             clear_cache();
     }
 
-    struct set_infer_only {
-        imp & m_ref;
-        bool  m_old_infer_only;
-        set_infer_only(imp & r, bool flag):m_ref(r), m_old_infer_only(m_ref.m_infer_only) {
-            if (m_ref.m_infer_only != flag)
-                m_ref.clear_cache();
-            m_ref.m_infer_only = flag;
+    /** \brief Make sure the caches do not grow without bounds. */
+    void prepare_cache() {
+        for (cache & c : m_cache) {
+            if (c.size() > LEAN_TYPE_CHECKER_MAX_CACHE_SIZE)
+                c.clear();
         }
-        ~set_infer_only() {
-            if (m_ref.m_infer_only != m_old_infer_only)
+    }
+
+    /**
+        \brief Auxiliary object for discarding the results cached by a top-level call
+        that produced unification constraints. These results are only valid with respect to
+        the constraints stored in the buffer provided by the caller.
+    */
+    struct uc_cache_guard {
+        imp &    m_ref;
+        unsigned m_num_uc;
+        uc_cache_guard(imp & r):m_ref(r), m_num_uc(r.m_uc ? r.m_uc->size() : 0) {}
+        ~uc_cache_guard() {
+            if (m_ref.m_uc && m_ref.m_uc->size() != m_num_uc)
                 m_ref.clear_cache();
-            m_ref.m_infer_only = m_old_infer_only;
         }
     };
 
@@ -440,15 +619,18 @@ public:
         m_normalizer(env) {
         m_uc              = nullptr;
         m_infer_only      = infer_only;
+        m_lazy_steps      = 0;
+        m_num_cache_hits  = 0;
     }
 
     expr infer_check(expr const & e, context const & ctx, optional<metavar_env> const & menv, buffer<unification_constraint> * uc,
                      bool infer_only) {
-        clear_cache(); // temp hack
-        set_infer_only set(*this, infer_only);
+        flet<bool> set_infer_only(m_infer_only, infer_only);
         set_ctx(ctx);
         update_menv(menv);
+        prepare_cache();
         flet<unification_constraints*> set_uc(m_uc, uc);
+        uc_cache_guard guard(*this);
         return infer_type_core(e, ctx);
     }
 
@@ -474,6 +656,9 @@ public:
         update_menv(menv);
         if (t1 == t2)
             return true;
+        m_lazy_steps = LEAN_TYPE_CHECKER_LAZY_DELTA_MAX_STEPS;
+        if (is_convertible_lazy(t1, t2, true))
+            return true;
         expr new_t1 = normalize(t1, ctx, false);
         expr new_t2 = normalize(t2, ctx, false);
         return new_t1 == new_t2;
@@ -482,6 +667,7 @@ public:
     void check_type(expr const & e, context const & ctx) {
         set_ctx(ctx);
         update_menv(none_menv());
+        prepare_cache();
         expr t = infer_type_core(e, ctx);
         check_type(t, e, ctx);
     }
@@ -524,12 +710,13 @@ public:
     }
 
     void clear_cache() {
-        m_cache.clear();
-        m_normalizer.clear();
+        m_cache[0].clear();
+        m_cache[1].clear();
     }
 
     void clear() {
         clear_cache();
+        m_normalizer.clear();
         m_menv.clear();
         m_ctx = context();
     }
@@ -537,6 +724,8 @@ public:
     normalizer & get_normalizer() {
         return m_normalizer;
     }
+
+    unsigned get_num_cache_hits() const { return m_num_cache_hits; }
 };
 
 type_checker::type_checker(ro_environment const & env, bool infer_only):m_ptr(new imp(env, infer_only)) {}
@@ -621,6 +810,7 @@ bool type_checker::is_flex_proposition(expr const & e, context const & ctx) {
 }
 void type_checker::clear() { m_ptr->clear(); }
 normalizer & type_checker::get_normalizer() { return m_ptr->get_normalizer(); }
+unsigned type_checker::get_num_cache_hits() const { return m_ptr->get_num_cache_hits(); }
 expr  type_check(expr const & e, ro_environment const & env, context const & ctx) {
     return type_checker(env).check(e, ctx);
 }
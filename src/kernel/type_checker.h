@@ -118,6 +118,9 @@ public:
 
     /** \brief Return reference to the normalizer used by this type checker. */
     normalizer & get_normalizer();
+
+    /** \brief Return the number of results that were reused from the cache (for profiling and testing). */
+    unsigned get_num_cache_hits() const;
 };
 class type_inferer : public type_checker {
 public:
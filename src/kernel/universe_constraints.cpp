@@ -6,29 +6,103 @@ Author: Leonardo de Moura
 */
 #include <utility>
 #include <vector>
+#include <algorithm>
+#include <deque>
 #include "util/safe_arith.h"
 #include "util/pair.h"
-#include "util/buffer.h"
+#include "util/name_set.h"
 #include "kernel/universe_constraints.h"
 
 namespace lean {
+universe_constraints::universe_constraints(universe_constraints const & s):
+    m_incoming_edges(s.m_incoming_edges), m_outgoing_edges(s.m_outgoing_edges), m_cache_size(0) {
+}
+
+/**
+   \brief Update the distances \c d, assuming the distance to \c n is at least \c k.
+   That is, compute the longest paths that go through \c n.
+
+   The graph may contain cycles (e.g., n1 >= n2 and n2 >= n1), then we cannot simply process
+   the variables in topological order. We use a FIFO queue of variables whose distance was
+   improved (i.e., Bellman-Ford). Since the graph does not contain positive cycles, the distance
+   of a variable is updated at most once per round, and there are at most V rounds, where V is
+   the number of variables reachable from \c n. So, the procedure performs at most O(V*E) steps.
+   A LIFO order may revisit the same variables an exponential number of times.
+*/
+void universe_constraints::propagate(node_to_edges const & es, distances & d, name const & n, int k) {
+    auto it = d.find(n);
+    if (it != d.end() && it->second >= k)
+        return;
+    d[n] = k;
+    std::deque<name> todo;
+    name_set         in_todo; // variables in todo
+    todo.push_back(n);
+    in_todo.insert(n);
+    while (!todo.empty()) {
+        name m = todo.front();
+        todo.pop_front();
+        in_todo.erase(m);
+        int dm = d[m];
+        auto es_it = es.find(m);
+        if (es_it == es.end())
+            continue;
+        for (edge const & e : es_it->second) {
+            int new_k = dm + e.second;
+            auto d_it = d.find(e.first);
+            if (d_it == d.end()) {
+                d.insert(mk_pair(e.first, new_k));
+            } else if (new_k > d_it->second) {
+                d_it->second = new_k;
+            } else {
+                continue;
+            }
+            if (in_todo.insert(e.first).second)
+                todo.push_back(e.first);
+        }
+    }
+}
+
+universe_constraints::distances universe_constraints::longest_paths(node_to_edges const & es, name const & n) {
+    distances d;
+    propagate(es, d, n, 0);
+    return d;
+}
+
+universe_constraints::distances const & universe_constraints::get_distances_from(name const & n) const {
+    auto it = m_cache.find(n);
+    if (it != m_cache.end())
+        return it->second;
+    if (m_cache_size > LEAN_UNIVERSE_DISTANCE_CACHE_SIZE) {
+        m_cache.clear();
+        m_cache_size = 0;
+    }
+    distances const & d = m_cache.insert(mk_pair(n, longest_paths(m_outgoing_edges, n))).first->second;
+    m_cache_size += d.size();
+    return d;
+}
+
 optional<int> universe_constraints::get_distance(name const & n1, name const & n2) const {
-    auto it = m_distances.find(mk_pair(n1, n2));
-    if (it != m_distances.end())
+    if (!contains(n1) || !contains(n2))
+        return optional<int>();
+    if (n1 == n2)
+        return optional<int>(0);
+    lock_guard<mutex> lock(m_cache_mutex);
+    distances const & d = get_distances_from(n1);
+    auto it = d.find(n2);
+    if (it != d.end())
         return optional<int>(it->second);
     else
         return optional<int>();
 }
 
 void universe_constraints::add_var(name const & n) {
-    lean_assert(!get_distance(n, n));
-    m_distances[mk_pair(n, n)] = 0;
-    m_outgoing_edges[n].emplace_back(n, 0);
-    m_incoming_edges[n].emplace_back(n, 0);
+    lean_assert(!contains(n));
+    m_outgoing_edges[n];
+    m_incoming_edges[n];
 }
 
 bool universe_constraints::contains(name const & n) const {
-    return static_cast<bool>(get_distance(n, n));
+    return m_outgoing_edges.find(n) != m_outgoing_edges.end();
 }
 
 bool universe_constraints::is_implied(name const & n1, name const & n2, int k) const {
@@ -42,55 +116,37 @@ bool universe_constraints::is_consistent(name const & n1, name const & n2, int k
 }
 
 bool universe_constraints::overflows(name const & n1, name const & n2, int k) const {
+    // The new constraint creates paths x -> n1 -> n2 -> y
+    distances in  = longest_paths(m_incoming_edges, n1);
+    distances out = longest_paths(m_outgoing_edges, n2);
+    auto cmp = [](std::pair<name const, int> const & p1, std::pair<name const, int> const & p2) { return p1.second < p2.second; };
+    auto in_range  = std::minmax_element(in.begin(), in.end(), cmp);
+    auto out_range = std::minmax_element(out.begin(), out.end(), cmp);
     try {
-        auto it1 = m_incoming_edges.find(n1);
-        if (it1 != m_incoming_edges.end()) {
-            for (auto const & in : it1->second)
-                safe_add(in.second, k);
-        }
-        auto it2 = m_outgoing_edges.find(n2);
-        if (it2 != m_outgoing_edges.end()) {
-            for (auto const & out : it2->second)
-                safe_add(out.second, k);
-        }
+        safe_add(safe_add(in_range.first->second, k), out_range.first->second);
+        safe_add(safe_add(in_range.second->second, k), out_range.second->second);
         return false;
     } catch (...) {
         return true;
     }
 }
 
-/**
-    \brief Add the pair (n, k) to entries if it does not contain an entry (n, k').
-    Otherwise, replace entry (n, k') with (n, k).
-*/
-static void updt_entry(std::vector<std::pair<name, int>> & entries, name const & n, int k) {
-    auto it = std::find_if(entries.begin(), entries.end(), [&](std::pair<name, int> const & p) { return p.first == n; });
-    if (it == entries.end())
-        entries.emplace_back(n, k);
-    else
-        it->second = k;
-}
-
 void universe_constraints::add_constraint(name const & n1, name const & n2, int k) {
     lean_assert(contains(n1));
     lean_assert(contains(n2));
     lean_assert(is_consistent(n1, n2, k));
     if (is_implied(n1, n2, k))
         return; // redundant
-    buffer<std::tuple<name, name, int>> to_add;
-    for (auto const & in : m_incoming_edges[n1])
-        to_add.emplace_back(in.first, n2, safe_add(in.second, k));
-    for (auto const & out : m_outgoing_edges[n2])
-        to_add.emplace_back(n1, out.first, safe_add(out.second, k));
-    for (auto const & e : to_add) {
-        name const & from = std::get<0>(e);
-        name const & to   = std::get<1>(e);
-        int new_k         = std::get<2>(e);
-        auto old_k        = get_distance(from, to);
-        if (!old_k || new_k > *old_k) {
-            updt_entry(m_outgoing_edges[from], to, new_k);
-            updt_entry(m_incoming_edges[to], from, new_k);
-            m_distances[mk_pair(from, to)] = new_k;
+    m_outgoing_edges[n1].emplace_back(n2, k);
+    m_incoming_edges[n2].emplace_back(n1, k);
+    lock_guard<mutex> lock(m_cache_mutex);
+    for (auto & p : m_cache) {
+        distances & d = p.second;
+        auto it = d.find(n1);
+        if (it != d.end()) {
+            unsigned old_sz = d.size();
+            propagate(m_outgoing_edges, d, n2, it->second + k);
+            m_cache_size += d.size() - old_sz;
         }
     }
 }
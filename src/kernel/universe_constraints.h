@@ -5,34 +5,48 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
-#include <unordered_map>
 #include <utility>
-#include <functional>
 #include <vector>
+#include "util/thread.h"
 #include "util/name.h"
-#include "util/hash.h"
 #include "util/name_map.h"
 #include "util/optional.h"
 
+// Maximum number of distances stored in the cache of universe_constraints (the sum of the number
+// of variables reachable from each cached source). The cache is reset when it is exceeded.
+#ifndef LEAN_UNIVERSE_DISTANCE_CACHE_SIZE
+#define LEAN_UNIVERSE_DISTANCE_CACHE_SIZE 65536
+#endif
+
 namespace lean {
 /**
    \brief Store the set of universe constraints.
 
-   It is based on Floyd-Warshall all-pairs shortest path algorithm.
+   The constraints form a graph where an edge (n1, n2, k) represents the constraint n1 >= n2 + k.
+   We only store the edges that were added (and were not implied by the existing ones). The
+   distance between two variables is the weight of the longest path between them. The graph does not
+   contain positive cycles, since we only add consistent constraints. The distances from a variable
+   to all variables reachable from it are computed on demand, and cached. The cache is updated
+   incrementally when new constraints are added, and it is reset when it stores more than
+   LEAN_UNIVERSE_DISTANCE_CACHE_SIZE distances.
 */
 class universe_constraints {
     typedef std::pair<name, int> edge;
     typedef std::vector<edge> edges;
     typedef name_map<edges> node_to_edges;
-    typedef std::pair<name, name> name_pair;
-    struct name_pair_hash_fn {
-        unsigned operator()(name_pair const & p) const { return hash(p.first.hash(), p.second.hash()); }
-    };
-    typedef std::unordered_map<name_pair, int, name_pair_hash_fn, std::equal_to<name_pair>> distances;
-    node_to_edges m_incoming_edges;
-    node_to_edges m_outgoing_edges;
-    distances     m_distances;
+    typedef name_map<int> distances;
+    node_to_edges             m_incoming_edges;
+    node_to_edges             m_outgoing_edges;
+    mutable mutex             m_cache_mutex;
+    mutable name_map<distances> m_cache; // source -> longest distance to each reachable variable
+    mutable unsigned          m_cache_size; // total number of distances in m_cache
+
+    distances const & get_distances_from(name const & n) const;
+    static void propagate(node_to_edges const & es, distances & d, name const & n, int k);
+    static distances longest_paths(node_to_edges const & es, name const & n);
 public:
+    universe_constraints():m_cache_size(0) {}
+    universe_constraints(universe_constraints const & s);
     /**
        \brief Add a new variable.
 
@@ -71,6 +71,7 @@ public:
 };
 
 expr deep_copy(expr const & e) {
+    scoped_hash_consing disable(false);
     return deep_copy_fn()(e);
 }
 
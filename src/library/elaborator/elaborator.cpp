@@ -9,8 +9,11 @@ Author: Leonardo de Moura
 #include <utility>
 #include <algorithm>
 #include "util/list.h"
-#include "util/splay_tree.h"
+#include "util/avl_tree.h"
+#include "util/avl_map.h"
+#include "util/optional.h"
 #include "util/interrupt.h"
+#include "util/thread_pool.h"
 #include "util/sstream.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/formatter.h"
@@ -38,16 +41,23 @@ Author: Leonardo de Moura
 #define LEAN_ELABORATOR_INJECTIVITY true
 #endif
 
+#ifndef LEAN_ELABORATOR_PARALLEL
+#define LEAN_ELABORATOR_PARALLEL false
+#endif
+
 namespace lean {
 static name g_x_name("x");
 
 static name g_elaborator_max_steps      {"elaborator", "max_steps"};
 static name g_elaborator_use_normalizer {"elaborator", "use_normalizer"};
 static name g_elaborator_injectivity    {"elaborator", "injectivity"};
+static name g_elaborator_parallel       {"elaborator", "parallel"};
 
 RegisterUnsignedOption(g_elaborator_max_steps, LEAN_ELABORATOR_MAX_STEPS, "(elaborator) maximum number of steps");
 RegisterBoolOption(g_elaborator_use_normalizer, LEAN_ELABORATOR_USE_NORMALIZER,
                    "(elaborator) invoke normalizer during elaboration");
+RegisterBoolOption(g_elaborator_parallel, LEAN_ELABORATOR_PARALLEL,
+                   "(elaborator) explore the alternatives of the first choice case-split in parallel");
 RegisterBoolOption(g_elaborator_injectivity, LEAN_ELABORATOR_INJECTIVITY, "(elaborator) reduce unification constrainst of the form f(t1, t2) ≈ f(s1, s2)  into t1 ≈ s1 and t2 ≈ s2 even if f-applications are not in head normal form");
 
 unsigned get_elaborator_max_steps(options const & opts) {
@@ -59,36 +69,42 @@ bool get_elaborator_use_normalizer(options const & opts) {
 bool get_elaborator_injectivity(options const & opts) {
     return opts.get_bool(g_elaborator_injectivity, LEAN_ELABORATOR_INJECTIVITY);
 }
+bool get_elaborator_parallel(options const & opts) {
+    return opts.get_bool(g_elaborator_parallel, LEAN_ELABORATOR_PARALLEL);
+}
 
 class elaborator::imp {
-    typedef splay_tree<name, name_cmp>                         name_set;
+    typedef avl_tree<name, name_cmp>                           name_set;
     typedef list<unification_constraint>                       cnstr_list;
     typedef list<name>                                         name_list;
-    typedef list<std::pair<unification_constraint, name_list>> delayed_cnstr_list;
+    struct id_cmp { int operator()(unsigned i1, unsigned i2) const { return i1 < i2 ? -1 : (i1 > i2 ? 1 : 0); } };
+    /**
+       \brief Delayed constraints indexed by the order they were delayed.
+       The oldest constraint has the smallest id.
+       (avl_map values must be default constructible, thus we use optional.)
+    */
+    typedef avl_map<unsigned, optional<unification_constraint>, id_cmp> delayed_cnstr_map;
+    /**
+       \brief Mapping from metavariables to the ids of the delayed constraints that contain them.
+       The lists may contain ids of constraints that are not delayed anymore.
+    */
+    typedef avl_map<name, list<unsigned>, name_quick_cmp> watch_map;
 
+    /**
+       \brief The metavariable environment is shared by all states. Case-splits use
+       its scopes (see metavar_env_cell::push) to undo the updates performed by failed branches.
+    */
     struct state {
         metavar_env        m_menv;
         cnstr_list         m_active_cnstrs;
-        delayed_cnstr_list m_delayed_cnstrs;
+        delayed_cnstr_map  m_delayed_cnstrs;
+        watch_map          m_watches;
+        unsigned           m_next_delayed_id;
         name_set           m_recently_assigned; // recently assigned metavars
         state(metavar_env const & menv, unsigned num_cnstrs, unification_constraint const * cnstrs):
             m_menv(menv.copy()),
-            m_active_cnstrs(to_list(cnstrs, cnstrs + num_cnstrs)) {
-        }
-
-        state(state const & other):
-            m_menv(other.m_menv.copy()),
-            m_active_cnstrs(other.m_active_cnstrs),
-            m_delayed_cnstrs(other.m_delayed_cnstrs),
-            m_recently_assigned(other.m_recently_assigned) {
-        }
-
-        state & operator=(state const & other) {
-            m_menv  = other.m_menv.copy();
-            m_active_cnstrs = other.m_active_cnstrs;
-            m_delayed_cnstrs = other.m_delayed_cnstrs;
-            m_recently_assigned = other.m_recently_assigned;
-            return *this;
+            m_active_cnstrs(to_list(cnstrs, cnstrs + num_cnstrs)),
+            m_next_delayed_id(0) {
         }
     };
 
@@ -98,9 +114,10 @@ class elaborator::imp {
     struct case_split {
         justification              m_curr_assumption; // object used to justify current split
         state                      m_prev_state;
+        unsigned                   m_scope_lvl; // number of scopes in the metavariable environment when the split was created
         std::vector<justification> m_failed_justifications; // justifications for failed branches
 
-        case_split(state const & prev_state):m_prev_state(prev_state) {}
+        case_split(state const & prev_state):m_prev_state(prev_state), m_scope_lvl(prev_state.m_menv->num_scopes()) {}
         virtual ~case_split() {}
 
         virtual bool next(imp & owner) = 0;
@@ -187,12 +204,14 @@ class elaborator::imp {
     bool                                     m_use_normalizer;
     bool                                     m_assume_injectivity;
     unsigned                                 m_max_steps;
+    bool                                     m_parallel;
 
     void set_options(options const & o) {
         m_use_justifications = true;
         m_use_normalizer     = get_elaborator_use_normalizer(o);
         m_assume_injectivity = get_elaborator_injectivity(o);
         m_max_steps          = get_elaborator_max_steps(o);
+        m_parallel           = get_elaborator_parallel(o);
     }
 
     void check_system() {
@@ -255,9 +274,57 @@ class elaborator::imp {
         return s.fold([](name const & n, name_list const & l) { return cons(n, l); }, name_list());
     }
 
-    /** \brief Add given constraint to the delayed list */
+    /**
+       \brief Add given constraint to the delayed set, and register it in the
+       watch lists of the metavariables it contains.
+    */
     void push_delayed(unification_constraint const & c) {
-        m_state.m_delayed_cnstrs.emplace_front(c, collect_mvars(c));
+        unsigned id = m_state.m_next_delayed_id;
+        m_state.m_next_delayed_id++;
+        m_state.m_delayed_cnstrs.insert(id, optional<unification_constraint>(c));
+        for (name const & m : collect_mvars(c)) {
+            list<unsigned> const * ids = m_state.m_watches.find(m);
+            m_state.m_watches.insert(m, cons(id, ids ? *ids : list<unsigned>()));
+        }
+    }
+
+    /**
+       \brief Move the delayed constraints watched by the recently assigned metavariables
+       to the active list. The constraints are moved in the order they were delayed.
+    */
+    void wakeup_delayed() {
+        buffer<unsigned> ids;
+        m_state.m_recently_assigned.for_each([&](name const & m) {
+                if (list<unsigned> const * ws = m_state.m_watches.find(m)) {
+                    for (unsigned id : *ws)
+                        ids.push_back(id);
+                    m_state.m_watches.erase(m);
+                }
+            });
+        // push the newest first, then the oldest one is at the front of the active list
+        std::sort(ids.begin(), ids.end(), [](unsigned i1, unsigned i2) { return i1 > i2; });
+        for (unsigned id : ids) {
+            if (optional<unification_constraint> const * c = m_state.m_delayed_cnstrs.find(id)) {
+                push_active(**c);
+                m_state.m_delayed_cnstrs.erase(id);
+            }
+        }
+    }
+
+    /**
+       \brief Remove the oldest delayed constraint that satisfies \c p.
+       \c p is not applied to the constraints delayed after it.
+    */
+    template<typename P>
+    void remove_oldest_delayed(P && p) {
+        buffer<std::pair<unsigned, unification_constraint>> cs;
+        m_state.m_delayed_cnstrs.for_each([&](unsigned id, optional<unification_constraint> const & c) { cs.emplace_back(id, *c); });
+        for (auto const & e : cs) {
+            if (p(e.second)) {
+                m_state.m_delayed_cnstrs.erase(e.first);
+                return;
+            }
+        }
     }
 
     /** \brief Return true iff \c m is an assigned metavariable in the current state */
@@ -434,7 +501,7 @@ class elaborator::imp {
     }
 
     justification mk_failure_justification(unification_constraint const & c) {
-        return justification(new unification_failure_justification(c, m_state.m_menv.copy()));
+        return justification(new unification_failure_justification(c, metavar_env_snapshot(m_state.m_menv)));
     }
 
     /**
@@ -1465,11 +1532,12 @@ class elaborator::imp {
             if (p(c))
                 return true;
         }
-        for (auto const & c : m_state.m_delayed_cnstrs) {
-            if (p(c.first))
-                return true;
-        }
-        return false;
+        bool found = false;
+        m_state.m_delayed_cnstrs.for_each([&](unsigned, optional<unification_constraint> const & c) {
+                if (!found && p(*c))
+                    found = true;
+            });
+        return found;
     }
 
     /**
@@ -1907,6 +1975,10 @@ class elaborator::imp {
     }
 
     bool process_choice(unification_constraint const & c) {
+#if defined(LEAN_MULTI_THREAD)
+        if (m_parallel && !m_plugin && m_case_splits.empty() && choice_size(c) > 1)
+            return process_choice_par(c);
+#endif
         std::unique_ptr<case_split> new_cs(new choice_case_split(c, m_state));
         bool r = new_cs->next(*this);
         lean_assert(r);
@@ -1914,6 +1986,92 @@ class elaborator::imp {
         return r;
     }
 
+#if defined(LEAN_MULTI_THREAD)
+    /**
+       \brief Process the choice constraint \c c by elaborating each alternative on a worker thread.
+       Each worker uses a copy of the current state.
+
+       The result is the one the sequential search would produce: the first alternative
+       (in the order of \c c) that succeeds wins, and the workers for the following alternatives
+       are interrupted. The state and case-splits of the winner are adopted by this
+       elaborator, and a choice case-split for \c c is created. Thus, \c next can still produce
+       the remaining solutions, and the conflict justifications are the same.
+
+       \pre m_case_splits.empty()
+    */
+    bool process_choice_par(unification_constraint const & c) {
+        lean_assert(m_case_splits.empty());
+        std::unique_ptr<choice_case_split> new_cs(new choice_case_split(c, m_state));
+        unsigned num = choice_size(c);
+        std::vector<justification> assumptions;
+        for (unsigned i = 0; i < num; i++)
+            assumptions.push_back(mk_assumption());
+        std::vector<std::unique_ptr<imp>> workers;
+        for (unsigned i = 0; i < num; i++) {
+            state s(m_state);
+            s.m_menv = m_state.m_menv.copy();
+            workers.push_back(std::unique_ptr<imp>(new imp(*this, s)));
+            workers.back()->push_new_eq_constraint(get_context(c), choice_mvar(c), choice_ith(c, i), assumptions[i]);
+        }
+        std::vector<std::unique_ptr<exception>> exs(num);
+        std::vector<task> tasks;
+        tasks.reserve(num);
+        for (unsigned i = 0; i < num; i++) {
+            imp * w = workers[i].get();
+            std::unique_ptr<exception> * ex = &exs[i];
+            tasks.emplace_back([=]() {
+                    try {
+                        w->next();
+                    } catch (exception & e) {
+                        ex->reset(e.clone());
+                    } catch (...) {
+                        ex->reset(new exception("elaborator worker failed"));
+                    }
+                });
+        }
+        auto cancel = [&]() {
+            for (task & t : tasks)
+                t.request_interrupt();
+            for (task & t : tasks)
+                t.wait();
+        };
+        try {
+            for (unsigned i = 0; i < num; i++) {
+                wait_for(tasks[i], g_no_timeout);
+                if (!exs[i]) {
+                    cancel();
+                    imp & w = *workers[i];
+                    new_cs->m_idx             = i + 1;
+                    new_cs->m_curr_assumption = assumptions[i];
+                    m_state = w.m_state;
+                    m_case_splits.push_back(std::move(new_cs));
+                    for (auto & cs : w.m_case_splits)
+                        m_case_splits.push_back(std::move(cs));
+                    for (auto const & other : workers)
+                        m_next_id = std::max(m_next_id, other->m_next_id);
+                    return true;
+                }
+                elaborator_exception * e = dynamic_cast<elaborator_exception*>(exs[i].get());
+                if (e == nullptr) {
+                    cancel();
+                    exs[i]->rethrow();
+                } else if (!depends_on(e->get_justification(), assumptions[i])) {
+                    // the other alternatives would fail too
+                    cancel();
+                    m_conflict = e->get_justification();
+                    return false;
+                }
+                new_cs->m_failed_justifications.push_back(e->get_justification());
+            }
+        } catch (...) {
+            cancel();
+            throw;
+        }
+        m_conflict = mk_failure_by_cases_justification(c, *new_cs);
+        return false;
+    }
+#endif
+
     void resolve_conflict() {
         lean_assert(m_conflict);
 
@@ -1936,19 +2094,39 @@ class elaborator::imp {
         throw elaborator_exception(m_conflict);
     }
 
+    /**
+       \brief Undo the updates to the metavariable environment performed after the
+       case-split \c s was created, and return the environment.
+    */
+    metavar_env const & backtrack_menv(case_split & s) {
+        metavar_env const & menv = s.m_prev_state.m_menv;
+        menv->pop(menv->num_scopes() - s.m_scope_lvl);
+        return menv;
+    }
+
+    /** \brief Backtrack the metavariable environment, and create a scope for the next alternative of \c s. */
+    void start_case(case_split & s) {
+        backtrack_menv(s)->push();
+    }
+
+    justification mk_failure_by_cases_justification(unification_constraint const & c, case_split & s) {
+        return justification(new unification_failure_by_cases_justification(c, s.m_failed_justifications.size(),
+                                                                            s.m_failed_justifications.data(),
+                                                                            metavar_env_snapshot(backtrack_menv(s))));
+    }
+
     bool next_choice_case(choice_case_split & s) {
         unification_constraint & choice = s.m_choice;
         unsigned idx = s.m_idx;
         if (idx < choice_size(choice)) {
             s.m_idx++;
             s.m_curr_assumption = mk_assumption();
+            start_case(s);
             m_state = s.m_prev_state;
             push_new_eq_constraint(get_context(choice), choice_mvar(choice), choice_ith(choice, idx), s.m_curr_assumption);
             return true;
         } else {
-            m_conflict = justification(new unification_failure_by_cases_justification(choice, s.m_failed_justifications.size(),
-                                                                                      s.m_failed_justifications.data(),
-                                                                                      s.m_prev_state.m_menv));
+            m_conflict = mk_failure_by_cases_justification(choice, s);
             return false;
         }
     }
@@ -1959,12 +2137,11 @@ class elaborator::imp {
         if (idx < sz) {
             s.m_idx++;
             s.m_curr_assumption = s.m_assumptions[sz - idx - 1];
+            start_case(s);
             m_state             = s.m_states[sz - idx - 1];
             return true;
         } else {
-            m_conflict = justification(new unification_failure_by_cases_justification(s.m_constraint, s.m_failed_justifications.size(),
-                                                                                      s.m_failed_justifications.data(),
-                                                                                      s.m_prev_state.m_menv));
+            m_conflict = mk_failure_by_cases_justification(s.m_constraint, s);
             return false;
         }
     }
@@ -1972,9 +2149,13 @@ class elaborator::imp {
     bool next_plugin_case(plugin_case_split & s) {
         try {
             s.m_curr_assumption = mk_assumption();
+            // the alternative has its own metavariable environment
+            backtrack_menv(s);
             std::pair<metavar_env, list<unification_constraint>> r = s.m_alternatives->next(s.m_curr_assumption);
             m_state.m_active_cnstrs     = s.m_prev_state.m_active_cnstrs;
             m_state.m_delayed_cnstrs    = s.m_prev_state.m_delayed_cnstrs;
+            m_state.m_watches           = s.m_prev_state.m_watches;
+            m_state.m_next_delayed_id   = s.m_prev_state.m_next_delayed_id;
             m_state.m_recently_assigned = s.m_prev_state.m_recently_assigned;
             m_state.m_menv              = r.first;
             for (auto c : r.second) {
@@ -1982,92 +2163,63 @@ class elaborator::imp {
             }
             return true;
         } catch (exception & ex) {
-            m_conflict = justification(new unification_failure_by_cases_justification(s.m_constraint, s.m_failed_justifications.size(),
-                                                                                      s.m_failed_justifications.data(),
-                                                                                      s.m_prev_state.m_menv));
+            m_conflict = mk_failure_by_cases_justification(s.m_constraint, s);
             return false;
         }
     }
 
     bool process_delayed() {
-        name_set const & recently_assigned = m_state.m_recently_assigned;
-        m_state.m_delayed_cnstrs =
-            filter(m_state.m_delayed_cnstrs,
-                   [&](std::pair<unification_constraint, name_list> const & p) {
-                       bool found = false;
-                       for (auto const & m : p.second) {
-                           if (recently_assigned.contains(m)) {
-                               found = true;
-                               break;
-                           }
-                       }
-                       if (found) {
-                           push_active(p.first);
-                           return false;
-                       } else {
-                           return true;
-                       }
-                   });
-
+        wakeup_delayed();
         m_state.m_recently_assigned = name_set(); // reset
         lean_assert(m_state.m_recently_assigned.empty());
         if (!empty(m_state.m_active_cnstrs))
             return true;
         // second pass trying to apply process_meta_app
-        m_state.m_delayed_cnstrs =
-            remove_last(m_state.m_delayed_cnstrs,
-                        [&](std::pair<unification_constraint, name_list> const & p) {
-                            unification_constraint const & c = p.first;
-                            if (is_eq(c) || is_convertible(c)) {
-                                expr const & a = is_eq(c) ? eq_lhs(c) : convertible_from(c);
-                                expr const & b = is_eq(c) ? eq_rhs(c) : convertible_to(c);
-                                if ((process_meta_app(a, b, true, c) || process_meta_app(b, a, false, c))) {
-                                    // std::cout << "META_APP: "; display(std::cout, c); std::cout << "\n";
-                                    return true;
-                                }
-                            }
-                            return false;
-                        });
+        remove_oldest_delayed([&](unification_constraint const & c) {
+                if (is_eq(c) || is_convertible(c)) {
+                    expr const & a = is_eq(c) ? eq_lhs(c) : convertible_from(c);
+                    expr const & b = is_eq(c) ? eq_rhs(c) : convertible_to(c);
+                    if ((process_meta_app(a, b, true, c) || process_meta_app(b, a, false, c))) {
+                        // std::cout << "META_APP: "; display(std::cout, c); std::cout << "\n";
+                        return true;
+                    }
+                }
+                return false;
+            });
         if (!empty(m_state.m_active_cnstrs))
             return true;
         // final pass trying expensive constraints
-        m_state.m_delayed_cnstrs =
-            remove_last(m_state.m_delayed_cnstrs,
-                        [&](std::pair<unification_constraint, name_list> const & p) {
-                            unification_constraint const & c = p.first;
-                            if (is_eq(c) || is_convertible(c)) {
-                                // std::cout << "EXPENSIVE: "; display(std::cout, c); std::cout << "\n";
-                                expr const & a = is_eq(c) ? eq_lhs(c) : convertible_from(c);
-                                expr const & b = is_eq(c) ? eq_rhs(c) : convertible_to(c);
-                                if (process_lower(a, b, c) ||
-                                    process_upper(a, b, c) ||
-                                    process_metavar_inst(a, b, true, c) ||
-                                    process_metavar_inst(b, a, false, c) ||
-                                    process_metavar_lift_abstraction(a, b, c) ||
-                                    process_metavar_lift_abstraction(b, a, c) ||
-                                    process_meta_app(a, b, true, c, false, true) ||
-                                    process_meta_app(b, a, false, c, false, true) ||
-                                    process_meta_app(a, b, true, c, true)) {
-                                    return true;
-                                }
-                            }
-                            return false;
-                        });
+        remove_oldest_delayed([&](unification_constraint const & c) {
+                if (is_eq(c) || is_convertible(c)) {
+                    // std::cout << "EXPENSIVE: "; display(std::cout, c); std::cout << "\n";
+                    expr const & a = is_eq(c) ? eq_lhs(c) : convertible_from(c);
+                    expr const & b = is_eq(c) ? eq_rhs(c) : convertible_to(c);
+                    if (process_lower(a, b, c) ||
+                        process_upper(a, b, c) ||
+                        process_metavar_inst(a, b, true, c) ||
+                        process_metavar_inst(b, a, false, c) ||
+                        process_metavar_lift_abstraction(a, b, c) ||
+                        process_metavar_lift_abstraction(b, a, c) ||
+                        process_meta_app(a, b, true, c, false, true) ||
+                        process_meta_app(b, a, false, c, false, true) ||
+                        process_meta_app(a, b, true, c, true)) {
+                        return true;
+                    }
+                }
+                return false;
+            });
         if (!empty(m_state.m_active_cnstrs))
             return true;
         // "approximated mode"
         // change convertability into equality constraint
-        m_state.m_delayed_cnstrs =
-            remove_last(m_state.m_delayed_cnstrs,
-                        [&](std::pair<unification_constraint, name_list> const & p) {
-                            if (is_convertible(p.first)) {
-                                unification_constraint const & c = p.first;
-                                // std::cout << "CONVERTABILITY: "; display(std::cout, c); std::cout << "\n";
-                                push_new_eq_constraint(get_context(c), convertible_from(c), convertible_to(c), get_justification(c));
-                                return true;
-                            }
-                            return false;
-                        });
+        remove_oldest_delayed([&](unification_constraint const & c) {
+                if (is_convertible(c)) {
+                    // std::cout << "CONVERTABILITY: "; display(std::cout, c); std::cout << "\n";
+                    push_new_eq_constraint(get_context(c), convertible_from(c), convertible_to(c), get_justification(c));
+                    return true;
+                }
+                return false;
+            });
         return !empty(m_state.m_active_cnstrs);
     }
 
@@ -2087,6 +2239,23 @@ public:
         // display(std::cout);
     }
 
+    /** \brief Create a worker for exploring an alternative of a case-split of \c parent in state \c s. */
+    imp(imp const & parent, state const & s):
+        m_env(parent.m_env),
+        m_type_inferer(parent.m_env),
+        m_normalizer(parent.m_env),
+        m_state(s),
+        m_next_id(parent.m_next_id),
+        m_first(true),
+        m_U(parent.m_U),
+        m_num_steps(0),
+        m_use_justifications(parent.m_use_justifications),
+        m_use_normalizer(parent.m_use_normalizer),
+        m_assume_injectivity(parent.m_assume_injectivity),
+        m_max_steps(parent.m_max_steps),
+        m_parallel(false) {
+    }
+
     metavar_env next() {
         m_num_steps = 0;
         check_system();
@@ -2115,15 +2284,16 @@ public:
                 if (!process(c)) {
                     resolve_conflict();
                 }
-            } else if (!empty(m_state.m_delayed_cnstrs)) {
+            } else if (!m_state.m_delayed_cnstrs.empty()) {
                 // std::cout << "PROCESSING DELAYED\n"; display(std::cout); std::cout << "\n\n";
                 if (!process_delayed()) {
                     // std::cout << "FAILED to solve\n";
                     // display(std::cout);
-                    return m_state.m_menv;
+                    return m_state.m_menv.copy();
                 }
             } else {
-                return m_state.m_menv;
+                // the result is a copy because case-splits may undo updates to m_state.m_menv
+                return m_state.m_menv.copy();
             }
         }
     }
@@ -2140,8 +2310,7 @@ public:
         for (auto c : m_state.m_active_cnstrs)
             display(out, c);
         out << "Delayed constraints:\n";
-        for (auto c : m_state.m_delayed_cnstrs)
-            display(out, c.first);
+        m_state.m_delayed_cnstrs.for_each([&](unsigned, optional<unification_constraint> const & c) { display(out, *c); });
     }
 };
 
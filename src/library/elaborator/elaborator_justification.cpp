@@ -32,7 +32,7 @@ format propagation_justification::pp_header(formatter const & fmt, options const
 // Unification failure (by cases)
 // -------------------------
 unification_failure_by_cases_justification::unification_failure_by_cases_justification(
-    unification_constraint const & c, unsigned num, justification const * cs, metavar_env const & menv):
+    unification_constraint const & c, unsigned num, justification const * cs, metavar_env_snapshot const & menv):
     unification_failure_justification(c, menv),
     m_cases(cs, cs + num) {
 }
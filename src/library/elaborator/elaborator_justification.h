@@ -32,20 +32,21 @@ public:
 */
 class unification_failure_justification : public propagation_justification {
 protected:
-    // We store the menv at the time of failure. We use it to produce less cryptic error messages.
-    metavar_env m_menv;
+    // We store a snapshot of the menv at the time of failure. We use it to produce less cryptic error messages.
+    // Failures are frequent during elaboration, and the snapshot is only converted into a menv when it is pretty printed.
+    metavar_env_snapshot m_menv;
     virtual char const * get_prop_name() const { return "Failed to solve"; }
 public:
-    unification_failure_justification(unification_constraint const & c, metavar_env const & menv):
+    unification_failure_justification(unification_constraint const & c, metavar_env_snapshot const & menv):
         propagation_justification(c), m_menv(menv) {}
     virtual format pp_header(formatter const & fmt, options const & opts, optional<metavar_env> const &) const {
-        return propagation_justification::pp_header(fmt, opts, optional<metavar_env>(m_menv));
+        return propagation_justification::pp_header(fmt, opts, some_menv(m_menv.to_metavar_env()));
     }
     virtual format pp(formatter const & fmt, options const & opts, pos_info_provider const * p, bool display_children,
                       optional<metavar_env> const &) const {
-        return propagation_justification::pp(fmt, opts, p, display_children, optional<metavar_env>(m_menv));
+        return propagation_justification::pp(fmt, opts, p, display_children, some_menv(m_menv.to_metavar_env()));
     }
-    metavar_env get_menv() const { return m_menv; }
+    metavar_env_snapshot const & get_menv() const { return m_menv; }
 };
 
 /**
@@ -56,7 +57,8 @@ public:
 class unification_failure_by_cases_justification : public unification_failure_justification {
     std::vector<justification> m_cases; // why each case failed
 public:
-    unification_failure_by_cases_justification(unification_constraint const & c, unsigned num, justification const * cs, metavar_env const & menv);
+    unification_failure_by_cases_justification(unification_constraint const & c, unsigned num, justification const * cs,
+                                               metavar_env_snapshot const & menv);
     virtual ~unification_failure_by_cases_justification();
     virtual void get_children(buffer<justification_cell*> & r) const;
     std::vector<justification> const & get_cases() const { return m_cases; }
@@ -1040,8 +1040,8 @@ static int environment_add_uvar_cnstr(lua_State * L) {
 }
 
 static int environment_is_ge(lua_State * L) {
-    ro_shared_environment env(L, 1);
-    lua_pushboolean(L, env->is_ge(to_level(L, 2), to_level(L, 3)));
+    auto s = to_environment(L, 1)->get_snapshot();
+    lua_pushboolean(L, s->is_ge(to_level(L, 2), to_level(L, 3)));
     return 1;
 }
 
@@ -1085,32 +1085,32 @@ static int environment_add_axiom(lua_State * L) {
 }
 
 static int environment_find_object(lua_State * L) {
-    ro_shared_environment env(L, 1);
-    return push_optional_object(L, env->find_object(to_name_ext(L, 2)));
+    auto s = to_environment(L, 1)->get_snapshot();
+    return push_optional_object(L, s->find_object(to_name_ext(L, 2)));
 }
 
 static int environment_has_object(lua_State * L) {
-    ro_shared_environment env(L, 1);
-    lua_pushboolean(L, env->has_object(to_name_ext(L, 2)));
+    auto s = to_environment(L, 1)->get_snapshot();
+    lua_pushboolean(L, s->has_object(to_name_ext(L, 2)));
     return 1;
 }
 
 static int environment_type_check(lua_State * L) {
-    ro_shared_environment env(L, 1);
+    auto s = to_environment(L, 1)->get_snapshot();
     int nargs = lua_gettop(L);
     if (nargs == 2)
-        return push_expr(L, env->type_check(to_expr(L, 2)));
+        return push_expr(L, s->type_check(to_expr(L, 2)));
     else
-        return push_expr(L, env->type_check(to_expr(L, 2), to_context(L, 3)));
+        return push_expr(L, s->type_check(to_expr(L, 2), to_context(L, 3)));
 }
 
 static int environment_normalize(lua_State * L) {
-    ro_shared_environment env(L, 1);
+    auto s = to_environment(L, 1)->get_snapshot();
     int nargs = lua_gettop(L);
     if (nargs == 2)
-        return push_expr(L, env->normalize(to_expr(L, 2)));
+        return push_expr(L, s->normalize(to_expr(L, 2)));
     else
-        return push_expr(L, env->normalize(to_expr(L, 2), to_context(L, 3)));
+        return push_expr(L, s->normalize(to_expr(L, 2), to_context(L, 3)));
 }
 
 /**
@@ -1120,7 +1120,7 @@ static int environment_normalize(lua_State * L) {
    \see environment_local_objects.
 */
 static int environment_next_object(lua_State * L) {
-    ro_shared_environment env(L, lua_upvalueindex(1));
+    auto s = to_environment(L, lua_upvalueindex(1))->get_snapshot();
     unsigned i   = lua_tointeger(L, lua_upvalueindex(2));
     unsigned num = lua_tointeger(L, lua_upvalueindex(3));
     if (i >= num) {
@@ -1129,16 +1129,16 @@ static int environment_next_object(lua_State * L) {
         bool local   = lua_toboolean(L, lua_upvalueindex(4));
         lua_pushinteger(L, i + 1);
         lua_replace(L, lua_upvalueindex(2)); // update closure
-        push_object(L, env->get_object(i, local));
+        push_object(L, s->get_object(i, local));
     }
     return 1;
 }
 
 static int environment_objects_core(lua_State * L, bool local) {
-    ro_shared_environment env(L, 1);
+    environment const & env = to_environment(L, 1);
     push_environment(L, env);   // upvalue(1): environment
     lua_pushinteger(L, 0);      // upvalue(2): index
-    lua_pushinteger(L, env->get_num_objects(local)); // upvalue(3): size
+    lua_pushinteger(L, env->get_snapshot()->get_num_objects(local)); // upvalue(3): size
     lua_pushboolean(L, local);  // upvalue(4): local flag
     lua_pushcclosure(L, &safe_function<environment_next_object>, 4); // create closure with 4 upvalues
     return 1;
@@ -1154,20 +1154,20 @@ static int environment_local_objects(lua_State * L) {
 
 static int environment_infer_type(lua_State * L) {
     int nargs = lua_gettop(L);
-    ro_shared_environment env(L, 1);
+    auto s = to_environment(L, 1)->get_snapshot();
     if (nargs == 2)
-        return push_expr(L, env->infer_type(to_expr(L, 2)));
+        return push_expr(L, s->infer_type(to_expr(L, 2)));
     else
-        return push_expr(L, env->infer_type(to_expr(L, 2), to_context(L, 3)));
+        return push_expr(L, s->infer_type(to_expr(L, 2), to_context(L, 3)));
 }
 
 static int environment_is_proposition(lua_State * L) {
     int nargs = lua_gettop(L);
-    ro_shared_environment env(L, 1);
+    auto s = to_environment(L, 1)->get_snapshot();
     if (nargs == 2)
-        lua_pushboolean(L, env->is_proposition(to_expr(L, 2)));
+        lua_pushboolean(L, s->is_proposition(to_expr(L, 2)));
     else
-        lua_pushboolean(L, env->is_proposition(to_expr(L, 2), to_context(L, 3)));
+        lua_pushboolean(L, s->is_proposition(to_expr(L, 2), to_context(L, 3)));
     return 1;
 }
 
@@ -1188,8 +1188,8 @@ static int environment_set_opaque(lua_State * L) {
 }
 
 static int environment_is_opaque(lua_State * L) {
-    ro_shared_environment env(L, 1);
-    auto obj = env->find_object(to_name_ext(L, 2));
+    // set_opaque does not modify the objects stored in snapshots
+    auto obj = to_environment(L, 1)->get_snapshot()->find_object(to_name_ext(L, 2));
     lua_pushboolean(L, obj && obj->is_opaque());
     return 1;
 }
@@ -1226,8 +1226,7 @@ static int environment_load(lua_State * L) {
 }
 
 static int environment_get_universe_distance(lua_State * L) {
-    ro_shared_environment env(L, 1);
-    auto r = env->get_universe_distance(to_name_ext(L, 2), to_name_ext(L, 3));
+    auto r = to_environment(L, 1)->get_snapshot()->get_universe_distance(to_name_ext(L, 2), to_name_ext(L, 3));
     if (r)
         lua_pushinteger(L, *r);
     else
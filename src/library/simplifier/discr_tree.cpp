@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include "library/simplifier/discr_tree.h"
+
+namespace lean {
+int cmp(discr_key const & k1, discr_key const & k2) {
+    if (k1.m_kind != k2.m_kind)
+        return k1.m_kind < k2.m_kind ? -1 : 1;
+    if (k1.m_data != k2.m_data)
+        return k1.m_data < k2.m_data ? -1 : 1;
+    if (k1.m_kind == discr_key::kind::Constant)
+        return quick_cmp(k1.m_name, k2.m_name);
+    return 0;
+}
+
+static discr_key mk_key(expr const & e, unsigned nargs) {
+    switch (e.kind()) {
+    case expr_kind::Var:      return discr_key(discr_key::kind::Var, var_idx(e));
+    case expr_kind::Constant: return discr_key(const_name(e));
+    case expr_kind::App:      return discr_key(discr_key::kind::App, nargs);
+    case expr_kind::Proj:     return discr_key(discr_key::kind::Proj, proj_first(e));
+    case expr_kind::Lambda:   return discr_key(discr_key::kind::Lambda);
+    case expr_kind::Pi:       return discr_key(discr_key::kind::Pi);
+    case expr_kind::Sigma:    return discr_key(discr_key::kind::Sigma);
+    case expr_kind::HEq:      return discr_key(discr_key::kind::HEq);
+    case expr_kind::Pair:     return discr_key(discr_key::kind::Pair);
+    case expr_kind::Value:    return discr_key(discr_key::kind::Value);
+    case expr_kind::Type:     return discr_key(discr_key::kind::Type);
+    case expr_kind::Let:      return discr_key(discr_key::kind::Let);
+    case expr_kind::MetaVar:  return discr_key(discr_key::kind::MetaVar);
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+discr_key get_discr_key(discr_item const & it) {
+    return mk_key(*it.m_expr, it.m_num_args);
+}
+
+void push_discr_children(discr_item const & it, buffer<discr_item> & todo) {
+    expr const & e = *it.m_expr;
+    switch (e.kind()) {
+    case expr_kind::Var: case expr_kind::Constant: case expr_kind::Value:
+    case expr_kind::Type: case expr_kind::Let: case expr_kind::MetaVar:
+        return;
+    case expr_kind::App: {
+        unsigned i = it.m_num_args;
+        while (i > 0) {
+            --i;
+            todo.push_back(discr_item(arg(e, i)));
+        }
+        return;
+    }
+    case expr_kind::Proj:
+        todo.push_back(discr_item(proj_arg(e)));
+        return;
+    case expr_kind::Lambda: case expr_kind::Pi: case expr_kind::Sigma:
+        todo.push_back(discr_item(abst_body(e)));
+        todo.push_back(discr_item(abst_domain(e)));
+        return;
+    case expr_kind::HEq:
+        todo.push_back(discr_item(heq_rhs(e)));
+        todo.push_back(discr_item(heq_lhs(e)));
+        return;
+    case expr_kind::Pair:
+        todo.push_back(discr_item(pair_type(e)));
+        todo.push_back(discr_item(pair_second(e)));
+        todo.push_back(discr_item(pair_first(e)));
+        return;
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+/** \brief Return the unfolding of the constant \c c used by \c hop_match. */
+static optional<expr> unfold_constant(ro_environment const & env, expr const & c) {
+    auto obj = env->find_object(const_name(c));
+    if (obj && (obj->is_definition() || obj->is_builtin()))
+        return some_expr(obj->get_value());
+    return none_expr();
+}
+
+static void mk_discr_path(expr const & p, unsigned depth, ro_environment const & env, buffer<discr_path_entry> & r) {
+    switch (p.kind()) {
+    case expr_kind::Var:
+        if (var_idx(p) >= depth)
+            r.push_back(discr_key(discr_key::kind::Star));
+        else
+            r.push_back(mk_key(p, 0));
+        return;
+    case expr_kind::Constant: {
+        if (!env->find_object(const_name(p))) {
+            // the constant may be defined later, and then unfolded by the matcher
+            r.push_back(discr_key(discr_key::kind::Star));
+            return;
+        }
+        buffer<discr_key> unfold;
+        optional<expr> it = unfold_constant(env, p);
+        while (it) {
+            unfold.push_back(mk_key(*it, is_app(*it) ? num_args(*it) : 0));
+            it = is_constant(*it) ? unfold_constant(env, *it) : none_expr();
+        }
+        r.push_back(discr_path_entry(mk_key(p, 0), to_list(unfold.begin(), unfold.end())));
+        return;
+    }
+    case expr_kind::App:
+        if (is_var(arg(p, 0)) && var_idx(arg(p, 0)) >= depth) {
+            r.push_back(discr_key(discr_key::kind::Star));
+        } else {
+            r.push_back(mk_key(p, num_args(p)));
+            for (expr const & a : args(p))
+                mk_discr_path(a, depth, env, r);
+        }
+        return;
+    case expr_kind::Proj:
+        r.push_back(mk_key(p, 0));
+        mk_discr_path(proj_arg(p), depth, env, r);
+        return;
+    case expr_kind::Lambda: case expr_kind::Pi: case expr_kind::Sigma:
+        r.push_back(mk_key(p, 0));
+        mk_discr_path(abst_domain(p), depth, env, r);
+        mk_discr_path(abst_body(p), depth + 1, env, r);
+        return;
+    case expr_kind::HEq:
+        r.push_back(mk_key(p, 0));
+        mk_discr_path(heq_lhs(p), depth, env, r);
+        mk_discr_path(heq_rhs(p), depth, env, r);
+        return;
+    case expr_kind::Pair:
+        r.push_back(mk_key(p, 0));
+        mk_discr_path(pair_first(p), depth, env, r);
+        mk_discr_path(pair_second(p), depth, env, r);
+        mk_discr_path(pair_type(p), depth, env, r);
+        return;
+    case expr_kind::Value: case expr_kind::Type: case expr_kind::Let: case expr_kind::MetaVar:
+        // the matcher only succeeds if the target is equal to the pattern
+        r.push_back(mk_key(p, 0));
+        return;
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+void mk_discr_path(expr const & p, ro_environment const & env, buffer<discr_path_entry> & r) {
+    mk_discr_path(p, 0, env, r);
+}
+}
@@ -0,0 +1,212 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "util/list.h"
+#include "util/buffer.h"
+#include "util/name.h"
+#include "kernel/expr.h"
+#include "kernel/environment.h"
+
+namespace lean {
+/**
+   \brief Label used in the edges of a discrimination tree.
+
+   The path associated with an expression is its preorder traversal, where
+   each node is labeled with its kind, and some extra data:
+   the de Bruijn index for variables, the name for constants, the number of arguments for
+   applications, and the first/second flag for projections.
+   The label \c Star is used for pattern variables.
+*/
+class discr_key {
+public:
+    enum class kind { Star, Var, Constant, App, Proj, Lambda, Pi, Sigma, HEq, Pair, Value, Type, Let, MetaVar };
+private:
+    kind     m_kind;
+    unsigned m_data;
+    name     m_name;
+public:
+    discr_key(kind k, unsigned d = 0):m_kind(k), m_data(d) {}
+    explicit discr_key(name const & n):m_kind(kind::Constant), m_data(0), m_name(n) {}
+    kind get_kind() const { return m_kind; }
+    unsigned get_data() const { return m_data; }
+    name const & get_name() const { return m_name; }
+    friend int cmp(discr_key const & k1, discr_key const & k2);
+    friend bool operator==(discr_key const & k1, discr_key const & k2) { return cmp(k1, k2) == 0; }
+    friend bool operator<(discr_key const & k1, discr_key const & k2) { return cmp(k1, k2) < 0; }
+};
+
+/**
+   \brief Element of the path associated with a pattern. When the key is a constant that
+   may be unfolded by the matcher, \c m_unfold contains the keys of its unfoldings.
+*/
+struct discr_path_entry {
+    discr_key       m_key;
+    list<discr_key> m_unfold;
+    discr_path_entry(discr_key const & k, list<discr_key> const & u = list<discr_key>()):m_key(k), m_unfold(u) {}
+};
+
+/**
+   \brief Store in \c r the path for the pattern \c p. The free variables of \c p are
+   the pattern variables, and they are mapped to \c Star. Applications whose function is a
+   pattern variable (higher-order patterns) are also mapped to \c Star.
+
+   The environment \c env is used to compute the unfoldings of constants (see \c hop_match).
+*/
+void mk_discr_path(expr const & p, ro_environment const & env, buffer<discr_path_entry> & r);
+
+/**
+   \brief Subterm of the expression being retrieved. If \c m_expr is an application, then
+   the item is the application of its first \c m_num_args arguments.
+*/
+struct discr_item {
+    expr const * m_expr;
+    unsigned     m_num_args;
+    explicit discr_item(expr const & e):m_expr(&e), m_num_args(is_app(e) ? num_args(e) : 0) {}
+    discr_item(expr const & e, unsigned n):m_expr(&e), m_num_args(n) {}
+};
+discr_key get_discr_key(discr_item const & it);
+/** \brief Push the children of \c it in \c todo. The first child is stored in the top of the stack. */
+void push_discr_children(discr_item const & it, buffer<discr_item> & todo);
+
+/**
+   \brief Persistent discrimination tree. The values are stored in the leaves, and tagged
+   with their insertion order. Copying a discrimination tree is a constant time operation,
+   and insertion only copies the nodes in the path to the new leaf.
+
+   The retrieval operation is conservative: it produces every value whose pattern may
+   be matched by \c hop_match against the given expression.
+*/
+template<typename T>
+class discr_tree {
+    typedef std::pair<unsigned, T> entry;
+    struct node;
+    typedef std::shared_ptr<node const> node_ptr;
+    struct node {
+        std::vector<std::pair<discr_key, node_ptr>> m_children; // sorted by key
+        // (k, c) means the constant child c may be unfolded into an expression with key k
+        std::vector<std::pair<discr_key, name>>     m_unfold;   // sorted by key
+        list<entry>                                 m_values;
+
+        node const * find(discr_key const & k) const {
+            auto it = std::lower_bound(m_children.begin(), m_children.end(), k,
+                                       [](std::pair<discr_key, node_ptr> const & p, discr_key const & k) { return p.first < k; });
+            if (it != m_children.end() && it->first == k)
+                return it->second.get();
+            else
+                return nullptr;
+        }
+
+        void add_unfold(discr_key const & k, name const & c) {
+            std::pair<discr_key, name> p(k, c);
+            auto it = std::lower_bound(m_unfold.begin(), m_unfold.end(), p,
+                                       [](std::pair<discr_key, name> const & p1, std::pair<discr_key, name> const & p2) {
+                                           int r = cmp(p1.first, p2.first);
+                                           return r < 0 || (r == 0 && quick_cmp(p1.second, p2.second) < 0);
+                                       });
+            if (it == m_unfold.end() || !(it->first == k) || it->second != c)
+                m_unfold.insert(it, p);
+        }
+    };
+    node_ptr m_root;
+    unsigned m_next_idx;
+
+    static node_ptr insert(node const * n, discr_path_entry const * it, discr_path_entry const * end, entry const & v) {
+        std::shared_ptr<node> r = n ? std::make_shared<node>(*n) : std::make_shared<node>();
+        if (it == end) {
+            r->m_values = cons(v, r->m_values);
+            return r;
+        }
+        discr_key const & k = it->m_key;
+        auto c = std::lower_bound(r->m_children.begin(), r->m_children.end(), k,
+                                  [](std::pair<discr_key, node_ptr> const & p, discr_key const & k) { return p.first < k; });
+        if (c != r->m_children.end() && c->first == k)
+            c->second = insert(c->second.get(), it + 1, end, v);
+        else
+            r->m_children.insert(c, std::make_pair(k, insert(nullptr, it + 1, end, v)));
+        for (discr_key const & u : it->m_unfold)
+            r->add_unfold(u, k.get_name());
+        return r;
+    }
+
+    static void find_core(node const & n, buffer<discr_item> & todo, buffer<entry const *> & r) {
+        if (todo.empty()) {
+            for (entry const & v : n.m_values)
+                r.push_back(&v);
+            return;
+        }
+        discr_item it = todo.back();
+        todo.pop_back();
+        unsigned sz = todo.size();
+        if (node const * c = n.find(discr_key(discr_key::kind::Star)))
+            find_core(*c, todo, r);
+        discr_key k = get_discr_key(it);
+        if (node const * c = n.find(k)) {
+            push_discr_children(it, todo);
+            find_core(*c, todo, r);
+            todo.shrink(sz);
+        }
+        if (k.get_kind() == discr_key::kind::App) {
+            // The matcher may also match a pattern (f a_1 ... a_m) with (g b_1 ... b_k b_{k+1} ... b_{k+m}),
+            // by matching f with (g b_1 ... b_k).
+            expr const & e = *it.m_expr;
+            for (unsigned m = 2; m < it.m_num_args; m++) {
+                if (node const * c = n.find(discr_key(discr_key::kind::App, m))) {
+                    unsigned i = it.m_num_args;
+                    while (i > it.m_num_args - m + 1) {
+                        --i;
+                        todo.push_back(discr_item(arg(e, i)));
+                    }
+                    todo.push_back(discr_item(e, it.m_num_args - m + 1));
+                    find_core(*c, todo, r);
+                    todo.shrink(sz);
+                }
+            }
+        }
+        auto u = std::lower_bound(n.m_unfold.begin(), n.m_unfold.end(), k,
+                                  [](std::pair<discr_key, name> const & p, discr_key const & k) { return p.first < k; });
+        for (; u != n.m_unfold.end() && u->first == k; ++u) {
+            if (node const * c = n.find(discr_key(u->second)))
+                find_core(*c, todo, r);
+        }
+        todo.push_back(it);
+    }
+
+public:
+    discr_tree():m_next_idx(0) {}
+
+    /** \brief Insert the value \c v with the given path (see \c mk_discr_path). */
+    void insert(buffer<discr_path_entry> const & path, T const & v) {
+        m_root = insert(m_root.get(), path.begin(), path.end(), entry(m_next_idx, v));
+        m_next_idx++;
+    }
+
+    /**
+       \brief Execute <tt>fn(v)</tt> for each value \c v whose pattern may match \c e.
+       The values are visited from the most recently inserted to the least recently inserted one.
+       The traversal is interrupted as soon as \c fn returns true.
+    */
+    template<typename F>
+    bool find(expr const & e, F && fn) const {
+        if (!m_root)
+            return false;
+        buffer<discr_item> todo;
+        buffer<entry const *> r;
+        todo.push_back(discr_item(e));
+        find_core(*m_root, todo, r);
+        std::sort(r.begin(), r.end(), [](entry const * v1, entry const * v2) { return v1->first > v2->first; });
+        for (entry const * v : r) {
+            if (fn(v->second))
+                return true;
+        }
+        return false;
+    }
+};
+}
@@ -4,9 +4,13 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include "util/splay_tree.h"
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "util/avl_tree.h"
 #include "util/list_fn.h"
 #include "util/sstream.h"
+#include "util/thread.h"
 #include "kernel/environment.h"
 #include "library/io_state_stream.h"
 #include "library/equality.h"
@@ -14,16 +18,104 @@ Author: Leonardo de Moura
 #include "library/simplifier/ceq.h"
 #include "library/simplifier/rewrite_rule_set.h"
 
+#ifndef LEAN_RULE_SET_FINGERPRINT_TABLE_SIZE
+#define LEAN_RULE_SET_FINGERPRINT_TABLE_SIZE 100000
+#endif
+
 namespace lean {
+/**
+   \brief Table for computing the fingerprints of rule sets.
+
+   The fingerprint of an updated rule set is determined by the fingerprint of the original
+   rule set, the environment, and the update. So, rule sets built by the same sequence of updates
+   share the same fingerprint. This is important because some procedures (e.g., simplify_tactic)
+   build a new rule set whenever they are executed.
+
+   Fingerprints are never reused. When the table is full, we just reset it, and the fingerprints
+   created afterwards are different from the existing ones.
+*/
+class rule_set_fingerprint_table {
+public:
+    enum class kind { Insert, Enable, Disable, Congr };
+private:
+    struct key {
+        unsigned                 m_parent;
+        kind                     m_kind;
+        environment_cell const * m_env;
+        name                     m_id;
+        std::vector<expr>        m_args;
+        key(unsigned p, kind k, environment_cell const * env, name const & id, std::vector<expr> const & args):
+            m_parent(p), m_kind(k), m_env(env), m_id(id), m_args(args) {}
+        friend bool operator==(key const & k1, key const & k2) {
+            return
+                k1.m_parent == k2.m_parent && k1.m_kind == k2.m_kind && k1.m_env == k2.m_env &&
+                k1.m_id == k2.m_id && k1.m_args == k2.m_args;
+        }
+    };
+    struct key_hash {
+        unsigned operator()(key const & k) const {
+            unsigned h = hash(hash(k.m_parent, static_cast<unsigned>(k.m_kind)), k.m_id.hash());
+            for (expr const & e : k.m_args)
+                h = hash(h, e.hash());
+            return h;
+        }
+    };
+    struct value {
+        unsigned                 m_fingerprint;
+        ro_environment::weak_ref m_env;  // used to detect that the environment at m_env has been deleted
+        value(unsigned fp, ro_environment::weak_ref const & env):m_fingerprint(fp), m_env(env) {}
+    };
+    mutex                                         m_mutex;
+    unsigned                                      m_next;
+    std::unordered_map<key, value, key_hash>      m_table;
+public:
+    rule_set_fingerprint_table():m_next(1) {}
+
+    /**
+       \brief Return the fingerprint of the rule set obtained by applying the update (k, id, args) to
+       a rule set with fingerprint \c parent.
+    */
+    unsigned get(unsigned parent, kind k, ro_environment::weak_ref const & env, name const & id,
+                 std::vector<expr> const & args) {
+        lock_guard<mutex> lock(m_mutex);
+        if (std::any_of(args.begin(), args.end(), [](expr const & e) { return has_metavar(e); })) {
+            // metavariables are only meaningful with respect to a metavariable environment
+            return m_next++;
+        }
+        environment_cell const * env_ptr = env.expired() ? nullptr : env.lock().get();
+        key k1(parent, k, env_ptr, id, args);
+        auto it = m_table.find(k1);
+        if (it != m_table.end() && !it->second.m_env.expired())
+            return it->second.m_fingerprint;
+        if (m_table.size() >= LEAN_RULE_SET_FINGERPRINT_TABLE_SIZE)
+            m_table.clear();
+        unsigned r = m_next++;
+        m_table.erase(k1);
+        m_table.insert(mk_pair(k1, value(r, env)));
+        return r;
+    }
+};
+
+static rule_set_fingerprint_table & get_fingerprint_table() {
+    static rule_set_fingerprint_table g_table;
+    return g_table;
+}
+
+static unsigned mk_fingerprint(unsigned parent, rule_set_fingerprint_table::kind k, ro_environment::weak_ref const & env,
+                               name const & id, std::vector<expr> const & args = std::vector<expr>()) {
+    return get_fingerprint_table().get(parent, k, env, id, args);
+}
+
 rewrite_rule::rewrite_rule(name const & id, expr const & lhs, expr const & rhs, expr const & ceq, expr const & proof,
                            unsigned num_args, bool is_permutation, bool must_check):
     m_id(id), m_lhs(lhs), m_rhs(rhs), m_ceq(ceq), m_proof(proof), m_num_args(num_args),
     m_is_permutation(is_permutation), m_must_check_types(must_check) {
 }
 
-rewrite_rule_set::rewrite_rule_set(ro_environment const & env):m_env(env.to_weak_ref()) {}
+rewrite_rule_set::rewrite_rule_set(ro_environment const & env):m_env(env.to_weak_ref()), m_fingerprint(0) {}
 rewrite_rule_set::rewrite_rule_set(rewrite_rule_set const & other):
-    m_env(other.m_env), m_rule_set(other.m_rule_set), m_disabled_rules(other.m_disabled_rules), m_congr_thms(other.m_congr_thms) {}
+    m_env(other.m_env), m_rule_set(other.m_rule_set), m_index(other.m_index), m_disabled_rules(other.m_disabled_rules), m_congr_thms(other.m_congr_thms),
+    m_fingerprint(other.m_fingerprint) {}
 rewrite_rule_set::~rewrite_rule_set() {}
 
 void rewrite_rule_set::insert(name const & id, expr const & th, expr const & proof, optional<ro_metavar_env> const & menv) {
@@ -40,10 +132,13 @@ void rewrite_rule_set::insert(name const & id, expr const & th, expr const & pro
         }
         lean_assert(is_equality(eq));
         bool must_check = !is_safe_to_skip_check_ceq_types(m_env, menv, ceq);
-        m_rule_set = cons(rewrite_rule(id, arg(eq, num_args(eq) - 2), arg(eq, num_args(eq) - 1),
-                                       ceq, proof, num, is_perm, must_check),
-                          m_rule_set);
+        rewrite_rule rule(id, arg(eq, num_args(eq) - 2), arg(eq, num_args(eq) - 1), ceq, proof, num, is_perm, must_check);
+        buffer<discr_path_entry> path;
+        mk_discr_path(rule.get_lhs(), env, path);
+        m_rule_set = cons(rule, m_rule_set);
+        m_index.insert(path, rule);
     }
+    m_fingerprint = mk_fingerprint(m_fingerprint, rule_set_fingerprint_table::kind::Insert, m_env, id, {th, proof});
 }
 
 void rewrite_rule_set::insert(name const & th_name) {
@@ -69,24 +164,22 @@ void rewrite_rule_set::enable(name const & id, bool f) {
         m_disabled_rules.erase(id);
     else
         m_disabled_rules.insert(id);
+    m_fingerprint = mk_fingerprint(m_fingerprint, f ? rule_set_fingerprint_table::kind::Enable : rule_set_fingerprint_table::kind::Disable,
+                                   m_env, id);
 }
 
 void rewrite_rule_set::insert_congr(expr const & e) {
     ro_environment env(m_env);
     m_congr_thms.emplace_front(check_congr_theorem(env, e));
+    m_fingerprint = mk_fingerprint(m_fingerprint, rule_set_fingerprint_table::kind::Congr, m_env, name(), {e});
 }
 
 void rewrite_rule_set::insert_congr(name const & th_name) {
     insert_congr(mk_constant(th_name));
 }
 
-bool rewrite_rule_set::find_match(expr const &, match_fn const & fn) const {
-    auto l = m_rule_set;
-    for (auto const & rule : l) {
-        if (enabled(rule) && fn(rule))
-            return true;
-    }
-    return false;
+bool rewrite_rule_set::find_match(expr const & e, match_fn const & fn) const {
+    return m_index.find(e, [&](rewrite_rule const & rule) { return enabled(rule) && fn(rule); });
 }
 
 void rewrite_rule_set::for_each(visit_fn const & fn) const {
@@ -9,13 +9,14 @@ Author: Leonardo de Moura
 #include <functional>
 #include "util/lua.h"
 #include "util/list.h"
-#include "util/splay_tree.h"
+#include "util/avl_tree.h"
 #include "util/name.h"
 #include "kernel/environment.h"
 #include "kernel/metavar.h"
 #include "kernel/formatter.h"
 #include "library/io_state_stream.h"
 #include "library/simplifier/congr.h"
+#include "library/simplifier/discr_tree.h"
 
 namespace lean {
 class rewrite_rule_set;
@@ -46,11 +47,13 @@ public:
    \brief Actual implementation of the \c rewrite_rule_set class.
 */
 class rewrite_rule_set {
-    typedef splay_tree<name, name_quick_cmp> name_set;
+    typedef avl_tree<name, name_quick_cmp> name_set;
     ro_environment::weak_ref m_env;
-    list<rewrite_rule>       m_rule_set; // TODO(Leo): use better data-structure, e.g., discrimination trees
+    list<rewrite_rule>       m_rule_set;
+    discr_tree<rewrite_rule> m_index;    // index for retrieving the rules whose left-hand-side may match an expression
     name_set                 m_disabled_rules;
     list<congr_theorem_info> m_congr_thms; // This is probably ok since we usually have very few congruence theorems
+    unsigned                 m_fingerprint;
 
     bool enabled(rewrite_rule const & rule) const;
 public:
@@ -100,6 +103,14 @@ public:
     /** \brief Execute <tt>fn(congr_th)</tt> for each congruence theorem in this rule set. */
     void for_each_congr(visit_congr_fn const & fn) const;
 
+    /**
+       \brief Return a fingerprint for the rules in this rule set.
+       Two rule sets have the same fingerprint only if they contain the same rules, and the same
+       rules are enabled. The fingerprint changes whenever the rule set is updated.
+       Rule sets created by the same sequence of updates (in the same environment) usually have the same fingerprint.
+    */
+    unsigned get_fingerprint() const { return m_fingerprint; }
+
     /** \brief Pretty print this rule set. */
     format pp(formatter const & fmt, options const & opts) const;
 };
@@ -4,11 +4,15 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <algorithm>
 #include <utility>
 #include <vector>
+#include <memory>
 #include "util/flet.h"
 #include "util/freset.h"
 #include "util/interrupt.h"
+#include "util/thread.h"
+#include "util/shared_mutex.h"
 #include "util/luaref.h"
 #include "util/script_state.h"
 #include "kernel/type_checker.h"
@@ -74,6 +78,14 @@ Author: Leonardo de Moura
 #define LEAN_SIMPLIFIER_MAX_STEPS std::numeric_limits<unsigned>::max()
 #endif
 
+#ifndef LEAN_SIMPLIFIER_SHARED_MEMO_SIZE
+#define LEAN_SIMPLIFIER_SHARED_MEMO_SIZE 100000
+#endif
+
+#ifndef LEAN_SIMPLIFIER_SHARED_MEMO_SLOTS
+#define LEAN_SIMPLIFIER_SHARED_MEMO_SLOTS 8
+#endif
+
 namespace lean {
 static name g_simplifier_proofs       {"simplifier", "proofs"};
 static name g_simplifier_contextual   {"simplifier", "contextual"};
@@ -123,6 +135,99 @@ static name g_H("H");
 static name g_x("x");
 static name g_unique = name::mk_internal_unique_name();
 
+/**
+   \brief Memo table shared by all simplifier objects.
+
+   Proof scripts usually invoke the simplifier on closely related goals. So, we keep the results
+   obtained by previous invocations. The results are stored in slots. Each slot is associated with
+   an environment (and the version of its objects), the fingerprints of the rule sets used by the
+   simplifier, and its configuration. A slot associated with an environment that has been deleted
+   or modified is never used again.
+
+   \remark \c m_mutex only protects the list of slots, and it is only acquired when a simplifier
+   object is created. Each slot has its own lock, then simplifiers using different slots do not
+   contend, and simplifiers using the same slot can read it concurrently.
+*/
+class simplifier_memo {
+public:
+    typedef simplifier_cell::result result;
+    /**
+       \brief Result for an expression. The proof may contain binder names created using the indices
+       <tt>m_start_idx+1, ..., m_start_idx+m_num_idxs</tt>. We only reuse the entry when the
+       simplifier would create the same names.
+    */
+    struct entry {
+        result   m_result;
+        unsigned m_start_idx;
+        unsigned m_num_idxs;
+        entry() {}
+        entry(result const & r, unsigned start_idx, unsigned num_idxs):m_result(r), m_start_idx(start_idx), m_num_idxs(num_idxs) {}
+    };
+    struct slot {
+        ro_environment::weak_ref m_env;
+        environment_cell const * m_env_ptr;
+        unsigned                 m_objects_version;
+        std::vector<unsigned>    m_fingerprints;
+        unsigned                 m_config;
+        shared_mutex             m_cache_mutex; // protects m_cache
+        expr_map<entry>          m_cache;
+        bool is_alive() const { return !m_env.expired(); }
+    };
+    typedef std::shared_ptr<slot> slot_ref;
+private:
+    mutex                 m_mutex;
+    std::vector<slot_ref> m_slots; // the most recently used slot is the last one
+public:
+    /** \brief Return the slot for the given environment, rule set fingerprints and configuration. */
+    slot_ref get_slot(ro_environment const & env, std::vector<unsigned> const & fingerprints, unsigned config) {
+        lock_guard<mutex> lock(m_mutex);
+        unsigned version = env->get_objects_version();
+        m_slots.erase(std::remove_if(m_slots.begin(), m_slots.end(), [](slot_ref const & s) { return !s->is_alive(); }),
+                      m_slots.end());
+        for (unsigned i = 0; i < m_slots.size(); i++) {
+            slot_ref s = m_slots[i];
+            if (s->m_env_ptr == env.operator->() && s->m_objects_version == version &&
+                s->m_fingerprints == fingerprints && s->m_config == config) {
+                m_slots.erase(m_slots.begin() + i);
+                m_slots.push_back(s);
+                return s;
+            }
+        }
+        if (m_slots.size() >= LEAN_SIMPLIFIER_SHARED_MEMO_SLOTS)
+            m_slots.erase(m_slots.begin());
+        slot_ref s = std::make_shared<slot>();
+        s->m_env             = env.to_weak_ref();
+        s->m_env_ptr         = env.operator->();
+        s->m_objects_version = version;
+        s->m_fingerprints    = fingerprints;
+        s->m_config          = config;
+        m_slots.push_back(s);
+        return s;
+    }
+
+    /** \brief Return the result for \c e when the next index used by the simplifier is \c start_idx. */
+    optional<entry> find(slot & s, expr const & e, unsigned start_idx) {
+        shared_lock lock(s.m_cache_mutex);
+        auto it = s.m_cache.find(e);
+        if (it != s.m_cache.end() && (it->second.m_num_idxs == 0 || it->second.m_start_idx == start_idx))
+            return optional<entry>(it->second);
+        else
+            return optional<entry>();
+    }
+
+    void insert(slot & s, expr const & e, entry const & r) {
+        exclusive_lock lock(s.m_cache_mutex);
+        if (s.m_cache.size() >= LEAN_SIMPLIFIER_SHARED_MEMO_SIZE)
+            s.m_cache.clear();
+        s.m_cache[e] = r;
+    }
+};
+
+static simplifier_memo & get_simplifier_memo() {
+    static simplifier_memo g_memo;
+    return g_memo;
+}
+
 class simplifier_cell::imp {
     friend class simplifier_cell;
     friend class simplifier;
@@ -143,6 +248,8 @@ class simplifier_cell::imp {
     unsigned       m_next_idx;  // index used to create fresh constants
     unsigned       m_num_steps; // number of steps performed
     unsigned       m_depth;     // recursion depth
+    unsigned       m_num_scopes; // number of local hypotheses, constant remappings and binders in scope
+    simplifier_memo::slot_ref m_shared; // slot of the shared memo table, nullptr if it is not used
     name_map<name> m_name_subst;
     cached_ro_metavar_env m_menv;
     std::shared_ptr<simplifier_monitor> m_monitor;
@@ -174,8 +281,10 @@ class simplifier_cell::imp {
             m_fn(fn), m_old(m_fn.m_rule_sets[0]), m_reset_cache(m_fn.m_cache) {
             lean_assert(const_type(H));
             m_fn.m_rule_sets[0].insert(g_local, *const_type(H), H, m_fn.m_menv.to_some_menv());
+            m_fn.m_num_scopes++;
         }
         ~updt_rule_set() {
+            m_fn.m_num_scopes--;
             m_fn.m_rule_sets[0] = m_old;
             // Remark: m_reset_cache destructor will restore the cache
         }
@@ -187,8 +296,10 @@ class simplifier_cell::imp {
         updt_const_map(imp & fn, expr const & old_x, expr const & new_x, expr const & H):
             m_fn(fn), m_old_x(old_x) {
             m_fn.m_const_map[old_x] = result(new_x, H, true);
+            m_fn.m_num_scopes++;
         }
         ~updt_const_map() {
+            m_fn.m_num_scopes--;
             m_fn.m_const_map.erase(m_old_x);
         }
     };
@@ -1069,6 +1180,7 @@ class simplifier_cell::imp {
         expr const & d   = abst_domain(e);
         expr fresh_const = mk_fresh_const(d);
         expr bi          = instantiate(abst_body(e), fresh_const);
+        flet<unsigned> inc_scopes(m_num_scopes, m_num_scopes+1);
         result res_bi    = simplify(bi);
         expr new_bi    = res_bi.m_expr;
         if (is_eqp(new_bi, bi))
@@ -1291,6 +1403,7 @@ class simplifier_cell::imp {
         expr const & d   = abst_domain(e);
         expr b           = abst_body(e);
         expr bi          = instantiate(b, fresh_const);
+        flet<unsigned> inc_scopes(m_num_scopes, m_num_scopes+1);
         result res_bi    = simplify(bi);
         expr new_bi      = res_bi.m_expr;
         if (is_eqp(new_bi, bi))
@@ -1439,10 +1552,26 @@ class simplifier_cell::imp {
         }
     }
 
-    result save(expr const & e, result const & r) {
+    /**
+       \brief Return true if the result for \c e can be stored/retrieved from the shared memo table.
+
+       Fresh constants are only unique with respect to a simplifier invocation, and local hypotheses
+       modify the rule sets. So, we do not use the shared memo table when they are in scope.
+    */
+    bool use_shared_memo(expr const & e) const {
+        return m_shared && m_num_scopes == 0 && !has_metavar(e);
+    }
+
+    /**
+       \brief Store the result \c r for \c e in the cache.
+       \c start_idx is the value of \c m_next_idx before \c e was simplified.
+    */
+    result save(expr const & e, result const & r, unsigned start_idx) {
         if (m_memoize) {
             result new_r = r.update_expr(m_max_sharing(r.m_expr));
             m_cache.insert(mk_pair(e, new_r));
+            if (use_shared_memo(e))
+                get_simplifier_memo().insert(*m_shared, e, simplifier_memo::entry(new_r, start_idx, m_next_idx - start_idx));
             if (m_monitor)
                 m_monitor->step_eh(ro_simplifier(m_this), e, new_r.m_expr, new_r.m_proof);
             return new_r;
@@ -1463,20 +1592,28 @@ class simplifier_cell::imp {
             if (it != m_cache.end()) {
                 return it->second;
             }
+            if (use_shared_memo(e)) {
+                if (auto r = get_simplifier_memo().find(*m_shared, e, m_next_idx)) {
+                    m_next_idx += r->m_num_idxs;
+                    m_cache.insert(mk_pair(e, r->m_result));
+                    return r->m_result;
+                }
+            }
         }
+        unsigned idx = m_next_idx;
         if (m_monitor)
             m_monitor->pre_eh(ro_simplifier(m_this), e);
         switch (e.kind()) {
         case expr_kind::Var:      return result(e);
-        case expr_kind::Constant: return save(e, simplify_constant(e));
+        case expr_kind::Constant: return save(e, simplify_constant(e), idx);
         case expr_kind::Type:     return result(e);
         case expr_kind::MetaVar:
         case expr_kind::Value:    return rewrite(e, result(e));
-        case expr_kind::App:      return save(e, simplify_app(e));
-        case expr_kind::Lambda:   return save(e, simplify_lambda(e));
-        case expr_kind::Pi:       return save(e, simplify_pi(e));
-        case expr_kind::Let:      return save(e, simplify(instantiate(let_body(e), let_value(e))));
-        case expr_kind::HEq:      return save(e, simplify_heq(e));
+        case expr_kind::App:      return save(e, simplify_app(e), idx);
+        case expr_kind::Lambda:   return save(e, simplify_lambda(e), idx);
+        case expr_kind::Pi:       return save(e, simplify_pi(e), idx);
+        case expr_kind::Let:      return save(e, simplify(instantiate(let_body(e), let_value(e))), idx);
+        case expr_kind::HEq:      return save(e, simplify_heq(e), idx);
         }
         lean_unreachable();
     }
@@ -1510,6 +1647,30 @@ class simplifier_cell::imp {
         m_preserve_binder_names = get_simplifier_preserve_binder_names(o);
     }
 
+    /** \brief Return the configuration options that affect the result produced by the simplifier. */
+    unsigned get_config() const {
+        bool flags[] = { m_proofs_enabled, m_contextual, m_single_pass, m_beta, m_eta, m_eval, m_unfold,
+                         m_conditional, m_preserve_binder_names, m_use_heq };
+        unsigned r = 0;
+        for (bool f : flags)
+            r = 2*r + (f ? 1 : 0);
+        return r;
+    }
+
+    /**
+       \brief Return the slot of the shared memo table for this simplifier.
+       We do not use the shared memo table when a monitor is provided, since cached results
+       are not reported to it, and when the number of steps is bounded.
+    */
+    simplifier_memo::slot_ref mk_shared_slot() {
+        if (!m_memoize || m_monitor || m_max_steps != LEAN_SIMPLIFIER_MAX_STEPS)
+            return simplifier_memo::slot_ref();
+        std::vector<unsigned> fingerprints;
+        for (auto const & rs : m_rule_sets)
+            fingerprints.push_back(rs.get_fingerprint());
+        return get_simplifier_memo().get_slot(m_env, fingerprints, get_config());
+    }
+
 public:
     imp(ro_environment const & env, options const & o, unsigned num_rs, rewrite_rule_set const * rs,
         std::shared_ptr<simplifier_monitor> const & monitor):
@@ -1527,8 +1688,10 @@ public:
     result operator()(expr const & e, optional<ro_metavar_env> const & menv) {
         if (m_menv.update(menv))
             m_cache.clear();
-        m_num_steps = 0;
-        m_depth     = 0;
+        m_num_steps  = 0;
+        m_depth      = 0;
+        m_num_scopes = 0;
+        m_shared     = mk_shared_slot();
         try {
             auto r = simplify(e);
             if (m_proofs_enabled && !r.get_proof())
@@ -10,13 +10,13 @@ Author: Leonardo de Moura
 #include "util/lua.h"
 #include "util/debug.h"
 #include "util/name.h"
-#include "util/splay_map.h"
+#include "util/avl_map.h"
 #include "util/rc.h"
 #include "kernel/expr.h"
 #include "library/tactic/assignment.h"
 
 namespace lean {
-typedef splay_map<name, expr, name_quick_cmp> proof_map;
+typedef avl_map<name, expr, name_quick_cmp> proof_map;
 
 /**
    \brief Return the proof for the goal named \c n in the \c proof_map \c m.
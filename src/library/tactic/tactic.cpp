@@ -20,7 +20,20 @@ Author: Leonardo de Moura
 #include "library/kernel_bindings.h"
 #include "library/tactic/tactic.h"
 
+#ifndef LEAN_TACTIC_LUA_WORKERS
+#define LEAN_TACTIC_LUA_WORKERS false
+#endif
+
 namespace lean {
+static name g_tactic_lua_workers {"tactic", "lua_workers"};
+RegisterBoolOption(g_tactic_lua_workers, LEAN_TACTIC_LUA_WORKERS,
+                   "(tactic) execute Lua tactics on worker Lua States, allowing them to run in parallel. "
+                   "Workers use copies of the global variables: assignments to global variables are lost, "
+                   "and reading a global variable that cannot be copied (e.g., a table) is an error");
+bool get_tactic_lua_workers(options const & opts) {
+    return opts.get_bool(g_tactic_lua_workers, LEAN_TACTIC_LUA_WORKERS);
+}
+
 solve_result::solve_result(expr const & pr):m_kind(solve_result_kind::Proof) { new (&m_proof) expr(pr); }
 solve_result::solve_result(counterexample const & cex):m_kind(solve_result_kind::Counterexample) { new (&m_cex) counterexample(cex); }
 solve_result::solve_result(list<proof_state> const & fs):m_kind(solve_result_kind::Failure) { new (&m_failures) list<proof_state>(fs); }
@@ -667,14 +680,71 @@ static int tactic_solve(lua_State * L) {
     }
 }
 
+static atomic<unsigned> g_lua_tactic_id(0);
+
+/**
+   \brief Execute the Lua function \c ref (with identifier \c id) with arguments \c env, \c ios and \c s
+   on a worker of \c S, and then invoke \c f with the worker Lua State. The result of the Lua function
+   is on the top of its stack. Return false if the function (or one of its upvalues) could not be
+   copied to the worker. In this case, the function is not executed, and the caller should execute it
+   in \c S. Errors raised by the function itself are propagated.
+
+   \remark The worker is not shared with other threads, then there is no need to execute \c ref
+   in a coroutine.
+
+   \remark The global variables of the worker are copies made when they are accessed for the first
+   time. Assignments to global variables are not propagated back to \c S, and redefinitions in \c S
+   are not propagated to workers that already have a copy. Since the function may have side effects,
+   it is not executed again in \c S when one of the global variables it accesses cannot be copied,
+   an error is raised instead.
+*/
+template<typename F>
+static bool apply_on_lua_worker(script_state const & S, luaref const & ref, unsigned id,
+                                ro_environment const & env, io_state const & ios, proof_state const & s, F && f) {
+    script_worker w(S);
+    return w.get_state().apply([&](lua_State * W) {
+            int sz_before = lua_gettop(W);
+            try {
+                // The function and its upvalues are copied before the function is executed.
+                w.push_function(W, ref, id); // push user-fun on the stack
+            } catch (interrupted &) {
+                throw;
+            } catch (exception &) {
+                // The function uses values that cannot be copied to the worker (e.g., tables).
+                lua_settop(W, sz_before);
+                return false;
+            }
+            try {
+                push_environment(W, env);    // push args...
+                push_io_state(W, ios);
+                push_proof_state(W, s);
+                pcall(W, 3, 1, 0);
+                f(W);
+            } catch (...) {
+                lua_settop(W, sz_before);
+                throw;
+            }
+            lua_settop(W, sz_before);
+            return true;
+        });
+}
+
 static int mk_lua_tactic01(lua_State * L) {
     luaL_checktype(L, 1, LUA_TFUNCTION); // user-fun
     script_state::weak_ref S = to_script_state(L).to_weak_ref();
     luaref ref(L, 1);
+    unsigned id = g_lua_tactic_id++;
     return push_tactic(L,
                        mk_tactic01([=](ro_environment const & env, io_state const & ios, proof_state const & s) -> optional<proof_state> {
                                script_state S_copy(S);
                                optional<proof_state> r;
+                               if (get_tactic_lua_workers(ios.get_options()) &&
+                                   apply_on_lua_worker(S_copy, ref, id, env, ios, s, [&](lua_State * W) {
+                                           if (is_proof_state(W, -1))
+                                               r = to_proof_state(W, -1);
+                                       })) {
+                                   return r;
+                               }
                                luaref coref; // Remark: we have to release the reference in a protected block.
                                try {
                                    bool done    = false;
@@ -715,19 +785,26 @@ static int mk_lua_cond_tactic(lua_State * L, tactic t1, tactic t2) {
     luaL_checktype(L, 1, LUA_TFUNCTION); // user-fun
     script_state::weak_ref S = to_script_state(L).to_weak_ref();
     luaref ref(L, 1);
+    unsigned id = g_lua_tactic_id++;
     return push_tactic(L,
                        mk_tactic([=](ro_environment const & env, io_state const & ios, proof_state const & s) -> proof_state_seq {
                                return mk_proof_state_seq([=]() {
                                        script_state S_copy(S);
                                        bool cond = false;
-                                       S_copy.exec_protected([&]() {
-                                               ref.push();               // push user-fun on the stack
-                                               push_environment(L, env); // push args...
-                                               push_io_state(L, ios);
-                                               push_proof_state(L, s);
-                                               pcall(L, 3, 1, 0);
-                                               cond = lua_toboolean(L, -1);
-                                           });
+                                       bool on_worker = get_tactic_lua_workers(ios.get_options()) &&
+                                           apply_on_lua_worker(S_copy, ref, id, env, ios, s, [&](lua_State * W) {
+                                                   cond = lua_toboolean(W, -1);
+                                               });
+                                       if (!on_worker) {
+                                           S_copy.exec_protected([&]() {
+                                                   ref.push();               // push user-fun on the stack
+                                                   push_environment(L, env); // push args...
+                                                   push_io_state(L, ios);
+                                                   push_proof_state(L, s);
+                                                   pcall(L, 3, 1, 0);
+                                                   cond = lua_toboolean(L, -1);
+                                               });
+                                       }
                                        if (cond) {
                                            return t1(env, ios, s).pull();
                                        } else {
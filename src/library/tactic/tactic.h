@@ -10,6 +10,7 @@ Author: Leonardo de Moura
 #include <memory>
 #include <string>
 #include "util/thread.h"
+#include "util/interrupt.h"
 #include "util/lazy_list.h"
 #include "kernel/io_state.h"
 #include "library/tactic/proof_state.h"
@@ -201,12 +202,11 @@ tactic using_params(tactic const & t, options const & opts);
    If the tactic does not terminate in \c ms milliseconds, then the empty
    sequence is returned.
 
-   \remark the tactic \c t is executed in a separate execution thread.
+   \remark the tactic \c t is executed by the thread pool (see \c thread_pool.h).
 
-   \remark \c check_ms is how often the main thread checks whether the child
-   thread finished.
+   \remark \c check_ms is how often the main thread checks whether it has been interrupted.
 */
-tactic try_for(tactic const & t, unsigned ms, unsigned check_ms = 1);
+tactic try_for(tactic const & t, unsigned ms, unsigned check_ms = g_small_sleep);
 /**
    \brief Execute both tactics and and combines their results.
    The results produced by tactic \c t1 are listed before the ones
@@ -226,11 +226,10 @@ tactic interleave(tactic const & t1, tactic const & t2);
    the elements in the output sequence is not deterministic.
    It depends on how fast \c t1 and \c t2 produce their output.
 
-   \remark \c check_ms is how often the main thread checks whether the children
-   threads finished.
+   \remark \c check_ms is how often the main thread checks whether it has been interrupted.
 */
 tactic par(tactic const & t1, tactic const & t2, unsigned check_ms);
-inline tactic par(tactic const & t1, tactic const & t2) { return par(t1, t2, 1); }
+inline tactic par(tactic const & t1, tactic const & t2) { return par(t1, t2, g_small_sleep); }
 
 /**
    \brief Return a tactic that keeps applying \c t until it fails.
@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <signal.h>
 #include <cstdlib>
 #include <getopt.h>
@@ -69,7 +70,12 @@ static void display_help(std::ostream & out) {
     std::cout << "                    it is useful for interrupting non-terminating user scripts,\n";
     std::cout << "                    0 means 'do not check'.\n";
     std::cout << "  --trust -t        trust imported modules\n";
+    std::cout << "  --threads=num -j  number of threads used to type check imported modules\n";
+    std::cout << "  --asyncproofs -a  type check theorem proofs in background threads\n";
+    std::cout << "  --compressproofs -z\n";
+    std::cout << "                    store theorem proofs in serialized form after they are type checked\n";
     std::cout << "  --quiet -q        do not print verbose messages\n";
+    std::cout << "  --hashcons -H     hash-cons expressions (structurally identical terms are shared)\n";
 #if defined(LEAN_USE_BOOST)
     std::cout << "  --tstack=num -s   thread stack size in Kb\n";
 #endif
@@ -101,7 +107,11 @@ static struct option g_long_options[] = {
     {"githash",    no_argument,       0, 'g'},
     {"output",     required_argument, 0, 'o'},
     {"trust",      no_argument,       0, 't'},
+    {"threads",    required_argument, 0, 'j'},
+    {"asyncproofs", no_argument,      0, 'a'},
+    {"compressproofs", no_argument,   0, 'z'},
     {"quiet",      no_argument,       0, 'q'},
+    {"hashcons",   no_argument,       0, 'H'},
 #if defined(LEAN_USE_BOOST)
     {"tstack",     required_argument, 0, 's'},
 #endif
@@ -115,10 +125,13 @@ int main(int argc, char ** argv) {
     bool export_objects = false;
     bool trust_imported = false;
     bool quiet          = false;
+    unsigned num_threads = 1;
+    bool async_proofs    = false;
+    bool compress_proofs = false;
     std::string output;
     input_kind default_k = input_kind::Lean; // default
     while (true) {
-        int c = getopt_long(argc, argv, "qtnlupgvhc:012s:012o:", g_long_options, NULL);
+        int c = getopt_long(argc, argv, "Hazqtnlupgvhc:012s:012o:j:", g_long_options, NULL);
         if (c == -1)
             break; // end of command line
         switch (c) {
@@ -160,9 +173,21 @@ int main(int argc, char ** argv) {
             trust_imported = true;
             lean::set_default_trust_imported_for_lua(true);
             break;
+        case 'j':
+            num_threads = std::max(atoi(optarg), 1);
+            break;
+        case 'a':
+            async_proofs = true;
+            break;
+        case 'z':
+            compress_proofs = true;
+            break;
         case 'q':
             quiet = true;
             break;
+        case 'H':
+            lean::set_hash_consing(true);
+            break;
         default:
             std::cerr << "Unknown command line option\n";
             display_help(std::cerr);
@@ -171,6 +196,9 @@ int main(int argc, char ** argv) {
     }
     environment env;
     env->set_trusted_imported(trust_imported);
+    env->set_num_check_threads(num_threads);
+    env->set_async_theorem_checking(async_proofs);
+    env->set_compress_proofs(compress_proofs);
     io_state ios = init_frontend(env, no_kernel);
     if (quiet)
         ios.set_option("verbose", false);
@@ -191,6 +219,7 @@ int main(int argc, char ** argv) {
 #endif
                 shell sh(env, &S);
                 int status = sh() ? 0 : 1;
+                env->join_theorem_checks();
                 if (export_objects)
                     env->export_objects(output);
                 return status;
@@ -234,7 +263,14 @@ int main(int argc, char ** argv) {
                     lean_unreachable(); // LCOV_EXCL_LINE
                 }
             }
-            if (export_objects)
+            try {
+                env->join_theorem_checks();
+            } catch (lean::exception & ex) {
+                ::lean::display_error(ios, nullptr, ex);
+                ok = false;
+            }
+            // do not export objects when one of the inputs was rejected
+            if (export_objects && ok)
                 env->export_objects(output);
             return ok ? 0 : 1;
         }
@@ -4,11 +4,16 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <vector>
+#include <string>
 #include "util/test.h"
 #include "util/exception.h"
 #include "util/trace.h"
+#include "util/thread.h"
+#include "util/interrupt.h"
 #include "kernel/kernel_exception.h"
 #include "kernel/environment.h"
+#include "kernel/threadsafe_environment.h"
 #include "kernel/type_checker.h"
 #include "kernel/kernel.h"
 #include "kernel/normalizer.h"
@@ -271,6 +276,257 @@ static void tst13() {
     } catch (exception &) {}
 }
 
+static void tst14() {
+    environment env;
+    env->set_async_theorem_checking(true);
+    env->set_compress_proofs(true);
+    expr A = Const("A");
+    expr B = Const("B");
+    expr a = Const("a");
+    expr b = Const("b");
+    env->add_var("A", Type());
+    env->add_var("B", Type());
+    env->add_var("a", A);
+    env->add_var("b", B);
+    env->add_theorem("t1", A, a);
+    env->add_theorem("t2", A, a);
+    env->join_theorem_checks();
+    lean_assert(env->get_object("t1").get_value() == a);
+    lean_assert(env->get_object("t2").get_type() == A);
+    env->add_theorem("t3", A, b);
+    lean_assert(env->has_object("t3"));
+    try {
+        env->join_theorem_checks();
+        lean_unreachable();
+    } catch (kernel_exception & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+    // theorems that were not proved are not kept in the environment
+    lean_assert(!env->has_object("t3"));
+    env->add_theorem("t4", B, a);
+    env->add_theorem("t5", A, a);
+    env->add_theorem("t6", B, b);
+    env->add_theorem("t7", B, a);
+    unsigned num_objects = env->get_num_objects(true);
+    try {
+        env->join_theorem_checks();
+        lean_unreachable();
+    } catch (theorem_check_exception & ex) {
+        lean_assert_eq(ex.get_failures().size(), 2);
+        lean_assert(ex.get_removed().empty());
+    }
+    lean_assert(!env->has_object("t4"));
+    lean_assert(env->has_object("t5"));
+    lean_assert(!env->has_object("t7"));
+    lean_assert(env->has_object("t6"));
+    lean_assert_eq(env->get_num_objects(true), num_objects - 2);
+    // declarations that use pending theorems wait for them
+    env->add_theorem("t8", A, a);
+    env->add_definition("d", A, Const("t8"));
+    lean_assert(env->has_object("d"));
+    env->add_theorem("t9", A, b);
+    try {
+        env->add_definition("f", A, Const("t9"));
+        lean_unreachable();
+    } catch (kernel_exception &) {}
+    lean_assert(!env->has_object("t9"));
+    lean_assert(!env->has_object("f"));
+    // theorems whose proofs use rejected theorems are removed and reported
+    env->add_theorem("t10", A, b);
+    env->add_theorem("t11", A, Const("t10"));
+    try {
+        env->join_theorem_checks();
+        lean_unreachable();
+    } catch (theorem_check_exception & ex) {
+        lean_assert_eq(ex.get_failures().size(), 1);
+        lean_assert_eq(ex.get_removed().size(), 1);
+        lean_assert_eq(ex.get_removed()[0], name("t11"));
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+    lean_assert(!env->has_object("t10"));
+    lean_assert(!env->has_object("t11"));
+    // proofs are checked in the environment where the theorem was declared
+    env->add_theorem("t12", A, Const("t12"));
+    try {
+        env->join_theorem_checks();
+        lean_unreachable();
+    } catch (kernel_exception &) {}
+    lean_assert(!env->has_object("t12"));
+}
+
+static void tst15() {
+    environment env;
+    env->add_var("a", Type());
+    std::vector<environment> scopes;
+    scopes.push_back(env);
+    for (unsigned i = 0; i < 50; i++) {
+        environment child = scopes.back()->mk_child();
+        if (i % 2 == 0)
+            child->add_var(name(name("x"), i), Type());
+        scopes.push_back(child);
+    }
+    environment inner = scopes.back();
+    lean_assert(inner->has_object("a"));
+    lean_assert(inner->has_object(name(name("x"), 48u)));
+    lean_assert(!inner->has_object(name(name("x"), 49u)));
+    lean_assert(!scopes[10]->has_object(name(name("x"), 10u)));
+    lean_assert_eq(inner->get_num_objects(false), env->get_num_objects(false) + 25);
+    lean_assert(inner->get_object(env->get_num_objects(false) - 1, false).get_name() == "a");
+    lean_assert(inner->get_object(env->get_num_objects(false), false).get_name() == name(name("x"), 0u));
+    try {
+        scopes[10]->add_var("b", Type());
+        lean_unreachable();
+    } catch (exception const & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+    try {
+        inner->add_var(name(name("x"), 0u), Type());
+        lean_unreachable();
+    } catch (exception const & ex) {
+        std::cout << "expected error: " << ex.what() << "\n";
+    }
+    // objects added after the children are deleted are visible in new children
+    scopes.resize(1);
+    inner = environment();
+    env->add_var("b", Type());
+    environment child1 = env->mk_child();
+    environment child2 = env->mk_child();
+    lean_assert(child1->has_object("b"));
+    lean_assert(child2->has_object("b"));
+    lean_assert_eq(child1->get_num_objects(false), env->get_num_objects(false));
+    // the index of the ancestor objects is extended when new objects are added, and it is shared by nested scopes
+    child1 = environment();
+    child2 = environment();
+    for (unsigned i = 0; i < 600; i++)
+        env->add_var(name(name("y"), i), Type());
+    child1 = env->mk_child();
+    for (unsigned i = 0; i < 300; i++)
+        child1->add_var(name(name("z"), i), Type());
+    child2 = child1->mk_child();
+    lean_assert_eq(child2->get_num_objects(false), child1->get_num_objects(false));
+    for (unsigned i = 0; i < child1->get_num_objects(false); i++)
+        lean_assert(child2->get_object(i, false).cell() == child1->get_object(i, false).cell());
+    lean_assert(child2->has_object(name(name("y"), 599u)) && child2->has_object(name(name("z"), 299u)));
+}
+
+#if defined(LEAN_MULTI_THREAD)
+static void tst16() {
+    environment env;
+    env->add_var("a", Type());
+    lean_assert(env->get_snapshot()->has_object("a"));
+    unsigned n = 2000;
+    atomic<bool> done(false);
+    std::vector<thread> readers;
+    for (unsigned i = 0; i < 4; i++) {
+        readers.emplace_back([&]() {
+                unsigned last = 0;
+                while (!done) {
+                    auto s = env->get_snapshot();
+                    unsigned num = s->get_num_objects(false);
+                    lean_assert(num >= last);
+                    last = num;
+                    lean_assert(s->has_object("a"));
+                    lean_assert(s->is_ge(level() + 1, level()));
+                    object const & obj = s->get_object(num - 1, false);
+                    lean_assert(!obj.has_name() || s->has_object(obj.get_name()));
+                }
+            });
+    }
+    for (unsigned i = 0; i < n; i++) {
+        read_write_shared_environment w(env);
+        w->add_var(name(name("x"), i), Type());
+    }
+    done = true;
+    for (auto & t : readers)
+        t.join();
+    auto s = env->get_snapshot();
+    lean_assert(s->has_object(name(name("x"), n - 1)));
+    lean_assert_eq(s->get_num_objects(false), env->get_num_objects(false));
+    lean_assert(s->get_object(env->get_num_objects(false) - 1, false).get_name() == name(name("x"), n - 1));
+    environment child = env->mk_child();
+    child->add_var("b", Type());
+    auto cs = child->get_snapshot();
+    lean_assert(cs->has_object("b") && cs->has_object("a"));
+    lean_assert(!env->get_snapshot()->has_object("b"));
+    lean_assert_eq(cs->get_num_objects(true), 1u);
+    lean_assert_eq(cs->get_num_objects(false), env->get_num_objects(false) + 1);
+}
+
+static void tst17() {
+    environment env;
+    expr A = Const("A");
+    expr a = Const("a");
+    expr d = Const("d");
+    env->add_var("A", Type());
+    env->add_var("a", A);
+    env->add_definition("d", A, a);
+    auto s = env->get_snapshot();
+    {
+        read_write_shared_environment w(env);
+        // readers do not wait for the writer
+        interruptible_thread reader([&]() {
+                auto s = env->get_snapshot();
+                lean_assert(s->type_check(d) == A);
+                lean_assert(s->infer_type(d) == A);
+                lean_assert(s->normalize(d) == a);
+                lean_assert(!s->is_proposition(a));
+            });
+        reader.join();
+        w->set_opaque("d", true);
+    }
+    // the opaque flag of the objects in a snapshot is not modified
+    lean_assert(!s->find_object("d")->is_opaque());
+    lean_assert(s->normalize(d) == a);
+    auto s2 = env->get_snapshot();
+    lean_assert(s2->find_object("d")->is_opaque());
+    lean_assert(s2->normalize(d) == d);
+    lean_assert_eq(s2->get_num_objects(false), env->get_num_objects(false));
+    // the opaque flag can be changed in a child, and it does not affect the parent
+    environment child = env->mk_child();
+    child->set_opaque("d", false);
+    lean_assert(!child->get_object("d").is_opaque());
+    lean_assert(env->get_object("d").is_opaque());
+    lean_assert(!child->get_snapshot()->find_object("d")->is_opaque());
+    lean_assert(child->normalize(d) == a);
+    environment grandchild = child->mk_child();
+    lean_assert(!grandchild->get_object("d").is_opaque());
+    lean_assert(grandchild->normalize(d) == a);
+    // the objects returned by position agree with the ones returned by name
+    auto check_positions = [&](environment const & e, bool opaque) {
+        auto s = e->get_snapshot();
+        unsigned num = 0;
+        for (unsigned i = 0; i < e->get_num_objects(false); i++) {
+            if (e->get_object(i, false).has_name() && e->get_object(i, false).get_name() == name("d")) {
+                lean_assert_eq(e->get_object(i, false).is_opaque(), opaque);
+                lean_assert_eq(s->get_object(i, false).is_opaque(), opaque);
+                num++;
+            }
+        }
+        lean_assert_eq(num, 1u);
+    };
+    check_positions(env, true);
+    check_positions(child, false);
+    check_positions(grandchild, false);
+    // the representation of the object is preserved
+    environment env2;
+    env2->set_compress_proofs(true);
+    env2->add_var("A", Type());
+    env2->add_var("a", A);
+    env2->add_theorem("t", A, a);
+    env2->set_opaque("t", false);
+    object t = env2->get_object("t");
+    lean_assert(t.is_theorem() && !t.is_opaque());
+    lean_assert_eq(std::string(t.keyword()), std::string("theorem"));
+    lean_assert(t.get_value() == a);
+    env2->set_opaque("t", true);
+    lean_assert(env2->get_object("t").is_opaque());
+    lean_assert(env2->get_object("t").get_value() == a);
+}
+#else
+static void tst16() {}
+static void tst17() {}
+#endif
+
 int main() {
     save_stack_info();
     register_modules();
@@ -288,5 +544,9 @@ int main() {
     tst11();
     tst12();
     tst13();
+    tst14();
+    tst15();
+    tst16();
+    tst17();
     return has_violations() ? 1 : 0;
 }
@@ -416,6 +416,73 @@ static void tst21() {
     check_serializer(t);
 }
 
+static void tst22() {
+    scoped_hash_consing enable;
+    expr f = Const("f");
+    expr a = Const("a");
+    expr N = Const("N");
+    expr t1 = f(a, Var(0));
+    expr t2 = f(a, Var(0));
+    lean_assert(is_eqp(t1, t2));
+    lean_assert(is_canonical(t1));
+    lean_assert(!is_eqp(f(a, Var(1)), t1));
+    expr l1 = mk_lambda("x", N, t1);
+    expr l2 = mk_lambda("x", N, t2);
+    expr l3 = mk_lambda("y", N, t2);
+    lean_assert(is_eqp(l1, l2));
+    // binder names are preserved, but alpha-equivalence is still used by operator==
+    lean_assert(!is_eqp(l1, l3));
+    lean_assert(!is_canonical(l1));
+    lean_assert(l1 == l3);
+    lean_assert(f(a, l1) == f(a, l3));
+    lean_assert(f(a, Var(0)) != f(a, Var(1)));
+    lean_assert(!is_eqp(copy(t1), t1));
+    lean_assert(copy(t1) == t1);
+    {
+        scoped_hash_consing disable(false);
+        expr t3 = f(a, Var(0));
+        lean_assert(!is_eqp(t1, t3));
+        lean_assert(t1 == t3);
+    }
+    unsigned sz = get_hash_consing_table_size();
+    {
+        expr big = f(mk_app(f, Const("b1"), Const("b2")), mk_app(f, Const("b3"), Var(3)));
+        lean_assert(get_hash_consing_table_size() > sz);
+    }
+    gc_hash_consing_table();
+    lean_assert(is_eqp(f(a, Var(0)), t1));
+}
+
+static void tst23() {
+    expr T = Const("T");
+    context ctx;
+    std::vector<context> ctxs;
+    for (unsigned i = 0; i < 1000; i++) {
+        ctxs.push_back(ctx);
+        ctx = extend(ctx, name(name("x"), i), T);
+    }
+    lean_assert(ctx.size() == 1000);
+    for (unsigned i = 0; i < 1000; i++) {
+        lean_assert(lookup(ctx, i).get_name() == name(name("x"), 999 - i));
+        auto p = lookup_ext(ctx, i);
+        lean_assert(p.first.get_name() == name(name("x"), 999 - i));
+        lean_assert(is_eqp(p.second, ctxs[999 - i]));
+        lean_assert(p.second.size() == 999 - i);
+    }
+    lean_assert(!find(ctx, 1000));
+    lean_assert(ctx.truncate(10) == ctx.truncate(10));
+    lean_assert(ctx.truncate(10).size() == 10);
+    lean_assert(lookup(ctx.truncate(10), 9).get_name() == name(name("x"), 990));
+    lean_assert(ctx != ctxs[999]);
+    lean_assert(extend(ctxs[999], "y", T) == ctx);
+    unsigned n = 0;
+    for (auto const & e : ctx) {
+        lean_assert(e.get_name() == name(name("x"), 999 - n));
+        n++;
+    }
+    lean_assert(n == 1000);
+}
+
 int main() {
     save_stack_info();
     lean_assert(sizeof(expr) == sizeof(optional<expr>));
@@ -440,6 +507,8 @@ int main() {
     tst19();
     tst20();
     tst21();
+    tst22();
+    tst23();
     std::cout << "sizeof(expr):            " << sizeof(expr) << "\n";
     std::cout << "sizeof(expr_app):        " << sizeof(expr_app) << "\n";
     std::cout << "sizeof(expr_cell):       " << sizeof(expr_cell) << "\n";
@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include "kernel/abstract.h"
 #include "kernel/metavar.h"
 #include "kernel/kernel.h"
+#include "kernel/instantiate.h"
 using namespace lean;
 
 static void tst1() {
@@ -147,6 +148,34 @@ static void tst6() {
     lean_assert(lift_free_vars(f(m2), 0, 1, menv) == f(add_lift(m2, 0, 1)));
 }
 
+static void tst7() {
+    expr f = Const("f");
+    expr t = Const("t");
+    lean_assert(get_free_var_range(f) == 0);
+    lean_assert(get_free_var_range(Var(3)) == 4);
+    lean_assert(get_free_var_range(f(Var(0), Var(2))) == 3);
+    lean_assert(get_free_var_range(mk_lambda("x", t, f(Var(0)))) == 0);
+    lean_assert(get_free_var_range(mk_lambda("x", Var(1), f(Var(0), Var(3)))) == 3);
+    lean_assert(get_free_var_range(mk_let("x", some_expr(Var(4)), Var(0), Var(1))) == 5);
+    lean_assert(get_free_var_range(mk_pair(f, f, mk_sigma("x", t, Var(2)))) == 2);
+    lean_assert(get_free_var_range(mk_proj1(Var(2))) == 3);
+    lean_assert(get_free_var_range(mk_heq(Var(1), f)) == 2);
+    lean_assert(get_free_var_range(mk_constant("c", f(Var(0)))) == 1);
+    // subterms that do not contain the variables being replaced are not modified
+    expr g  = f(Var(0), mk_lambda("x", t, f(Var(1), Var(3))));
+    expr n  = mk_lambda("x", t, f(Var(0)));
+    expr a  = f(n, Var(1), g);
+    lean_assert(is_eqp(lift_free_vars(a, 3, 1), a));
+    lean_assert(is_eqp(arg(lift_free_vars(a, 2, 1), 1), n));
+    lean_assert(lift_free_vars(a, 2, 1) == f(n, Var(1), f(Var(0), mk_lambda("x", t, f(Var(1), Var(4))))));
+    expr b  = f(n, Var(0), mk_lambda("x", t, f(Var(1), Var(4))));
+    lean_assert(lower_free_vars(b, 3, 2) == f(n, Var(0), mk_lambda("x", t, f(Var(1), Var(2)))));
+    lean_assert(is_eqp(arg(lower_free_vars(b, 3, 2), 1), n));
+    lean_assert(instantiate(a, 1, t) == f(n, t, f(Var(0), mk_lambda("x", t, f(Var(1), Var(2))))));
+    lean_assert(is_eqp(instantiate(n, 0, t), n));
+    lean_assert(has_free_var(a, 2) && !has_free_var(a, 3) && has_free_var(a, 1, 3) && !has_free_var(a, 3, 10));
+}
+
 int main() {
     save_stack_info();
     tst1();
@@ -155,5 +184,6 @@ int main() {
     tst4();
     tst5();
     tst6();
+    tst7();
     return has_violations() ? 1 : 0;
 }
@@ -9,6 +9,8 @@ Author: Leonardo de Moura
 #include <vector>
 #include <utility>
 #include "util/test.h"
+#include "util/thread.h"
+#include "util/stackinfo.h"
 #include "kernel/metavar.h"
 #include "kernel/instantiate.h"
 #include "kernel/abstract.h"
@@ -630,6 +632,146 @@ static void tst28() {
     lean_assert(add_lift(m2, 2, 2, menv) != add_lift(m2, 2, 2));
 }
 
+static void tst29() {
+    metavar_env menv;
+    expr f = Const("f");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr m1 = menv->mk_metavar();
+    expr m2 = menv->mk_metavar();
+    lean_assert(menv->assign(m1, f(m2)));
+    menv->push();
+    lean_assert(menv->num_scopes() == 1);
+    unsigned ts = menv->get_timestamp();
+    expr m3 = menv->mk_metavar();
+    lean_assert(menv->assign(m2, a, mk_assumption_justification(0)));
+    // the substitution of m1 is normalized
+    lean_assert(menv->get_subst(m1) == some_expr(f(a)));
+    lean_assert(!menv->has_type(m3));
+    expr T3 = menv->get_type(m3);
+    lean_assert(menv->has_type(m3));
+    menv->push();
+    lean_assert(menv->assign(m3, b));
+    menv->pop();
+    lean_assert(!menv->is_assigned(m3));
+    lean_assert(menv->is_assigned(m2));
+    menv->pop();
+    lean_assert(menv->num_scopes() == 0);
+    lean_assert(menv->get_timestamp() > ts);
+    lean_assert(menv->is_assigned(m1));
+    lean_assert(!menv->is_assigned(m2));
+    lean_assert(menv->get_subst(m1) == some_expr(f(m2)));
+    lean_assert(!menv->is_assigned(metavar_name(m3)));
+    // metavariables created after pop are fresh
+    expr m4 = menv->mk_metavar();
+    lean_assert(m4 != m3 && m4 != T3);
+    lean_assert(menv->assign(m2, b, mk_assumption_justification(1)));
+    lean_assert(menv->get_subst(m1) == some_expr(f(b)));
+    // pop undoes all updates of nested scopes
+    menv->push();
+    menv->push();
+    lean_assert(menv->assign(m4, a));
+    menv->pop(2);
+    lean_assert(menv->num_scopes() == 0);
+    lean_assert(!menv->is_assigned(m4));
+}
+
+#if defined(LEAN_MULTI_THREAD)
+static void tst30() {
+    metavar_env menv;
+    expr f = Const("f");
+    expr a = Const("a");
+    unsigned n = 100;
+    std::vector<expr> ms;
+    for (unsigned i = 0; i < n; i++)
+        ms.push_back(menv->mk_metavar());
+    // The substitutions are not normalized when they are assigned. So, get_subst has to normalize them.
+    for (unsigned i = 0; i + 1 < n; i++)
+        lean_assert(menv->assign(ms[i], f(ms[i+1]), mk_assumption_justification(i)));
+    lean_assert(menv->assign(ms[n-1], a));
+    std::vector<expr> expected(n, a);
+    for (unsigned i = n - 1; i > 0; i--)
+        expected[i-1] = f(expected[i]);
+    unsigned ts = menv->get_timestamp();
+    ro_metavar_env ro_menv(menv);
+    std::vector<thread> readers;
+    for (unsigned t = 0; t < 4; t++) {
+        readers.emplace_back([&, t]() {
+                save_stack_info(false);
+                for (unsigned j = 0; j < 2*n; j++) {
+                    unsigned i = (j * (t + 1)) % n;
+                    lean_assert(ro_menv->get_subst(ms[i]) == some_expr(expected[i]));
+                    lean_assert(ro_menv->instantiate_metavars(f(ms[0])) == f(expected[0]));
+                }
+            });
+    }
+    for (auto & t : readers)
+        t.join();
+    // readers do not modify the shared metavariable environment
+    lean_assert(menv->get_timestamp() == ts);
+    menv->for_each_subst([&](name const & m, expr const & s) {
+            if (m == metavar_name(ms[0]))
+                lean_assert(s == f(ms[1]));
+        });
+}
+#else
+static void tst30() {}
+#endif
+
+static void tst31() {
+    metavar_env menv;
+    expr f = Const("f");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr m1 = menv->mk_metavar();
+    expr m2 = menv->mk_metavar();
+    expr m3 = menv->mk_metavar();
+    lean_assert(menv->assign(m1, f(m2)));
+    lean_assert(menv->assign(m2, f(m3)));
+    lean_assert(menv->get_subst(m1) == some_expr(f(f(m3))));
+    // normalized substitutions are cached, and the cache is invalidated when the environment is updated
+    lean_assert(menv->get_subst(m1) == some_expr(f(f(m3))));
+    menv->push();
+    lean_assert(menv->assign(m3, a));
+    lean_assert(menv->get_subst(m1) == some_expr(f(f(a))));
+    menv->pop();
+    lean_assert(menv->get_subst(m1) == some_expr(f(f(m3))));
+    lean_assert(menv->assign(m3, b));
+    lean_assert(menv->get_subst(m1) == some_expr(f(f(b))));
+    // long chains of assignments
+    unsigned n = 2000;
+    std::vector<expr> ms;
+    for (unsigned i = 0; i < n; i++)
+        ms.push_back(menv->mk_metavar());
+    for (unsigned i = 0; i + 1 < n; i++)
+        lean_assert(menv->assign(ms[i], f(ms[i+1])));
+    lean_assert(menv->assign(ms[n-1], a));
+    for (unsigned i = n; i > 0; i--)
+        lean_assert(menv->get_subst(ms[i-1]));
+    lean_assert(menv->get_subst(ms[n-2]) == some_expr(f(a)));
+}
+
+static void tst32() {
+    metavar_env menv;
+    expr f = Const("f");
+    expr a = Const("a");
+    expr m1 = menv->mk_metavar();
+    expr m2 = menv->mk_metavar();
+    menv->push();
+    lean_assert(menv->assign(m1, f(m2)));
+    metavar_env_snapshot s(menv);
+    lean_assert(menv->assign(m2, a));
+    menv->pop();
+    // the snapshot is not affected by the updates performed after it was created
+    metavar_env menv2 = s.to_metavar_env();
+    lean_assert(!is_eqp(menv, menv2));
+    lean_assert(menv2->get_subst(m1) == some_expr(f(m2)));
+    lean_assert(!menv2->is_assigned(m2));
+    lean_assert(!menv->is_assigned(m1));
+    // metavariables created by the new environment are fresh
+    lean_assert(menv2->mk_metavar() != m1 && menv2->mk_metavar() != m2);
+}
+
 int main() {
     save_stack_info();
     register_modules();
@@ -661,5 +803,9 @@ int main() {
     tst26();
     tst27();
     tst28();
+    tst29();
+    tst30();
+    tst31();
+    tst32();
     return has_violations() ? 1 : 0;
 }
@@ -349,6 +349,64 @@ static void tst11() {
                    menv->instantiate_metavars(N));
 }
 
+static void tst12() {
+    environment env;
+    env->add_var("t", Type());
+    env->add_var("N", Type());
+    env->add_var("z", Const("N"));
+    env->add_var("s", Const("N") >> Const("N"));
+    env->add_var("g", Const("N") >> (Const("N") >> Const("N")));
+    expr N = Const("N");
+    expr z = Const("z");
+    expr s = Const("s");
+    expr g = Const("g");
+    expr x = Const("x");
+    expr f = Const("f");
+    env->add_definition("id", Fun({x, N}, x));
+    env->add_definition("twice", Fun({{f, N >> N}, {x, N}}, f(f(x))));
+    env->add_definition("four", Const("twice")(s, Const("twice")(s, z)));
+    expr id = Const("id");
+    // The normalizer is reused in different contexts, and the normal forms of the definitions are cached.
+    normalizer proc(env);
+    context ctx({{"a", N}, {"b", N}});
+    for (unsigned i = 0; i < 2; i++) {
+        lean_assert_eq(count(proc(Const("four"))), 4 + 2);
+        lean_assert_eq(proc(lam(lam(g(id(Var(0)), id(Var(1)))))), lam(lam(g(Var(0), Var(1)))));
+        lean_assert_eq(proc(lam(g(id(Var(0)), Const("four")))), lam(g(Var(0), proc(Const("four")))));
+        lean_assert_eq(proc(g(id(Var(0)), id(Var(1))), ctx), g(Var(0), Var(1)));
+        lean_assert_eq(proc(mk_app(lam(g(Var(0), Var(1))), id(Var(1))), ctx), g(Var(1), Var(0)));
+    }
+}
+
+static void tst13() {
+    environment env;
+    expr N = Const("N");
+    expr g = Const("g");
+    expr x = Const("x");
+    env->add_var("N", Type());
+    env->add_var("a", N);
+    env->add_var("g", N >> (N >> N));
+    env->add_definition("id", Fun({x, N}, x));
+    env->add_definition("dup", Fun({x, N}, g(x, x)));
+    // The arguments are evaluated at most once, and the normal form is a DAG of size 32.
+    // A normalizer that copies the arguments would produce 2^32 nodes.
+    expr a = Const("a");
+    expr y = Const("y");
+    auto chain = [](expr e) {
+        for (unsigned i = 0; i < 32; i++)
+            e = Const("dup")(Const("id")(e));
+        return e;
+    };
+    normalizer proc(env);
+    for (expr r : {proc(chain(Const("id")(a))), abst_body(proc(Fun({y, N}, chain(Const("id")(y)))))}) {
+        for (unsigned i = 0; i < 32; i++) {
+            lean_assert(is_app(r) && arg(r, 0) == g && is_eqp(arg(r, 1), arg(r, 2)));
+            r = arg(r, 1);
+        }
+        lean_assert(r == a || r == Var(0));
+    }
+}
+
 int main() {
     save_stack_info();
     register_modules();
@@ -364,5 +422,7 @@ int main() {
     tst9();
     tst10();
     tst11();
+    tst12();
+    tst13();
     return has_violations() ? 1 : 0;
 }
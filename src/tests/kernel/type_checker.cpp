@@ -498,6 +498,82 @@ static void tst22() {
     lean_assert(!tc.is_convertible(b, a));
 }
 
+static void tst23() {
+    environment env;
+    init_test_frontend(env);
+    type_checker tc(env);
+    // the cache is keyed by pointer: structurally equal terms built independently are not reused
+    expr t1 = mk_big(0, 4);
+    expr t2 = mk_big(0, 4);
+    lean_assert(t1 == t2 && !is_eqp(t1, t2));
+    expr r1 = tc.check(t1);
+    lean_assert_eq(tc.check(t2), r1);
+    lean_assert_eq(tc.get_num_cache_hits(), 0u);
+    {
+        // with hash-consing they are the same cell, and results are cached across top-level calls
+        scoped_hash_consing hc;
+        expr s1 = mk_big(0, 4);
+        expr s2 = mk_big(0, 4);
+        lean_assert(is_eqp(s1, s2));
+        expr r2 = tc.check(s1);
+        unsigned hits = tc.get_num_cache_hits();
+        lean_assert(is_eqp(tc.check(s2), r2));
+        lean_assert_eq(tc.get_num_cache_hits(), hits + 1);
+        // the cache is invalidated when the context changes
+        context ctx = extend(context(), "x", Int);
+        lean_assert_eq(tc.check(s1, ctx), r1);
+        lean_assert_eq(tc.get_num_cache_hits(), hits + 1);
+        lean_assert_eq(tc.check(s2, ctx), r1);
+        lean_assert_eq(tc.get_num_cache_hits(), hits + 2);
+        // results depending on unification constraints are not reused
+        expr f = Const("f");
+        env->add_var("f", Int >> Int);
+        metavar_env menv;
+        expr m1 = menv->mk_metavar();
+        expr F1 = f(m1);
+        expr F2 = f(m1);
+        lean_assert(is_eqp(F1, F2));
+        buffer<unification_constraint> uc1, uc2;
+        hits = tc.get_num_cache_hits();
+        tc.check(F1, context(), menv, uc1);
+        tc.check(F2, context(), menv, uc2);
+        lean_assert(uc1.size() > 0);
+        lean_assert(uc1.size() == uc2.size());
+        lean_assert_eq(tc.get_num_cache_hits(), hits);
+    }
+}
+
+static void tst24() {
+    environment env;
+    expr N = Const("N");
+    expr P = Const("P");
+    expr h = Const("h");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr x = Const("x");
+    env->add_var("N", Type());
+    env->add_var("P", N >> Type());
+    env->add_var("h", N >> (N >> N));
+    env->add_var("a", N);
+    env->add_var("b", N);
+    // d_{i+1} := fun x : N, h (d_i x) (d_i x), the normal form of (d_n a) contains 2^n occurrences of a
+    auto d = [](unsigned i) { return Const(name(name("d"), i)); };
+    unsigned n = 40;
+    env->add_definition(const_name(d(0)), N >> N, Fun({x, N}, x));
+    for (unsigned i = 1; i <= n; i++)
+        env->add_definition(const_name(d(i)), N >> N, Fun({x, N}, h(d(i-1)(x), d(i-1)(x))));
+    type_checker tc(env);
+    lean_assert(tc.is_convertible(d(n)(a), h(d(n-1)(a), d(n-1)(a))));
+    lean_assert(tc.is_definitionally_equal(h(d(n-1)(a), d(n-1)(a)), d(n)(a)));
+    lean_assert(tc.is_convertible(P(d(n)(a)), P(h(d(n-1)(a), d(n-1)(a)))));
+    lean_assert(tc.is_convertible(N >> P(d(n)(a)), N >> P(h(d(n-1)(a), d(n-1)(a)))));
+    lean_assert(tc.is_convertible(P(d(n)(a)) >> Type(), P(h(d(n-1)(a), d(n-1)(a))) >> Type(level()+1)));
+    // the lazy check fails, and full normalization is used
+    lean_assert(!tc.is_convertible(d(2)(a), d(2)(b)));
+    lean_assert(!tc.is_convertible(d(1)(a), h(a, b)));
+    lean_assert(tc.is_convertible(d(1)(a), h(d(0)(a), a)));
+}
+
 int main() {
     save_stack_info();
     register_modules();
@@ -520,6 +596,8 @@ int main() {
     tst17();
     tst18();
     tst19();
+    tst23();
+    tst24();
     return has_violations() ? 1 : 0;
     tst20();
     tst21();
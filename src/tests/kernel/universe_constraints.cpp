@@ -4,6 +4,10 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
 #include "util/test.h"
 #include "kernel/universe_constraints.h"
 using namespace lean;
@@ -39,9 +43,98 @@ static void tst1() {
     lean_assert(uc.is_consistent(d, a, -3));
 }
 
+static void tst2() {
+    // compare with the distances computed by the Floyd-Warshall algorithm
+    unsigned n = 30;
+    int none   = std::numeric_limits<int>::min();
+    std::vector<name> vs;
+    std::vector<std::vector<int>> d(n, std::vector<int>(n, none));
+    universe_constraints uc;
+    for (unsigned i = 0; i < n; i++) {
+        vs.push_back(name(name("u"), i));
+        uc.add_var(vs.back());
+        d[i][i] = 0;
+    }
+    std::mt19937 rng;
+    rng.seed(1);
+    std::uniform_int_distribution<unsigned> uint_dist;
+    for (unsigned step = 0; step < 200; step++) {
+        unsigned i = uint_dist(rng) % n;
+        unsigned j = uint_dist(rng) % n;
+        int k      = uint_dist(rng) % 3;
+        if (!uc.is_consistent(vs[i], vs[j], k)) {
+            lean_assert(d[j][i] != none && d[j][i] >= 1 - k);
+            continue;
+        }
+        lean_assert(d[j][i] == none || d[j][i] < 1 - k);
+        uc.add_constraint(vs[i], vs[j], k);
+        d[i][j] = std::max(d[i][j], k);
+        for (unsigned m = 0; m < n; m++)
+            for (unsigned x = 0; x < n; x++)
+                for (unsigned y = 0; y < n; y++)
+                    if (d[x][m] != none && d[m][y] != none)
+                        d[x][y] = std::max(d[x][y], d[x][m] + d[m][y]);
+        if (step % 20 == 0) {
+            universe_constraints copy(uc);
+            for (unsigned x = 0; x < n; x++) {
+                for (unsigned y = 0; y < n; y++) {
+                    auto r = copy.get_distance(vs[x], vs[y]);
+                    lean_assert(d[x][y] == none ? !r : r && *r == d[x][y]);
+                }
+            }
+        }
+        for (unsigned x = 0; x < n; x++) {
+            unsigned y = uint_dist(rng) % n;
+            auto r = uc.get_distance(vs[x], vs[y]);
+            lean_assert(d[x][y] == none ? !r : r && *r == d[x][y]);
+        }
+    }
+}
+
+static void tst3() {
+    universe_constraints uc;
+    name a("a"), b("b"), c("c");
+    uc.add_var(a); uc.add_var(b); uc.add_var(c);
+    int max = std::numeric_limits<int>::max();
+    lean_assert(!uc.overflows(a, b, max));
+    uc.add_constraint(a, b, max - 1);
+    lean_assert(uc.overflows(b, c, 2));
+    lean_assert(!uc.overflows(b, c, 1));
+    lean_assert(!uc.overflows(a, c, 2));
+    lean_assert(!uc.get_distance(a, name("d")));
+}
+
+static void tst4() {
+    // Chain of diamonds v_i -> w_i -> v_{i+1} and v_i -> v_{i+1}, where only the edge v_i -> w_i
+    // has a non-zero weight 2^(n-1-i). A LIFO propagation explores the short paths first, and
+    // v_n takes all values 0, 1, ..., 2^n - 1 before the longest path is found.
+    unsigned n = 30;
+    universe_constraints uc;
+    std::vector<name> vs, ws;
+    for (unsigned i = 0; i <= n; i++) {
+        vs.push_back(name(name("v"), i));
+        ws.push_back(name(name("w"), i));
+        uc.add_var(vs.back());
+        uc.add_var(ws.back());
+    }
+    for (unsigned i = 0; i < n; i++) {
+        uc.add_constraint(vs[i], ws[i], 1 << (n - 1 - i));
+        uc.add_constraint(vs[i], vs[i+1], 0);
+    }
+    for (unsigned i = 0; i < n; i++)
+        uc.add_constraint(ws[i], vs[i+1], 0);
+    universe_constraints copy(uc);
+    lean_assert_eq(*copy.get_distance(vs[0], vs[n]), (1 << n) - 1);
+    lean_assert_eq(*copy.get_distance(vs[1], ws[n-1]), (1 << (n - 1)) - 1);
+    lean_assert(!copy.get_distance(vs[n], vs[0]));
+}
+
 int main() {
     save_stack_info();
     tst1();
+    tst2();
+    tst3();
+    tst4();
     return has_violations() ? 1 : 0;
 }
 
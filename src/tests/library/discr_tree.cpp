@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <vector>
+#include "util/test.h"
+#include "kernel/environment.h"
+#include "kernel/abstract.h"
+#include "library/simplifier/discr_tree.h"
+using namespace lean;
+
+static void insert(discr_tree<unsigned> & t, ro_environment const & env, expr const & p, unsigned v) {
+    buffer<discr_path_entry> path;
+    mk_discr_path(p, env, path);
+    t.insert(path, v);
+}
+
+static std::vector<unsigned> find(discr_tree<unsigned> const & t, expr const & e) {
+    std::vector<unsigned> r;
+    t.find(e, [&](unsigned v) { r.push_back(v); return false; });
+    return r;
+}
+
+static void tst1() {
+    environment env;
+    expr A = Const("A");
+    expr f = Const("f");
+    expr g = Const("g");
+    expr h = Const("h");
+    expr a = Const("a");
+    expr b = Const("b");
+    env->add_var("A", Type());
+    env->add_var("f", A >> (A >> A));
+    env->add_var("g", A >> A);
+    env->add_definition("h", A >> A, g);
+    env->add_var("a", A);
+    env->add_var("b", A);
+    discr_tree<unsigned> t;
+    insert(t, env, f(Var(0), a), 1);
+    insert(t, env, g(Var(0)), 2);
+    insert(t, env, Var(0), 3);
+    insert(t, env, h(Var(0)), 4);
+    insert(t, env, Var(1)(Var(0)), 5);
+    discr_tree<unsigned> t2(t);
+    insert(t2, env, f(b, Var(0)), 6);
+    lean_assert(find(t, f(b, a)) == std::vector<unsigned>({5, 3, 1}));
+    lean_assert(find(t, f(b, b)) == std::vector<unsigned>({5, 3}));
+    lean_assert(find(t, g(b)) == std::vector<unsigned>({5, 4, 3, 2}));
+    lean_assert(find(t, f(a, b, a)) == std::vector<unsigned>({5, 3}));
+    lean_assert(find(t, a) == std::vector<unsigned>({5, 3}));
+    lean_assert(find(t2, f(b, a)) == std::vector<unsigned>({6, 5, 3, 1}));
+    lean_assert(find(t2, f(a, a)) == std::vector<unsigned>({5, 3, 1}));
+    discr_tree<unsigned> t3;
+    insert(t3, env, mk_lambda("x", A, f(Var(0), Var(1))), 1);
+    insert(t3, env, mk_lambda("x", A, f(Var(1), Var(0))), 2);
+    lean_assert(find(t3, mk_lambda("x", A, f(Var(0), a))) == std::vector<unsigned>({1}));
+    lean_assert(find(t3, mk_lambda("x", A, f(a, Var(0)))) == std::vector<unsigned>({2}));
+    lean_assert(find(t3, mk_lambda("x", A, f(a, a))).empty());
+}
+
+int main() {
+    save_stack_info();
+    tst1();
+    return has_violations() ? 1 : 0;
+}
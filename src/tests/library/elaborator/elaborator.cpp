@@ -866,6 +866,54 @@ void tst27() {
                    Fun({f, Type() >> Type()}, eq(Type(), g(Type() >> Type(), f)(a), a)));
 }
 
+static void tst28() {
+    environment env;
+    env->add_uvar_cnstr("U");
+    expr N = Const("N");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr c = Const("c");
+    expr g = Const("g");
+    env->add_var("N", Type());
+    env->add_var("a", N);
+    env->add_var("b", N);
+    env->add_var("c", N);
+    env->add_var("g", N >> (N >> N));
+    options par_opts = options(name({"elaborator", "parallel"}), true);
+    // return all solutions for ?m1 in {a, b, c}, ?m2 in {a, b, c}, g ?m1 ?m3 == g t ?m2, ?m3 == b
+    auto solve = [&](options const & opts, std::function<expr(expr const &)> const & t) {
+        metavar_env menv;
+        expr m1 = menv->mk_metavar();
+        expr m2 = menv->mk_metavar();
+        expr m3 = menv->mk_metavar();
+        buffer<unification_constraint> ucs;
+        ucs.push_back(mk_choice_constraint(context(), m1, { a, b, c }, justification()));
+        ucs.push_back(mk_choice_constraint(context(), m2, { a, b, c }, justification()));
+        ucs.push_back(mk_eq_constraint(context(), g(m1, m3), g(t(m2), m2), justification()));
+        ucs.push_back(mk_eq_constraint(context(), m3, b, justification()));
+        elaborator elb(env, menv, ucs.size(), ucs.data(), opts);
+        buffer<expr> r;
+        try {
+            while (true) {
+                metavar_env s = elb.next();
+                r.push_back(s->instantiate_metavars(g(m1, g(m2, m3))));
+            }
+        } catch (elaborator_exception &) {
+        }
+        return r;
+    };
+    auto check = [&](std::function<expr(expr const &)> const & t, unsigned num_sols) {
+        buffer<expr> r1 = solve(options(), t);
+        buffer<expr> r2 = solve(par_opts, t);
+        lean_assert(r1.size() == num_sols);
+        lean_assert(r1 == r2);
+        return r2;
+    };
+    lean_assert(check([&](expr const &) { return c; }, 1)[0] == g(c, g(b, b)));
+    lean_assert(check([&](expr const & m2) { return m2; }, 1)[0] == g(b, g(b, b)));
+    check([&](expr const &) { return g(a, a); }, 0);
+}
+
 int main() {
     save_stack_info();
     register_modules();
@@ -896,5 +944,6 @@ int main() {
     tst25();
     tst26();
     tst27();
+    tst28();
     return has_violations() ? 1 : 0;
 }
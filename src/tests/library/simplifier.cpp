@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include "util/test.h"
+#include "kernel/kernel.h"
+#include "kernel/kernel_exception.h"
+#include "library/simplifier/simplifier.h"
+#include "frontends/lean/frontend.h"
+#include "frontends/lua/register_modules.h"
+using namespace lean;
+
+static options mk_unfold_options(bool memoize = true) {
+    options opts;
+    opts = opts.update(name{"simplifier", "unfold"}, true);
+    opts = opts.update(name{"simplifier", "memoize"}, memoize);
+    return opts;
+}
+
+static expr simp(ro_environment const & env, options const & opts, expr const & e) {
+    simplifier s(env, opts, 0, nullptr, std::shared_ptr<simplifier_monitor>());
+    return s(e, optional<ro_metavar_env>()).get_expr();
+}
+
+static void tst1() {
+    environment env;
+    init_test_frontend(env);
+    expr A = Const("A");
+    expr a = Const("a");
+    expr f = Const("f");
+    expr c = Const("c");
+    env->add_var("A", Type());
+    env->add_var("a", A);
+    env->add_var("f", A >> A);
+    env->add_definition("c", A, a);
+    options opts = mk_unfold_options();
+    // the shared memo table is indexed by pointer, then we use the same expression in all invocations
+    expr e  = f(c);
+    expr r1 = simp(env, opts, e);
+    lean_assert_eq(r1, f(a));
+    // the second simplifier reuses the result produced by the first one
+    expr r2 = simp(env, opts, e);
+    lean_assert(is_eqp(r1, r2));
+    // results are not shared when memoization is disabled
+    expr r3 = simp(env, mk_unfold_options(false), e);
+    lean_assert_eq(r3, r1);
+    lean_assert(!is_eqp(r3, r1));
+    // modifying the environment invalidates the results
+    env->add_var("b", A);
+    expr r4 = simp(env, opts, e);
+    lean_assert_eq(r4, r1);
+    lean_assert(!is_eqp(r4, r1));
+    expr r5 = simp(env, opts, e);
+    lean_assert(is_eqp(r4, r5));
+}
+
+static void tst2() {
+    environment env;
+    init_test_frontend(env);
+    env->set_async_theorem_checking(true);
+    expr A = Const("A");
+    expr B = Const("B");
+    expr a = Const("a");
+    expr b = Const("b");
+    expr f = Const("f");
+    expr c = Const("c");
+    env->add_var("A", Type());
+    env->add_var("B", Type());
+    env->add_var("a", A);
+    env->add_var("b", B);
+    env->add_var("f", A >> A);
+    options opts = mk_unfold_options();
+    expr e = f(c);
+    // theorems are not unfolded
+    env->add_theorem("c", A, b);
+    unsigned num_objects = env->get_num_objects(false);
+    lean_assert_eq(simp(env, opts, e), e);
+    try {
+        env->join_theorem_checks();
+        lean_unreachable();
+    } catch (kernel_exception &) {}
+    lean_assert(!env->has_object("c"));
+    // the environment has the same number of objects, but the results obtained when
+    // c was a theorem must not be reused
+    env->add_definition("c", A, a);
+    lean_assert_eq(env->get_num_objects(false), num_objects);
+    lean_assert_eq(simp(env, opts, e), f(a));
+}
+
+int main() {
+    save_stack_info();
+    register_modules();
+    tst1();
+    tst2();
+    return has_violations() ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <iostream>
+#include <sstream>
+#include "util/test.h"
+#include "util/avl_map.h"
+#include "util/name.h"
+using namespace lean;
+
+struct int_cmp { int operator()(int i1, int i2) const { return i1 < i2 ? -1 : (i1 > i2 ? 1 : 0); } };
+
+typedef avl_map<int, name, int_cmp> int2name;
+
+static void tst0() {
+    int2name m1;
+    m1[10] = name("t1");
+    m1[20] = name("t2");
+    int2name m2(m1);
+    m2[10] = name("t3");
+    lean_assert(m1[10] == name("t1"));
+    lean_assert(m1[20] == name("t2"));
+    lean_assert(m2[10] == name("t3"));
+    lean_assert(m2[20] == name("t2"));
+    lean_assert(m2.size() == 2);
+    lean_assert(m2[100] == name());
+    lean_assert(m2.size() == 3);
+    lean_assert(m2[100] == name());
+    lean_assert(m2.size() == 3);
+}
+
+static void tst1() {
+    int2name m;
+    m[10] = name("t1");
+    m[20] = name("t2");
+    lean_assert(fold(m, [](int k, name const &, int a) { return k + a; }, 0) == 30);
+    std::ostringstream out;
+    for_each(m, [&](int, name const & v) { out << v << " "; });
+    std::cout << out.str() << "\n";
+    lean_assert(out.str() == "t1 t2 ");
+}
+
+static void tst2() {
+    int2name m1, m2;
+    m1[10] = name("t1");
+    lean_assert(m1.size() == 1);
+    lean_assert(m2.size() == 0);
+    swap(m1, m2);
+    lean_assert(m2.size() == 1);
+    lean_assert(m1.size() == 0);
+}
+
+static void tst3() {
+    int2name m1;
+    m1.insert(1, name("a"));
+    int2name m2 = insert(m1, 2, name("b"));
+    int2name m3 = erase(m2, 1);
+    lean_assert(m1.contains(1) && !m1.contains(2));
+    lean_assert(m2.contains(1) && m2.contains(2));
+    lean_assert(!m3.contains(1) && m3.contains(2));
+    lean_assert(*(m3.find(2)) == name("b"));
+    lean_assert(m1.find(2) == nullptr);
+    int2name m4(m1);
+    lean_assert(m4.is_eqp(m1));
+    m4.erase(5);
+    lean_assert(m4.is_eqp(m1));
+}
+
+int main() {
+    tst0();
+    tst1();
+    tst2();
+    tst3();
+    return has_violations() ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <random>
+#include <ctime>
+#include <unordered_set>
+#include <sstream>
+#include "util/test.h"
+#include "util/thread.h"
+#include "util/avl_tree.h"
+using namespace lean;
+
+struct int_lt { int operator()(int i1, int i2) const { return i1 < i2 ? -1 : (i1 > i2 ? 1 : 0); } };
+
+typedef avl_tree<int, int_lt> int_avl_tree;
+typedef std::unordered_set<int> int_set;
+
+static void tst1() {
+    int_avl_tree s;
+    for (int v : {10, 3, 20, 40, 5, 11, 20, 30, 25, 15})
+        s.insert(v);
+    std::cout << s << "\n";
+    lean_assert(s.check_invariant());
+    lean_assert_eq(s.size(), 9u);
+    for (int v : {40, 11, 20, 25, 5, 10, 3, 15, 30})
+        lean_assert(s.contains(v));
+    lean_assert(!s.contains(4));
+    int_avl_tree s2(s);
+    s.insert(34);
+    lean_assert(s.contains(34));
+    lean_assert(!s2.contains(34));
+    int const * v = s.find(11);
+    lean_assert(*v == 11);
+    s.erase(11);
+    lean_assert(!s.contains(11));
+    lean_assert(s2.contains(11));
+    lean_assert(!s.empty());
+    s.clear();
+    lean_assert(s.empty());
+    lean_assert(s2.size() == 9);
+}
+
+static bool operator==(int_set const & v1, int_avl_tree const & v2) {
+    buffer<int> b;
+    v2.to_buffer(b);
+    if (v1.size() != b.size())
+        return false;
+    for (unsigned i = 0; i < b.size(); i++) {
+        if (v1.find(b[i]) == v1.end())
+            return false;
+        if (i > 0 && b[i-1] >= b[i])
+            return false;
+    }
+    return true;
+}
+
+static void driver(unsigned max_sz, unsigned max_val, unsigned num_ops, double insert_freq, double copy_freq) {
+    int_set v1;
+    int_avl_tree v2;
+    int_avl_tree v3;
+    std::mt19937   rng;
+    rng.seed(static_cast<unsigned int>(time(0)));
+    std::uniform_int_distribution<unsigned int> uint_dist;
+
+    std::vector<std::pair<int_set, int_avl_tree>> copies;
+    for (unsigned i = 0; i < num_ops; i++) {
+        double f = static_cast<double>(uint_dist(rng) % 10000) / 10000.0;
+        if (f < copy_freq)
+            copies.emplace_back(v1, v2);
+        f = static_cast<double>(uint_dist(rng) % 10000) / 10000.0;
+        for (unsigned int j = 0; j < uint_dist(rng) % 5; j++) {
+            int a = uint_dist(rng) % max_val;
+            lean_assert(v3.contains(a) == (v1.find(a) != v1.end()));
+        }
+        if (f < insert_freq) {
+            if (v1.size() >= max_sz)
+                continue;
+            int a = uint_dist(rng) % max_val;
+            v1.insert(a);
+            v2.insert(a);
+            v3 = insert(v3, a);
+        } else {
+            int a = uint_dist(rng) % max_val;
+            v1.erase(a);
+            v2.erase(a);
+            v3 = erase(v3, a);
+        }
+        lean_assert(v1 == v2);
+        lean_assert(v1 == v3);
+        lean_assert(v2.check_invariant());
+    }
+    // updates do not affect copies
+    for (auto const & p : copies) {
+        lean_assert(p.first == p.second);
+    }
+    std::cout << "Copies created: " << copies.size() << "\n";
+}
+
+static void tst2() {
+    driver(4,  32, 10000, 0.5, 0.01);
+    driver(4,  10000, 10000, 0.5, 0.01);
+    driver(16, 16, 10000, 0.5, 0.1);
+    driver(128, 64, 10000, 0.5, 0.1);
+    driver(128, 64, 10000, 0.4, 0.1);
+    driver(128, 1000, 10000, 0.5, 0.5);
+    driver(1024, 1000, 10000, 0.7, 0.01);
+}
+
+static void tst3() {
+    int_avl_tree v;
+    v.insert(10);
+    v.insert(5);
+    v.insert(1);
+    v.insert(3);
+    lean_assert_eq(fold(v, [](int a, int b) { return a + b; }, 0), 19);
+    std::ostringstream out;
+    for_each(v, [&](int a) { out << a << " "; });
+    std::cout << out.str() << "\n";
+    lean_assert(out.str() == "1 3 5 10 ");
+}
+
+#if defined(LEAN_MULTI_THREAD)
+static void tst4() {
+    // threads reading and updating copies of a shared tree
+    int_avl_tree s;
+    for (int i = 0; i < 1000; i += 2)
+        s.insert(i);
+    std::vector<thread> threads;
+    for (unsigned i = 0; i < 8; i++) {
+        threads.emplace_back([&, i]() {
+                int_avl_tree local(s);
+                for (int k = 0; k < 20; k++) {
+                    for (int j = 0; j < 1000; j++) {
+                        lean_assert(s.contains(j) == (j % 2 == 0));
+                        if (j % 8 == static_cast<int>(i))
+                            local.insert(j);
+                    }
+                }
+                lean_assert(local.check_invariant());
+            });
+    }
+    for (auto & t : threads)
+        t.join();
+    lean_assert_eq(s.size(), 500u);
+}
+#else
+static void tst4() {}
+#endif
+
+int main() {
+    tst1();
+    tst2();
+    tst3();
+    tst4();
+    return has_violations() ? 1 : 0;
+}
@@ -9,6 +9,8 @@ Author: Soonho Kong
 #include <sstream>
 #include <utility>
 #include <string>
+#include <memory>
+#include <random>
 #include "util/test.h"
 #include "util/numerics/mpq.h"
 #include "util/sexpr/format.h"
@@ -116,11 +118,216 @@ static void tst4() {
     lean_assert_eq(s.str(), "() (foo bar) nil \"test\" (100 1/2)");
 }
 
+static std::string pretty_str(unsigned w, format const & f) {
+    std::ostringstream out;
+    pretty(out, w, false, f);
+    return out.str();
+}
+
+static void tst5() {
+    format f = paren(format{format("f"), nest(2, format{line(), format("a")}), line(), format("b")});
+    lean_assert_eq(pretty_str(80, f), "(f a b)");
+    lean_assert_eq(pretty_str(4, f), "(f\n   a\n b)");
+    format g = paren(format{format("g"), nest(2, format{line(), f, line(), f})});
+    lean_assert_eq(pretty_str(14, g), "(g\n   (f a b)\n   (f a b))");
+    lean_assert_eq(pretty_str(10, fillwords({"aaa", "bb", "c", "dddd", "ee", "f"})), "aaa bb c\ndddd ee f ");
+    // long document, the lines produced by fill must fit in the available space
+    std::vector<format> args;
+    for (unsigned i = 0; i < 10000; i++)
+        args.push_back(format(i % 1000));
+    std::istringstream in(pretty_str(40, fill(args.begin(), args.end())));
+    std::string l;
+    unsigned num_lines = 0;
+    while (std::getline(in, l)) {
+        lean_assert(l.size() <= 41);
+        num_lines++;
+    }
+    lean_assert(num_lines > 500);
+}
+
+/**
+   \brief Reference implementation of the layout engine used before format::pretty_fn.
+   Documents are mirrored by \c doc objects, since the internal representation of
+   \c format is private. A choice <tt>x <|> y</tt> is printed as \c x iff the space up
+   to the next line break (using \c y for nested choices) fits in the available space.
+*/
+namespace ref {
+enum class doc_kind { Nil, Text, Line, Nest, Compose, Choice };
+struct doc;
+typedef std::shared_ptr<doc> doc_ref;
+struct doc {
+    doc_kind             m_kind;
+    std::string          m_text;
+    int                  m_nest;
+    std::vector<doc_ref> m_args; // Compose: arguments, Choice: x and y
+    doc(doc_kind k, std::string const & t = std::string(), int n = 0, std::vector<doc_ref> const & args = std::vector<doc_ref>()):
+        m_kind(k), m_text(t), m_nest(n), m_args(args) {}
+};
+static doc_ref mk_nil() { return std::make_shared<doc>(doc_kind::Nil); }
+static doc_ref mk_text(std::string const & t) { return std::make_shared<doc>(doc_kind::Text, t); }
+static doc_ref mk_line() { return std::make_shared<doc>(doc_kind::Line); }
+static doc_ref mk_nest(int n, doc_ref const & d) { return std::make_shared<doc>(doc_kind::Nest, std::string(), n, std::vector<doc_ref>{d}); }
+static doc_ref mk_compose(std::vector<doc_ref> const & args) { return std::make_shared<doc>(doc_kind::Compose, std::string(), 0, args); }
+static doc_ref mk_choice(doc_ref const & x, doc_ref const & y) {
+    return std::make_shared<doc>(doc_kind::Choice, std::string(), 0, std::vector<doc_ref>{x, y});
+}
+static doc_ref flatten(doc_ref const & d, bool & diff) {
+    switch (d->m_kind) {
+    case doc_kind::Nil: case doc_kind::Text: return d;
+    case doc_kind::Nest:    return flatten(d->m_args[0], diff);
+    case doc_kind::Line:    diff = true; return mk_text(" ");
+    case doc_kind::Choice:  diff = true; return flatten(d->m_args[0], diff);
+    case doc_kind::Compose: {
+        std::vector<doc_ref> args;
+        for (auto const & a : d->m_args)
+            args.push_back(flatten(a, diff));
+        return mk_compose(args);
+    }}
+    lean_unreachable();
+}
+static doc_ref group(doc_ref const & d) {
+    bool diff = false;
+    doc_ref flat = flatten(d, diff);
+    return diff ? mk_choice(flat, d) : flat;
+}
+static doc_ref wrap(doc_ref const & d1, doc_ref const & d2) {
+    return mk_compose({d1, mk_choice(mk_text(" "), mk_line()), d2});
+}
+
+struct space_exceeded {};
+typedef std::vector<std::pair<doc_ref, unsigned>> todo_stack;
+
+static int space_upto_line_break(doc_ref const & d, int available, bool & found) {
+    switch (d->m_kind) {
+    case doc_kind::Nil:    return 0;
+    case doc_kind::Text:   return d->m_text.size();
+    case doc_kind::Line:   found = true; return 0;
+    case doc_kind::Nest:   return space_upto_line_break(d->m_args[0], available, found);
+    case doc_kind::Choice: return space_upto_line_break(d->m_args[1], available, found);
+    case doc_kind::Compose: {
+        int len = 0;
+        for (unsigned i = 0; i < d->m_args.size() && !found; i++) {
+            len += space_upto_line_break(d->m_args[i], available, found);
+            if (len > available)
+                throw space_exceeded();
+        }
+        return len;
+    }}
+    lean_unreachable();
+}
+static bool space_upto_line_break_list_exceeded(doc_ref const & d, int available, todo_stack const & todo) {
+    try {
+        bool found = false;
+        available -= space_upto_line_break(d, available, found);
+        auto it = todo.end();
+        while (it != todo.begin() && !found) {
+            --it;
+            if (available < 0)
+                return true;
+            available -= space_upto_line_break(it->first, available, found);
+        }
+        return available < 0;
+    } catch (space_exceeded) {
+        return true;
+    }
+}
+static std::string pretty(unsigned w, doc_ref const & d) {
+    std::ostringstream out;
+    unsigned pos = 0;
+    todo_stack todo;
+    todo.emplace_back(d, 0);
+    while (!todo.empty()) {
+        doc_ref s = todo.back().first;
+        unsigned indent = todo.back().second;
+        todo.pop_back();
+        switch (s->m_kind) {
+        case doc_kind::Nil:
+            break;
+        case doc_kind::Text:
+            pos += s->m_text.size();
+            out << s->m_text;
+            break;
+        case doc_kind::Line:
+            pos = indent;
+            out << "\n" << std::string(indent, ' ');
+            break;
+        case doc_kind::Nest:
+            todo.emplace_back(s->m_args[0], indent + s->m_nest);
+            break;
+        case doc_kind::Compose:
+            for (unsigned i = s->m_args.size(); i > 0; i--)
+                todo.emplace_back(s->m_args[i-1], indent);
+            break;
+        case doc_kind::Choice: {
+            int available = static_cast<int>(w) - static_cast<int>(pos);
+            if (!space_upto_line_break_list_exceeded(s->m_args[0], available, todo))
+                todo.emplace_back(s->m_args[0], indent);
+            else
+                todo.emplace_back(s->m_args[1], indent);
+            break;
+        }}
+    }
+    return out.str();
+}
+}
+
+/** \brief Return a random document, and its mirror for the reference implementation. */
+static std::pair<format, ref::doc_ref> mk_random_doc(std::mt19937 & rng, unsigned depth) {
+    std::uniform_int_distribution<unsigned> dist;
+    unsigned k = depth == 0 ? dist(rng) % 3 : dist(rng) % 9;
+    switch (k) {
+    case 0: {
+        std::string t(1 + dist(rng) % 8, 'a' + dist(rng) % 26);
+        return mk_pair(format(t), ref::mk_text(t));
+    }
+    case 1:
+        return mk_pair(line(), ref::mk_line());
+    case 2:
+        return mk_pair(format(), ref::mk_nil());
+    case 3: {
+        int n = dist(rng) % 5;
+        auto p = mk_random_doc(rng, depth - 1);
+        return mk_pair(nest(n, p.first), ref::mk_nest(n, p.second));
+    }
+    case 4: case 5: {
+        auto p1 = mk_random_doc(rng, depth - 1);
+        auto p2 = mk_random_doc(rng, depth - 1);
+        auto p3 = mk_random_doc(rng, depth - 1);
+        return mk_pair(format{p1.first, p2.first, p3.first}, ref::mk_compose({p1.second, p2.second, p3.second}));
+    }
+    case 6: case 7: {
+        auto p = mk_random_doc(rng, depth - 1);
+        return mk_pair(group(p.first), ref::group(p.second));
+    }
+    default: {
+        auto p1 = mk_random_doc(rng, depth - 1);
+        auto p2 = mk_random_doc(rng, depth - 1);
+        if (dist(rng) % 2 == 0)
+            return mk_pair(wrap(p1.first, p2.first), ref::wrap(p1.second, p2.second));
+        // colors are disabled, then highlight does not change the layout
+        return mk_pair(highlight(compose(p1.first, p2.first)), ref::mk_compose({p1.second, p2.second}));
+    }}
+}
+
+static void tst6() {
+    // compare the output of the layout engine with the one produced by the reference implementation
+    std::mt19937 rng;
+    rng.seed(1);
+    std::uniform_int_distribution<unsigned> dist;
+    for (unsigned i = 0; i < 2000; i++) {
+        auto p = mk_random_doc(rng, 1 + dist(rng) % 7);
+        unsigned w = dist(rng) % 60;
+        lean_assert_eq(pretty_str(w, p.first), ref::pretty(w, p.second));
+    }
+}
+
 int main() {
     save_stack_info();
     tst1();
     tst2();
     tst3();
     tst4();
+    tst5();
+    tst6();
     return has_violations() ? 1 : 0;
 }
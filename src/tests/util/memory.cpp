@@ -5,6 +5,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include "util/test.h"
 #include "util/memory.cpp"
 
@@ -32,7 +34,55 @@ static void tst1() {
     lean_assert_eq(old_mem, lean::get_allocated_memory());
 }
 
+static void tst2() {
+    std::vector<char*> blocks;
+    std::vector<size_t> sizes;
+    for (unsigned i = 0; i < 20000; i++) {
+        size_t sz = 1 + i % 300;
+        char * b  = static_cast<char*>(lean::alloc_small(sz));
+        std::fill(b, b + sz, static_cast<char>(i));
+        blocks.push_back(b);
+        sizes.push_back(sz);
+        if (i % 3 == 0) {
+            // release some blocks to make sure they are reused
+            lean::free_small(blocks.back(), sizes.back());
+            blocks.pop_back();
+            sizes.pop_back();
+        }
+    }
+    for (unsigned i = 0; i < blocks.size(); i++) {
+        char c = blocks[i][0];
+        lean_assert(std::all_of(blocks[i], blocks[i] + sizes[i], [&](char d) { return c == d; }));
+    }
+    for (unsigned i = 0; i < blocks.size(); i++)
+        lean::free_small(blocks[i], sizes[i]);
+}
+
+static void tst3() {
+#if defined(LEAN_MULTI_THREAD)
+    // blocks allocated by a thread are released by another one
+    unsigned N = 100000;
+    std::vector<void*> blocks(N);
+    lean::thread t([&]() {
+            for (unsigned i = 0; i < N; i++)
+                blocks[i] = lean::alloc_small(24);
+        });
+    t.join();
+    for (unsigned i = 0; i < N; i++)
+        lean::free_small(blocks[i], 24);
+    std::vector<void*> other(N);
+    for (unsigned i = 0; i < N; i++)
+        other[i] = lean::alloc_small(24);
+    std::sort(other.begin(), other.end());
+    lean_assert(std::unique(other.begin(), other.end()) == other.end());
+    for (unsigned i = 0; i < N; i++)
+        lean::free_small(other[i], 24);
+#endif
+}
+
 int main() {
     tst1();
+    tst2();
+    tst3();
     return lean::has_violations() ? 1 : 0;
 }
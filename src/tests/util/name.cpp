@@ -157,6 +157,28 @@ static void tst12() {
     lean_assert(mk_unique(s, name("foo")) == name(name("foo"), 2));
 }
 
+static void tst13() {
+#if LEAN_INTERN_NAMES
+    gc_name_table();
+    unsigned sz = get_name_table_size();
+    {
+        name n1({"tst13", "foo", "bla"});
+        name n2(name(name("tst13"), "foo"), "bla");
+        lean_assert(n1 == n2);
+        lean_assert(name::ptr_eq()(n1, n2));
+        lean_assert(n1 != name({"tst13", "foo", "boo"}));
+        lean_assert(is_prefix_of(name({"tst13", "foo"}), n1));
+        lean_assert(!is_prefix_of(name({"tst13", "bla"}), n1));
+        lean_assert(is_prefix_of(name(), n1));
+        lean_assert(name(n1, 1) == name(n2, 1));
+        lean_assert(name(n1, 1) != name(n2, 2));
+        lean_assert(get_name_table_size() > sz);
+    }
+    gc_name_table();
+    lean_assert(get_name_table_size() == sz);
+#endif
+}
+
 int main() {
     tst1();
     tst2();
@@ -170,5 +192,6 @@ int main() {
     tst10();
     tst11();
     tst12();
+    tst13();
     return has_violations() ? 1 : 0;
 }
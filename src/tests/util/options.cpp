@@ -154,6 +154,40 @@ static void tst6() {
     check_serializer(opt);
 }
 
+RegisterUnsignedOption("fakeopt3", 10, "fake option");
+
+static void tst7() {
+    lean_assert(get_option_slot("fakeopt"));
+    lean_assert(get_option_slot("fakeopt3"));
+    lean_assert(*get_option_slot("fakeopt") != *get_option_slot("fakeopt3"));
+    lean_assert(!get_option_slot("fakeopt2"));
+    options opt;
+    lean_assert(!opt.contains(name("fakeopt")));
+    lean_assert(opt.get_unsigned(name("fakeopt3"), 10) == 10);
+    opt = opt.update(name("fakeopt"), true);
+    opt = opt.update(name("fakeopt2"), 3);
+    opt = opt.update(name("fakeopt3"), 5u);
+    lean_assert(opt.contains(name("fakeopt")));
+    lean_assert(opt.get_bool(name("fakeopt")));
+    lean_assert(opt.get_int(name("fakeopt2")) == 3);
+    lean_assert(opt.get_unsigned(name("fakeopt3"), 10) == 5);
+    lean_assert(opt.get_unsigned(name("fakeopt"), 10) == 10); // type mismatch
+    opt = opt.update(name("fakeopt"), false);
+    lean_assert(!opt.get_bool(name("fakeopt"), true));
+    options opt2 = join(opt, options(name("fakeopt3"), 7u));
+    lean_assert(opt2.get_unsigned(name("fakeopt3"), 10) == 7);
+    lean_assert(opt2.get_int(name("fakeopt2")) == 3);
+    lean_assert(opt.get_unsigned(name("fakeopt3"), 10) == 5);
+    std::ostringstream out;
+    serializer s(out);
+    s << opt2;
+    std::istringstream in(out.str());
+    deserializer d(in);
+    options opt3 = read_options(d);
+    lean_assert(opt3.get_unsigned(name("fakeopt3"), 10) == 7);
+    lean_assert(!opt3.get_bool(name("fakeopt"), true));
+}
+
 int main() {
     save_stack_info();
     tst1();
@@ -162,5 +196,6 @@ int main() {
     tst4();
     tst5();
     tst6();
+    tst7();
     return has_violations() ? 1 : 0;
 }
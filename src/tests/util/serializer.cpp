@@ -11,9 +11,14 @@ Author: Leonardo de Moura
 #include <vector>
 #include <functional>
 #include <cmath>
+#include <fstream>
+#include <cstdio>
+#include <limits>
 #include "util/test.h"
+#include "util/mapped_file.h"
 #include "util/object_serializer.h"
 #include "util/debug.h"
+#include "util/exception.h"
 #include "util/list.h"
 #include "util/name.h"
 using namespace lean;
@@ -170,10 +175,93 @@ static void tst4() {
     lean_assert_eq(d5, o5);
 }
 
+static void tst5() {
+    std::string fname = "serializer_tst5.bin";
+    {
+        std::ofstream out(fname, std::ofstream::binary);
+        serializer s(out);
+        s << std::string("hello") << 10u;
+        s.write_block("abc", 3);
+        s << name({"a", "b"}) << 20u;
+    }
+    for (unsigned i = 0; i < 2; i++) {
+        file_block b;
+        std::string str; unsigned n1, n2; name n;
+        if (i == 0) {
+            mapped_file_istream in(std::make_shared<mapped_file>(fname));
+            deserializer d(in);
+            d >> str >> n1;
+            b = read_file_block(d.get_stream(), 3);
+            d >> n >> n2;
+        } else {
+            std::ifstream in(fname, std::ifstream::binary);
+            deserializer d(in);
+            d >> str >> n1;
+            b = read_file_block(d.get_stream(), 3);
+            d >> n >> n2;
+        }
+        lean_assert_eq(str, "hello");
+        lean_assert_eq(n1, 10u);
+        lean_assert_eq(std::string(b.data(), b.size()), "abc");
+        lean_assert_eq(n, name({"a", "b"}));
+        lean_assert_eq(n2, 20u);
+    }
+    std::remove(fname.c_str());
+}
+
+static void tst6() {
+    std::ostringstream out;
+    serializer s(out);
+    s << 0u << 127u << 128u << std::numeric_limits<unsigned>::max();
+    lean_assert_eq(out.str().size(), 1u + 1u + 2u + 5u);
+    s << -1 << 63 << -64 << std::numeric_limits<int>::max() << std::numeric_limits<int>::min();
+    lean_assert_eq(out.str().size(), 9u + 1u + 1u + 1u + 5u + 5u);
+    s << std::string("hello") << std::string("world") << std::string("hello") << std::string("a\0b", 3);
+    size_t sz = out.str().size();
+    s << std::string("world");
+    lean_assert_eq(out.str().size(), sz + 1);
+    std::istringstream in(out.str());
+    deserializer d(in);
+    lean_assert_eq(d.read_unsigned(), 0u);
+    lean_assert_eq(d.read_unsigned(), 127u);
+    lean_assert_eq(d.read_unsigned(), 128u);
+    lean_assert_eq(d.read_unsigned(), std::numeric_limits<unsigned>::max());
+    lean_assert_eq(d.read_int(), -1);
+    lean_assert_eq(d.read_int(), 63);
+    lean_assert_eq(d.read_int(), -64);
+    lean_assert_eq(d.read_int(), std::numeric_limits<int>::max());
+    lean_assert_eq(d.read_int(), std::numeric_limits<int>::min());
+    lean_assert_eq(d.read_string(), "hello");
+    lean_assert_eq(d.read_string(), "world");
+    lean_assert_eq(d.read_string(), "hello");
+    lean_assert_eq(d.read_string(), std::string("a\0b", 3));
+    lean_assert_eq(d.read_string(), "world");
+    try {
+        d.read_unsigned();
+        lean_unreachable();
+    } catch (exception &) {
+    }
+    // values that do not fit in 32 bits are rejected
+    for (char last : {'\x10', '\x1f', '\x8f'}) {
+        std::string bad("\xff\xff\xff\xff");
+        bad += last;
+        bad += '\x01';
+        std::istringstream in2(bad);
+        deserializer d2(in2);
+        try {
+            d2.read_unsigned();
+            lean_unreachable();
+        } catch (exception &) {
+        }
+    }
+}
+
 int main() {
     tst1();
     tst2();
     tst3();
     tst4();
+    tst5();
+    tst6();
     return has_violations() ? 1 : 0;
 }
@@ -7,10 +7,12 @@ Author: Leonardo de Moura
 #include <cstdlib>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include "util/thread.h"
 #include "util/debug.h"
 #include "util/shared_mutex.h"
 #include "util/interrupt.h"
+#include "util/thread_pool.h"
 using namespace lean;
 
 #if !defined(__APPLE__) && defined(LEAN_MULTI_THREAD)
@@ -171,6 +173,68 @@ static void tst6() {
     t1.request_interrupt();
     t1.join();
 }
+
+static void tst7() {
+    // long running task is interrupted
+    task t1([]() { sleep_for(1000000); });
+    lean_assert(!wait_for(t1, 20));
+    lean_assert(!t1.is_done());
+    t1.request_interrupt();
+    t1.wait();
+    lean_assert(t1.is_done());
+    // tasks waiting for other tasks do not block the thread pool
+    atomic<unsigned> counter(0);
+    std::vector<task> ts;
+    for (unsigned i = 0; i < 8; i++) {
+        ts.push_back(task([&]() {
+                    task child([&]() { counter++; });
+                    wait_any(1, &child);
+                    counter++;
+                }));
+    }
+    for (task const & t : ts)
+        t.wait();
+    lean_assert(counter == 16);
+    // task interrupted before being started
+    task t2([&]() {
+            task child([]() { check_interrupted(); });
+            child.request_interrupt();
+            child.wait();
+            counter++;
+        });
+    t2.wait();
+    lean_assert(counter == 17);
+    std::cout << "thread pool size: " << get_thread_pool_size() << "\n";
+}
+
+static void tst8() {
+    // idle workers exit
+    for (unsigned i = 0; i < 100 && get_thread_pool_size() > 0; i++)
+        sleep_for(100);
+    lean_assert_eq(get_thread_pool_size(), 0u);
+    // the number of workers executing tasks is bounded by the number of hardware threads
+    unsigned max_workers = std::max(1u, static_cast<unsigned>(thread::hardware_concurrency()));
+    mutex m;
+    unsigned running = 0;
+    unsigned max_running = 0;
+    std::vector<task> ts;
+    for (unsigned i = 0; i < 4 * max_workers; i++) {
+        ts.push_back(task([&]() {
+                    {
+                        lock_guard<mutex> lk(m);
+                        running++;
+                        max_running = std::max(max_running, running);
+                    }
+                    sleep_for(10);
+                    lock_guard<mutex> lk(m);
+                    running--;
+                }));
+    }
+    for (task const & t : ts)
+        t.wait();
+    lean_assert_le(max_running, max_workers);
+    lean_assert_le(get_thread_pool_size(), max_workers);
+}
 #else
 static void tst1() {}
 static void tst2() {}
@@ -178,6 +242,8 @@ static void tst3() {}
 static void tst4() {}
 static void tst5() {}
 static void tst6() {}
+static void tst7() {}
+static void tst8() {}
 #endif
 
 int main() {
@@ -188,5 +254,7 @@ int main() {
     tst4();
     tst5();
     tst6();
+    tst7();
+    tst8();
     return has_violations() ? 1 : 0;
 }
@@ -0,0 +1,349 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include "util/rc.h"
+#include "util/debug.h"
+#include "util/buffer.h"
+
+namespace lean {
+/**
+   \brief Persistent AVL trees (see http://en.wikipedia.org/wiki/AVL_tree)
+
+   Nodes are never modified after they are created. Updates (\c insert and \c erase)
+   copy the path from the root to the updated position, and share the remaining nodes.
+   So, the copy operation is O(1), and updates are O(log n).
+
+   In contrast to \c splay_tree, \c find does not reorganize the tree. Thus, different threads
+   can read the same tree (or trees sharing nodes) without any synchronization.
+
+   \c CMP is a functional object for comparing values of type T.
+   It must have a method
+   <code>
+         int operator()(T const & v1, T const & v2) const;
+   </code>
+   The method must return
+   - -1 if <tt>v1 < v2</tt>,
+   - 0  if <tt>v1 == v2</tt>,
+   - 1  if <tt>v1 > v2</tt>
+*/
+template<typename T, typename CMP>
+class avl_tree : public CMP {
+    struct node_cell;
+    /** \brief Smart pointer for node cells */
+    class node {
+        node_cell * m_ptr;
+    public:
+        node():m_ptr(nullptr) {}
+        explicit node(node_cell * ptr):m_ptr(ptr) { if (m_ptr) m_ptr->inc_ref(); }
+        node(node const & n):m_ptr(n.m_ptr) { if (m_ptr) m_ptr->inc_ref(); }
+        node(node && n):m_ptr(n.m_ptr) { n.m_ptr = nullptr; }
+        ~node() { if (m_ptr) m_ptr->dec_ref(); }
+        node & operator=(node const & n) { LEAN_COPY_REF(n); }
+        node & operator=(node && n) { LEAN_MOVE_REF(n); }
+        node_cell * operator->() const { lean_assert(m_ptr); return m_ptr; }
+        node_cell const * raw() const { return m_ptr; }
+        explicit operator bool() const { return m_ptr != nullptr; }
+        bool is_eqp(node const & n) const { return m_ptr == n.m_ptr; }
+        friend void swap(node & n1, node & n2) { std::swap(n1.m_ptr, n2.m_ptr); }
+    };
+
+    struct node_cell {
+        node     m_left;
+        node     m_right;
+        T        m_value;
+        unsigned m_height;
+        MK_LEAN_RC();
+        node_cell(T const & v, node const & left, node const & right):
+            m_left(left), m_right(right), m_value(v), m_height(std::max(height(left), height(right)) + 1), m_rc(0) {
+            // the return type of CMP()(t1, 2) should be int
+            static_assert(std::is_same<typename std::result_of<decltype(std::declval<CMP>())(T const &, T const &)>::type,
+                                       int>::value,
+                          "The return type of CMP()(t1, t2) is not int.");
+        }
+        void dealloc() {
+            delete this;
+        }
+
+        static void display(std::ostream & out, node const & n) {
+            if (n) {
+                if (!n->m_left && !n->m_right) {
+                    out << n->m_value;
+                } else {
+                    out << "(" << n->m_value << " ";
+                    display(out, n->m_left);
+                    out << " ";
+                    display(out, n->m_right);
+                    out << ")";
+                }
+            } else {
+                out << "()";
+            }
+        }
+    };
+
+    node m_root;
+
+    int cmp(T const & v1, T const & v2) const {
+        return CMP::operator()(v1, v2);
+    }
+
+    static unsigned height(node const & n) { return n ? n->m_height : 0; }
+
+    static node mk_node(T const & v, node const & l, node const & r) {
+        return node(new node_cell(v, l, r));
+    }
+
+    /**
+       \brief Create a node for <tt>(v l r)</tt> when the heights of \c l and \c r
+       differ by at most two. That is, the result of a single insertion or deletion.
+    */
+    static node mk_balanced(T const & v, node const & l, node const & r) {
+        unsigned hl = height(l);
+        unsigned hr = height(r);
+        if (hl > hr + 1) {
+            if (height(l->m_left) >= height(l->m_right)) {
+                // single rotation: ((A x B) v r) ==> (A x (B v r))
+                return mk_node(l->m_value, l->m_left, mk_node(v, l->m_right, r));
+            } else {
+                // double rotation: ((A x (B y C)) v r) ==> ((A x B) y (C v r))
+                node const & lr = l->m_right;
+                return mk_node(lr->m_value, mk_node(l->m_value, l->m_left, lr->m_left), mk_node(v, lr->m_right, r));
+            }
+        } else if (hr > hl + 1) {
+            if (height(r->m_right) >= height(r->m_left)) {
+                // single rotation: (l v (A x B)) ==> ((l v A) x B)
+                return mk_node(r->m_value, mk_node(v, l, r->m_left), r->m_right);
+            } else {
+                // double rotation: (l v ((A y B) x C)) ==> ((l v A) y (B x C))
+                node const & rl = r->m_left;
+                return mk_node(rl->m_value, mk_node(v, l, rl->m_left), mk_node(r->m_value, rl->m_right, r->m_right));
+            }
+        } else {
+            return mk_node(v, l, r);
+        }
+    }
+
+    node insert(node const & n, T const & v) const {
+        if (!n)
+            return mk_node(v, node(), node());
+        int c = cmp(v, n->m_value);
+        if (c < 0)
+            return mk_balanced(n->m_value, insert(n->m_left, v), n->m_right);
+        else if (c > 0)
+            return mk_balanced(n->m_value, n->m_left, insert(n->m_right, v));
+        else
+            return mk_node(v, n->m_left, n->m_right);
+    }
+
+    /** \brief Remove the minimal element of the non-empty tree \c n, and store it in \c min. */
+    static node erase_min(node const & n, T const * & min) {
+        if (!n->m_left) {
+            min = &(n->m_value);
+            return n->m_right;
+        } else {
+            return mk_balanced(n->m_value, erase_min(n->m_left, min), n->m_right);
+        }
+    }
+
+    node erase(node const & n, T const & v) const {
+        if (!n)
+            return n;
+        int c = cmp(v, n->m_value);
+        if (c < 0) {
+            node new_left = erase(n->m_left, v);
+            if (new_left.is_eqp(n->m_left))
+                return n;
+            return mk_balanced(n->m_value, new_left, n->m_right);
+        } else if (c > 0) {
+            node new_right = erase(n->m_right, v);
+            if (new_right.is_eqp(n->m_right))
+                return n;
+            return mk_balanced(n->m_value, n->m_left, new_right);
+        } else if (!n->m_left) {
+            return n->m_right;
+        } else if (!n->m_right) {
+            return n->m_left;
+        } else {
+            T const * min = nullptr;
+            // min points to a value stored in n->m_right, and it is kept alive by n
+            node new_right = erase_min(n->m_right, min);
+            return mk_balanced(*min, n->m_left, new_right);
+        }
+    }
+
+    bool check_invariant(node const & n) const {
+        if (n) {
+            lean_assert_eq(n->m_height, std::max(height(n->m_left), height(n->m_right)) + 1);
+            lean_assert_le(height(n->m_left),  height(n->m_right) + 1);
+            lean_assert_le(height(n->m_right), height(n->m_left) + 1);
+            if (n->m_left) {
+                check_invariant(n->m_left);
+                lean_assert_lt(cmp(n->m_left->m_value, n->m_value), 0);
+            }
+            if (n->m_right) {
+                check_invariant(n->m_right);
+                lean_assert_lt(cmp(n->m_value, n->m_right->m_value), 0);
+            }
+        }
+        return true;
+    }
+
+    static void to_buffer(node const & n, buffer<T> & r) {
+        if (n) {
+            to_buffer(n->m_left, r);
+            r.push_back(n->m_value);
+            to_buffer(n->m_right, r);
+        }
+    }
+
+    template<typename F, typename R>
+    static R fold(node const & n, F && f, R r) {
+        static_assert(std::is_same<typename std::result_of<F(T const &, R)>::type, R>::value,
+                      "fold: return type of f(t : T, r : R) is not R");
+        if (n) {
+            r = fold(n->m_left, f, r);
+            r = f(n->m_value, r);
+            return fold(n->m_right, f, r);
+        } else {
+            return r;
+        }
+    }
+
+    template<typename F>
+    static void for_each(node const & n, F && f) {
+        static_assert(std::is_same<typename std::result_of<F(T const &)>::type, void>::value,
+                      "for_each: return type of f is not void");
+        if (n) {
+            for_each(n->m_left, f);
+            f(n->m_value);
+            for_each(n->m_right, f);
+        }
+    }
+
+public:
+    avl_tree(CMP const & cmp = CMP()):CMP(cmp) {}
+    avl_tree(avl_tree const & s):CMP(s), m_root(s.m_root) {}
+    avl_tree(avl_tree && s):CMP(s), m_root(std::move(s.m_root)) {}
+
+    /** \brief O(1) copy */
+    avl_tree & operator=(avl_tree const & s) { m_root = s.m_root; return *this; }
+    /** \brief O(1) move */
+    avl_tree & operator=(avl_tree && s) { m_root = std::move(s.m_root); return *this; }
+
+    friend void swap(avl_tree & t1, avl_tree & t2) { swap(t1.m_root, t2.m_root); }
+
+    /** \brief Return true iff this tree is empty. */
+    bool empty() const { return !m_root; }
+
+    /** \brief Remove all elements from the tree. */
+    void clear() { m_root = node(); }
+
+    /** \brief Return true iff this tree and \c t point to the same node */
+    bool is_eqp(avl_tree const & t) const { return m_root.is_eqp(t.m_root); }
+
+    /** \brief Return the size of the tree */
+    unsigned size() const { return fold([](T const &, unsigned a) { return a + 1; }, 0u); }
+
+    /** \brief Insert \c v in this tree. If the tree contains a value equal to \c v, then it is replaced. */
+    void insert(T const & v) {
+        m_root = insert(m_root, v);
+        lean_assert(check_invariant());
+    }
+
+    /**
+        \brief Return a pointer to a value equal to \c v that is stored in this tree.
+        If the tree does not contain any value equal to \c v, then return \c nullptr.
+
+        \remark <tt>find(v) != nullptr</tt> iff <tt>contains(v)</tt>
+
+        \remark The tree is not modified. The pointer is valid while the tree is not updated.
+    */
+    T const * find(T const & v) const {
+        node_cell const * n = m_root.raw();
+        while (n) {
+            int c = cmp(v, n->m_value);
+            if (c < 0)
+                n = n->m_left.raw();
+            else if (c > 0)
+                n = n->m_right.raw();
+            else
+                return &(n->m_value);
+        }
+        return nullptr;
+    }
+
+    /** \brief Return true iff the tree contains an element equal to \c v. */
+    bool contains(T const & v) const {
+        return find(v);
+    }
+
+    /** \brief Remove \c v from this tree. Actually, it removes an element that is equal to \c v. */
+    void erase(T const & v) {
+        m_root = erase(m_root, v);
+        lean_assert(check_invariant());
+    }
+
+    /** \brief (For debugging) Check whether this tree is well formed. */
+    bool check_invariant() const {
+        return check_invariant(m_root);
+    }
+
+    /**
+        \brief Copy the contents of this tree to the given buffer.
+        The elements will be stored in increasing order.
+    */
+    void to_buffer(buffer<T> & r) const {
+        to_buffer(m_root, r);
+    }
+
+    /** \brief (For debugging) Display the content of this tree. */
+    friend std::ostream & operator<<(std::ostream & out, avl_tree const & t) {
+        node_cell::display(out, t.m_root);
+        return out;
+    }
+
+    /**
+       \brief Return <tt>f(a_k, ..., f(a_1, f(a_0, r)) ...)</tt>, where
+       <tt>a_0, a_1, ... a_k</tt> are the elements is stored in the tree.
+    */
+    template<typename F, typename R>
+    R fold(F && f, R r) const {
+        static_assert(std::is_same<typename std::result_of<F(T const &, R)>::type, R>::value,
+                      "fold: return type of f(t : T, r : R) is not R");
+        return fold(m_root, std::forward<F>(f), r);
+    }
+
+    /**
+       \brief Apply \c f to each value stored in the tree.
+    */
+    template<typename F>
+    void for_each(F && f) const {
+        static_assert(std::is_same<typename std::result_of<F(T const &)>::type, void>::value,
+                      "for_each: return type of f is not void");
+        for_each(m_root, std::forward<F>(f));
+    }
+};
+template<typename T, typename CMP>
+avl_tree<T, CMP> insert(avl_tree<T, CMP> const & t, T const & v) { avl_tree<T, CMP> r(t); r.insert(v); return r; }
+template<typename T, typename CMP>
+avl_tree<T, CMP> erase(avl_tree<T, CMP> const & t, T const & v) { avl_tree<T, CMP> r(t); r.erase(v); return r; }
+template<typename T, typename CMP, typename F, typename R>
+R fold(avl_tree<T, CMP> const & t, F && f, R r) {
+    static_assert(std::is_same<typename std::result_of<F(T const &, R)>::type, R>::value,
+                  "fold: return type of f(t : T, r : R) is not R");
+    return t.fold(std::forward<F>(f), r);
+}
+template<typename T, typename CMP, typename F>
+void for_each(avl_tree<T, CMP> const & t, F && f) {
+    static_assert(std::is_same<typename std::result_of<F(T const &)>::type, void>::value,
+                  "for_each: return type of f is not void");
+    return t.for_each(std::forward<F>(f));
+}
+}
@@ -23,6 +23,10 @@ bool interrupt_requested() {
     return g_interrupt.load();
 }
 
+atomic_bool * get_interrupt_flag() {
+    return &g_interrupt;
+}
+
 void check_interrupted() {
     if (interrupt_requested()) {
         reset_interrupt();
@@ -25,6 +25,11 @@ void reset_interrupt();
 */
 bool interrupt_requested();
 
+/**
+   \brief Return the address of the (interrupt) flag of the current thread.
+*/
+atomic_bool * get_interrupt_flag();
+
 /**
    \brief Throw an interrupted exception if the (interrupt) flag is set.
 */
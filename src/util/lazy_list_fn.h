@@ -7,6 +7,7 @@ Author: Leonardo de Moura
 #pragma once
 #include <utility>
 #include "util/interrupt.h"
+#include "util/thread_pool.h"
 #include "util/lazy_list.h"
 #include "util/list.h"
 
@@ -214,10 +215,9 @@ lazy_list<T> repeat_at_most(T const & v, F && f, unsigned k, char const * cname
    method in the class lazy_list. If the \c pull method timeouts, the lazy list
    is truncated.
 
-   \remark the \c method is executed in a separate execution thread.
+   \remark the \c method is executed by the thread pool (see \c thread_pool.h).
 
-   \remark \c check_ms is how often the main thread checks whether the child
-   thread finished.
+   \remark \c check_ms is how often the main thread checks whether it has been interrupted.
 */
 #if !defined(LEAN_MULTI_THREAD)
 template<typename T>
@@ -227,39 +227,20 @@ lazy_list<T> timeout(lazy_list<T> const & l, unsigned, unsigned) {
 #else
 template<typename T>
 lazy_list<T> timeout(lazy_list<T> const & l, unsigned ms, unsigned check_ms = g_small_sleep) {
-    if (check_ms == 0)
-        check_ms = 1;
     return mk_lazy_list<T>([=]() {
             typename lazy_list<T>::maybe_pair r;
-            atomic<bool> done(false);
-            interruptible_thread th([&]() {
-                    try {
-                        r = l.pull();
-                    } catch (...) {
-                        r = typename lazy_list<T>::maybe_pair();
-                    }
-                    done = true;
-                });
+            task t([&]() { r = l.pull(); });
             try {
-                auto start = chrono::steady_clock::now();
-                chrono::milliseconds d(ms);
-                chrono::milliseconds small(check_ms);
-                while (!done) {
-                    auto curr = chrono::steady_clock::now();
-                    if (chrono::duration_cast<chrono::milliseconds>(curr - start) > d)
-                        break;
-                    check_interrupted();
-                    this_thread::sleep_for(small);
-                }
-                th.request_interrupt();
-                th.join();
+                wait_for(t, ms, check_ms);
+                t.request_interrupt();
+                t.wait();
                 if (r)
                     return some(mk_pair(r->first, timeout(r->second, ms, check_ms)));
                 else
                     return r;
             } catch (...) {
-                th.request_interrupt();
-                th.join();
+                t.request_interrupt();
+                t.wait();
                 throw;
             }
         });
@@ -282,49 +263,28 @@ lazy_list<T> par(lazy_list<T> const & l1, lazy_list<T> const & l2, unsigned chec
     return mk_lazy_list<T>([=]() {
             typename lazy_list<T>::maybe_pair r1;
             typename lazy_list<T>::maybe_pair r2;
-            atomic<bool>  done1(false);
-            atomic<bool>  done2(false);
-            interruptible_thread th1([&]() {
-                    try {
-                        r1 = l1.pull();
-                    } catch (...) {
-                        r1 = typename lazy_list<T>::maybe_pair();
-                    }
-                    done1 = true;
-                });
-            interruptible_thread th2([&]() {
-                    try {
-                        r2 = l2.pull();
-                    } catch (...) {
-                        r2 = typename lazy_list<T>::maybe_pair();
-                    }
-                    done2 = true;
-                });
+            task ts[2] = { task([&]() { r1 = l1.pull(); }), task([&]() { r2 = l2.pull(); }) };
             try {
-                chrono::milliseconds small(check_ms);
-                while (!done1 && !done2) {
-                    check_interrupted();
-                    this_thread::sleep_for(small);
-                }
-                th1.request_interrupt();
-                th2.request_interrupt();
-                th1.join();
-                th2.join();
+                wait_any(2, ts, g_no_timeout, check_ms);
+                ts[0].request_interrupt();
+                ts[1].request_interrupt();
+                ts[0].wait();
+                ts[1].wait();
                 if (r1 && r2) {
-                    lazy_list<T> tail(r2->first, par(r1->second, r2->second));
+                    lazy_list<T> tail(r2->first, par(r1->second, r2->second, check_ms));
                     return some(mk_pair(r1->first, tail));
                 } else if (r1) {
-                    return some(mk_pair(r1->first, par(r1->second, l2)));
+                    return some(mk_pair(r1->first, par(r1->second, l2, check_ms)));
                 } else if (r2) {
-                    return some(mk_pair(r2->first, par(l1, r2->second)));
+                    return some(mk_pair(r2->first, par(l1, r2->second, check_ms)));
                 } else {
                     return r2;
                 }
             } catch (...) {
-                th1.request_interrupt();
-                th2.request_interrupt();
-                th1.join();
-                th2.join();
+                ts[0].request_interrupt();
+                ts[1].request_interrupt();
+                ts[0].wait();
+                ts[1].wait();
                 throw;
             }
         });
@@ -8,6 +8,7 @@ Author: Leonardo de Moura
 #include <iostream>
 #include <iterator>
 #include "util/rc.h"
+#include "util/memory.h"
 #include "util/debug.h"
 
 namespace lean {
@@ -19,6 +20,7 @@ class list {
 public:
     class cell {
         MK_LEAN_RC()
+        LEAN_SMALL_OBJECT_ALLOCATOR()
         T      m_head;
         list   m_tail;
         template<typename... Fields>
@@ -87,6 +87,14 @@ int get_nonnil_top(lua_State * L) {
     return top;
 }
 
+void pushglobaltable(lua_State * L) {
+    #if LUA_VERSION_NUM < 502
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    #else
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+    #endif
+}
+
 static void exec(lua_State * L) {
     pcall(L, 0, LUA_MULTRET, 0);
 }
@@ -28,6 +28,8 @@ bool resume(lua_State * L, int nargs);
 int lessthan(lua_State * L, int idx1, int idx2);
 int equal(lua_State * L, int idx1, int idx2);
 int get_nonnil_top(lua_State * L);
+/** \brief Push the table of global variables of \c L on the stack. */
+void pushglobaltable(lua_State * L);
 // =======================================
 
 // =======================================
@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <fstream>
+#include <string>
+#include <vector>
+#if !defined(LEAN_WINDOWS)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "util/mapped_file.h"
+#include "util/exception.h"
+#include "util/serializer.h"
+#include "util/sstream.h"
+
+namespace lean {
+static void read_file(std::string const & fname, std::vector<char> & buffer) {
+    std::ifstream in(fname, std::ifstream::binary);
+    if (!in.good())
+        throw exception(sstream() << "failed to open file '" << fname << "'");
+    in.seekg(0, std::ios::end);
+    buffer.resize(in.tellg());
+    in.seekg(0, std::ios::beg);
+    in.read(buffer.data(), buffer.size());
+}
+
+mapped_file::mapped_file(std::string const & fname):m_data(nullptr), m_size(0), m_mapped(false) {
+#if !defined(LEAN_WINDOWS)
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw exception(sstream() << "failed to open file '" << fname << "'");
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void * p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            m_data   = static_cast<char const *>(p);
+            m_size   = st.st_size;
+            m_mapped = true;
+        }
+    }
+    close(fd);
+    if (m_mapped)
+        return;
+#endif
+    read_file(fname, m_buffer);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+}
+
+mapped_file::~mapped_file() {
+#if !defined(LEAN_WINDOWS)
+    if (m_mapped)
+        munmap(const_cast<char *>(m_data), m_size);
+#endif
+}
+
+memory_streambuf::memory_streambuf(char const * data, size_t size) {
+    char * b = const_cast<char *>(data);
+    setg(b, b, b + size);
+}
+
+memory_streambuf::pos_type memory_streambuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (which & std::ios_base::out)
+        return pos_type(off_type(-1));
+    char * p;
+    if (dir == std::ios_base::beg)
+        p = eback() + off;
+    else if (dir == std::ios_base::cur)
+        p = gptr() + off;
+    else
+        p = egptr() + off;
+    if (p < eback() || p > egptr())
+        return pos_type(off_type(-1));
+    setg(eback(), p, egptr());
+    return pos_type(p - eback());
+}
+
+memory_streambuf::pos_type memory_streambuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+bool memory_streambuf::skip(size_t n) {
+    if (static_cast<size_t>(egptr() - gptr()) < n)
+        return false;
+    gbump(n);
+    return true;
+}
+
+mapped_file_istream::mapped_file_istream(std::shared_ptr<mapped_file const> const & file):
+    std::istream(nullptr), m_file(file), m_buffer(file->data(), file->size()) {
+    rdbuf(&m_buffer);
+}
+
+file_block::file_block(std::shared_ptr<mapped_file const> const & f, size_t offset, size_t size):
+    m_owner(f), m_data(f->data() + offset), m_size(size) {
+}
+
+file_block::file_block(std::string const & s) {
+    std::shared_ptr<std::string> c = std::make_shared<std::string>(s);
+    m_owner = c;
+    m_data  = c->data();
+    m_size  = c->size();
+}
+
+file_block read_file_block(std::istream & in, size_t size) {
+    if (mapped_file_istream * m = dynamic_cast<mapped_file_istream *>(&in)) {
+        memory_streambuf & buf = m->get_buffer();
+        size_t offset = buf.position();
+        if (!buf.skip(size))
+            throw_corrupted_file();
+        return file_block(m->get_file(), offset, size);
+    } else {
+        std::string s(size, 0);
+        in.read(&s[0], size);
+        if (static_cast<size_t>(in.gcount()) != size)
+            throw_corrupted_file();
+        return file_block(s);
+    }
+}
+}
@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lean {
+/**
+   \brief Read-only view of the contents of a file.
+   The file is memory mapped on platforms that support it, and read into memory on the other ones.
+*/
+class mapped_file {
+    char const *      m_data;
+    size_t            m_size;
+    std::vector<char> m_buffer; // used when the file is not memory mapped
+    bool              m_mapped;
+public:
+    /** \brief Open the given file. Throw an exception if the file cannot be opened. */
+    mapped_file(std::string const & fname);
+    mapped_file(mapped_file const &) = delete;
+    mapped_file & operator=(mapped_file const &) = delete;
+    ~mapped_file();
+    char const * data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+/**
+   \brief Stream buffer for reading a memory region.
+   The region is not copied, and it must be alive while the buffer is used.
+*/
+class memory_streambuf : public std::streambuf {
+protected:
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+public:
+    memory_streambuf(char const * data, size_t size);
+    /** \brief Return the position of the next character in the region. */
+    size_t position() const { return gptr() - eback(); }
+    char const * current() const { return gptr(); }
+    /** \brief Skip the next \c n characters. Return false if there are less than \c n characters available. */
+    bool skip(size_t n);
+};
+
+/**
+   \brief Input stream for reading a mapped file.
+*/
+class mapped_file_istream : public std::istream {
+    std::shared_ptr<mapped_file const> m_file;
+    memory_streambuf                   m_buffer;
+public:
+    mapped_file_istream(std::shared_ptr<mapped_file const> const & file);
+    std::shared_ptr<mapped_file const> const & get_file() const { return m_file; }
+    memory_streambuf & get_buffer() { return m_buffer; }
+};
+
+/**
+   \brief Block of characters owned by a mapped file or by the block itself.
+   Copying a block is a constant time operation.
+*/
+class file_block {
+    std::shared_ptr<void const> m_owner;
+    char const *                m_data;
+    size_t                      m_size;
+public:
+    file_block():m_data(nullptr), m_size(0) {}
+    file_block(std::shared_ptr<mapped_file const> const & f, size_t offset, size_t size);
+    /** \brief Create a block containing a copy of the given string */
+    explicit file_block(std::string const & s);
+    char const * data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+/**
+   \brief Read a block of \c size characters from the given stream.
+   If \c in is a \c mapped_file_istream, then the block is not copied.
+   Throw an exception if the stream does not contain \c size characters.
+*/
+file_block read_file_block(std::istream & in, size_t size);
+}
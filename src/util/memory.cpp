@@ -6,6 +6,9 @@ Author: Leonardo de Moura
 */
 #include <new>
 #include <cstdlib>
+#include <vector>
+#include <utility>
+#include "util/thread.h"
 
 #if !defined(LEAN_TRACK_MEMORY)
 
@@ -40,7 +43,6 @@ void free(void * ptr) {
 }
 
 #else
-#include "util/thread.h"
 
 #if defined(HAS_MALLOC_USABLE_SIZE)
 #include <malloc.h> // NOLINT
@@ -167,3 +169,148 @@ void  operator delete(void * ptr) throw() { return lean::free(ptr); }
 void* operator new[](std::size_t sz) throw(std::bad_alloc) { return lean::malloc(sz); }
 void  operator delete[](void * ptr) throw() { return lean::free(ptr); }
 #endif
+
+#ifndef LEAN_SMALL_OBJECT_MAX_SIZE
+#define LEAN_SMALL_OBJECT_MAX_SIZE 256
+#endif
+
+#ifndef LEAN_SMALL_OBJECT_PAGE_SIZE
+#define LEAN_SMALL_OBJECT_PAGE_SIZE (1024*16)
+#endif
+
+// Maximal number of free blocks of a size class that a thread keeps in its own pool
+#ifndef LEAN_SMALL_OBJECT_MAX_CACHED
+#define LEAN_SMALL_OBJECT_MAX_CACHED (1024*4)
+#endif
+
+namespace lean {
+constexpr unsigned g_small_object_align = 8;
+constexpr unsigned g_num_size_classes   = LEAN_SMALL_OBJECT_MAX_SIZE / g_small_object_align;
+
+inline unsigned get_size_class(size_t sz) { return sz == 0 ? 0 : (sz - 1) / g_small_object_align; }
+inline size_t get_class_size(unsigned c) { return (c + 1) * g_small_object_align; }
+
+struct free_block {
+    free_block * m_next;
+};
+
+/**
+   \brief Free blocks that are not owned by any thread. They are obtained from threads that
+   released too many blocks or terminated.
+*/
+class small_object_heap {
+    typedef std::pair<free_block *, unsigned> free_list;
+    mutex                  m_mutex;
+    std::vector<free_list> m_lists[g_num_size_classes];
+public:
+    void push(unsigned c, free_block * l, unsigned n) {
+        lock_guard<mutex> lk(m_mutex);
+        m_lists[c].push_back(free_list(l, n));
+    }
+    bool pop(unsigned c, free_block * & l, unsigned & n) {
+        lock_guard<mutex> lk(m_mutex);
+        if (m_lists[c].empty())
+            return false;
+        l = m_lists[c].back().first;
+        n = m_lists[c].back().second;
+        m_lists[c].pop_back();
+        return true;
+    }
+};
+
+/**
+   \brief The heap is never deleted, since blocks may be released during the destruction of
+   static objects. For the same reason, the pages containing the blocks are never released.
+*/
+static small_object_heap & get_small_object_heap() {
+    static small_object_heap * g_heap = new small_object_heap();
+    return *g_heap;
+}
+
+/**
+   \brief Thread local pool of small blocks.
+   It is a POD, so it is still available after the thread local objects are destroyed.
+*/
+struct small_object_pool {
+    free_block * m_free[g_num_size_classes];
+    unsigned     m_num_free[g_num_size_classes];
+    bool         m_initialized;
+    bool         m_finalized;   // true if the thread local objects of this thread were destroyed
+};
+static LEAN_THREAD_LOCAL small_object_pool g_small_object_pool;
+
+/** \brief Return the blocks of the pool to the heap when the thread terminates. */
+struct small_object_pool_finalizer {
+    ~small_object_pool_finalizer() {
+        small_object_pool & p = g_small_object_pool;
+        for (unsigned c = 0; c < g_num_size_classes; c++) {
+            if (p.m_free[c])
+                get_small_object_heap().push(c, p.m_free[c], p.m_num_free[c]);
+            p.m_free[c]     = nullptr;
+            p.m_num_free[c] = 0;
+        }
+        p.m_finalized = true;
+    }
+};
+static LEAN_THREAD_LOCAL small_object_pool_finalizer g_small_object_pool_finalizer;
+
+static void refill(small_object_pool & p, unsigned c) {
+    if (!p.m_initialized) {
+        // make sure the finalizer is created
+        static_cast<void>(&g_small_object_pool_finalizer);
+        p.m_initialized = true;
+    }
+    if (get_small_object_heap().pop(c, p.m_free[c], p.m_num_free[c]))
+        return;
+    size_t sz   = get_class_size(c);
+    unsigned n  = LEAN_SMALL_OBJECT_PAGE_SIZE / sz;
+    char * page = static_cast<char*>(malloc(n * sz));
+    free_block * l = nullptr;
+    for (unsigned i = n; i > 0; i--) {
+        free_block * b = reinterpret_cast<free_block*>(page + (i - 1) * sz);
+        b->m_next = l;
+        l = b;
+    }
+    p.m_free[c]     = l;
+    p.m_num_free[c] = n;
+}
+
+void * alloc_small(size_t sz) {
+    if (sz > LEAN_SMALL_OBJECT_MAX_SIZE)
+        return malloc(sz);
+    unsigned c = get_size_class(sz);
+    small_object_pool & p = g_small_object_pool;
+    if (p.m_finalized)
+        return malloc(get_class_size(c));
+    if (!p.m_free[c])
+        refill(p, c);
+    free_block * r = p.m_free[c];
+    p.m_free[c] = r->m_next;
+    p.m_num_free[c]--;
+    return r;
+}
+
+void free_small(void * ptr, size_t sz) {
+    if (sz > LEAN_SMALL_OBJECT_MAX_SIZE) {
+        free(ptr);
+        return;
+    }
+    unsigned c = get_size_class(sz);
+    free_block * b = static_cast<free_block*>(ptr);
+    small_object_pool & p = g_small_object_pool;
+    if (p.m_finalized) {
+        b->m_next = nullptr;
+        get_small_object_heap().push(c, b, 1);
+        return;
+    }
+    if (p.m_num_free[c] >= LEAN_SMALL_OBJECT_MAX_CACHED) {
+        // the thread is releasing blocks allocated by other threads, give them back
+        get_small_object_heap().push(c, p.m_free[c], p.m_num_free[c]);
+        p.m_free[c]     = nullptr;
+        p.m_num_free[c] = 0;
+    }
+    b->m_next = p.m_free[c];
+    p.m_free[c] = b;
+    p.m_num_free[c]++;
+}
+}
@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
+#include <cstddef>
 
 namespace lean {
 size_t get_allocated_memory();
@@ -12,8 +13,29 @@ long long get_thread_allocated_memory();
 void * malloc(size_t sz);
 void * realloc(void * ptr, size_t sz);
 void free(void * ptr);
-}
 
+/**
+   \brief Allocate a block of \c sz bytes.
+   Small blocks are taken from a thread local pool that keeps a free list for each size class,
+   bigger ones are allocated using \c malloc. The block must be released using \c free_small
+   with the same size. A block may be released by a thread different from the one that allocated it.
 
+   \remark Small blocks are aligned to 8 bytes.
+*/
+void * alloc_small(size_t sz);
+/** \brief Release a block allocated by \c alloc_small. */
+void free_small(void * ptr, size_t sz);
+}
 
+/**
+   \brief Declare class specific allocation functions that use \c alloc_small and \c free_small.
+   It should be used in classes of small objects that are frequently created and deleted.
 
+   \remark Objects must be deleted using a pointer to their dynamic type.
+*/
+#define LEAN_SMALL_OBJECT_ALLOCATOR()                                          \
+public:                                                                        \
+void * operator new(size_t sz) { return ::lean::alloc_small(sz); }             \
+void * operator new(size_t, void * ptr) { return ptr; }                        \
+void operator delete(void * ptr, size_t sz) { ::lean::free_small(ptr, sz); }  \
+void operator delete(void *, void *) {}
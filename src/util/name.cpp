@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <sstream>
 #include <string>
+#include <unordered_set>
 #include "util/thread.h"
 #include "util/name.h"
 #include "util/sstream.h"
@@ -20,6 +21,14 @@ Author: Leonardo de Moura
 #include "util/ascii.h"
 #include "util/object_serializer.h"
 
+#ifndef LEAN_NAME_TABLE_GC_THRESHOLD
+#define LEAN_NAME_TABLE_GC_THRESHOLD 1024
+#endif
+
+#ifndef LEAN_NAME_TABLE_NUM_SHARDS
+#define LEAN_NAME_TABLE_NUM_SHARDS 16
+#endif
+
 namespace lean {
 constexpr char const * anonymous_str = "[anonymous]";
 
@@ -52,6 +61,10 @@ struct name::imp {
     }
 
     imp(bool s, imp * p):m_rc(1), m_is_string(s), m_hash(0), m_prefix(p) { if (p) p->inc_ref(); }
+    /** \brief Create a cell that is only used for searching the interning table. */
+    imp(imp * p, char const * str, unsigned h):m_rc(0), m_is_string(true), m_hash(h), m_prefix(p) { m_str = str_cast(str); }
+    imp(imp * p, unsigned k, unsigned h):m_rc(0), m_is_string(false), m_hash(h), m_prefix(p) { m_k = k; }
+    static char * str_cast(char const * str) { return const_cast<char*>(str); }
 
     static void display_core(std::ostream & out, imp * p, char const * sep) {
         lean_assert(p != nullptr);
@@ -82,6 +95,109 @@ struct name::imp {
     }
 };
 
+#if LEAN_INTERN_NAMES
+/**
+   \brief Table of the (interned) name cells. A cell is in the table iff it was interned.
+   Since the prefix of an interned cell is also interned, two names are equal iff they are
+   represented by the same cell.
+
+   The table owns a reference to each one of its elements. So, an element is removed only when
+   the table owns the only reference to it, and no other thread can be holding it.
+   The table is split in shards protected by different mutexes to reduce contention.
+*/
+class name_table {
+    struct cell_hash { std::size_t operator()(name::imp const * p) const { return p->m_hash; } };
+    struct cell_eq {
+        bool operator()(name::imp const * p1, name::imp const * p2) const {
+            return
+                p1->m_hash == p2->m_hash && p1->m_prefix == p2->m_prefix && p1->m_is_string == p2->m_is_string &&
+                (p1->m_is_string ? strcmp(p1->m_str, p2->m_str) == 0 : p1->m_k == p2->m_k);
+        }
+    };
+    typedef std::unordered_set<name::imp *, cell_hash, cell_eq> table;
+    struct shard {
+        mutex    m_mutex;
+        table    m_table;
+        unsigned m_gc_threshold;
+        shard():m_gc_threshold(LEAN_NAME_TABLE_GC_THRESHOLD) {}
+        ~shard() {
+            for (name::imp * p : m_table)
+                p->dec_ref();
+        }
+        /** \brief Remove the cells only referenced by the table. Return true if a cell was removed. */
+        bool gc() {
+            bool r  = false;
+            auto it = m_table.begin();
+            while (it != m_table.end()) {
+                if ((*it)->get_rc() == 1) {
+                    name::imp * p = *it;
+                    it = m_table.erase(it);
+                    p->dec_ref();
+                    r = true;
+                } else {
+                    ++it;
+                }
+            }
+            return r;
+        }
+    };
+    shard m_shards[LEAN_NAME_TABLE_NUM_SHARDS];
+public:
+    /**
+       \brief Return the interned cell equal to \c probe. The function \c mk is used to create
+       the cell if the table does not contain it. The result is owned by the caller.
+    */
+    template<typename F>
+    name::imp * intern(name::imp const & probe, F && mk) {
+        shard & s = m_shards[probe.m_hash % LEAN_NAME_TABLE_NUM_SHARDS];
+        lock_guard<mutex> lock(s.m_mutex);
+        auto it = s.m_table.find(const_cast<name::imp*>(&probe));
+        if (it != s.m_table.end()) {
+            (*it)->inc_ref();
+            return *it;
+        }
+        if (s.m_table.size() >= s.m_gc_threshold) {
+            s.gc();
+            s.m_gc_threshold = std::max(static_cast<unsigned>(2 * s.m_table.size()), s.m_gc_threshold);
+        }
+        name::imp * r = mk();
+        r->inc_ref(); // reference owned by the table
+        s.m_table.insert(r);
+        return r;
+    }
+
+    unsigned size() {
+        unsigned r = 0;
+        for (shard & s : m_shards) {
+            lock_guard<mutex> lock(s.m_mutex);
+            r += s.m_table.size();
+        }
+        return r;
+    }
+
+    void gc() {
+        // removing a cell may release its prefix
+        bool progress = true;
+        while (progress) {
+            progress = false;
+            for (shard & s : m_shards) {
+                lock_guard<mutex> lock(s.m_mutex);
+                if (s.gc())
+                    progress = true;
+            }
+        }
+    }
+};
+
+static name_table & get_name_table() {
+    static name_table g_table;
+    return g_table;
+}
+
+unsigned get_name_table_size() { return get_name_table().size(); }
+void gc_name_table() { get_name_table().gc(); }
+#endif
+
 name::name(imp * p) {
     m_ptr = p;
     if (m_ptr)
@@ -95,23 +211,35 @@ name::name() {
 name::name(name const & prefix, char const * name) {
     size_t sz  = strlen(name);
     lean_assert(sz < (1u << 31));
-    char * mem = new char[sizeof(imp) + sz + 1];
-    m_ptr      = new (mem) imp(true, prefix.m_ptr);
-    std::memcpy(mem + sizeof(imp), name, sz + 1);
-    m_ptr->m_str       = mem + sizeof(imp);
-    if (m_ptr->m_prefix)
-        m_ptr->m_hash = hash_str(sz, name, m_ptr->m_prefix->m_hash);
-    else
-        m_ptr->m_hash = hash_str(sz, name, 0);
+    unsigned h = hash_str(sz, name, prefix.m_ptr ? prefix.m_ptr->m_hash : 0);
+    auto mk = [&]() {
+        char * mem = new char[sizeof(imp) + sz + 1];
+        imp * r    = new (mem) imp(true, prefix.m_ptr);
+        std::memcpy(mem + sizeof(imp), name, sz + 1);
+        r->m_str   = mem + sizeof(imp);
+        r->m_hash  = h;
+        return r;
+    };
+#if LEAN_INTERN_NAMES
+    m_ptr = get_name_table().intern(imp(prefix.m_ptr, name, h), mk);
+#else
+    m_ptr = mk();
+#endif
 }
 
 name::name(name const & prefix, unsigned k, bool) {
-    m_ptr      = new imp(false, prefix.m_ptr);
-    m_ptr->m_k = k;
-    if (m_ptr->m_prefix)
-        m_ptr->m_hash = ::lean::hash(m_ptr->m_prefix->m_hash, k);
-    else
-        m_ptr->m_hash = k;
+    unsigned h = prefix.m_ptr ? ::lean::hash(prefix.m_ptr->m_hash, k) : k;
+    auto mk = [&]() {
+        imp * r   = new imp(false, prefix.m_ptr);
+        r->m_k    = k;
+        r->m_hash = h;
+        return r;
+    };
+#if LEAN_INTERN_NAMES
+    m_ptr = get_name_table().intern(imp(prefix.m_ptr, k, h), mk);
+#else
+    m_ptr = mk();
+#endif
 }
 
 name::name(name const & prefix, unsigned k):name(prefix, k, true) {
@@ -185,6 +313,7 @@ char const * name::get_string() const {
     return m_ptr->m_str;
 }
 
+#if !LEAN_INTERN_NAMES
 bool operator==(name const & a, name const & b) {
     name::imp * i1 = a.m_ptr;
     name::imp * i2 = b.m_ptr;
@@ -210,8 +339,16 @@ bool operator==(name const & a, name const & b) {
         i2 = i2->m_prefix;
     }
 }
+#endif
 
 bool is_prefix_of(name const & n1, name const & n2) {
+#if LEAN_INTERN_NAMES
+    for (name::imp * i2 = n2.m_ptr; i2; i2 = i2->m_prefix) {
+        if (i2 == n1.m_ptr)
+            return true;
+    }
+    return n1.m_ptr == nullptr;
+#else
     buffer<name::imp*> limbs1, limbs2;
     name::imp* i1 = n1.m_ptr;
     name::imp* i2 = n2.m_ptr;
@@ -238,6 +375,7 @@ bool is_prefix_of(name const & n1, name const & n2) {
         }
     }
     return true;
+#endif
 }
 
 bool operator==(name const & a, char const * b) {
@@ -245,6 +383,8 @@ bool operator==(name const & a, char const * b) {
 }
 
 int cmp(name::imp * i1, name::imp * i2) {
+    if (i1 == i2)
+        return 0;
     buffer<name::imp *> limbs1, limbs2;
     copy_limbs(i1, limbs1);
     copy_limbs(i2, limbs2);
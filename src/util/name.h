@@ -12,14 +12,22 @@ Author: Leonardo de Moura
 #include "util/lua.h"
 #include "util/serializer.h"
 
+#ifndef LEAN_INTERN_NAMES
+#define LEAN_INTERN_NAMES 1
+#endif
+
 namespace lean {
 constexpr char const * lean_name_separator = "::";
 enum class name_kind { ANONYMOUS, STRING, NUMERAL };
 /**
    \brief Hierarchical names.
+
+   When LEAN_INTERN_NAMES is set, names are hash-consed in a global table.
+   So, two names are equal iff they are represented by the same cell.
 */
 class name {
     struct imp;
+    friend class name_table;
     friend int cmp(imp * i1, imp * i2);
     imp * m_ptr;
     explicit name(imp * p);
@@ -60,7 +68,11 @@ public:
     name & operator=(name && other);
     /** \brief Return true iff \c n1 is a prefix of \c n2. */
     friend bool is_prefix_of(name const & n1, name const & n2);
+#if LEAN_INTERN_NAMES
+    friend bool operator==(name const & a, name const & b) { return a.m_ptr == b.m_ptr; }
+#else
     friend bool operator==(name const & a, name const & b);
+#endif
     friend bool operator!=(name const & a, name const & b) { return !(a == b); }
     friend bool operator==(name const & a, char const * b);
     friend bool operator!=(name const & a, char const * b) { return !(a == b); }
@@ -124,6 +136,13 @@ public:
     struct ptr_eq { bool operator()(name const & n1, name const & n2) const { return n1.m_ptr == n2.m_ptr; } };
 };
 
+#if LEAN_INTERN_NAMES
+/** \brief Return the number of cells in the table of interned names. */
+unsigned get_name_table_size();
+/** \brief Remove from the table of interned names the cells that are not used anymore. */
+void gc_name_table();
+#endif
+
 struct name_hash { unsigned operator()(name const & n) const { return n.hash(); } };
 struct name_eq { bool operator()(name const & n1, name const & n2) const { return n1 == n2; } };
 struct name_cmp { int operator()(name const & n1, name const & n2) const { return cmp(n1, n2); } };
@@ -25,7 +25,7 @@ std::string realpath(char const * fname) {
 #else
     char * tmp = ::realpath(fname, nullptr);
     std::string r(tmp);
-    free(tmp);
+    ::free(tmp);
     return r;
 #endif
 }
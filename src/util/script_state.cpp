@@ -12,6 +12,7 @@ Author: Leonardo de Moura
 #include "util/lua.h"
 #include "util/debug.h"
 #include "util/exception.h"
+#include "util/sstream.h"
 #include "util/memory.h"
 #include "util/buffer.h"
 #include "util/interrupt.h"
@@ -20,6 +21,11 @@ Author: Leonardo de Moura
 #include "util/name.h"
 #include "util/splay_map.h"
 #include "util/lean_path.h"
+#include "util/luaref.h"
+
+#ifndef LEAN_MAX_IDLE_SCRIPT_WORKERS
+#define LEAN_MAX_IDLE_SCRIPT_WORKERS 8
+#endif
 
 extern "C" void * lua_realloc(void *, void * q, size_t, size_t new_size) { return lean::realloc(q, new_size); }
 
@@ -37,12 +43,21 @@ void script_state::set_check_interrupt_freq(unsigned count) {
 
 void open_extra(lua_State * L);
 
+static void copy_values(lua_State * src, int first, int last, lua_State * tgt);
+static int worker_global_index(lua_State * W);
+
 static char g_weak_ptr_key; // key for Lua registry (used at get_weak_ptr and save_weak_ptr)
 
 struct script_state::imp {
     lua_State * m_state;
     mutex       m_mutex;
     std::unordered_set<std::string> m_imported_modules;
+    mutex       m_pool_mutex; // protects m_imported_files and m_workers
+    std::vector<std::string> m_imported_files; // imported files in the order they were imported
+    std::vector<std::shared_ptr<imp>> m_workers; // idle workers (at most LEAN_MAX_IDLE_SCRIPT_WORKERS)
+    // The following fields are only used when this object is a worker
+    std::weak_ptr<imp> m_owner;
+    unsigned           m_num_owner_imports;
 
     static std::weak_ptr<imp> * get_weak_ptr(lua_State * L) {
         lua_pushlightuserdata(L, static_cast<void *>(&g_weak_ptr_key));
@@ -68,7 +83,7 @@ struct script_state::imp {
         }
     }
 
-    imp() {
+    imp():m_num_owner_imports(0) {
         // TODO(Leo) investigate why TCMALLOC + lua_realloc do not work together
         // #ifdef LEAN_USE_LUA_NEWSTATE
         #if 0
@@ -113,6 +128,8 @@ struct script_state::imp {
         if (m_imported_modules.find(fname) == m_imported_modules.end()) {
             dofile(fname.c_str());
             m_imported_modules.insert(fname);
+            lock_guard<mutex> lock(m_pool_mutex);
+            m_imported_files.push_back(fname);
             return true;
         } else {
             return false;
@@ -126,8 +143,73 @@ struct script_state::imp {
     bool import(char const * fname) {
         return import_explicit(find_file(fname));
     }
+
+    /**
+       \brief Mark this object as a worker of \c owner. Global variables
+       that are not defined in this object are copied from \c owner on demand.
+    */
+    void set_owner(std::shared_ptr<imp> const & owner) {
+        m_owner = owner;
+        pushglobaltable(m_state);
+        lua_newtable(m_state);
+        lua_pushcfunction(m_state, safe_function<worker_global_index>);
+        lua_setfield(m_state, -2, "__index");
+        lua_setmetatable(m_state, -2);
+        lua_pop(m_state, 1);
+    }
+
+    /** \brief Import the files imported by the owner since the last time this method was invoked. */
+    void sync_imports(std::vector<std::string> const & owner_files) {
+        while (m_num_owner_imports < owner_files.size()) {
+            import_explicit(owner_files[m_num_owner_imports]);
+            m_num_owner_imports++;
+        }
+    }
 };
 
+/**
+   \brief Metamethod for accessing global variables of a worker that
+   are not defined yet. The value is copied from the owner, and stored
+   in the worker.
+*/
+static int worker_global_index(lua_State * W) {
+    if (lua_type(W, 2) != LUA_TSTRING) {
+        lua_pushnil(W);
+        return 1;
+    }
+    std::shared_ptr<script_state::imp> owner;
+    std::shared_ptr<script_state::imp> worker = script_state::imp::get_weak_ptr(W)->lock();
+    if (worker)
+        owner = worker->m_owner.lock();
+    if (!owner) {
+        lua_pushnil(W);
+        return 1;
+    }
+    lock_guard<mutex> lock(owner->m_mutex);
+    lua_State * O = owner->m_state;
+    pushglobaltable(O);
+    lua_pushstring(O, lua_tostring(W, 2));
+    lua_rawget(O, -2);
+    lua_remove(O, -2);
+    if (lua_isnil(O, -1)) {
+        lua_pop(O, 1);
+        lua_pushnil(W);
+        return 1;
+    }
+    try {
+        copy_values(O, lua_gettop(O), lua_gettop(O), W);
+    } catch (exception & ex) {
+        lua_pop(O, 1);
+        throw exception(sstream() << "global variable '" << lua_tostring(W, 2)
+                        << "' cannot be copied to worker Lua State (" << ex.what() << ")");
+    }
+    lua_pop(O, 1);
+    lua_pushvalue(W, 2);
+    lua_pushvalue(W, -2);
+    lua_rawset(W, 1);
+    return 1;
+}
+
 script_state to_script_state(lua_State * L) {
     return script_state(*script_state::imp::get_weak_ptr(L));
 }
@@ -170,6 +252,89 @@ lua_State * script_state::get_state() {
     return m_ptr->m_state;
 }
 
+script_state script_state::acquire_worker() {
+    std::shared_ptr<imp> w;
+    std::vector<std::string> files;
+    {
+        lock_guard<mutex> lock(m_ptr->m_pool_mutex);
+        if (!m_ptr->m_workers.empty()) {
+            w = m_ptr->m_workers.back();
+            m_ptr->m_workers.pop_back();
+        }
+        files = m_ptr->m_imported_files;
+    }
+    if (!w) {
+        script_state r;
+        w = r.m_ptr;
+        w->set_owner(m_ptr);
+    }
+    w->sync_imports(files);
+    return script_state(weak_ref(w));
+}
+
+void script_state::release_worker(script_state const & worker) {
+    lean_assert(worker.m_ptr->m_owner.lock() == m_ptr);
+    lock_guard<mutex> lock(m_ptr->m_pool_mutex);
+    // Workers beyond the limit are closed when the last reference to them is released.
+    if (m_ptr->m_workers.size() < LEAN_MAX_IDLE_SCRIPT_WORKERS)
+        m_ptr->m_workers.push_back(worker.m_ptr);
+}
+
+script_worker::script_worker(script_state const & owner):
+    m_owner(owner), m_worker(m_owner.acquire_worker()) {
+}
+
+script_worker::~script_worker() {
+    m_owner.release_worker(m_worker);
+}
+
+static char g_worker_fns_key; // key for Lua registry (used at script_worker::push_function)
+
+void script_worker::push_function(lua_State * W, luaref const & fn, unsigned id) {
+    lua_pushlightuserdata(W, static_cast<void *>(&g_worker_fns_key));
+    lua_rawget(W, LUA_REGISTRYINDEX);
+    if (lua_isnil(W, -1)) {
+        lua_pop(W, 1);
+        lua_newtable(W);
+        lua_pushlightuserdata(W, static_cast<void *>(&g_worker_fns_key));
+        lua_pushvalue(W, -2);
+        lua_rawset(W, LUA_REGISTRYINDEX);
+    }
+    int fns = lua_gettop(W);
+    lua_rawgeti(W, fns, id);
+    if (lua_isfunction(W, -1)) {
+        lua_remove(W, fns);
+        return;
+    }
+    bool failed_before = lua_isboolean(W, -1);
+    lua_pop(W, 1);
+    try {
+        if (failed_before)
+            throw exception("function cannot be copied to worker Lua State");
+        m_owner.exec_protected([&]() {
+                lua_State * S = fn.get_state();
+                fn.push();
+                try {
+                    copy_values(S, lua_gettop(S), lua_gettop(S), W);
+                } catch (...) {
+                    lua_pop(S, 1);
+                    throw;
+                }
+                lua_pop(S, 1);
+            });
+    } catch (...) {
+        // remember the failure, and avoid copying the function again
+        lua_settop(W, fns);
+        lua_pushboolean(W, false);
+        lua_rawseti(W, fns, id);
+        lua_pop(W, 1);
+        throw;
+    }
+    lua_pushvalue(W, -1);
+    lua_rawseti(W, fns, id);
+    lua_remove(W, fns);
+}
+
 constexpr char const * state_mt = "luastate.mt";
 
 bool is_state(lua_State * L, int idx) {
@@ -222,6 +387,13 @@ static char const * reader(lua_State *, void * data, size_t * sz) {
     }
 }
 
+static bool is_global_table(lua_State * L, int i) {
+    pushglobaltable(L);
+    bool r = lua_rawequal(L, i, -1);
+    lua_pop(L, 1);
+    return r;
+}
+
 static void copy_values(lua_State * src, int first, int last, lua_State * tgt) {
     for (int i = first; i <= last; i++) {
         switch (lua_type(src, i)) {
@@ -244,7 +416,10 @@ static void copy_values(lua_State * src, int first, int last, lua_State * tgt) {
                 char const * name = lua_getupvalue(src, i, j);
                 if (name == nullptr)
                     break;
-                copy_values(src, lua_gettop(src), lua_gettop(src), tgt); // copy upvalue to tgt stack
+                if (is_global_table(src, lua_gettop(src)))
+                    pushglobaltable(tgt); // the function uses the global variables of tgt
+                else
+                    copy_values(src, lua_gettop(src), lua_gettop(src), tgt); // copy upvalue to tgt stack
                 lua_pop(src, 1); // remove upvalue from src stack
                 lua_setupvalue(tgt, -2, j);
                 j++;
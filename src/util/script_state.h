@@ -11,6 +11,7 @@ Author: Leonardo de Moura
 #include "util/unlock_guard.h"
 
 namespace lean {
+class luaref;
 /**
    \brief Wrapper for lua_State objects which contains all Lean bindings.
 */
@@ -23,6 +24,7 @@ private:
     mutex & get_mutex();
     lua_State * get_state();
     friend class data_channel;
+    friend class script_worker;
 public:
     static void set_check_interrupt_freq(unsigned count);
 
@@ -64,6 +66,23 @@ public:
         return f(get_state());
     }
 
+    /**
+       \brief Return a worker for executing Lua code in parallel with this object.
+
+       A worker is an independent Lua State initialized with the registered
+       modules and the files imported by this object. Global variables that
+       are missing in the worker are copied from this object on first access,
+       and an error is raised if the value cannot be copied (e.g., it is a table).
+       Workers must be returned using \c release_worker. At most
+       LEAN_MAX_IDLE_SCRIPT_WORKERS idle workers are kept in a pool, the others are closed.
+
+       \remark The copies are never synchronized. Global variables assigned by code
+       running on the worker are not visible in this object, and global variables
+       redefined in this object after they were copied keep their old value in the worker.
+    */
+    script_state acquire_worker();
+    void release_worker(script_state const & worker);
+
     typedef void (*reg_fn)(lua_State *); // NOLINT
     static void register_module(reg_fn f);
 
@@ -84,6 +103,31 @@ public:
         f();
     }
 };
+/**
+   \brief Auxiliary class for executing Lua code on a worker of a script_state object.
+   The worker is returned to the pool when this object is destroyed.
+*/
+class script_worker {
+    script_state m_owner;
+    script_state m_worker;
+public:
+    script_worker(script_state const & owner);
+    ~script_worker();
+    script_state & get_state() { return m_worker; }
+    /**
+       \brief Push on the stack of the worker Lua State \c W a copy of the function
+       referenced by \c fn in the owner. The copy is cached in the worker using
+       \c id as key. Userdata objects such as expressions and proof states are
+       shared by the copy, and the globals of the function are the ones of the worker.
+
+       This method throws an exception if the function cannot be copied
+       (e.g., one of its upvalues is a table).
+
+       \remark This method must be invoked while the worker is locked.
+    */
+    void push_function(lua_State * W, luaref const & fn, unsigned id);
+};
+
 /**
    \brief Return a reference to the script_state object that is wrapping \c L.
 */
@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <string>
+#include <utility>
 #include <limits>
 #include <stdio.h>
 #include <ios>
@@ -14,15 +15,35 @@ Author: Leonardo de Moura
 namespace lean {
 void serializer_core::write_unsigned(unsigned i) {
     static_assert(sizeof(i) == 4, "unexpected unsigned size");
-    m_out.put((i >> 24) & 0xff);
-    m_out.put((i >> 16) & 0xff);
-    m_out.put((i >> 8) & 0xff);
-    m_out.put(i & 0xff);
+    char buffer[5];
+    unsigned sz = 0;
+    while (i >= 0x80) {
+        buffer[sz++] = static_cast<char>((i & 0x7f) | 0x80);
+        i >>= 7;
+    }
+    buffer[sz++] = static_cast<char>(i);
+    write_raw(buffer, sz);
 }
 
 void serializer_core::write_int(int i) {
     static_assert(sizeof(i) == 4, "unexpected int size");
-    write_unsigned(i);
+    // zigzag encoding: small negative numbers are also encoded using few bytes
+    unsigned u = static_cast<unsigned>(i);
+    write_unsigned((u << 1) ^ (i < 0 ? 0xffffffffu : 0u));
+}
+
+void serializer_core::write_string_core(char const * str, size_t size) {
+    std::string s(str, size);
+    auto it = m_strings.find(s);
+    if (it != m_strings.end()) {
+        write_unsigned(it->second + 1);
+    } else {
+        unsigned idx = m_strings.size();
+        m_strings.insert(std::make_pair(s, idx));
+        write_unsigned(0);
+        write_unsigned(size);
+        write_raw(str, size);
+    }
 }
 
 #define BIG_BUFFER 1024
@@ -43,30 +64,38 @@ void serializer_core::write_double(double d) {
 }
 
 std::string deserializer_core::read_string() {
-    std::string r;
-    while (true) {
-        char c = m_in.get();
-        if (c == 0)
-            break;
-        if (c == EOF)
+    unsigned idx = read_unsigned();
+    if (idx > 0) {
+        if (idx > m_strings.size())
             throw_corrupted_file();
-        r += c;
+        return m_strings[idx - 1];
     }
+    unsigned size = read_unsigned();
+    std::string r(size, 0);
+    if (size > 0 && m_buf.sgetn(&r[0], size) != static_cast<std::streamsize>(size))
+        throw_corrupted_file();
+    m_strings.push_back(r);
     return r;
 }
 
 unsigned deserializer_core::read_unsigned() {
-    unsigned r;
+    unsigned r = 0;
     static_assert(sizeof(r) == 4, "unexpected unsigned size");
-    r  = static_cast<unsigned>(m_in.get()) << 24;
-    r |= static_cast<unsigned>(m_in.get()) << 16;
-    r |= static_cast<unsigned>(m_in.get()) << 8;
-    r |= static_cast<unsigned>(m_in.get());
-    return r;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        unsigned char c = get();
+        // the fifth byte only contains the 4 most significant bits
+        if (shift == 28 && (c & 0xf0) != 0)
+            throw_corrupted_file();
+        r |= static_cast<unsigned>(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+            return r;
+    }
+    throw_corrupted_file();
 }
 
 int deserializer_core::read_int() {
-    return read_unsigned();
+    unsigned u = read_unsigned();
+    return static_cast<int>((u >> 1) ^ (0u - (u & 1)));
 }
 
 double deserializer_core::read_double() {
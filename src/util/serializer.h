@@ -9,24 +9,39 @@ Author: Leonardo de Moura
 #include <string>
 #include <sstream>
 #include <cstring>
+#include <vector>
+#include <unordered_map>
 #include "util/extensible_object.h"
 
 namespace lean {
+[[ noreturn ]] void throw_corrupted_file();
+
 /**
    \brief Low-tech serializer.
    The actual functionality is implemented using extensions.
+
+   Unsigned and integer values are encoded using LEB128 (variable length) encoding,
+   and strings are stored in a table. So, a string is only written once, and
+   the following occurrences are encoded using its position in the table.
+
+   The values are written directly to the stream buffer of the given output stream, and each
+   value is written using a single call. So, the output stream can be inspected at any time.
 */
 class serializer_core {
-    std::ostream & m_out;
+    std::streambuf &                          m_out;
+    std::unordered_map<std::string, unsigned> m_strings;
+    void write_raw(char const * data, size_t size) { m_out.sputn(data, size); }
+    void write_string_core(char const * str, size_t size);
 public:
-    serializer_core(std::ostream & out):m_out(out) {}
-    void write_string(char const * str) { m_out.write(str, strlen(str) + 1); }
-    void write_string(std::string const & str) { m_out.write(str.c_str(), str.size() + 1); }
+    serializer_core(std::ostream & out):m_out(*out.rdbuf()) {}
+    void write_string(char const * str) { write_string_core(str, strlen(str)); }
+    void write_string(std::string const & str) { write_string_core(str.data(), str.size()); }
     void write_unsigned(unsigned i);
     void write_int(int i);
-    void write_char(char c) { m_out.put(c); }
-    void write_bool(bool b) { m_out.put(b ? 1 : 0); }
+    void write_char(char c) { m_out.sputc(c); }
+    void write_bool(bool b) { m_out.sputc(b ? 1 : 0); }
     void write_double(double b);
+    void write_block(char const * data, size_t size) { write_raw(data, size); }
 };
 
 typedef extensible_object<serializer_core> serializer;
@@ -42,16 +57,27 @@ inline serializer & operator<<(serializer & s, double b) { s.write_double(b); re
 /**
    \brief Low-tech serializer.
    The actual functionality is implemented using extensions.
+
+   The values are read directly from the stream buffer of the given input stream.
 */
 class deserializer_core {
-    std::istream & m_in;
+    std::istream &           m_in;
+    std::streambuf &         m_buf;
+    std::vector<std::string> m_strings;
+    char get() {
+        int c = m_buf.sbumpc();
+        if (c == std::char_traits<char>::eof())
+            throw_corrupted_file();
+        return c;
+    }
 public:
-    deserializer_core(std::istream & in):m_in(in) {}
+    deserializer_core(std::istream & in):m_in(in), m_buf(*in.rdbuf()) {}
+    std::istream & get_stream() { return m_in; }
     std::string read_string();
     unsigned read_unsigned();
     int read_int();
-    char read_char() { return m_in.get(); }
-    bool read_bool() { return m_in.get() != 0; }
+    char read_char() { return get(); }
+    bool read_bool() { return get() != 0; }
     double read_double();
 };
 
@@ -63,6 +89,4 @@ inline deserializer & operator>>(deserializer & d, int & i) { i = d.read_int();
 inline deserializer & operator>>(deserializer & d, char & c) { c = d.read_char(); return d; }
 inline deserializer & operator>>(deserializer & d, bool & b) { b = d.read_bool(); return d; }
 inline deserializer & operator>>(deserializer & d, double & b) { b = d.read_double(); return d; }
-
-[[ noreturn ]] void throw_corrupted_file();
 }
@@ -7,6 +7,9 @@
 #include <sstream>
 #include <string>
 #include <cstring>
+#include <deque>
+#include <iterator>
+#include <algorithm>
 #include <utility>
 #include <vector>
 #include "util/sstream.h"
@@ -159,7 +162,7 @@ format group(format const & f) {
     g_diff_flatten = false;
     format flat_f = format::flatten(f);
     if (g_diff_flatten) {
-        return choice(flat_f, f);
+        return format::choice(flat_f, f);
     } else {
         // flat_f and f are essentially the same format object.
         // So, we don't need to create a choice.
@@ -180,87 +183,10 @@ format paren(format const & x) {
 // wrap x y = x <> (text " " :<|> line) <> y
 format wrap(format const & f1, format const & f2) {
     return format{f1,
-                  choice(format(" "), line()),
+                  format::choice(format(" "), line()),
                   f2};
 }
 
-/**
-   \brief Auxiliary exception used to sign that the amount of
-   available space was exhausted. It is used in \c space_upto_line_break and
-   \c space_upto_line_break_list_exceeded
-*/
-struct space_exceeded {};
-
-/**
-   \brief Return true iff the space upto line break fits in the available space.
-*/
-bool format::space_upto_line_break_list_exceeded(sexpr const & s, int available, std::vector<std::pair<sexpr, unsigned>> const & todo) {
-    try {
-        bool found_newline = false;
-        available -= space_upto_line_break(s, available, found_newline);
-        auto it    = todo.end();
-        auto begin = todo.begin();
-        while (it != begin && !found_newline) {
-            --it;
-            if (available < 0)
-                return true;
-            available -= space_upto_line_break(it->first, available, found_newline);
-        }
-        return available < 0;
-    } catch (space_exceeded) {
-        return true;
-    }
-}
-
-/**
-   \brief Return the space upto line break. If the space exceeds available, then throw an exception.
-*/
-int format::space_upto_line_break(sexpr const & s, int available, bool & found_newline) {
-    // s : format
-    lean_assert(!found_newline);
-    lean_assert(sexpr_kind(s) <= format_kind::COLOR_END);
-
-    switch (sexpr_kind(s)) {
-    case format_kind::NIL:
-    case format_kind::COLOR_BEGIN:
-    case format_kind::COLOR_END:
-    {
-        return 0;
-    }
-    case format_kind::COMPOSE:
-    case format_kind::FLAT_COMPOSE:
-    {
-        sexpr list  = sexpr_compose_list(s);
-        int len = 0;
-        while (!is_nil(list) && !found_newline) {
-            sexpr const & h = car(list);
-            list = cdr(list);
-            len += space_upto_line_break(h, available, found_newline);
-            if (len > available)
-                throw space_exceeded();
-        }
-        return len;
-    }
-    case format_kind::NEST:
-    {
-        sexpr const & x = sexpr_nest_s(s);
-        return space_upto_line_break(x, available, found_newline);
-    }
-    case format_kind::TEXT: {
-        return sexpr_text_length(s);
-    }
-    case format_kind::LINE:
-        found_newline = true;
-        return 0;
-    case format_kind::CHOICE:
-    {
-        sexpr const & x = sexpr_choice_2(s);
-        return space_upto_line_break(x, available, found_newline);
-    }
-    }
-    lean_unreachable(); // LCOV_EXCL_LINE
-}
-
 format operator+(format const & f1, format const & f2) {
     return format{f1, f2};
 }
@@ -269,64 +195,224 @@ format operator^(format const & f1, format const & f2) {
     return format {f1, format(" "), f2};
 }
 
-std::ostream & format::pretty(std::ostream & out, unsigned w, bool colors, format const & f) {
-    unsigned pos        = 0;
-    std::vector<std::pair<sexpr, unsigned>> todo;
-    todo.push_back(std::make_pair(f.m_value, 0));
-    while (!todo.empty()) {
-        auto pair       = todo.back();
-        sexpr s         = pair.first;
-        unsigned indent = pair.second;
-        todo.pop_back();
-
-        switch (sexpr_kind(s)) {
-        case format_kind::NIL:
+/**
+   \brief Streaming layout engine for \c format objects (Oppen style).
+
+   Every choice is created by \c group or \c wrap (\c format::choice is private), and has the form
+   <tt>choice(flatten(y), y)</tt>. Thus, the engine only traverses the second
+   alternative \c y, and a choice is a group that is either printed in flat
+   mode (lines are spaces and nested groups are flat), or in break mode.
+   A group is printed in flat mode iff its flat width plus the width of
+   the text up to the next line after it fits in the available space.
+
+   The traversal produces a stream of tokens. Tokens are printed as soon as
+   possible, and a group is kept in the lookahead buffer only until
+   this decision can be made. Since the width of the tokens in the buffer
+   is bounded by the line width, the engine runs in time linear in the size of the format object.
+*/
+class format::pretty_fn {
+    enum class token_kind { Text, Line, ColorBegin, ColorEnd, GroupBegin, GroupEnd };
+    struct token {
+        token_kind    m_kind;
+        sexpr const * m_text;     // Text: the content of the TEXT format object
+        unsigned      m_value;    // Text: length, Line: indentation, ColorBegin: color
+        int           m_start;    // GroupBegin: flat width of the stream before the group
+        int           m_line;     // GroupBegin: flat width of the stream before the next line after the group, or -1 if unknown
+        token(token_kind k, sexpr const * t = nullptr, unsigned v = 0, int s = 0):
+            m_kind(k), m_text(t), m_value(v), m_start(s), m_line(-1) {}
+    };
+    struct todo_entry {
+        sexpr const * m_value;    // nullptr if this entry marks the end of a group
+        unsigned      m_indent;
+        unsigned      m_group;    // identifier of the group (i.e., of its GroupBegin token)
+        todo_entry(sexpr const * v, unsigned i, unsigned g = 0):m_value(v), m_indent(i), m_group(g) {}
+    };
+
+    std::ostream &          m_out;
+    int                     m_width;
+    bool                    m_colors;
+    unsigned                m_pos;       // current column
+    int                     m_total;     // flat width of all tokens produced so far
+    std::deque<token>       m_buffer;    // tokens that were not printed yet
+    unsigned                m_first;     // identifier of the first token in m_buffer
+    std::vector<unsigned>   m_ended;     // groups that ended after the last line
+    std::vector<todo_entry> m_todo;
+
+    void print_spaces(unsigned n) {
+        std::fill_n(std::ostreambuf_iterator<char>(m_out), n, ' ');
+    }
+
+    void print(token const & t, bool flat) {
+        switch (t.m_kind) {
+        case token_kind::Text:
+            m_pos += t.m_value;
+            if (is_string(cdr(*t.m_text)))
+                m_out << to_string(cdr(*t.m_text));
+            else
+                m_out << cdr(*t.m_text);
             break;
-        case format_kind::COLOR_BEGIN:
-            if (colors) {
-                format::format_color c = static_cast<format::format_color>(to_int(cdr(s)));
-                out << "\e[" << (31 + c % 7) << "m";
+        case token_kind::Line:
+            if (flat) {
+                m_pos++;
+                m_out << ' ';
+            } else {
+                m_pos = t.m_value;
+                m_out << '\n';
+                print_spaces(t.m_value);
             }
             break;
-        case format_kind::COLOR_END:
-            if (colors) {
-                out << "\e[0m";
-            }
+        case token_kind::ColorBegin:
+            if (m_colors)
+                m_out << "\e[" << (31 + t.m_value % 7) << "m";
+            break;
+        case token_kind::ColorEnd:
+            if (m_colors)
+                m_out << "\e[0m";
             break;
-        case format_kind::COMPOSE:
-        case format_kind::FLAT_COMPOSE: {
-            unsigned old_sz     = todo.size();
-            for_each(sexpr_compose_list(s), [&](sexpr const & c) { todo.emplace_back(c, indent); });
-            std::reverse(todo.begin() + old_sz, todo.end());
+        case token_kind::GroupBegin:
+        case token_kind::GroupEnd:
             break;
         }
-        case format_kind::NEST:
-            todo.emplace_back(sexpr_nest_s(s), indent + sexpr_nest_i(s));
+    }
+
+    /** \brief Print the group at the beginning of the buffer in flat mode. */
+    void print_flat_group() {
+        unsigned depth = 0;
+        do {
+            token const & t = m_buffer.front();
+            if (t.m_kind == token_kind::GroupBegin)
+                depth++;
+            else if (t.m_kind == token_kind::GroupEnd)
+                depth--;
+            else
+                print(t, true);
+            m_buffer.pop_front();
+            m_first++;
+        } while (depth > 0);
+    }
+
+    /** \brief Print the tokens in the buffer until we find a group that cannot be decided yet. */
+    void flush() {
+        while (!m_buffer.empty()) {
+            token const & t = m_buffer.front();
+            if (t.m_kind == token_kind::GroupBegin) {
+                int available = m_width - static_cast<int>(m_pos);
+                if (t.m_line >= 0) {
+                    if (t.m_line - t.m_start <= available) {
+                        print_flat_group();
+                        continue;
+                    }
+                } else if (m_total - t.m_start <= available) {
+                    return; // we need more lookahead
+                }
+                // group does not fit, then it is printed in break mode
+            } else {
+                print(t, false);
+            }
+            m_buffer.pop_front();
+            m_first++;
+        }
+    }
+
+    /** \brief Store the position of the next line in the groups that ended after the last line. */
+    void set_next_line() {
+        for (unsigned g : m_ended) {
+            if (g >= m_first)
+                m_buffer[g - m_first].m_line = m_total;
+        }
+        m_ended.clear();
+    }
+
+    void push(token const & t) {
+        switch (t.m_kind) {
+        case token_kind::Text:
+            m_total += t.m_value;
             break;
-        case format_kind::LINE:
-            pos        = indent;
-            out << "\n";
-            for (unsigned i = 0; i < indent; i++)
-                out << " ";
+        case token_kind::Line:
+            set_next_line();
+            m_total++;
             break;
-        case format_kind::TEXT:
-            pos += sexpr_text_length(s);
-            if (is_string(cdr(s)))
-                out << to_string(cdr(s));
-            else
-                out << cdr(s);
+        default:
             break;
-        case format_kind::CHOICE: {
-            sexpr const & x = sexpr_choice_1(s);
-            sexpr const & y = sexpr_choice_2(s);;
-            int available   = static_cast<int>(w) - static_cast<int>(pos);
-            if (!space_upto_line_break_list_exceeded(x, available, todo))
-                todo.emplace_back(x, indent);
-            else
-                todo.emplace_back(y, indent);
         }
+        if (m_buffer.empty() && t.m_kind != token_kind::GroupBegin) {
+            print(t, false);
+            m_first++;
+        } else {
+            m_buffer.push_back(t);
+            if (m_buffer.front().m_kind == token_kind::GroupBegin)
+                flush();
         }
     }
+
+    void begin_group(unsigned indent, sexpr const & s) {
+        unsigned g = m_first + m_buffer.size();
+        m_todo.emplace_back(nullptr, indent, g);
+        m_todo.emplace_back(&s, indent);
+        push(token(token_kind::GroupBegin, nullptr, 0, m_total));
+    }
+
+    void end_group(unsigned g) {
+        if (g >= m_first) {
+            // the group was not decided yet
+            m_ended.push_back(g);
+            push(token(token_kind::GroupEnd));
+        }
+    }
+
+public:
+    pretty_fn(std::ostream & out, unsigned w, bool colors):
+        m_out(out), m_width(w), m_colors(colors), m_pos(0), m_total(0), m_first(0) {}
+
+    void operator()(format const & f) {
+        m_todo.emplace_back(&f.m_value, 0);
+        while (!m_todo.empty()) {
+            todo_entry e = m_todo.back();
+            m_todo.pop_back();
+            if (e.m_value == nullptr) {
+                end_group(e.m_group);
+                continue;
+            }
+            sexpr const & s = *e.m_value;
+            switch (sexpr_kind(s)) {
+            case format_kind::NIL:
+                break;
+            case format_kind::COLOR_BEGIN:
+                push(token(token_kind::ColorBegin, nullptr, to_int(cdr(s))));
+                break;
+            case format_kind::COLOR_END:
+                push(token(token_kind::ColorEnd));
+                break;
+            case format_kind::COMPOSE:
+            case format_kind::FLAT_COMPOSE: {
+                unsigned old_sz = m_todo.size();
+                for (sexpr const * it = &sexpr_compose_list(s); !is_nil(*it); it = &cdr(*it))
+                    m_todo.emplace_back(&car(*it), e.m_indent);
+                std::reverse(m_todo.begin() + old_sz, m_todo.end());
+                break;
+            }
+            case format_kind::NEST:
+                m_todo.emplace_back(&sexpr_nest_s(s), e.m_indent + sexpr_nest_i(s));
+                break;
+            case format_kind::LINE:
+                push(token(token_kind::Line, nullptr, e.m_indent));
+                break;
+            case format_kind::TEXT:
+                push(token(token_kind::Text, &s, sexpr_text_length(s)));
+                break;
+            case format_kind::CHOICE:
+                begin_group(e.m_indent, sexpr_choice_2(s));
+                break;
+            }
+        }
+        set_next_line();
+        flush();
+        lean_assert(m_buffer.empty());
+    }
+};
+
+std::ostream & format::pretty(std::ostream & out, unsigned w, bool colors, format const & f) {
+    pretty_fn(out, w, colors)(f);
     return out;
 }
 
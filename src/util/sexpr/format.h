@@ -124,9 +124,8 @@ private:
         return sexpr{sexpr(format::format_kind::LINE)};
     }
 
-    // Functions used inside of pretty printing
-    static bool space_upto_line_break_list_exceeded(sexpr const & s, int available, std::vector<std::pair<sexpr, unsigned>> const & todo);
-    static int space_upto_line_break(sexpr const & s, int available, bool & found);
+    // Layout engine used to implement pretty
+    class pretty_fn;
 
     static bool is_fnil(format const & f)   {
         return to_int(car(f.m_value)) == format_kind::NIL;
@@ -149,7 +148,13 @@ private:
     static bool is_choice(format const & f) {
         return to_int(car(f.m_value)) == format_kind::CHOICE;
     }
-    friend format choice(format const & f1, format const & f2) {
+    /**
+       \brief Return the choice <tt>f1 <|> f2</tt>.
+
+       \remark This method is private since the layout engine (\c pretty_fn) assumes that every
+       choice has the form <tt>flatten(y) <|> y</tt>. Choices are only created by \c group and \c wrap.
+    */
+    static format choice(format const & f1, format const & f2) {
         return format(sexpr_choice(f1.m_value, f2.m_value));
     }
 
@@ -6,6 +6,7 @@ Author: Leonardo de Moura
 */
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include "util/sstream.h"
 #include "util/sexpr/options.h"
 #include "util/sexpr/option_declarations.h"
@@ -44,8 +45,59 @@ option_declarations const & get_option_declarations() {
     return get_option_declarations_core();
 }
 
+typedef std::unordered_map<name, unsigned, name_hash, name_eq> option_slots;
+static option_slots & get_option_slots() {
+    static option_slots g_option_slots;
+    return g_option_slots;
+}
+
+optional<unsigned> get_option_slot(name const & n) {
+    option_slots const & slots = get_option_slots();
+    auto it = slots.find(n);
+    if (it == slots.end())
+        return optional<unsigned>();
+    else
+        return optional<unsigned>(it->second);
+}
+
 mk_option_declaration::mk_option_declaration(name const & n, option_kind k, char const * default_value, char const * description) {
     get_option_declarations_core().insert(mk_pair(n, option_declaration(n, k, default_value, description)));
+    option_slots & slots = get_option_slots();
+    if (slots.find(n) == slots.end()) {
+        unsigned slot = slots.size();
+        slots.insert(mk_pair(n, slot));
+    }
+}
+
+options::options(sexpr const & v):m_value(v) {
+    if (is_nil(m_value))
+        return;
+    std::shared_ptr<index> idx = std::make_shared<index>(get_option_slots().size(), nullptr);
+    sexpr const * it = &m_value;
+    while (!is_nil(*it)) {
+        sexpr const & p = head(*it);
+        if (auto slot = get_option_slot(to_name(head(p)))) {
+            sexpr const * & entry = (*idx)[*slot];
+            if (entry == nullptr) // the first occurrence of an option is the one used
+                entry = &tail(p);
+        }
+        it = &tail(*it);
+    }
+    m_index = idx;
+}
+
+/** \brief Return a pointer to the value of \c n, or nullptr if \c n is not set. */
+sexpr const * options::find(name const & n) const {
+    if (m_index) {
+        if (auto slot = get_option_slot(n)) {
+            if (*slot < m_index->size())
+                return (*m_index)[*slot];
+        }
+    } else if (is_nil(m_value)) {
+        return nullptr;
+    }
+    sexpr const * r = ::lean::find(m_value, [&](sexpr const & p) { return to_name(head(p)) == n; });
+    return r == nullptr ? nullptr : &tail(*r);
 }
 
 bool options::empty() const {
@@ -57,7 +109,7 @@ unsigned options::size() const {
 }
 
 bool options::contains(name const & n) const {
-    return ::lean::contains(m_value, [&](sexpr const & p) { return to_name(head(p)) == n; });
+    return find(n) != nullptr;
 }
 
 bool options::contains(char const * n) const {
@@ -65,37 +117,37 @@ bool options::contains(char const * n) const {
 }
 
 sexpr options::get_sexpr(name const & n, sexpr const & default_value) const {
-    sexpr const * r = find(m_value, [&](sexpr const & p) { return to_name(head(p)) == n; });
-    return r == nullptr ? default_value : tail(*r);
+    sexpr const * r = find(n);
+    return r == nullptr ? default_value : *r;
 }
 
 int options::get_int(name const & n, int default_value) const {
-    sexpr const & r = get_sexpr(n);
-    return !is_nil(r) && is_int(r) ? to_int(r) : default_value;
+    sexpr const * r = find(n);
+    return r && is_int(*r) ? to_int(*r) : default_value;
 }
 
 unsigned options::get_unsigned(name const & n, unsigned default_value) const {
-    sexpr const & r = get_sexpr(n);
-    return !is_nil(r) && is_int(r) ? static_cast<unsigned>(to_int(r)) : default_value;
+    sexpr const * r = find(n);
+    return r && is_int(*r) ? static_cast<unsigned>(to_int(*r)) : default_value;
 }
 
 bool options::get_bool(name const & n, bool default_value) const {
-    sexpr const & r = get_sexpr(n);
-    return !is_nil(r) && is_bool(r) ? to_bool(r) != 0 : default_value;
+    sexpr const * r = find(n);
+    return r && is_bool(*r) ? to_bool(*r) != 0 : default_value;
 }
 
 double options::get_double(name const & n, double default_value) const {
-    sexpr const & r = get_sexpr(n);
-    return !is_nil(r) && is_double(r) ? to_double(r) : default_value;
+    sexpr const * r = find(n);
+    return r && is_double(*r) ? to_double(*r) : default_value;
 }
 
 char const * options::get_string(name const & n, char const * default_value) const {
-    sexpr const & r = get_sexpr(n);
-    return !is_nil(r) && is_string(r) ? to_string(r).c_str() : default_value;
+    sexpr const * r = find(n);
+    return r && is_string(*r) ? to_string(*r).c_str() : default_value;
 }
 
 sexpr options::get_sexpr(char const * n, sexpr const & default_value) const {
-    sexpr const * r = find(m_value, [&](sexpr const & p) { return to_name(head(p)) == n; });
+    sexpr const * r = ::lean::find(m_value, [&](sexpr const & p) { return to_name(head(p)) == n; });
     return r == nullptr ? default_value : tail(*r);
 }
 
@@ -6,6 +6,9 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <algorithm>
+#include <memory>
+#include <vector>
+#include "util/optional.h"
 #include "util/name.h"
 #include "util/sexpr/sexpr.h"
 #include "util/sexpr/format.h"
@@ -16,18 +19,33 @@ namespace lean {
 enum option_kind { BoolOption, IntOption, UnsignedOption, DoubleOption, StringOption, SExprOption };
 std::ostream & operator<<(std::ostream & out, option_kind k);
 
-/** \brief Configuration options. */
+/**
+   \brief Return the slot associated with the declared option \c n.
+   Each option declared using \c RegisterOption has a small unique slot.
+*/
+optional<unsigned> get_option_slot(name const & n);
+
+/**
+   \brief Configuration options.
+
+   Besides the association list, a set of options contains an index from the slots
+   of the declared options to their values. So, looking up a declared option does not
+   require a traversal of the association list.
+*/
 class options {
-    sexpr m_value;
-    options(sexpr const & v):m_value(v) {}
+    typedef std::vector<sexpr const *> index; // slot -> pointer to value in m_value, nullptr if not set
+    sexpr                        m_value;
+    std::shared_ptr<index const> m_index;
+    options(sexpr const & v);
+    sexpr const * find(name const & n) const;
 public:
     options() {}
-    options(options const & o):m_value(o.m_value) {}
-    options(options && o):m_value(std::move(o.m_value)) {}
+    options(options const & o):m_value(o.m_value), m_index(o.m_index) {}
+    options(options && o):m_value(std::move(o.m_value)), m_index(std::move(o.m_index)) {}
     template<typename T> options(name const & n, T const & t) { *this = update(n, t); }
     ~options() {}
 
-    options & operator=(options const & o) { m_value = o.m_value; return *this; }
+    options & operator=(options const & o) { m_value = o.m_value; m_index = o.m_index; return *this; }
 
     bool empty() const;
     unsigned size() const;
@@ -0,0 +1,269 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "util/thread_pool.h"
+
+#if defined(LEAN_MULTI_THREAD)
+namespace lean {
+struct task::cell {
+    std::function<void()> m_fn;
+    bool                  m_done;        // protected by the thread pool m_done_mutex
+    mutex                 m_mutex;       // protects the following two fields
+    bool                  m_interrupted;
+    atomic_bool *         m_flag_addr;   // interrupt flag of the worker executing the task
+    cell(std::function<void()> const & fn):m_fn(fn), m_done(false), m_interrupted(false), m_flag_addr(nullptr) {}
+};
+typedef std::shared_ptr<task::cell> cell_ptr;
+
+static LEAN_THREAD_LOCAL int g_worker_idx = -1;
+
+#ifndef LEAN_THREAD_POOL_IDLE_TIMEOUT
+#define LEAN_THREAD_POOL_IDLE_TIMEOUT 1000 // milliseconds
+#endif
+
+class thread_pool {
+    typedef std::deque<cell_ptr> task_queue;
+    struct worker {
+        task_queue                            m_queue;
+        std::unique_ptr<interruptible_thread> m_thread;
+        bool                                  m_exited; // true if the thread terminated, then the worker can be reused
+        worker():m_exited(false) {}
+    };
+    mutex                                m_mutex;   // protects the queues and counters below
+    condition_variable                   m_cv;      // idle workers wait on it
+    std::vector<std::unique_ptr<worker>> m_workers;
+    task_queue                           m_queue;   // tasks submitted by threads that are not workers
+    // Maximum number of workers that are not waiting for the termination of other tasks.
+    unsigned                             m_max_workers;
+    unsigned                             m_num_workers; // number of threads that did not exit
+    unsigned                             m_num_idle;    // workers that are not executing a task
+    unsigned                             m_num_blocked; // workers waiting for the termination of other tasks
+    unsigned                             m_num_queued;
+    bool                                 m_shutdown;
+
+    cell_ptr pop(unsigned idx) {
+        task_queue & own = m_workers[idx]->m_queue;
+        cell_ptr r;
+        if (!own.empty()) {
+            r = own.back();
+            own.pop_back();
+        } else if (!m_queue.empty()) {
+            r = m_queue.front();
+            m_queue.pop_front();
+        } else {
+            unsigned sz = m_workers.size();
+            for (unsigned i = 1; i < sz; i++) {
+                task_queue & other = m_workers[(idx + i) % sz]->m_queue;
+                if (!other.empty()) {
+                    r = other.front();
+                    other.pop_front();
+                    break;
+                }
+            }
+        }
+        return r;
+    }
+
+    void run(cell_ptr const & t) {
+        {
+            lock_guard<mutex> lk(t->m_mutex);
+            t->m_flag_addr = get_interrupt_flag();
+            if (t->m_interrupted)
+                ::lean::request_interrupt();
+        }
+        try {
+            t->m_fn();
+        } catch (...) {
+        }
+        {
+            lock_guard<mutex> lk(t->m_mutex);
+            t->m_flag_addr = nullptr;
+        }
+        reset_interrupt();
+        t->m_fn = nullptr;
+        {
+            lock_guard<mutex> lk(m_done_mutex);
+            t->m_done = true;
+        }
+        m_done_cv.notify_all();
+    }
+
+    void worker_loop(unsigned idx) {
+        g_worker_idx = idx;
+        unique_lock<mutex> lk(m_mutex);
+        auto idle_since = chrono::steady_clock::now();
+        while (true) {
+            if (cell_ptr t = pop(idx)) {
+                m_num_queued--;
+                m_num_idle--;
+                lk.unlock();
+                run(t);
+                lk.lock();
+                m_num_idle++;
+                idle_since = chrono::steady_clock::now();
+            } else if (m_shutdown) {
+                return;
+            } else if (m_num_workers - m_num_blocked > m_max_workers ||
+                       chrono::steady_clock::now() - idle_since >= chrono::milliseconds(LEAN_THREAD_POOL_IDLE_TIMEOUT)) {
+                // the limit was exceeded while other workers were blocked, or there is nothing to do
+                m_num_idle--;
+                m_num_workers--;
+                m_workers[idx]->m_exited = true;
+                return;
+            } else {
+                m_cv.wait_for(lk, chrono::milliseconds(LEAN_THREAD_POOL_IDLE_TIMEOUT));
+            }
+        }
+    }
+
+    /** \brief Create a new worker, the workers of threads that exited are reused. */
+    void add_worker() {
+        unsigned idx = 0;
+        while (idx < m_workers.size() && !m_workers[idx]->m_exited)
+            idx++;
+        if (idx == m_workers.size()) {
+            m_workers.push_back(std::unique_ptr<worker>(new worker()));
+        } else {
+            m_workers[idx]->m_thread->join();
+            m_workers[idx]->m_exited = false;
+        }
+        m_num_workers++;
+        m_num_idle++;
+        m_workers[idx]->m_thread.reset(new interruptible_thread([=]() { worker_loop(idx); }));
+    }
+
+    /**
+       \brief Create workers for the queued tasks that do not have an idle worker to execute them.
+       At most \c m_max_workers workers are not blocked. Workers waiting for the termination of other tasks
+       do not count, so tasks that wait for other tasks cannot produce a deadlock.
+    */
+    void add_workers() {
+        while (m_num_queued > m_num_idle && m_num_workers - m_num_blocked < m_max_workers)
+            add_worker();
+    }
+
+public:
+    mutex                                m_done_mutex;
+    condition_variable                   m_done_cv; // notified whenever a task is done
+
+    thread_pool():
+        m_max_workers(std::max(1u, static_cast<unsigned>(thread::hardware_concurrency()))),
+        m_num_workers(0), m_num_idle(0), m_num_blocked(0), m_num_queued(0), m_shutdown(false) {}
+
+    ~thread_pool() {
+        {
+            lock_guard<mutex> lk(m_mutex);
+            m_shutdown = true;
+        }
+        m_cv.notify_all();
+        for (auto & w : m_workers)
+            w->m_thread->join();
+    }
+
+    void submit(cell_ptr const & t) {
+        lock_guard<mutex> lk(m_mutex);
+        if (g_worker_idx >= 0)
+            m_workers[g_worker_idx]->m_queue.push_back(t);
+        else
+            m_queue.push_back(t);
+        m_num_queued++;
+        if (m_num_idle > 0)
+            m_cv.notify_one();
+        add_workers();
+    }
+
+    /** \brief Auxiliary object for marking the current worker as blocked while it waits for other tasks. */
+    class blocked_scope {
+        thread_pool & m_pool;
+        bool          m_worker;
+    public:
+        blocked_scope(thread_pool & p):m_pool(p), m_worker(g_worker_idx >= 0) {
+            if (m_worker) {
+                lock_guard<mutex> lk(m_pool.m_mutex);
+                m_pool.m_num_blocked++;
+                m_pool.add_workers();
+            }
+        }
+        ~blocked_scope() {
+            if (m_worker) {
+                lock_guard<mutex> lk(m_pool.m_mutex);
+                m_pool.m_num_blocked--;
+            }
+        }
+    };
+
+    unsigned size() {
+        lock_guard<mutex> lk(m_mutex);
+        return m_num_workers;
+    }
+};
+
+static thread_pool & get_thread_pool() {
+    static thread_pool g_thread_pool;
+    return g_thread_pool;
+}
+
+task::task(std::function<void()> const & fn):m_ptr(std::make_shared<cell>(fn)) {
+    get_thread_pool().submit(m_ptr);
+}
+
+task::~task() {}
+
+bool task::is_done() const {
+    thread_pool & p = get_thread_pool();
+    lock_guard<mutex> lk(p.m_done_mutex);
+    return m_ptr->m_done;
+}
+
+void task::request_interrupt() {
+    lock_guard<mutex> lk(m_ptr->m_mutex);
+    m_ptr->m_interrupted = true;
+    if (m_ptr->m_flag_addr)
+        m_ptr->m_flag_addr->store(true);
+}
+
+void task::wait() const {
+    if (is_done())
+        return;
+    thread_pool & p = get_thread_pool();
+    thread_pool::blocked_scope scope(p);
+    unique_lock<mutex> lk(p.m_done_mutex);
+    while (!m_ptr->m_done)
+        p.m_done_cv.wait(lk);
+}
+
+bool wait_any(unsigned num, task const * ts, unsigned ms, unsigned check_ms) {
+    if (check_ms == 0)
+        check_ms = 1;
+    thread_pool & p = get_thread_pool();
+    thread_pool::blocked_scope scope(p);
+    auto start = chrono::steady_clock::now();
+    unique_lock<mutex> lk(p.m_done_mutex);
+    while (true) {
+        for (unsigned i = 0; i < num; i++) {
+            if (ts[i].m_ptr->m_done)
+                return true;
+        }
+        unsigned d = check_ms;
+        if (ms != g_no_timeout) {
+            unsigned elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+            if (elapsed >= ms)
+                return false;
+            d = std::min(d, ms - elapsed);
+        }
+        check_interrupted();
+        p.m_done_cv.wait_for(lk, chrono::milliseconds(d));
+    }
+}
+
+unsigned get_thread_pool_size() {
+    return get_thread_pool().size();
+}
+}
+#endif
@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2014 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <limits>
+#include <memory>
+#include <functional>
+#include "util/thread.h"
+#include "util/interrupt.h"
+
+namespace lean {
+#if defined(LEAN_MULTI_THREAD)
+/**
+   \brief Handle for a procedure that is executed by the process-wide thread pool.
+
+   The pool uses work stealing: each worker thread has its own queue of tasks, tasks
+   submitted by a worker are stored in its queue, and idle workers steal tasks from the
+   queues of other workers. The pool creates a new worker whenever there is no idle worker
+   to execute a submitted task, as long as the number of workers that are not waiting for
+   the termination of other tasks (see \c wait and \c wait_any) is smaller than the number of
+   hardware threads. Thus, tasks that wait for other tasks cannot produce a deadlock.
+   Workers that are idle for \c LEAN_THREAD_POOL_IDLE_TIMEOUT milliseconds exit.
+
+   An interrupt request sent to a task sets the interrupt flag (see \c interrupt.h) of the
+   worker executing it. The flag is reset when the task terminates.
+
+   \remark Exceptions thrown by the procedure are ignored.
+*/
+class task {
+public:
+    struct cell;
+private:
+    std::shared_ptr<cell> m_ptr;
+public:
+    /** \brief Submit \c fn to the thread pool. */
+    explicit task(std::function<void()> const & fn);
+    ~task();
+
+    /** \brief Return true iff the procedure was executed. */
+    bool is_done() const;
+
+    /**
+       \brief Send an interrupt request to the task. If the task has not been started yet,
+       then the request is sent as soon as it is started.
+    */
+    void request_interrupt();
+
+    /**
+       \brief Wait for the termination of the task.
+
+       \remark This method does not check whether the current thread has been interrupted.
+    */
+    void wait() const;
+
+    friend bool wait_any(unsigned num, task const * ts, unsigned ms, unsigned check_ms);
+};
+
+constexpr unsigned g_no_timeout = std::numeric_limits<unsigned>::max();
+
+/**
+   \brief Wait for the termination of one of the tasks <tt>ts[0], ..., ts[num-1]</tt>, for at most
+   \c ms milliseconds. Return true iff one of them terminated.
+
+   \remark The interrupt flag of the current thread is checked every \c check_ms milliseconds.
+*/
+bool wait_any(unsigned num, task const * ts, unsigned ms = g_no_timeout, unsigned check_ms = g_small_sleep);
+inline bool wait_for(task const & t, unsigned ms, unsigned check_ms = g_small_sleep) { return wait_any(1, &t, ms, check_ms); }
+
+/** \brief Return the number of worker threads of the thread pool. */
+unsigned get_thread_pool_size();
+#endif
+}
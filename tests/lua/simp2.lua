@@ -0,0 +1,35 @@
+add_rewrite_rules({"Nat", "add_zerol"})
+add_rewrite_rules({"Nat", "add_zeror"})
+parse_lean_cmds([[
+  variable f : Nat -> Nat -> Nat
+  variable g : Nat -> Nat
+  variables a b : Nat
+  axiom g_a : g a = b
+]])
+local env = get_environment()
+local t   = parse_lean('f (g (a + 0)) (0 + b)')
+
+-- The second invocation may reuse the results produced by the first one
+local e1, pr1 = simplify(t)
+local e2, pr2 = simplify(t)
+print(e1)
+assert(e1 == e2)
+assert(pr1 == pr2)
+env:type_check(pr2)
+
+-- Updating the rule set must invalidate the cached results
+add_rewrite_rules("g_a")
+local e3, pr3 = simplify(t)
+print(e3)
+assert(e3 == parse_lean('f b b'))
+env:type_check(pr3)
+
+enable_rewrite_rules("g_a", false)
+local e4, pr4 = simplify(t)
+print(e4)
+assert(e4 == e1)
+env:type_check(pr4)
+
+enable_rewrite_rules("g_a", true)
+local e5 = simplify(t)
+assert(e5 == e3)
@@ -0,0 +1,53 @@
+local env  = environment()
+local Bool = Const("Bool")
+env:add_var("p", Bool)
+env:add_var("q", Bool)
+local p, q = Consts("p, q")
+local ctx  = context()
+ctx = ctx:extend("H1", p)
+ctx = ctx:extend("H2", q)
+local ps   = to_proof_state(env, ctx, p)
+local ios  = io_state()
+ios:set_options(options({"tactic", "lua_workers"}, true))
+
+function is_open(s)
+   return not s:is_proof_final_state()
+end
+-- uses the global function is_open, which is copied to the workers
+local t1 = tactic(function(env, ios, s)
+                     assert(is_open(s))
+                     return s
+end)
+-- the upvalue cnt is a table, then it cannot be copied to the workers
+local cnt = { 0 }
+local t2 = tactic(function(env, ios, s)
+                     cnt[1] = cnt[1] + 1
+                     return s
+end)
+local t3 = Cond(function(env, ios, s) return is_open(s) end, assumption_tac(), fail_tac())
+local t  = Par(t1 .. t2 .. t3, t1 .. t2 .. t3)
+for i = 1, 10 do
+   assert(t:solve(env, ios, ps) == Var(1))
+end
+assert(cnt[1] >= 10)
+-- errors raised on a worker are reported
+local t4 = tactic(function(env, ios, s)
+                     error("tactic failed")
+end)
+assert(not pcall(function() return t4:solve(env, ios, ps) end))
+-- tactics that read global tables cannot be executed on workers, and they are not executed
+-- again in the main Lua State since they may have side effects
+counters = { 0 }
+local t5 = tactic(function(env, ios, s)
+                     counters[1] = counters[1] + 1
+                     return s
+end)
+local ok, msg = pcall(function() return (t5 .. assumption_tac()):solve(env, ios, ps) end)
+assert(not ok)
+print(msg)
+assert(counters[1] == 0)
+-- they can be executed when the option tactic::lua_workers is disabled
+local ios2 = io_state()
+ios2:set_options(options({"tactic", "lua_workers"}, false))
+assert((t5 .. assumption_tac()):solve(env, ios2, ps) == Var(1))
+assert(counters[1] == 1)